@@ -0,0 +1,96 @@
+function result = ALPautotuneRate(ALPID, opt)
+% Finds the highest loss-free DMD rate and stores it per device serial
+% (see ALPmaxRate).
+% The timing model comes from ALP_MIN_PICTURE_TIME and measured
+% upload/playback throughput (ALPwrapper('MeasureTiming')). If a trigger
+% counter is given (camera or DAQ), the rate is bisected between a known
+% good and a known bad rate until every DMD flip is counted.
+%
+% opt fields (all optional):
+%   name         key the result is stored under ('dmd', 'camera', 'daq', ...)
+%   numFrames    frames per test sequence (default 2000)
+%   bitDepth     bit planes per picture (default 1)
+%   resetCounter @() called before each test playback
+%   countTriggers @() returning the number of triggers seen since reset
+%   minRate      lowest rate worth testing, Hz (default 100)
+%   toleranceHz  stop bisecting when good/bad are this close (default 50)
+%   margin       fraction of the loss-free rate that is stored (default 0.97)
+%   settleSec    time for the last triggers to arrive (default 0.2)
+%
+% Example (PointGrey camera counting DMD triggers):
+%   opt.name = 'camera';
+%   opt.resetCounter = @() PTwrapper('ResetTriggerCounter');
+%   opt.countTriggers = @() PTwrapper('getNumTrigs');
+%   ALPautotuneRate(0, opt);
+if ~exist('opt','var')
+    opt = struct();
+end
+defaults = struct('name','dmd','numFrames',2000,'bitDepth',1,'minRate',100, ...
+    'toleranceHz',50,'margin',0.97,'settleSec',0.2);
+f = fieldnames(defaults);
+for k=1:length(f)
+    if ~isfield(opt,f{k})
+        opt.(f{k}) = defaults.(f{k});
+    end
+end
+useCounter = isfield(opt,'countTriggers') && ~isempty(opt.countTriggers);
+
+% fastest the device allows, and how close playback gets to it
+timing = ALPwrapper('MeasureTiming',ALPID,opt.numFrames,0,opt.bitDepth);
+if ~timing.completed
+    error('ALPautotuneRate: test sequence did not complete');
+end
+fprintf('DMD %d: min picture time %d us (%.0f Hz), measured %.0f Hz, upload %.1f MB/s\n', ...
+    timing.serial, timing.minPictureTimeUs, timing.maxRateHz, timing.measuredRateHz, timing.uploadMBs);
+
+result.serial = timing.serial;
+result.name = opt.name;
+result.bitDepth = opt.bitDepth;
+result.minPictureTimeUs = timing.minPictureTimeUs;
+result.modelMaxRateHz = timing.maxRateHz;
+result.measuredMaxRateHz = timing.measuredRateHz;
+result.uploadMBs = timing.uploadMBs;
+result.tests = zeros(0,3); % rate, triggers counted, frames played
+
+goodRate = [];
+badRate = min(timing.maxRateHz, timing.measuredRateHz);
+if useCounter
+    if runTest(badRate)
+        goodRate = badRate;
+    else
+        lo = opt.minRate;
+        if ~runTest(lo)
+            error('ALPautotuneRate: triggers are lost even at %.0f Hz', lo);
+        end
+        goodRate = lo;
+        while badRate - goodRate > opt.toleranceHz
+            mid = (goodRate + badRate) / 2;
+            if runTest(mid)
+                goodRate = mid;
+            else
+                badRate = mid;
+            end
+        end
+    end
+else
+    goodRate = badRate;
+end
+
+result.lossFreeRateHz = goodRate;
+result.maxRate = floor(opt.margin * goodRate);
+result.date = datestr(now);
+setpref('ALPwrapper', sprintf('maxRate_%d_%s', result.serial, result.name), result);
+fprintf('DMD %d (%s): loss-free up to %.0f Hz, stored %d Hz\n', result.serial, result.name, goodRate, result.maxRate);
+
+    function ok = runTest(rate)
+        if isfield(opt,'resetCounter') && ~isempty(opt.resetCounter)
+            opt.resetCounter();
+        end
+        t = ALPwrapper('MeasureTiming',ALPID,opt.numFrames,rate,opt.bitDepth);
+        WaitSecs(opt.settleSec);
+        n = opt.countTriggers();
+        ok = t.completed && n == opt.numFrames;
+        result.tests(end+1,:) = [rate, n, opt.numFrames];
+        fprintf('  %.0f Hz: %d/%d triggers\n', rate, n, opt.numFrames);
+    end
+end
@@ -0,0 +1,16 @@
+function rate = ALPmaxRate(ALPID, defaultRate, name)
+% Loss-free DMD rate stored by ALPautotuneRate for this device, or
+% defaultRate if the device was never tuned.
+if ~exist('name','var')
+    name = 'dmd';
+end
+rate = defaultRate;
+try
+    devices = ALPwrapper('GetDevices');
+    key = sprintf('maxRate_%d_%s', devices(ALPID+1).Serial, name);
+    if ispref('ALPwrapper', key)
+        result = getpref('ALPwrapper', key);
+        rate = result.maxRate;
+    end
+catch
+end
@@ -249,7 +249,7 @@ classdef CalibrationClass  < handle
             roi.radius  =obj.strctCalibrationParams.radius ;
             roi.boundingbox = [1 1 2*obj.strctCalibrationParams.radius+1 2*obj.strctCalibrationParams.radius+1]; % full FOV
             roi.subsampling = 2;
-            roi.maxDMDrate = 22000;
+            roi.maxDMDrate = ALPmaxRate(obj.strctCalibrationParams.deviceID, 22000);
             roi.Mask = zeros(2*roi.radius+1,2*roi.radius+1);
             roi.selectedRate = roi.maxDMDrate ;
             roi=recomputeROI(roi,1);
@@ -324,15 +324,20 @@ classdef CalibrationClass  < handle
                         XimeaWrapper('StopAveraging');
                         numI=XimeaWrapper('getNumTrigs');
                         if numI ~= obj.strctBasis.numPatterns*obj.strctCalibrationParams.numCalibrationAverages
-                            obj.updateStatus(sprintf('Images mismatch. Trying again with reduced rate (%.2f min)',expTime*obj.strctCalibrationParams.numCalibrationAverages/60/0.6));
+                            % retry at the loss-free camera rate found by ALPautotuneRate (if known and lower)
+                            retryRate = ALPmaxRate(obj.strctCalibrationParams.deviceID, ceil(0.6*obj.strctCalibrationParams.cameraRate), 'camera');
+                            if retryRate >= obj.strctCalibrationParams.cameraRate
+                                retryRate = ceil(0.6*obj.strctCalibrationParams.cameraRate);
+                            end
+                            obj.updateStatus(sprintf('Images mismatch. Trying again with reduced rate %d Hz (%.2f min)',retryRate,size(obj.strctBasis.interferenceBasisPatterns,3)/retryRate*obj.strctCalibrationParams.numCalibrationAverages/60));
                             Z=XimeaWrapper('GetImageBuffer');
                             XimeaWrapper('StartAveraging',obj.strctBasis.numPatterns,false);
                             
                             % trying again....
                             if reupload
-                                ALPuploadAndPlay(obj.strctBasis.interferenceBasisPatterns,ceil(0.6*obj.strctCalibrationParams.cameraRate), obj.strctCalibrationParams.numCalibrationAverages);
+                                ALPuploadAndPlay(obj.strctCalibrationParams.deviceID,obj.strctBasis.interferenceBasisPatterns(:,:,:,currentColorChannel),retryRate, obj.strctCalibrationParams.numCalibrationAverages);
                             else
-                                res=ALPwrapper('PlayUploadedSequence',obj.strctCalibrationParams.deviceID,hadamardSequenceID(currentColorChannel),ceil(0.6*obj.strctCalibrationParams.cameraRate), obj.strctCalibrationParams.numCalibrationAverages);
+                                res=ALPwrapper('PlayUploadedSequence',obj.strctCalibrationParams.deviceID,hadamardSequenceID(currentColorChannel),retryRate, obj.strctCalibrationParams.numCalibrationAverages);
                             end
                             ALPwrapper('WaitForSequenceCompletion',obj.strctCalibrationParams.deviceID); % Block. Wait for sequence to end.
                             WaitSecs(2); % allow all images to reach buffer
@@ -550,7 +555,7 @@ classdef CalibrationClass  < handle
             roi.radius  =obj.strctCalibrationParams.radius ;
             roi.boundingbox = [1 1 2*obj.strctCalibrationParams.radius+1 2*obj.strctCalibrationParams.radius+1]; % full FOV
             roi.subsampling = subsampling;
-            roi.maxDMDrate = 22000;
+            roi.maxDMDrate = ALPmaxRate(obj.strctCalibrationParams.deviceID, 22000);
             roi.Mask = zeros(2*roi.radius+1,2*roi.radius+1);
             roi.selectedRate = roi.maxDMDrate ;
             roi=recomputeROI(roi,1);
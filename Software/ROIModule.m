@@ -279,7 +279,7 @@ figure(handles.figure1);
 roi.radius  =radius ;
 roi.boundingbox = [1 1 2*radius+1 2*radius+1]; % full FOV
 roi.subsampling = 1 ;
-roi.maxDMDrate = 20000;
+roi.maxDMDrate = ALPmaxRate(handles.ALPid, 20000); % tuned with ALPautotuneRate
 roi.Mask = zeros(2*roi.radius+1,2*roi.radius+1);
 roi.selectedRate = roi.maxDMDrate ;
 roi=recomputeROI(roi,1);
@@ -910,6 +910,25 @@ setMaxFrameRate(hObject,handles)
 function displayMessage(handles, msg)
 set(handles.StatusText,'String',['Status: ',msg]);
 
+function [strHealth, dmdHealth] = getDMDHealth(ALPid)
+% Summary of the ALPwrapper telemetry since the last ResetStats
+stats = ALPwrapper('GetStats',ALPid, 0);
+dmdHealth.uploadMBs = stats.uploadMBs;
+dmdHealth.bytesUploaded = stats.bytesUploaded;
+dmdHealth.pollCount = stats.pollCount;
+dmdHealth.lastSequenceDurationMs = stats.lastSequenceDurationMs;
+dmdHealth.numErrors = sum([stats.commands.errors]);
+dmdHealth.slowestCommandMs = 0;
+slowest = '';
+for k=1:length(stats.commands)
+    if strncmp(stats.commands(k).name,'Alp',3) && stats.commands(k).maxUs/1e3 > dmdHealth.slowestCommandMs
+        dmdHealth.slowestCommandMs = stats.commands(k).maxUs/1e3;
+        slowest = stats.commands(k).name;
+    end
+end
+strHealth = sprintf('DMD: upload %.1f MB/s, sequence %.1f ms, %d polls, %d errors, slowest call %s (%.1f ms)\n',...
+    dmdHealth.uploadMBs, dmdHealth.lastSequenceDurationMs, dmdHealth.pollCount, dmdHealth.numErrors, slowest, dmdHealth.slowestCommandMs);
+
 function abort=AbortRun(handles)
 global g_scanID
 % Abort?
@@ -1103,9 +1122,32 @@ strctRun.FilterWheelND473nm =  FilterWheelWrapper('GetPostionName',pos1);
 strctRun.FilterWheelND532nm =  FilterWheelWrapper('GetPostionName',pos2);
 fprintf('Scanning at depth %.0f (relative %.0f)\n',strctRun.motorPositionUm(1,2));
 fprintf('Uploading Sequence: %d spots (%d per Z, %d planes)...\n',strctRun.numSpots,roi.numSpots,roi.numDepthPlanes);
+ALPwrapper('ResetStats',handles.ALPid); % DMD health is reported per run
 strctRun.PMTgain = [];
+strctRun.sweepFrameIndices = []; % empty = play the uploaded sequence in order
+% A subset of the spots of the previous upload (same planes, same motor
+% position) is played from the frames already on the DMD instead of
+% regenerating and re-uploading the holograms.
+reuseUploaded = false;
+if ~repeatScan && isfield(handles,'prev_sweepFrameIndices') && ...
+        isequal(handles.prev_depthIndices, strctRun.depthIndices) && ...
+        isequal(handles.prev_motorPositionUm, strctRun.motorPositionUm) && ...
+        all(ismember(indicesToHolograms, handles.prev_indicesToHolograms)) && ...
+        ~isequal(indicesToHolograms(:), handles.prev_indicesToHolograms(:))
+    [~,locInPrev] = ismember(indicesToHolograms(:), handles.prev_indicesToHolograms(:));
+    prevSpotsPerPlane = length(handles.prev_indicesToHolograms);
+    frameIndices = bsxfun(@plus, locInPrev, (0:strctRun.numPlanes-1)*prevSpotsPerPlane);
+    reuseUploaded = ALPwrapper('CanPlayIndexed',handles.ALPid,handles.prev_sweepsequenceID, frameIndices(:)', strctRun.numFrames);
+end
+
 if repeatScan
     strctRun.sweepsequenceID = handles.prev_sweepsequenceID ;
+    strctRun.sweepFrameIndices = handles.prev_sweepFrameIndices;
+elseif reuseUploaded
+    fprintf('Playing %d of the %d uploaded patterns (no upload needed)\n', numel(frameIndices), prevSpotsPerPlane*strctRun.numPlanes);
+    strctRun.sweepsequenceID = handles.prev_sweepsequenceID;
+    strctRun.sweepFrameIndices = frameIndices(:)';
+    handles.prev_sweepFrameIndices = strctRun.sweepFrameIndices;
 else
 
     ALPwrapper('ReleaseAllSequences',handles.ALPid);
@@ -1177,6 +1219,9 @@ else
      
     handles.prev_indicesToHolograms = indicesToHolograms;
     handles.prev_sweepsequenceID = strctRun.sweepsequenceID;
+    handles.prev_sweepFrameIndices = [];
+    handles.prev_depthIndices = strctRun.depthIndices;
+    handles.prev_motorPositionUm = strctRun.motorPositionUm;
 end
 
 strctRun.lastID=ALPwrapper('UploadPatternSequence',handles.ALPid,zeros(768,1024)>0);
@@ -1228,6 +1273,7 @@ strctRun.planeRate = strctRun.dmdRate/strctRun.numPlanes/strctRun.numSpotsPerPla
 % 
 lowPassRange = min(0.9999,max(0, [0.05 30]*2/strctRun.planeRate));
 [strctRun.realTimeFiltering.b,strctRun.realTimeFiltering.a]=butter(2,lowPassRange);
+strctRun.dffBaselineSec = 10; % sliding baseline of the ROI dF/F traces
 
 %fprintf('Checking DAQ status...\n');
 if (~fnDAQusb('IsInitialized'))
@@ -1284,6 +1330,8 @@ strctRun.state = 1;
 
 strctRun.smartAvgPMT1 = SmartAveraging('Init',[strctRun.numSpotsPerPlane,strctRun.numPlanes], str2num(get(handles.hRunningAverageEditPMT1,'String')));
 strctRun.smartAvgPMT2 = SmartAveraging('Init',[strctRun.numSpotsPerPlane,strctRun.numPlanes], str2num(get(handles.hRunningAverageEditPMT2,'String')));
+strctRun.nativePipeline = false; % set up with the first sweep
+strctRun.pipelineChannels = cumsum(strctRun.PMTused); % fast DAQ channel of PMT1 / PMT2
 
 strctRun.prevRunsNumFrames = 0;
 strctRun.numFramesAcquired =0;
@@ -2626,6 +2674,20 @@ switch strctRun.state
         
         vRange = getVoltageRange(handles);
         strctRun.DAQvoltageRange = vRange;
+        
+        if ~strctRun.nativePipeline || strctRun.pipelineVoltageRange ~= vRange
+            % live view statistics kept by fnDAQusb, every GetFrames feeds them.
+            % They survive the AllocateFrames of a looped sweep.
+            strctRun.nativePipeline = fnDAQusb('PipelineInit',strctRun.USB2020_ID, size(strctRun.roi.Mask), strctRun.roi.selectedSpots,...
+                strctRun.roi.offsetX,strctRun.roi.offsetY,strctRun.roi.subsampling,vRange,0) > 0;
+            strctRun.pipelineVoltageRange = vRange;
+            if strctRun.nativePipeline && strctRun.PMTused(1)
+                fnDAQusb('PipelineSetWindow',strctRun.USB2020_ID,strctRun.pipelineChannels(1),strctRun.smartAvgPMT1.numSamplesToAverage);
+            end
+            if strctRun.nativePipeline && strctRun.PMTused(2)
+                fnDAQusb('PipelineSetWindow',strctRun.USB2020_ID,strctRun.pipelineChannels(2),strctRun.smartAvgPMT2.numSamplesToAverage);
+            end
+        end
         res=fnDAQusb('StartContinuousAcqusitionExtClock',...
             strctRun.USB2020_ID,...
             strctRun.fastDAQchannels(1),...
@@ -2635,7 +2697,11 @@ switch strctRun.state
             strctRun.USB1608_ID,...
             strctRun.slowDAQchannels(1),strctRun.slowDAQchannels(2),1,0); % not bipolar, 1V
         
-        res=ALPwrapper('PlayUploadedSequence',handles.ALPid,strctRun.sweepsequenceID, strctRun.roi.selectedRate * strctRun.numSpots, strctRun.roi.numFrames);
+        if isempty(strctRun.sweepFrameIndices)
+            res=ALPwrapper('PlayUploadedSequence',handles.ALPid,strctRun.sweepsequenceID, strctRun.roi.selectedRate * strctRun.numSpots, strctRun.roi.numFrames);
+        else
+            res=ALPwrapper('PlayUploadedSequenceIndexed',handles.ALPid,strctRun.sweepsequenceID, strctRun.sweepFrameIndices, strctRun.roi.selectedRate * strctRun.numSpots, strctRun.roi.numFrames);
+        end
         strctRun.state = 2;
          
         
@@ -2703,7 +2769,9 @@ switch strctRun.state
              strctRun.slowDAQsamplesCollected, strctRun.slowDAQnumSamples,strctRun.slowDAQsamplesCollected/strctRun.slowDAQnumSamples*100);
              fprintf('%s',strStatus);
             
-            set(handles.StatusText,'String',strStatus);
+            [strDMD, strctRun.dmdHealth] = getDMDHealth(handles.ALPid);
+            fprintf('%s',strDMD);
+            set(handles.StatusText,'String',[strStatus, strDMD]);
 
             
             if (strctRun.fastDAQnumSamples ==strctRun.fastDAQsamplesCollected && ...
@@ -3153,10 +3221,16 @@ end
 
 if saveMeanPMT1
     strctRun.smartAvgPMT1.savedMean = strctRun.smartAvgPMT1.avgdata;
+    if strctRun.nativePipeline && strctRun.PMTused(1)
+        fnDAQusb('PipelineSaveMean',strctRun.USB2020_ID,strctRun.pipelineChannels(1));
+    end
     fprintf('Background saved fot PMT1\n');
 end
 if saveMeanPMT2
     strctRun.smartAvgPMT2.savedMean = strctRun.smartAvgPMT2.avgdata;
+    if strctRun.nativePipeline && strctRun.PMTused(2)
+        fnDAQusb('PipelineSaveMean',strctRun.USB2020_ID,strctRun.pipelineChannels(2));
+    end
     fprintf('Background saved for PMT2\n');
 end
 
@@ -3166,10 +3240,16 @@ newAvgFramesPMT2 = str2num(get(handles.hRunningAverageEditPMT2,'String'));
 if newAvgFramesPMT1 ~= strctRun.smartAvgPMT1.numSamplesToAverage || resetAvgPMT1
     % reset
     strctRun.smartAvgPMT1 = SmartAveraging('Init',[strctRun.numSpotsPerPlane,strctRun.numPlanes], newAvgFramesPMT1);
+    if strctRun.nativePipeline && strctRun.PMTused(1)
+        fnDAQusb('PipelineSetWindow',strctRun.USB2020_ID,strctRun.pipelineChannels(1),newAvgFramesPMT1);
+    end
 end
 if newAvgFramesPMT2 ~= strctRun.smartAvgPMT2.numSamplesToAverage || resetAvgPMT2
     % reset
     strctRun.smartAvgPMT2 = SmartAveraging('Init',[strctRun.numSpotsPerPlane,strctRun.numPlanes], newAvgFramesPMT2);
+    if strctRun.nativePipeline && strctRun.PMTused(2)
+        fnDAQusb('PipelineSetWindow',strctRun.USB2020_ID,strctRun.pipelineChannels(2),newAvgFramesPMT2);
+    end
 end
 pmt1ProtectionWarning = false;
 pmt2ProtectionWarning = false;
@@ -3187,7 +3267,10 @@ if ~isempty(FramesFastDAQ)
         PMT1Values_mV =((2^12/2)-PMT1Values)/(2^12/2) *  strctRun.DAQvoltageRange * 1000;
          
         pmt1ProtectionWarning = max(PMT1Values_mV) > MAX_SAFE_VALUE | min(PMT1Values_mV) < MIN_SAFE_VALUE;
-        strctRun.smartAvgPMT1 = SmartAveraging('AddSamples',strctRun.smartAvgPMT1, PMT1Values_mV);
+        if ~strctRun.nativePipeline || get(handles.hFFT_PMT1,'value')
+            % the FFT plot needs the raw window
+            strctRun.smartAvgPMT1 = SmartAveraging('AddSamples',strctRun.smartAvgPMT1, PMT1Values_mV);
+        end
         offset=1;
     end
     
@@ -3195,7 +3278,9 @@ if ~isempty(FramesFastDAQ)
         PMT2Values = reshape(FramesFastDAQ(1+offset,:,:,:), [sz(2:end),1]);
         PMT2Values_mV =((2^12/2)-PMT2Values)/(2^12/2) *  strctRun.DAQvoltageRange * 1000;
         
-        strctRun.smartAvgPMT2 = SmartAveraging('AddSamples',strctRun.smartAvgPMT2, PMT2Values_mV);
+        if ~strctRun.nativePipeline || get(handles.hFFT_PMT2,'value')
+            strctRun.smartAvgPMT2 = SmartAveraging('AddSamples',strctRun.smartAvgPMT2, PMT2Values_mV);
+        end
         pmt2ProtectionWarning = max(PMT2Values_mV) > MAX_SAFE_VALUE | min(PMT2Values_mV) < MIN_SAFE_VALUE;
     end
 end
@@ -3203,6 +3288,25 @@ return;
 
 
 
+function [ImageProcessed, outputSignal] = renderLiveView(handles,strctRun,pmt,smartAvg, bSignalTypeMean, bRunningAverage,bSubtractMean, bSpatialSmoothing)
+% Same as RealTimeSignalProcessingPipeline, but rendered by fnDAQusb from the
+% statistics it kept for every frame GetFrames returned.
+if ~strctRun.nativePipeline
+    [ImageProcessed, outputSignal] = RealTimeSignalProcessingPipeline(handles,strctRun.roi,strctRun.DAQvoltageRange,smartAvg,...
+        bSignalTypeMean, bRunningAverage,bSubtractMean, bSpatialSmoothing);
+    return;
+end
+if ~bSignalTypeMean
+    strSignal = 'std';
+elseif bRunningAverage
+    strSignal = 'mean';
+else
+    strSignal = 'last';
+end
+[ImageProcessed, outputSignal] = fnDAQusb('PipelineRender',strctRun.USB2020_ID,strctRun.pipelineChannels(pmt),strSignal,...
+    bSubtractMean,bSpatialSmoothing);
+return;
+
 function [ImageProcessed, outputSignal] = RealTimeSignalProcessingPipeline(handles,roi,DAQvoltageRange,smartAvg, bSignalTypeMean, bRunningAverage,bSubtractMean, bSpatialSmoothing)
   if (bSignalTypeMean)
        % Anatomical
@@ -3332,7 +3436,7 @@ if ~isempty(FramesFastDAQIndex)
     if strctRun.PMTused(1)
         
         
-        [PMT1ProcessedSignal, outputSignal] = RealTimeSignalProcessingPipeline(handles,roi,strctRun.DAQvoltageRange,strctRun.smartAvgPMT1,...
+        [PMT1ProcessedSignal, outputSignal] = renderLiveView(handles,strctRun,1,strctRun.smartAvgPMT1,...
                 get(handles.hPMT1SigAvg,'value'), get(handles.hRunningAveragePMT1,'value'),...
                 get(handles.hPMT1MeanSub,'value'),get(handles.hSpatialSmoothingPMT1,'value'));
         
@@ -3362,7 +3466,7 @@ if ~isempty(FramesFastDAQIndex)
    
     if strctRun.PMTused(2)
        
-        [PMT2ProcessedSignal,outputSignal] = RealTimeSignalProcessingPipeline(handles,roi,strctRun.DAQvoltageRange,strctRun.smartAvgPMT2,...
+        [PMT2ProcessedSignal,outputSignal] = renderLiveView(handles,strctRun,2,strctRun.smartAvgPMT2,...
                 get(handles.hPMT2SigAvg,'value'), get(handles.hRunningAveragePMT2,'value'),...
                 get(handles.hPMT2MeanSub,'value'),get(handles.hSpatialSmoothingPMT2,'value'));
             
@@ -3482,10 +3586,32 @@ if ~isempty(strctRun.ROIs) && isfield(strctRun.ROIs,'ind')
     startUpdateInd = FramesFastDAQIndex; 
     selectedPMT = 1;
     selectedPlane = 1;
-    for frameIter=1:nNewFrames
-        signal = squeeze(Frames(selectedPMT,:,selectedPlane,frameIter));
-        for k=1:nROIs
-            strctRun.ROIvalues(strctRun.ROIs.IDs(k),startUpdateInd+frameIter) =  nanmean(signal(strctRun.ROIs.ind{k}));
+    % fnDAQusb keeps the ROI means, band pass and dF/F of every frame GetFrames
+    % returned, updated frame by frame. Set up again whenever the ROIs change.
+    if ~isfield(strctRun,'traceROIs') || ~isequal(strctRun.traceROIs, {strctRun.ROIs.IDs, strctRun.ROIs.ind})
+        strctRun.nativeTraces = fnDAQusb('TracesInit',strctRun.USB2020_ID,selectedPMT,selectedPlane,strctRun.ROIs.ind,...
+            strctRun.realTimeFiltering.b,strctRun.realTimeFiltering.a,round(strctRun.dffBaselineSec*strctRun.planeRate)) > 0;
+        if strctRun.nativeTraces
+            strctRun.traceROIs = {strctRun.ROIs.IDs, strctRun.ROIs.ind};
+            fnDAQusb('TracesAddFrames',strctRun.USB2020_ID,Frames,FramesFastDAQIndex);
+            if isfield(strctRun,'ROIvalues') && (~isfield(strctRun,'ROIfiltered') || ~isequal(size(strctRun.ROIfiltered),size(strctRun.ROIvalues)))
+                strctRun.ROIfiltered = zeros(size(strctRun.ROIvalues));
+                strctRun.ROIdff = zeros(size(strctRun.ROIvalues));
+            end
+        end
+    end
+    if strctRun.nativeTraces
+        [rawTraces, filteredTraces, dffTraces, traceStats] = fnDAQusb('TracesRead',strctRun.USB2020_ID);
+        frameColumns = traceStats.firstFrame + (1:size(rawTraces,2));
+        strctRun.ROIvalues(strctRun.ROIs.IDs,frameColumns) = rawTraces;
+        strctRun.ROIfiltered(strctRun.ROIs.IDs,frameColumns) = filteredTraces;
+        strctRun.ROIdff(strctRun.ROIs.IDs,frameColumns) = dffTraces;
+    else
+        for frameIter=1:nNewFrames
+            signal = squeeze(Frames(selectedPMT,:,selectedPlane,frameIter));
+            for k=1:nROIs
+                strctRun.ROIvalues(strctRun.ROIs.IDs(k),startUpdateInd+frameIter) =  nanmean(signal(strctRun.ROIs.ind{k}));
+            end
         end
     end
     
@@ -3510,12 +3636,17 @@ if ~isempty(strctRun.ROIs) && isfield(strctRun.ROIs,'ind')
             idx = find(strctRun.ROIvalues(strctRun.ROIs.IDs(k),:) ~= 0,1,'first');
          
             x = idx:min(size(strctRun.ROIvalues,2),strctRun.numFramesAcquired);
-            y = strctRun.ROIvalues(strctRun.ROIs.IDs(k), x);
+            bBandPass = get(handles.hROIbandpassFilt,'value')>0;
+            if strctRun.nativeTraces && bBandPass
+                y = strctRun.ROIfiltered(strctRun.ROIs.IDs(k), x);
+            else
+                y = strctRun.ROIvalues(strctRun.ROIs.IDs(k), x);
+            end
            
             if (get(handles.hFlipPolarity,'value'))
                 y = -y;
             end
-            if length(y) > 12 && get(handles.hROIbandpassFilt,'value')>0
+            if ~strctRun.nativeTraces && length(y) > 12 && bBandPass
                 yfilt= filtfilt(strctRun.realTimeFiltering.b,strctRun.realTimeFiltering.a,y);
             else
                 yfilt = y;
@@ -3523,8 +3654,24 @@ if ~isempty(strctRun.ROIs) && isfield(strctRun.ROIs,'ind')
             
             %         v=y-nanmedian(y);
             yfilt_mV = (yfilt) / (65535/2) * strctRun.DAQvoltageRange *1000;
-            meanROI = mean(yfilt_mV);
-            stdROI = std(yfilt_mV);
+            if strctRun.nativeTraces
+                % running statistics since the traces were set up or reset
+                if bBandPass
+                    meanROI = traceStats.meanFiltered(k);
+                    stdROI = traceStats.stdFiltered(k);
+                else
+                    meanROI = traceStats.meanRaw(k);
+                    stdROI = traceStats.stdRaw(k);
+                end
+                meanROI = meanROI / (65535/2) * strctRun.DAQvoltageRange *1000;
+                stdROI = stdROI / (65535/2) * strctRun.DAQvoltageRange *1000;
+                if (get(handles.hFlipPolarity,'value'))
+                    meanROI = -meanROI;
+                end
+            else
+                meanROI = mean(yfilt_mV);
+                stdROI = std(yfilt_mV);
+            end
             
             plot(handles.hRealTimeAxes,x,yfilt_mV,'color',strctRun.ROIs.colors(k,:));
             text(strctRun.startROIdisplay+1,meanROI,sprintf('%.3f +- %.3f',meanROI,stdROI),'parent',handles.hRealTimeAxes);
@@ -3541,6 +3688,11 @@ if ~isempty(strctRun.ROIs) && isfield(strctRun.ROIs,'ind')
     resetROI = getappdata(handles.figure1,'resetROI');
     if resetROI
         strctRun.ROIvalues(:,1:strctRun.numFramesAcquired)=0;
+        if strctRun.nativeTraces
+            strctRun.ROIfiltered(:,1:strctRun.numFramesAcquired)=0;
+            strctRun.ROIdff(:,1:strctRun.numFramesAcquired)=0;
+            fnDAQusb('TracesReset',strctRun.USB2020_ID);
+        end
         strctRun.startROIdisplay = strctRun.numFramesAcquired;
         setappdata(handles.figure1,'resetROI',false);
     end
@@ -394,6 +394,14 @@ handles = guidata(timerObject.UserData);
 
 
 stremToDisk = get(handles.hStreamToDisk,'value');
+if stremToDisk
+    % frames go to disk from the camera, only preview here
+    lastImage = PTwrapper('PeekLastImage');
+    if ~isempty(lastImage)
+        showLastImage(handles, lastImage, false);
+    end
+    return;
+end
 
 simMode = get(handles.hSimMode,'value')>0;
 epiMode = get(handles.hEpiMode,'value')>0;
@@ -845,12 +853,7 @@ fprintf('Dumping experiment %d to disk...',strctRun.experimentNumber);
 
 if get(handles.hStreamToDisk,'value')
     
-    [imageBuf, imageIndex] = PTwrapper('GetImageBuffer');
-    for k=1:size(imageBuf,3)
-        h5write(strctRun.imagesFile,'/DS1', reshape(imageBuf(:,:,k),ResW*ResH,1), [1,imageIndex], [ResW*ResH,1]);
-        imageIndex=imageIndex+1;
-    end
-    numImagesArrived = imageIndex-1;
+    numImagesArrived = PTwrapper('StopRecording');
 else    
     strctRun.images=PTwrapper('GetImageBuffer'); 
     
@@ -1312,7 +1315,9 @@ strctRun.imagesFile = sprintf('%s/Experiment%04d.h5',handles.outputFolder,strctR
 [X,Y,ResW,ResH]=GetCameraParams();
 stremToDisk = get(handles.hStreamToDisk,'value');
 if stremToDisk
-    h5create(strctRun.imagesFile,'/DS1',[ResH*ResH Inf],'ChunkSize',[ResH/8,ResW/8  ],'Datatype','uint16');
+    % the camera writes every frame to disk itself (see readCameraRecording)
+    strctRun.imagesFile = sprintf('%s/Experiment%04d.raw',handles.outputFolder,strctRun.experimentNumber);
+    PTwrapper('StartRecording',strctRun.imagesFile);
 end
 %% DAQ
 strctRun.slowDAQrateHz = 2000;
@@ -108,8 +108,11 @@ for CalibrationIteration=1:numCalibrationIterations
 
     fprintf('Depth: %.0f um, %.2f seconds (%.2f min)\n',relativeDepth,dmd.expTime*dmd.numCalibrationAverages,dmd.expTime*dmd.numCalibrationAverages/60);
     PTwrapper('SetExposure',1.0/exposureForCalibration);
+    % crop and decimate in the camera, only the fiber box is stored and transferred
+    PTwrapper('SetCaptureROI',dmd.fiberBox,opt.quantization);
     
-    onTheFlyReconstruction = false;
+    % phase of every (0,pi/2,pi) triple is reconstructed during capture, the raw frames are not kept
+    onTheFlyReconstruction = true;
     if onTheFlyReconstruction
         PTwrapper('StartAveraging',dmd.numPatterns/3,true);
     else
@@ -121,14 +124,14 @@ for CalibrationIteration=1:numCalibrationIterations
     else
         res=ALPwrapper('PlayUploadedSequence',dmd.hadamardSequenceID,dmd.cameraRate, dmd.numCalibrationAverages);
     end
-    ALPwrapper('WaitForSequenceCompletion'); % Block. Wait for sequence to end.
+    % stops the sequence as soon as the camera loses a frame
+    acquisitionOK = waitForSequenceWhileAcquiring();
     WaitSecs(0.5); % allow all images to reach buffer
     PTwrapper('StopAveraging');
     numI=PTwrapper('getNumTrigs');
-    if numI ~= dmd.numPatterns*dmd.numCalibrationAverages
+    if ~acquisitionOK || numI ~= dmd.numPatterns*dmd.numCalibrationAverages
         fprintf('Images mismatch. Trying again with reduced rate (%.2f min)\n',dmd.expTime*dmd.numCalibrationAverages/60/0.6);
         Z=PTwrapper('GetImageBuffer');
-        onTheFlyReconstruction = false;
         if onTheFlyReconstruction
             PTwrapper('StartAveraging',dmd.numPatterns/3,true);
         else
@@ -141,28 +144,36 @@ for CalibrationIteration=1:numCalibrationIterations
         else
             res=ALPwrapper('PlayUploadedSequence',dmd.hadamardSequenceID,ceil(0.6*dmd.cameraRate), dmd.numCalibrationAverages);
         end
-        ALPwrapper('WaitForSequenceCompletion'); % Block. Wait for sequence to end.
+        acquisitionOK = waitForSequenceWhileAcquiring();
         WaitSecs(2); % allow all images to reach buffer
         PTwrapper('StopAveraging');
         numI=PTwrapper('getNumTrigs');
-        if numI ~= dmd.numPatterns*dmd.numCalibrationAverages
+        if ~acquisitionOK || numI ~= dmd.numPatterns*dmd.numCalibrationAverages
             fprintf('Number of collected images does not match number of calibration patterns (%d/%d)\n',numI,dmd.numPatterns*dmd.numCalibrationAverages);
             fprintf('Going back to position 0\n');
             MotorControllerWrapper('SetAbsolutePositionMicrons', StageZeroDepth);
+            PTwrapper('SetCaptureROI',[]);
             return;
         end
     end
     fprintf( 'Transferring images from camera memory...\n');
-    calibrationImages=PTwrapper('GetImageBuffer');
-    maxIntensity = squeeze(max(max(calibrationImages,[],1),[],2));
+    if onTheFlyReconstruction
+        % Kinv_angle straight from the camera, the buffer only holds the quantized phase frames
+        [Kinv_angle,frameStats]=PTwrapper('GetPhaseBuffer');
+        PTwrapper('ClearBuffer');
+        PTwrapper('SetCaptureROI',[]);
+        dmd.newSize = [frameStats.frameSize, dmd.numPatterns];
+    else
+        [calibrationImages,~,frameStats]=PTwrapper('GetImageBuffer');
+        PTwrapper('SetCaptureROI',[]);
+        J = single(calibrationImages); 
+        clear calibrationImages
+        dmd.newSize = size(J);
+    end
+    maxIntensity = frameStats.max;
     fprintf('Mean of max intensity: %.2f. Number of images overexposed: %d\n',mean(maxIntensity),sum(maxIntensity>=4094));
-    
-    J = single(calibrationImages(dmd.fiberBox(2):opt.quantization:dmd.fiberBox(2)+dmd.fiberBox(4)-1, ...
-            dmd.fiberBox(1):opt.quantization:dmd.fiberBox(1)+dmd.fiberBox(3)-1,:)); 
 
-    clear calibrationImages
     % fast method for all pixels!
-    dmd.newSize = size(J);
     dumpVariableToCalibration(dmd.newSize,'newSize');
     
     % reconstruct the phase (!) of the complex field
@@ -192,10 +203,7 @@ for CalibrationIteration=1:numCalibrationIterations
 % end
 % K_obs=reshape(K, dmd.newSize(1)*dmd.newSize(2), dmd.numModes); % K2(:, x) is the x'th output mode
 
-    if onTheFlyReconstruction
-        Kinv_angle = reshape(J/4095 * 2*pi - pi,dmd.newSize(1)*dmd.newSize(2),dmd.numModes)';
-    else
-
+    if ~onTheFlyReconstruction
     Kinv_angle=reshape(atan2((J(:,:,2:3:end))-(J(:,:,3:3:end)), ...
                              (J(:,:,1:3:end))-(J(:,:,2:3:end))), ...
                     dmd.newSize(1)*dmd.newSize(2),dmd.numModes)';
@@ -432,3 +440,22 @@ dmd.patternsLoadedAndUploaded = false;
 dmd.calibrationFinished = true;
 
 fprintf('Finished all calibration procedures\n');
+
+
+function acquisitionOK = waitForSequenceWhileAcquiring()
+% Polls the camera while the DMD plays. A lost frame shifts every following
+% frame to the wrong averaging plane, so the sequence is stopped right away
+% instead of finding the trigger count mismatch after the whole block.
+acquisitionOK = true;
+while ~ALPwrapper('WaitForSequenceCompletion',0,0.5)
+    health = PTwrapper('GetAcquisitionHealth');
+    if ~health.ok
+        fprintf('Camera lost %d frames (buffer full %d, driver skipped %d, truncated %d). Stopping the sequence.\n', ...
+            health.framesLost, health.bufferFull, health.driverSkip, health.truncated);
+        ALPwrapper('StopSequence',0);
+        acquisitionOK = false;
+        return;
+    end
+end
+health = PTwrapper('GetAcquisitionHealth');
+acquisitionOK = health.ok;
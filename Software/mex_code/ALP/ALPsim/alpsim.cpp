@@ -0,0 +1,1245 @@
+/*
+ALP device simulator (ALPsim)
+DiCarlo Lab @ MIT
+
+Software model of an ALP-4.2 controller + DMD. See alpsim.h for build options
+and the timing model.
+
+What is modeled:
+  * Device allocation by index (ALP_DEFAULT) or serial number.
+  * Sequence memory with an on-board capacity limit (ALP_MEMORY_FULL).
+  * Blocking AlpSeqPut that takes bytes / USB bandwidth.
+  * Master-mode projection on a per-device thread: AlpProjStart / AlpProjStartCont,
+    ALP_SEQ_REPEAT, ALP_FIRSTFRAME / ALP_LASTFRAME, picture time validation against
+    ALP_MIN_PICTURE_TIME, legacy (1 waiting position) and sequence-queue modes,
+    frame look-up table (ALP_FLUT_MODE, 9 and 18 bit entries).
+  * One synch pulse per displayed picture, delivered to subscribers / frame tap.
+Not modeled: slave (triggered) mode, LED drivers, scrolling and gray-scale PWM timing.
+
+Revision History
+Version 0.1 10/18/2026
+*/
+#ifndef ALPSIM_EXPORTS
+#define ALPSIM_EXPORTS
+#endif
+#include "alpsim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
+typedef std::chrono::steady_clock SimClock;
+
+static const long SIM_QUEUE_SIZE = 32;			// waiting positions in ALP_PROJ_SEQUENCE_QUEUE mode
+static const long SIM_DEFAULT_PICTURE_TIME = 33334;	// us, AlpSeqTiming(ALP_DEFAULT, ALP_DEFAULT, ...)
+static const long SIM_MAX_PICTURE_TIME = 10000000;
+static const long SIM_SPIN_WINDOW_US = 1000;	// frames due within this window are emitted without sleeping
+static const long SIM_FLUT_ENTRIES9 = 4096;	// ALP_FLUT_MAX_ENTRIES9
+
+struct SimSequence {
+	long bitPlanes, picNum;
+	long repeat, firstFrame, lastFrame, bitNum, binMode, dataFormat, putLock;
+	long pictureTime, illuminateTime, synchDelay, synchPulseWidth, triggerInDelay;
+	long flutMode, flutEntries9, flutOffset9;
+	int useCount;			// number of queue entries (incl. the running one) referring to it
+	std::vector<unsigned char> memory;	// packed binary pictures, width/8*height bytes each
+};
+
+struct SimQueueEntry {
+	ALP_ID sequenceId;
+	ALP_ID queueId;
+	bool continuous;
+	long repeat, firstFrame, lastFrame, pictureTime;
+	std::vector<long> frameMap;	// FLUT mode: picture index of every frame in one iteration
+};
+
+struct SimSubscriber {
+	long id;
+	tAlpSimSynchCallback callback;
+	void *context;
+};
+
+class SimDevice {
+public:
+	SimDevice(int index, long serial, long dmdType);
+	~SimDevice();
+
+	bool allocated;
+	int index;
+	ALP_ID deviceId;
+	long serial, dmdType;
+	long width, height;
+	long bytesPerPicture;
+
+	std::mutex lock;				// protects everything below except the tap/subscriber state
+	std::condition_variable cv;
+	std::map<ALP_ID, SimSequence> sequences;
+	ALP_ID nextSequenceId, nextQueueId;
+	long usedMemory;				// binary pictures
+	std::deque<SimQueueEntry> queue;
+	long queueMode, waitUntil, inversion, upsideDown, synchPolarity, triggerEdge;
+	std::vector<unsigned long> flut9;	// frame look-up table, in 9-bit entries (an 18-bit entry uses two)
+	bool running;					// the projection thread is displaying a sequence
+	bool haltRequested, abortSequence, abortFrame, shutdown;
+	SimQueueEntry current;
+	long currentFrame, framesLeft;
+	unsigned long long sequenceCounter;
+	bool anyFrameShown;
+	tAlpSimSynchPulse lastPulse;
+	SimClock::time_point t0;
+	double simTimeUs;				// simulated clock (advances even when timeScale = 0)
+	tAlpSimStats stats;
+
+	std::mutex tapLock;				// protects callbacks and recording
+	tAlpSimFrameTap frameTap;
+	void *frameTapContext;
+	std::vector<SimSubscriber> subscribers;
+	long nextSubscriberId;
+	std::vector<tAlpSimSynchPulse> recording;
+	long recordingLimit;
+
+	std::thread worker;
+	void start();
+	void stop();
+	void clearQueue();	// drops the waiting queue entries, caller holds lock
+	void projectionLoop();
+	void emitPulse(const tAlpSimSynchPulse &pulse, const unsigned char *frame);
+	bool isProjecting() { return running || !queue.empty(); }
+};
+
+static std::mutex g_lock;
+static bool g_configured = false;
+static tAlpSimConfig g_config;
+static SimDevice* g_devices[ALPSIM_MAX_DEVICES] = { 0 };
+
+static const ALP_ID SIM_DEVICE_ID_BASE = 0x100;
+
+
+static void dmdTypeToResolution(long dmdType, long &width, long &height)
+{
+	switch (dmdType) {
+	case ALP_DMDTYPE_SXGA_PLUS:
+		width = 1400;
+		height = 1050;
+		break;
+	case ALP_DMDTYPE_DISCONNECT:
+	case ALP_DMDTYPE_1080P_095A:
+		width = 1920;
+		height = 1080;
+		break;
+	case ALP_DMDTYPE_WUXGA_096A:
+		width = 1920;
+		height = 1200;
+		break;
+	default:
+		// XGA variants
+		width = 1024;
+		height = 768;
+	}
+}
+
+static double envDouble(const char *name, double defaultValue)
+{
+	const char *value = getenv(name);
+	if (value == nullptr || *value == 0)
+		return defaultValue;
+	return atof(value);
+}
+
+static void setDefaultConfig()
+{
+	// Defaults describe the V-4100 / XGA 0.7" setup used on the rig: ~22 kHz binary
+	// rate, USB 2.0 upload, and 4 GB of sequence memory.
+	g_config.numDevices = (long)envDouble("ALPSIM_NUM_DEVICES", 1);
+	g_config.firstSerial = 10000;
+	g_config.dmdType = (long)envDouble("ALPSIM_DMD_TYPE", ALP_DMDTYPE_XGA_07A);
+	g_config.usbBandwidthMBs = envDouble("ALPSIM_USB_MBPS", 35.0);
+	g_config.minPictureTime = (long)envDouble("ALPSIM_MIN_PICTURE_TIME_US", 44);
+	g_config.darkPhaseTime = (long)envDouble("ALPSIM_DARK_PHASE_US", 44);
+	g_config.memoryBinaryFrames = (long)envDouble("ALPSIM_MEMORY_FRAMES", 43690);
+	g_config.timeScale = envDouble("ALPSIM_TIME_SCALE", 1.0);
+	g_config.numDevices = MAX(0, MIN(ALPSIM_MAX_DEVICES, g_config.numDevices));
+	g_configured = true;
+}
+
+static SimDevice* lookupDevice(ALP_ID DeviceId)
+{
+	if (DeviceId < SIM_DEVICE_ID_BASE || DeviceId >= SIM_DEVICE_ID_BASE + ALPSIM_MAX_DEVICES)
+		return nullptr;
+	std::lock_guard<std::mutex> guard(g_lock);
+	SimDevice *dev = g_devices[DeviceId - SIM_DEVICE_ID_BASE];
+	if (dev == nullptr || !dev->allocated)
+		return nullptr;
+	return dev;
+}
+
+static long minPictureTime(const SimSequence &seq)
+{
+	long t = g_config.minPictureTime * seq.bitNum;
+	if (seq.binMode != ALP_BIN_UNINTERRUPTED)
+		t += g_config.darkPhaseTime;
+	return t;
+}
+
+static void sleepSimulated(double simulatedUs)
+{
+	if (g_config.timeScale <= 0 || simulatedUs <= 0)
+		return;
+	std::this_thread::sleep_for(std::chrono::microseconds((long long)(simulatedUs * g_config.timeScale)));
+}
+
+
+SimDevice::SimDevice(int _index, long _serial, long _dmdType) : allocated(false), index(_index), serial(_serial), dmdType(_dmdType)
+{
+	deviceId = SIM_DEVICE_ID_BASE + index;
+	dmdTypeToResolution(dmdType, width, height);
+	bytesPerPicture = width * height / 8;
+	frameTap = nullptr;
+	frameTapContext = nullptr;
+	nextSubscriberId = 1;
+	recordingLimit = 0;
+}
+
+SimDevice::~SimDevice()
+{
+	stop();
+}
+
+void SimDevice::start()
+{
+	sequences.clear();
+	queue.clear();
+	nextSequenceId = 1;
+	nextQueueId = 1;
+	usedMemory = 0;
+	flut9.assign(SIM_FLUT_ENTRIES9, 0);
+	queueMode = ALP_PROJ_LEGACY;
+	waitUntil = ALP_PROJ_WAIT_PIC_TIME;
+	inversion = upsideDown = 0;
+	synchPolarity = ALP_LEVEL_HIGH;
+	triggerEdge = ALP_EDGE_RISING;
+	running = haltRequested = abortSequence = abortFrame = shutdown = false;
+	currentFrame = framesLeft = 0;
+	sequenceCounter = 0;
+	anyFrameShown = false;
+	memset(&lastPulse, 0, sizeof(lastPulse));
+	memset(&stats, 0, sizeof(stats));
+	t0 = SimClock::now();
+	simTimeUs = 0;
+	{
+		// a consumer of the previous allocation may be gone without having unregistered
+		std::lock_guard<std::mutex> guard(tapLock);
+		frameTap = nullptr;
+		frameTapContext = nullptr;
+		subscribers.clear();
+		recording.clear();
+		recordingLimit = 0;
+	}
+	allocated = true;
+	worker = std::thread(&SimDevice::projectionLoop, this);
+}
+
+void SimDevice::stop()
+{
+	if (!worker.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		shutdown = true;
+		haltRequested = true;
+		clearQueue();
+	}
+	cv.notify_all();
+	worker.join();
+	allocated = false;
+}
+
+void SimDevice::clearQueue()
+{
+	while (!queue.empty())
+	{
+		sequences[queue.back().sequenceId].useCount--;
+		queue.pop_back();
+	}
+}
+
+void SimDevice::emitPulse(const tAlpSimSynchPulse &pulse, const unsigned char *frame)
+{
+	std::lock_guard<std::mutex> guard(tapLock);
+	if (frameTap != nullptr)
+		frameTap(frameTapContext, &pulse, frame, width, height);
+	for (size_t k = 0; k < subscribers.size(); k++)
+		subscribers[k].callback(subscribers[k].context, &pulse);
+	if ((long)recording.size() < recordingLimit)
+		recording.push_back(pulse);
+}
+
+void SimDevice::projectionLoop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (!shutdown)
+	{
+		cv.wait(guard, [this] { return shutdown || !queue.empty(); });
+		if (shutdown)
+			break;
+
+		current = queue.front();
+		queue.pop_front();
+		running = true;
+		haltRequested = abortSequence = abortFrame = false;
+		SimSequence &seq = sequences[current.sequenceId];
+
+		bool lookup = !current.frameMap.empty();
+		long framesPerIteration = lookup ? (long)current.frameMap.size() : current.lastFrame - current.firstFrame + 1;
+		unsigned long long iterations = current.continuous ? 0 : (unsigned long long)current.repeat;
+		unsigned long long shown = 0;
+		SimClock::time_point start = SimClock::now();
+		double startSimTime = simTimeUs;
+
+		for (unsigned long long iter = 0; current.continuous || iter < iterations; iter++)
+		{
+			for (long k = 0; k < framesPerIteration; k++)
+			{
+				if (haltRequested || shutdown || abortFrame)
+					break;
+
+				// Wait until the picture is due (in batches, so that 20+ kHz sequences do not
+				// need one wake-up per frame).
+				double dueUs = (double)shown * current.pictureTime;
+				if (g_config.timeScale > 0)
+				{
+					SimClock::time_point due = start + std::chrono::microseconds((long long)(dueUs * g_config.timeScale));
+					if (due - SimClock::now() > std::chrono::microseconds(SIM_SPIN_WINDOW_US))
+						cv.wait_until(guard, due, [this] { return haltRequested || shutdown || abortFrame; });
+					if (haltRequested || shutdown || abortFrame)
+						break;
+					if (SimClock::now() - due > std::chrono::microseconds((long long)(current.pictureTime * g_config.timeScale) + SIM_SPIN_WINDOW_US))
+						stats.lateFrames++;
+				}
+
+				currentFrame = lookup ? current.frameMap[k] : current.firstFrame + k;
+				framesLeft = framesPerIteration - k - 1;
+				simTimeUs = startSimTime + dueUs;
+
+				tAlpSimSynchPulse pulse;
+				pulse.DeviceId = deviceId;
+				pulse.SequenceId = current.sequenceId;
+				pulse.QueueId = current.queueId;
+				pulse.FrameIndex = currentFrame;
+				pulse.PulseCounter = ++stats.framesDisplayed;
+				pulse.TimestampUs = simTimeUs;
+				lastPulse = pulse;
+				anyFrameShown = true;
+				const unsigned char *frame = &seq.memory[(size_t)currentFrame * bytesPerPicture];
+
+				// Sequence memory cannot be released while in use, so it is safe to hand it out unlocked.
+				guard.unlock();
+				emitPulse(pulse, frame);
+				guard.lock();
+				shown++;
+			}
+			sequenceCounter = iter;
+			if (haltRequested || shutdown || abortFrame || abortSequence)
+				break;
+		}
+
+		// the last picture is shown for a full picture time before the sequence completes
+		double endUs = (double)shown * current.pictureTime;
+		if (g_config.timeScale > 0 && !haltRequested && !shutdown)
+		{
+			SimClock::time_point due = start + std::chrono::microseconds((long long)(endUs * g_config.timeScale));
+			cv.wait_until(guard, due, [this] { return haltRequested || shutdown; });
+		}
+		simTimeUs = startSimTime + endUs;
+
+		seq.useCount--;
+		running = false;
+		abortSequence = abortFrame = false;
+		stats.sequencesCompleted++;
+		cv.notify_all();
+	}
+	running = false;
+	cv.notify_all();
+}
+
+
+ALP_API long ALP_ATTR AlpSimConfigure(const tAlpSimConfig *Config)
+{
+	if (Config == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(g_lock);
+	for (int k = 0; k < ALPSIM_MAX_DEVICES; k++)
+	{
+		if (g_devices[k] != nullptr && g_devices[k]->allocated)
+			return ALP_NOT_IDLE;	// configure before allocating devices
+	}
+	if (Config->numDevices < 0 || Config->numDevices > ALPSIM_MAX_DEVICES || Config->usbBandwidthMBs <= 0 ||
+		Config->minPictureTime <= 0 || Config->darkPhaseTime < 0 || Config->memoryBinaryFrames <= 0 || Config->timeScale < 0)
+		return ALP_PARM_INVALID;
+	g_config = *Config;
+	g_configured = true;
+	for (int k = 0; k < ALPSIM_MAX_DEVICES; k++)
+	{
+		delete g_devices[k];
+		g_devices[k] = nullptr;
+	}
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimGetConfig(tAlpSimConfig *Config)
+{
+	if (Config == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(g_lock);
+	if (!g_configured)
+		setDefaultConfig();
+	*Config = g_config;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimGetDeviceId(long SerialNumber, ALP_ID *DeviceId)
+{
+	if (DeviceId == nullptr)
+		return ALP_ADDR_INVALID;
+	*DeviceId = ALP_INVALID_ID;
+	std::lock_guard<std::mutex> guard(g_lock);
+	for (int k = 0; k < ALPSIM_MAX_DEVICES; k++)
+	{
+		SimDevice *dev = g_devices[k];
+		if (dev != nullptr && dev->allocated && (SerialNumber == ALP_DEFAULT || SerialNumber == dev->serial))
+		{
+			*DeviceId = dev->deviceId;
+			return ALP_OK;
+		}
+	}
+	return ALP_NOT_ONLINE;
+}
+
+ALP_API long ALP_ATTR AlpSimSetFrameTap(ALP_ID DeviceId, tAlpSimFrameTap Tap, void *Context)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->tapLock);
+	dev->frameTap = Tap;
+	dev->frameTapContext = Context;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimSubscribeSynch(ALP_ID DeviceId, tAlpSimSynchCallback Callback, void *Context, long *SubscriptionId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (Callback == nullptr || SubscriptionId == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(dev->tapLock);
+	SimSubscriber sub;
+	sub.id = dev->nextSubscriberId++;
+	sub.callback = Callback;
+	sub.context = Context;
+	dev->subscribers.push_back(sub);
+	*SubscriptionId = sub.id;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimUnsubscribeSynch(ALP_ID DeviceId, long SubscriptionId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->tapLock);
+	for (size_t k = 0; k < dev->subscribers.size(); k++)
+	{
+		if (dev->subscribers[k].id == SubscriptionId)
+		{
+			dev->subscribers.erase(dev->subscribers.begin() + k);
+			return ALP_OK;
+		}
+	}
+	return ALP_PARM_INVALID;
+}
+
+ALP_API long ALP_ATTR AlpSimGetCurrentFrame(ALP_ID DeviceId, unsigned char *PackedFrame, tAlpSimSynchPulse *Pulse)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	if (!dev->anyFrameShown)
+		return ALP_NOT_READY;
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(dev->lastPulse.SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_NOT_READY;	// sequence was released after it was shown
+	if (PackedFrame != nullptr)
+		memcpy(PackedFrame, &it->second.memory[(size_t)dev->lastPulse.FrameIndex * dev->bytesPerPicture], dev->bytesPerPicture);
+	if (Pulse != nullptr)
+		*Pulse = dev->lastPulse;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimStartRecording(ALP_ID DeviceId, long MaxFrames)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (MaxFrames < 0)
+		return ALP_PARM_INVALID;
+	std::lock_guard<std::mutex> guard(dev->tapLock);
+	dev->recording.clear();
+	dev->recording.reserve(MaxFrames);
+	dev->recordingLimit = MaxFrames;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimGetRecording(ALP_ID DeviceId, tAlpSimSynchPulse *Pulses, long MaxPulses, long *NumPulses)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (NumPulses == nullptr || (Pulses == nullptr && MaxPulses > 0))
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(dev->tapLock);
+	long n = MIN((long)dev->recording.size(), MaxPulses);
+	if (n > 0)
+		memcpy(Pulses, &dev->recording[0], n * sizeof(tAlpSimSynchPulse));
+	*NumPulses = (long)dev->recording.size();
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSimGetStats(ALP_ID DeviceId, tAlpSimStats *Stats)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (Stats == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	*Stats = dev->stats;
+	return ALP_OK;
+}
+
+
+/* ////////////////////////////// alp.h API ////////////////////////////// */
+
+ALP_API long ALP_ATTR AlpDevAlloc(long DeviceNum, long InitFlag, ALP_ID* DeviceIdPtr)
+{
+	if (DeviceIdPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	*DeviceIdPtr = ALP_INVALID_ID;
+
+	std::lock_guard<std::mutex> guard(g_lock);
+	if (!g_configured)
+		setDefaultConfig();
+
+	// ALP_DEFAULT picks the next free device, otherwise DeviceNum is a serial number
+	int selected = -1;
+	for (int k = 0; k < g_config.numDevices; k++)
+	{
+		bool isAllocated = g_devices[k] != nullptr && g_devices[k]->allocated;
+		if (DeviceNum == ALP_DEFAULT && !isAllocated)
+		{
+			selected = k;
+			break;
+		}
+		if (DeviceNum != ALP_DEFAULT && DeviceNum == g_config.firstSerial + k)
+		{
+			if (isAllocated)
+				return ALP_NOT_READY;
+			selected = k;
+			break;
+		}
+	}
+	if (selected < 0)
+		return ALP_NOT_ONLINE;
+
+	if (g_devices[selected] == nullptr)
+		g_devices[selected] = new SimDevice(selected, g_config.firstSerial + selected, g_config.dmdType);
+	g_devices[selected]->start();
+	*DeviceIdPtr = g_devices[selected]->deviceId;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpDevHalt(ALP_ID DeviceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::unique_lock<std::mutex> guard(dev->lock);
+	dev->clearQueue();
+	dev->haltRequested = true;
+	dev->cv.notify_all();
+	dev->cv.wait(guard, [dev] { return !dev->running; });
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpDevFree(ALP_ID DeviceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	dev->stop();
+	std::lock_guard<std::mutex> guard(dev->lock);
+	dev->sequences.clear();
+	dev->usedMemory = 0;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpDevControl(ALP_ID DeviceId, long ControlType, long ControlValue)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	switch (ControlType) {
+	case ALP_SYNCH_POLARITY:
+		if (ControlValue != ALP_LEVEL_HIGH && ControlValue != ALP_LEVEL_LOW && ControlValue != ALP_DEFAULT)
+			return ALP_PARM_INVALID;
+		dev->synchPolarity = ControlValue == ALP_DEFAULT ? ALP_LEVEL_HIGH : ControlValue;
+		return ALP_OK;
+	case ALP_TRIGGER_EDGE:
+		if (ControlValue != ALP_EDGE_RISING && ControlValue != ALP_EDGE_FALLING && ControlValue != ALP_DEFAULT)
+			return ALP_PARM_INVALID;
+		dev->triggerEdge = ControlValue == ALP_DEFAULT ? ALP_EDGE_RISING : ControlValue;
+		return ALP_OK;
+	case ALP_TRIGGER_TIME_OUT:
+	case ALP_USB_CONNECTION:
+	case ALP_DEV_DMD_MODE:
+	case ALP_PWM_LEVEL:
+		return ALP_OK;
+	default:
+		return ALP_PARM_INVALID;
+	}
+}
+
+ALP_API long ALP_ATTR AlpDevControlEx(ALP_ID DeviceId, long ControlType, void *UserStructPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (UserStructPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	switch (ControlType) {
+	case ALP_DEV_DYN_SYNCH_OUT1_GATE:
+	case ALP_DEV_DYN_SYNCH_OUT2_GATE:
+	case ALP_DEV_DYN_SYNCH_OUT3_GATE:
+		return ((tAlpDynSynchOutGate*)UserStructPtr)->Period <= 16 ? ALP_OK : ALP_PARM_INVALID;
+	default:
+		return ALP_PARM_INVALID;
+	}
+}
+
+ALP_API long ALP_ATTR AlpDevInquire(ALP_ID DeviceId, long InquireType, long *UserVarPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (UserVarPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	switch (InquireType) {
+	case ALP_DEVICE_NUMBER: *UserVarPtr = dev->serial; break;
+	case ALP_VERSION: *UserVarPtr = 0x0402; break;
+	case ALP_DEV_STATE: *UserVarPtr = dev->isProjecting() ? ALP_DEV_BUSY : ALP_DEV_READY; break;
+	case ALP_AVAIL_MEMORY: *UserVarPtr = g_config.memoryBinaryFrames - dev->usedMemory; break;
+	case ALP_DEV_DMDTYPE: *UserVarPtr = dev->dmdType; break;
+	case ALP_DEV_DISPLAY_WIDTH: *UserVarPtr = dev->width; break;
+	case ALP_DEV_DISPLAY_HEIGHT: *UserVarPtr = dev->height; break;
+	case ALP_SYNCH_POLARITY: *UserVarPtr = dev->synchPolarity; break;
+	case ALP_TRIGGER_EDGE: *UserVarPtr = dev->triggerEdge; break;
+	case ALP_DDC_FPGA_TEMPERATURE:
+	case ALP_APPS_FPGA_TEMPERATURE:
+	case ALP_PCB_TEMPERATURE:
+		*UserVarPtr = 40 * 256;	// 1 LSB = 1/256 degC
+		break;
+	default:
+		return ALP_PARM_INVALID;
+	}
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSeqAlloc(ALP_ID DeviceId, long BitPlanes, long PicNum, ALP_ID *SequenceIdPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (SequenceIdPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	*SequenceIdPtr = ALP_INVALID_ID;
+	if (BitPlanes < 1 || BitPlanes > 8 || PicNum < 1)
+		return ALP_PARM_INVALID;
+
+	std::lock_guard<std::mutex> guard(dev->lock);
+	long required = BitPlanes * PicNum;
+	if (dev->usedMemory + required > g_config.memoryBinaryFrames)
+		return ALP_MEMORY_FULL;
+
+	ALP_ID id = dev->nextSequenceId++;
+	SimSequence &seq = dev->sequences[id];
+	seq.bitPlanes = BitPlanes;
+	seq.picNum = PicNum;
+	seq.repeat = 1;
+	seq.firstFrame = 0;
+	seq.lastFrame = PicNum - 1;
+	seq.bitNum = BitPlanes;
+	seq.binMode = ALP_BIN_NORMAL;
+	seq.dataFormat = ALP_DATA_MSB_ALIGN;
+	seq.putLock = ALP_DEFAULT;
+	seq.pictureTime = SIM_DEFAULT_PICTURE_TIME;
+	seq.illuminateTime = SIM_DEFAULT_PICTURE_TIME - g_config.darkPhaseTime;
+	seq.synchDelay = 0;
+	seq.synchPulseWidth = seq.illuminateTime;
+	seq.triggerInDelay = 0;
+	seq.flutMode = ALP_FLUT_NONE;
+	seq.flutEntries9 = 1;
+	seq.flutOffset9 = 0;
+	seq.useCount = 0;
+	seq.memory.assign((size_t)PicNum * dev->bytesPerPicture, 0);
+	dev->usedMemory += required;
+	*SequenceIdPtr = id;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSeqFree(ALP_ID DeviceId, ALP_ID SequenceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_PARM_INVALID;
+	if (it->second.useCount > 0)
+		return ALP_SEQ_IN_USE;
+	dev->usedMemory -= it->second.bitPlanes * it->second.picNum;
+	dev->sequences.erase(it);
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSeqControl(ALP_ID DeviceId, ALP_ID SequenceId, long ControlType, long ControlValue)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_PARM_INVALID;
+	SimSequence &seq = it->second;
+	switch (ControlType) {
+	case ALP_SEQ_REPEAT:
+		if (ControlValue < 1)
+			return ALP_PARM_INVALID;
+		seq.repeat = ControlValue;
+		break;
+	case ALP_FIRSTFRAME:
+		if (ControlValue < 0 || ControlValue > seq.lastFrame)
+			return ALP_PARM_INVALID;
+		seq.firstFrame = ControlValue;
+		break;
+	case ALP_LASTFRAME:
+		if (ControlValue < seq.firstFrame || ControlValue >= seq.picNum)
+			return ALP_PARM_INVALID;
+		seq.lastFrame = ControlValue;
+		break;
+	case ALP_BITNUM:
+		if (ControlValue < 1 || ControlValue > seq.bitPlanes)
+			return ALP_PARM_INVALID;
+		seq.bitNum = ControlValue;
+		break;
+	case ALP_BIN_MODE:
+		if (ControlValue != ALP_BIN_NORMAL && ControlValue != ALP_BIN_UNINTERRUPTED)
+			return ALP_PARM_INVALID;
+		seq.binMode = ControlValue;
+		break;
+	case ALP_DATA_FORMAT:
+		if (ControlValue < ALP_DATA_MSB_ALIGN || ControlValue > ALP_DATA_BINARY_BOTTOMUP)
+			return ALP_PARM_INVALID;
+		seq.dataFormat = ControlValue;
+		break;
+	case ALP_SEQ_PUT_LOCK:
+		seq.putLock = ControlValue;
+		break;
+	case ALP_PWM_MODE:
+		if (ControlValue != ALP_DEFAULT && ControlValue != ALP_FLEX_PWM)
+			return ALP_PARM_INVALID;
+		break;
+	case ALP_FLUT_MODE:
+		if (ControlValue != ALP_FLUT_NONE && ControlValue != ALP_FLUT_9BIT && ControlValue != ALP_FLUT_18BIT)
+			return ALP_PARM_INVALID;
+		seq.flutMode = ControlValue;
+		break;
+	case ALP_FLUT_ENTRIES9:
+		if (ControlValue < 1 || ControlValue > SIM_FLUT_ENTRIES9)
+			return ALP_PARM_INVALID;
+		seq.flutEntries9 = ControlValue;
+		break;
+	case ALP_FLUT_OFFSET9:
+		if (ControlValue < 0 || ControlValue % 256 != 0 || ControlValue >= SIM_FLUT_ENTRIES9)
+			return ALP_PARM_INVALID;
+		seq.flutOffset9 = ControlValue;
+		break;
+	default:
+		return ALP_PARM_INVALID;
+	}
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSeqTiming(ALP_ID DeviceId, ALP_ID SequenceId, long IlluminateTime,
+	long PictureTime, long SynchDelay, long SynchPulseWidth, long TriggerInDelay)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_PARM_INVALID;
+	SimSequence &seq = it->second;
+
+	long minPicture = minPictureTime(seq);
+	long picture = PictureTime;
+	if (picture == ALP_DEFAULT)
+		picture = (IlluminateTime == ALP_DEFAULT) ? SIM_DEFAULT_PICTURE_TIME : IlluminateTime + g_config.darkPhaseTime;
+	if (picture < minPicture || picture > SIM_MAX_PICTURE_TIME || SynchDelay < 0 || SynchPulseWidth < 0 || TriggerInDelay < 0)
+		return ALP_PARM_INVALID;
+
+	long illuminate = IlluminateTime;
+	if (seq.binMode == ALP_BIN_UNINTERRUPTED)
+		illuminate = picture;	// no dark phase, IlluminateTime is ignored
+	else if (illuminate == ALP_DEFAULT)
+		illuminate = picture - g_config.darkPhaseTime;
+	if (illuminate > picture)
+		return ALP_PARM_INVALID;
+
+	seq.pictureTime = picture;
+	seq.illuminateTime = illuminate;
+	seq.synchDelay = SynchDelay;
+	seq.synchPulseWidth = (SynchPulseWidth == ALP_DEFAULT) ? illuminate : SynchPulseWidth;
+	seq.triggerInDelay = TriggerInDelay;
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSeqInquire(ALP_ID DeviceId, ALP_ID SequenceId, long InquireType, long *UserVarPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (UserVarPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_PARM_INVALID;
+	SimSequence &seq = it->second;
+	switch (InquireType) {
+	case ALP_BITPLANES: *UserVarPtr = seq.bitPlanes; break;
+	case ALP_BITNUM: *UserVarPtr = seq.bitNum; break;
+	case ALP_PICNUM: *UserVarPtr = seq.picNum; break;
+	case ALP_SEQ_REPEAT: *UserVarPtr = seq.repeat; break;
+	case ALP_FIRSTFRAME: *UserVarPtr = seq.firstFrame; break;
+	case ALP_LASTFRAME: *UserVarPtr = seq.lastFrame; break;
+	case ALP_BIN_MODE: *UserVarPtr = seq.binMode; break;
+	case ALP_DATA_FORMAT: *UserVarPtr = seq.dataFormat; break;
+	case ALP_SEQ_PUT_LOCK: *UserVarPtr = seq.putLock; break;
+	case ALP_PICTURE_TIME: *UserVarPtr = seq.pictureTime; break;
+	case ALP_ILLUMINATE_TIME: *UserVarPtr = seq.illuminateTime; break;
+	case ALP_SYNCH_DELAY: *UserVarPtr = seq.synchDelay; break;
+	case ALP_SYNCH_PULSEWIDTH: *UserVarPtr = seq.synchPulseWidth; break;
+	case ALP_TRIGGER_IN_DELAY: *UserVarPtr = seq.triggerInDelay; break;
+	case ALP_MAX_SYNCH_DELAY: *UserVarPtr = seq.pictureTime; break;
+	case ALP_MAX_TRIGGER_IN_DELAY: *UserVarPtr = seq.pictureTime; break;
+	case ALP_MIN_PICTURE_TIME: *UserVarPtr = minPictureTime(seq); break;
+	case ALP_MIN_ILLUMINATE_TIME: *UserVarPtr = g_config.minPictureTime * seq.bitNum; break;
+	case ALP_MAX_PICTURE_TIME: *UserVarPtr = SIM_MAX_PICTURE_TIME; break;
+	case ALP_ON_TIME: *UserVarPtr = seq.illuminateTime; break;
+	case ALP_OFF_TIME: *UserVarPtr = seq.pictureTime - seq.illuminateTime; break;
+	case ALP_FLUT_MODE: *UserVarPtr = seq.flutMode; break;
+	case ALP_FLUT_ENTRIES9: *UserVarPtr = seq.flutEntries9; break;
+	case ALP_FLUT_OFFSET9: *UserVarPtr = seq.flutOffset9; break;
+	default:
+		return ALP_PARM_INVALID;
+	}
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpSeqPut(ALP_ID DeviceId, ALP_ID SequenceId, long PicOffset, long PicLoad, void *UserArrayPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (UserArrayPtr == nullptr)
+		return ALP_ADDR_INVALID;
+
+	std::unique_lock<std::mutex> guard(dev->lock);
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_PARM_INVALID;
+	SimSequence &seq = it->second;
+	if (PicLoad == ALP_DEFAULT)
+	{
+		if (PicOffset != 0)
+			return ALP_PARM_INVALID;
+		PicLoad = seq.picNum;
+	}
+	if (PicOffset < 0 || PicLoad < 0 || PicOffset + PicLoad > seq.picNum)
+		return ALP_PARM_INVALID;
+	if (seq.useCount > 0 && seq.putLock == ALP_DEFAULT)
+		return ALP_SEQ_IN_USE;
+
+	bool binary = seq.dataFormat == ALP_DATA_BINARY_TOPDOWN || seq.dataFormat == ALP_DATA_BINARY_BOTTOMUP;
+	long stride = dev->width / 8;
+	for (long p = 0; p < PicLoad; p++)
+	{
+		unsigned char *dst = &seq.memory[(size_t)(PicOffset + p) * dev->bytesPerPicture];
+		if (binary)
+		{
+			const unsigned char *src = (const unsigned char*)UserArrayPtr + (size_t)p * dev->bytesPerPicture;
+			if (seq.dataFormat == ALP_DATA_BINARY_TOPDOWN)
+				memcpy(dst, src, dev->bytesPerPicture);
+			else
+				for (long y = 0; y < dev->height; y++)
+					memcpy(dst + y * stride, src + (dev->height - 1 - y) * stride, stride);
+		}
+		else
+		{
+			// one byte per pixel; the displayed binary picture is the most significant bit plane
+			const unsigned char *src = (const unsigned char*)UserArrayPtr + (size_t)p * dev->width * dev->height;
+			unsigned char msb = (seq.dataFormat == ALP_DATA_LSB_ALIGN) ? (unsigned char)(1 << (seq.bitPlanes - 1)) : 0x80;
+			for (long k = 0; k < dev->bytesPerPicture; k++)
+			{
+				unsigned char packed = 0;
+				for (int b = 0; b < 8; b++)
+					packed |= (src[k * 8 + b] & msb) ? (0x80 >> b) : 0;
+				dst[k] = packed;
+			}
+		}
+	}
+
+	// USB transfer time: the data goes over the wire as bit planes
+	double bytes = (double)PicLoad * seq.bitPlanes * dev->bytesPerPicture;
+	double transferUs = bytes / g_config.usbBandwidthMBs;	// MB/s == bytes/us
+	dev->stats.bytesUploaded += (unsigned long long)bytes;
+	dev->stats.uploadTimeUs += transferUs;
+	seq.useCount++;	// keep it from being freed while "on the wire"
+	guard.unlock();
+
+	sleepSimulated(transferUs);
+
+	guard.lock();
+	seq.useCount--;
+	return ALP_OK;
+}
+
+static long enqueue(SimDevice *dev, ALP_ID SequenceId, bool continuous)
+{
+	std::lock_guard<std::mutex> guard(dev->lock);
+	std::map<ALP_ID, SimSequence>::iterator it = dev->sequences.find(SequenceId);
+	if (it == dev->sequences.end())
+		return ALP_PARM_INVALID;
+	SimSequence &seq = it->second;
+	if (seq.pictureTime < minPictureTime(seq))
+		return ALP_PARM_INVALID;
+
+	if (dev->queueMode == ALP_PROJ_LEGACY)
+	{
+		// one waiting position: a new start replaces a sequence that is still waiting
+		while (!dev->queue.empty())
+		{
+			dev->sequences[dev->queue.back().sequenceId].useCount--;
+			dev->queue.pop_back();
+		}
+		// a running continuous sequence is replaced right away (after the current frame)
+		if (dev->running && dev->current.continuous)
+			dev->abortFrame = true;
+	}
+	else
+	{
+		if ((long)dev->queue.size() >= SIM_QUEUE_SIZE)
+			return ALP_NOT_READY;
+		if (dev->running && dev->current.continuous)
+			return ALP_PARM_INVALID;	// would never start
+	}
+
+	SimQueueEntry entry;
+	entry.sequenceId = SequenceId;
+	entry.queueId = dev->nextQueueId++;
+	entry.continuous = continuous;
+	entry.repeat = seq.repeat;
+	entry.firstFrame = seq.firstFrame;
+	entry.lastFrame = seq.lastFrame;
+	entry.pictureTime = seq.pictureTime;
+	if (seq.flutMode != ALP_FLUT_NONE)
+	{
+		// the frame numbers are taken from the FLUT when the sequence is started
+		// (like the other sequence settings)
+		bool wide = seq.flutMode == ALP_FLUT_18BIT;
+		long entries = wide ? seq.flutEntries9 / 2 : seq.flutEntries9;
+		long offset = wide ? seq.flutOffset9 / 2 : seq.flutOffset9;
+		if (entries < 1 || offset + entries > (wide ? SIM_FLUT_ENTRIES9 / 2 : SIM_FLUT_ENTRIES9))
+			return ALP_PARM_INVALID;
+		for (long k = 0; k < entries; k++)
+		{
+			long frame = wide ? (long)((dev->flut9[2 * (offset + k)] & 0x1FF) | (dev->flut9[2 * (offset + k) + 1] & 0x1FF) << 9) :
+				(long)(dev->flut9[offset + k] & 0x1FF);
+			if (frame >= seq.picNum)
+				return ALP_PARM_INVALID;
+			entry.frameMap.push_back(frame);
+		}
+	}
+	seq.useCount++;
+	dev->queue.push_back(entry);
+	dev->cv.notify_all();
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpProjStart(ALP_ID DeviceId, ALP_ID SequenceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	return enqueue(dev, SequenceId, false);
+}
+
+ALP_API long ALP_ATTR AlpProjStartCont(ALP_ID DeviceId, ALP_ID SequenceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	return enqueue(dev, SequenceId, true);
+}
+
+ALP_API long ALP_ATTR AlpProjHalt(ALP_ID DeviceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	dev->clearQueue();
+	if (dev->running)
+		dev->haltRequested = true;
+	dev->cv.notify_all();
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpProjWait(ALP_ID DeviceId)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::unique_lock<std::mutex> guard(dev->lock);
+	// waiting for an indefinitely running sequence would never return
+	if ((dev->running && dev->current.continuous && !dev->haltRequested) ||
+		(!dev->queue.empty() && dev->queue.back().continuous))
+		return ALP_PARM_INVALID;
+	dev->cv.wait(guard, [dev] { return !dev->isProjecting(); });
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpProjControl(ALP_ID DeviceId, long ControlType, long ControlValue)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	switch (ControlType) {
+	case ALP_PROJ_MODE:
+		// only master mode is simulated
+		return (ControlValue == ALP_MASTER || ControlValue == ALP_DEFAULT) ? ALP_OK : ALP_PARM_INVALID;
+	case ALP_PROJ_SYNC:
+		return (ControlValue == ALP_ASYNCHRONOUS || ControlValue == ALP_DEFAULT) ? ALP_OK : ALP_PARM_INVALID;
+	case ALP_PROJ_INVERSION:
+		dev->inversion = ControlValue;
+		return ALP_OK;
+	case ALP_PROJ_UPSIDE_DOWN:
+		dev->upsideDown = ControlValue;
+		return ALP_OK;
+	case ALP_PROJ_QUEUE_MODE:
+		if (ControlValue != ALP_PROJ_LEGACY && ControlValue != ALP_PROJ_SEQUENCE_QUEUE)
+			return ALP_PARM_INVALID;
+		if (dev->isProjecting())
+			return ALP_NOT_IDLE;
+		dev->queueMode = ControlValue;
+		return ALP_OK;
+	case ALP_PROJ_RESET_QUEUE:
+		dev->clearQueue();
+		return ALP_OK;
+	case ALP_PROJ_ABORT_SEQUENCE:
+	case ALP_PROJ_ABORT_FRAME:
+		if (!dev->running)
+			return ALP_OK;
+		if (ControlValue != ALP_DEFAULT && (ALP_ID)ControlValue != dev->current.queueId)
+			return ALP_PARM_INVALID;
+		if (ControlType == ALP_PROJ_ABORT_SEQUENCE)
+			dev->abortSequence = true;
+		else
+			dev->abortFrame = true;
+		dev->cv.notify_all();
+		return ALP_OK;
+	case ALP_PROJ_WAIT_UNTIL:
+		dev->waitUntil = ControlValue;
+		return ALP_OK;
+	default:
+		return ALP_PARM_INVALID;
+	}
+}
+
+ALP_API long ALP_ATTR AlpProjControlEx(ALP_ID DeviceId, long ControlType, void *pUserStructPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (pUserStructPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	if (ControlType != ALP_FLUT_WRITE_9BIT && ControlType != ALP_FLUT_WRITE_18BIT)
+		return ALP_PARM_INVALID;
+
+	tFlutWrite *flut = (tFlutWrite*)pUserStructPtr;
+	bool wide = ControlType == ALP_FLUT_WRITE_18BIT;
+	long maxEntries = wide ? SIM_FLUT_ENTRIES9 / 2 : SIM_FLUT_ENTRIES9;
+	long size = flut->nSize;
+	if (size == ALP_DEFAULT)
+	{
+		if (flut->nOffset != 0)
+			return ALP_PARM_INVALID;
+		size = maxEntries;
+	}
+	if (flut->nOffset < 0 || size < 0 || flut->nOffset + size > maxEntries)
+		return ALP_PARM_INVALID;
+
+	{
+		std::lock_guard<std::mutex> guard(dev->lock);
+		for (long k = 0; k < size; k++)
+		{
+			unsigned long frame = flut->FrameNumbers[k];
+			if (wide)
+			{
+				dev->flut9[2 * (flut->nOffset + k)] = frame & 0x1FF;
+				dev->flut9[2 * (flut->nOffset + k) + 1] = (frame >> 9) & 0x1FF;
+			}
+			else
+				dev->flut9[flut->nOffset + k] = frame & 0x1FF;
+		}
+	}
+	// USB transfer of the table (2 bytes per 9-bit entry)
+	sleepSimulated(size * (wide ? 4.0 : 2.0) / g_config.usbBandwidthMBs);
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpProjInquire(ALP_ID DeviceId, long InquireType, long *UserVarPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (UserVarPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	std::lock_guard<std::mutex> guard(dev->lock);
+	switch (InquireType) {
+	case ALP_PROJ_MODE: *UserVarPtr = ALP_MASTER; break;
+	case ALP_PROJ_SYNC: *UserVarPtr = ALP_ASYNCHRONOUS; break;
+	case ALP_PROJ_STATE: *UserVarPtr = dev->isProjecting() ? ALP_PROJ_ACTIVE : ALP_PROJ_IDLE; break;
+	case ALP_PROJ_INVERSION: *UserVarPtr = dev->inversion; break;
+	case ALP_PROJ_UPSIDE_DOWN: *UserVarPtr = dev->upsideDown; break;
+	case ALP_PROJ_QUEUE_MODE: *UserVarPtr = dev->queueMode; break;
+	case ALP_PROJ_QUEUE_MAX_AVAIL: *UserVarPtr = dev->queueMode == ALP_PROJ_LEGACY ? 1 : SIM_QUEUE_SIZE; break;
+	case ALP_PROJ_QUEUE_AVAIL:
+		*UserVarPtr = (dev->queueMode == ALP_PROJ_LEGACY ? 1 : SIM_QUEUE_SIZE) - (long)dev->queue.size();
+		break;
+	case ALP_PROJ_QUEUE_ID:
+		if (!dev->queue.empty())
+			*UserVarPtr = (long)dev->queue.back().queueId;
+		else if (dev->running)
+			*UserVarPtr = (long)dev->current.queueId;
+		else
+			*UserVarPtr = (long)ALP_INVALID_ID;
+		break;
+	case ALP_PROJ_WAIT_UNTIL: *UserVarPtr = dev->waitUntil; break;
+	case ALP_FLUT_MAX_ENTRIES9: *UserVarPtr = SIM_FLUT_ENTRIES9; break;
+	default:
+		return ALP_PARM_INVALID;
+	}
+	return ALP_OK;
+}
+
+ALP_API long ALP_ATTR AlpProjInquireEx(ALP_ID DeviceId, long InquireType, void *UserStructPtr)
+{
+	SimDevice *dev = lookupDevice(DeviceId);
+	if (dev == nullptr)
+		return ALP_NOT_AVAILABLE;
+	if (UserStructPtr == nullptr)
+		return ALP_ADDR_INVALID;
+	if (InquireType != ALP_PROJ_PROGRESS)
+		return ALP_PARM_INVALID;
+
+	std::lock_guard<std::mutex> guard(dev->lock);
+	tAlpProjProgress *progress = (tAlpProjProgress*)UserStructPtr;
+	memset(progress, 0, sizeof(tAlpProjProgress));
+	progress->nWaitingSequences = (unsigned long)dev->queue.size();
+	if (dev->running)
+	{
+		progress->CurrentQueueId = dev->current.queueId;
+		progress->SequenceId = dev->current.sequenceId;
+		progress->nFrameCounter = dev->framesLeft;
+		progress->nPictureTime = dev->current.pictureTime;
+		progress->nFramesPerSubSequence = dev->current.lastFrame - dev->current.firstFrame + 1;
+		if (dev->current.continuous)
+			progress->nFlags |= ALP_FLAG_SEQUENCE_INDEFINITE;
+		else
+			progress->nSequenceCounter = (unsigned long)(dev->current.repeat - dev->sequenceCounter);
+		if (dev->abortSequence || dev->abortFrame)
+			progress->nFlags |= ALP_FLAG_SEQUENCE_ABORTING;
+	}
+	else
+	{
+		progress->CurrentQueueId = ALP_INVALID_ID;
+		progress->SequenceId = ALP_INVALID_ID;
+		if (dev->queue.empty())
+			progress->nFlags |= ALP_FLAG_QUEUE_IDLE;
+	}
+	return ALP_OK;
+}
+
+
+/* LED drivers are not simulated */
+
+ALP_API long ALP_ATTR AlpLedAlloc(ALP_ID DeviceId, long LedType, void *UserStructPtr, ALP_ID *LedId)
+{
+	if (LedId != nullptr)
+		*LedId = ALP_INVALID_ID;
+	return lookupDevice(DeviceId) == nullptr ? ALP_NOT_AVAILABLE : ALP_NOT_ONLINE;
+}
+
+ALP_API long ALP_ATTR AlpLedFree(ALP_ID DeviceId, ALP_ID LedId)
+{
+	return ALP_PARM_INVALID;
+}
+
+ALP_API long ALP_ATTR AlpLedControl(ALP_ID DeviceId, ALP_ID LedId, long ControlType, long Value)
+{
+	return ALP_PARM_INVALID;
+}
+
+ALP_API long ALP_ATTR AlpLedInquire(ALP_ID DeviceId, ALP_ID LedId, long InquireType, long *UserVarPtr)
+{
+	return ALP_PARM_INVALID;
+}
+
+ALP_API long ALP_ATTR AlpLedControlEx(ALP_ID DeviceId, ALP_ID LedId, long ControlType, void *UserStructPtr)
+{
+	return ALP_PARM_INVALID;
+}
+
+ALP_API long ALP_ATTR AlpLedInquireEx(ALP_ID DeviceId, ALP_ID LedId, long InquireType, void *UserStructPtr)
+{
+	return ALP_PARM_INVALID;
+}
@@ -0,0 +1,102 @@
+/*
+ALP device simulator (ALPsim)
+DiCarlo Lab @ MIT
+
+Drop-in replacement for the ViALUX alpV42 library. Implements the alp.h API
+(device / sequence / projection functions) on top of a software DMD with a
+configurable timing model, so ALPwrapper can be exercised and benchmarked
+without the DLL or a physical device (including on Linux).
+
+Build options:
+  * As a shared library that replaces alpV42.dll. ALPsim.vcxproj builds MEX\ALPsim\alpV42.dll;
+    put that folder ahead of the ViALUX one on the PATH and the unmodified ALPwrapper
+    mex loads the simulator. On Linux:
+    g++ -std=c++11 -O2 -shared -fPIC -I../ALP-4.2 alpsim.cpp -o libalpsim.so -lpthread
+    Every mex that links it (ALPwrapper, simulated cameras) shares the same
+    simulated devices, so frame synch pulses can drive a simulated camera
+    (SyntheticBackend::ConnectSimulatedDMD in CameraCore).
+  * Compiled straight into a single mex:
+    mex -DALP_SIMULATOR -DALPSIM_STATIC -I../ALP-4.2 -I../ALPsim ALPwrapper.cpp ../ALPsim/alpsim.cpp
+
+The timing model can be set with AlpSimConfigure() before the first AlpDevAlloc,
+or from the environment (read once, on first use):
+  ALPSIM_NUM_DEVICES, ALPSIM_DMD_TYPE, ALPSIM_USB_MBPS, ALPSIM_MIN_PICTURE_TIME_US,
+  ALPSIM_DARK_PHASE_US, ALPSIM_MEMORY_FRAMES, ALPSIM_TIME_SCALE
+
+Revision History
+Version 0.1 10/18/2026
+*/
+#ifndef _ALPSIM_H_INCLUDED
+#define _ALPSIM_H_INCLUDED
+
+#ifndef ALP_API
+#if defined(_WIN32) && !defined(ALPSIM_STATIC)
+#ifdef ALPSIM_EXPORTS
+#define ALP_API extern "C" __declspec(dllexport)
+#else
+#define ALP_API extern "C" __declspec(dllimport)
+#endif
+#else
+#define ALP_API extern "C"
+#endif
+#define ALP_ATTR
+#endif
+
+#include <alp.h>
+
+#define ALPSIM_MAX_DEVICES 5
+
+// Timing / resource model of the simulated devices.
+struct tAlpSimConfig {
+	long numDevices;			// number of devices AlpDevAlloc(ALP_DEFAULT,...) will hand out
+	long firstSerial;			// serial number of device 0; device k gets firstSerial+k
+	long dmdType;				// ALP_DMDTYPE_*, defines the mirror resolution
+	double usbBandwidthMBs;		// effective AlpSeqPut throughput (MB/s of binary bit-plane data)
+	long minPictureTime;		// us, per bit plane, binary uninterrupted mode
+	long darkPhaseTime;			// us, added per picture in ALP_BIN_NORMAL mode
+	long memoryBinaryFrames;	// on-board sequence memory, in binary pictures (ALP_AVAIL_MEMORY)
+	double timeScale;			// 1 = real time, 0 = no sleeping at all (simulated clock still advances)
+};
+
+// One frame synch pulse (one picture shown on the DMD).
+struct tAlpSimSynchPulse {
+	ALP_ID DeviceId;
+	ALP_ID SequenceId;
+	ALP_ID QueueId;
+	long FrameIndex;				// picture index within the sequence memory
+	unsigned long long PulseCounter;	// total number of synch pulses emitted by this device
+	double TimestampUs;				// simulated time since AlpDevAlloc
+};
+
+struct tAlpSimStats {
+	unsigned long long bytesUploaded;
+	double uploadTimeUs;			// simulated time spent inside AlpSeqPut
+	unsigned long long framesDisplayed;
+	unsigned long long sequencesCompleted;
+	unsigned long long lateFrames;	// real-time mode: frames emitted more than one picture time (+1 ms batching) late
+};
+
+// Called from the projection thread for every displayed picture. PackedFrame points to
+// the device memory of that picture (binary, top-down, width/8 bytes per row) and is only
+// valid during the call. Callbacks must not call back into the AlpSim* registration functions.
+typedef void (*tAlpSimFrameTap)(void *Context, const tAlpSimSynchPulse *Pulse, const unsigned char *PackedFrame, long Width, long Height);
+typedef void (*tAlpSimSynchCallback)(void *Context, const tAlpSimSynchPulse *Pulse);
+
+ALP_API long ALP_ATTR AlpSimConfigure(const tAlpSimConfig *Config);
+ALP_API long ALP_ATTR AlpSimGetConfig(tAlpSimConfig *Config);
+// Id of a device another module (ALPwrapper) has allocated, by serial number or
+// ALP_DEFAULT for the first one. Returns ALP_NOT_ONLINE if it is not allocated.
+// Taps and subscriptions end when the device is freed and allocated again.
+ALP_API long ALP_ATTR AlpSimGetDeviceId(long SerialNumber, ALP_ID *DeviceId);
+ALP_API long ALP_ATTR AlpSimSetFrameTap(ALP_ID DeviceId, tAlpSimFrameTap Tap, void *Context);
+ALP_API long ALP_ATTR AlpSimSubscribeSynch(ALP_ID DeviceId, tAlpSimSynchCallback Callback, void *Context, long *SubscriptionId);
+ALP_API long ALP_ATTR AlpSimUnsubscribeSynch(ALP_ID DeviceId, long SubscriptionId);
+// Copy of the picture currently on the mirrors (binary, width/8*height bytes). Returns
+// ALP_NOT_READY if nothing was displayed yet.
+ALP_API long ALP_ATTR AlpSimGetCurrentFrame(ALP_ID DeviceId, unsigned char *PackedFrame, tAlpSimSynchPulse *Pulse);
+// Record the synch pulses of the next MaxFrames displayed pictures (0 stops recording).
+ALP_API long ALP_ATTR AlpSimStartRecording(ALP_ID DeviceId, long MaxFrames);
+ALP_API long ALP_ATTR AlpSimGetRecording(ALP_ID DeviceId, tAlpSimSynchPulse *Pulses, long MaxPulses, long *NumPulses);
+ALP_API long ALP_ATTR AlpSimGetStats(ALP_ID DeviceId, tAlpSimStats *Stats);
+
+#endif
@@ -6,14 +6,255 @@ Revision History
 Version 0.1 7/16/2014  
 */
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
 #include <mex.h>
+#ifdef ALP_SIMULATOR
+#include "alpsim.h"
+#else
 #include <alp.h>
+#endif
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 #include <queue>
 #include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
+// Telemetry. Every ALP call made by the wrapper and every mex command is timed
+// and accumulated in a log2 histogram (bin k counts durations in [2^(k-1), 2^k) us).
+// The most recent TELEMETRY_EVENTS records are kept in a ring for post-mortem.
+const int TELEMETRY_BINS = 24;		// up to ~8 sec
+const int TELEMETRY_EVENTS = 1024;
+
+struct TelemetryCounter {
+	long long count, errors;
+	double totalUs, maxUs, lastUs;
+	double bytes;
+	long long histogram[TELEMETRY_BINS];
+};
+
+struct TelemetryEvent {
+	double time;		// sec since telemetry reset
+	const char *name;
+	double durationUs;
+	long result;
+	double bytes;
+	long sequence;
+};
+
+class ALPtelemetry {
+public:
+	ALPtelemetry() { reset(); }
+	void reset();
+	double now();
+	void record(const char *name, double startTime, long result, double bytes = 0, long sequence = -1, bool logEvent = true);
+	void poll(bool idle);
+	void sequenceStarted(long sequence);
+	void sequenceEnded(const char *how);
+	mxArray* toMatlab(int numEvents);
+private:
+	std::chrono::steady_clock::time_point t0;
+	std::map<std::string, TelemetryCounter> counters;
+	TelemetryEvent events[TELEMETRY_EVENTS];
+	long long numEvents;
+	long long pollCount, pollsThisSequence, pollsLastSequence;
+	bool sequenceActive;
+	long activeSequence;
+	double sequenceStartTime, lastSequenceDuration;
+	double lastUploadMBs;
+};
+
+void ALPtelemetry::reset()
+{
+	t0 = std::chrono::steady_clock::now();
+	counters.clear();
+	numEvents = 0;
+	pollCount = pollsThisSequence = pollsLastSequence = 0;
+	sequenceActive = false;
+	activeSequence = -1;
+	sequenceStartTime = lastSequenceDuration = 0;
+	lastUploadMBs = 0;
+}
 
-#define MIN(a,b) (a)<(b)?(a):(b)
+double ALPtelemetry::now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
 
+void ALPtelemetry::record(const char *name, double startTime, long result, double bytes, long sequence, bool logEvent)
+{
+	double durationUs = (now() - startTime) * 1e6;
+	std::map<std::string, TelemetryCounter>::iterator it = counters.find(name);
+	if (it == counters.end())
+	{
+		TelemetryCounter c;
+		memset(&c, 0, sizeof(c));
+		it = counters.insert(std::make_pair(std::string(name), c)).first;
+	}
+	TelemetryCounter &c = it->second;
+	c.count++;
+	if (result != ALP_OK)
+		c.errors++;
+	c.totalUs += durationUs;
+	c.lastUs = durationUs;
+	if (durationUs > c.maxUs)
+		c.maxUs = durationUs;
+	c.bytes += bytes;
+	int bin = 0;
+	for (double edge = 1; durationUs >= edge && bin < TELEMETRY_BINS - 1; edge *= 2)
+		bin++;
+	c.histogram[bin]++;
+	if (bytes > 0 && durationUs > 0)
+		lastUploadMBs = bytes / durationUs;
+	if (!logEvent)
+		return;
+
+	// name points into the map key, which lives as long as the counter
+	TelemetryEvent &e = events[numEvents % TELEMETRY_EVENTS];
+	e.time = startTime;
+	e.name = it->first.c_str();
+	e.durationUs = durationUs;
+	e.result = result;
+	e.bytes = bytes;
+	e.sequence = sequence;
+	numEvents++;
+}
+
+void ALPtelemetry::poll(bool idle)
+{
+	pollCount++;
+	pollsThisSequence++;
+	if (idle && sequenceActive)
+		sequenceEnded("SequenceCompleted");
+}
+
+void ALPtelemetry::sequenceStarted(long sequence)
+{
+	if (sequenceActive)
+		sequenceEnded("SequenceReplaced");
+	sequenceActive = true;
+	activeSequence = sequence;
+	sequenceStartTime = now();
+	pollsThisSequence = 0;
+}
+
+void ALPtelemetry::sequenceEnded(const char *how)
+{
+	if (!sequenceActive)
+		return;
+	// duration is as observed from the host, i.e. start call to the first idle poll/wait
+	record(how, sequenceStartTime, ALP_OK, 0, activeSequence);
+	lastSequenceDuration = now() - sequenceStartTime;
+	pollsLastSequence = pollsThisSequence;
+	sequenceActive = false;
+}
+
+mxArray* ALPtelemetry::toMatlab(int maxEvents)
+{
+	const char *fields[] = { "uptime", "commands", "histogramEdgesUs", "bytesUploaded", "uploadMBs", "lastUploadMBs",
+		"pollCount", "pollsLastSequence", "lastSequenceDurationMs", "sequenceActive", "events" };
+	mxArray *out = mxCreateStructMatrix(1, 1, 11, fields);
+
+	const char *counterFields[] = { "name", "count", "errors", "totalMs", "meanUs", "maxUs", "lastUs", "bytes", "histogram" };
+	mxArray *cmds = mxCreateStructMatrix(1, (int)counters.size(), 9, counterFields);
+	int k = 0;
+	double uploadBytes = 0, uploadUs = 0;
+	for (std::map<std::string, TelemetryCounter>::iterator it = counters.begin(); it != counters.end(); it++, k++)
+	{
+		TelemetryCounter &c = it->second;
+		mxSetField(cmds, k, "name", mxCreateString(it->first.c_str()));
+		mxSetField(cmds, k, "count", mxCreateDoubleScalar((double)c.count));
+		mxSetField(cmds, k, "errors", mxCreateDoubleScalar((double)c.errors));
+		mxSetField(cmds, k, "totalMs", mxCreateDoubleScalar(c.totalUs / 1e3));
+		mxSetField(cmds, k, "meanUs", mxCreateDoubleScalar(c.count > 0 ? c.totalUs / c.count : 0));
+		mxSetField(cmds, k, "maxUs", mxCreateDoubleScalar(c.maxUs));
+		mxSetField(cmds, k, "lastUs", mxCreateDoubleScalar(c.lastUs));
+		mxSetField(cmds, k, "bytes", mxCreateDoubleScalar(c.bytes));
+		mxArray *hist = mxCreateDoubleMatrix(1, TELEMETRY_BINS, mxREAL);
+		double *h = mxGetPr(hist);
+		for (int b = 0; b < TELEMETRY_BINS; b++)
+			h[b] = (double)c.histogram[b];
+		mxSetField(cmds, k, "histogram", hist);
+		if (it->first == "AlpSeqPut")
+		{
+			uploadBytes = c.bytes;
+			uploadUs = c.totalUs;
+		}
+	}
+
+	mxArray *edges = mxCreateDoubleMatrix(1, TELEMETRY_BINS + 1, mxREAL);
+	double *e = mxGetPr(edges);
+	e[0] = 0;
+	for (int b = 1; b <= TELEMETRY_BINS; b++)
+		e[b] = (double)(1LL << (b - 1));
+	e[TELEMETRY_BINS] = mxGetInf();
+
+	mxSetField(out, 0, "uptime", mxCreateDoubleScalar(now()));
+	mxSetField(out, 0, "commands", cmds);
+	mxSetField(out, 0, "histogramEdgesUs", edges);
+	mxSetField(out, 0, "bytesUploaded", mxCreateDoubleScalar(uploadBytes));
+	mxSetField(out, 0, "uploadMBs", mxCreateDoubleScalar(uploadUs > 0 ? uploadBytes / uploadUs : 0));
+	mxSetField(out, 0, "lastUploadMBs", mxCreateDoubleScalar(lastUploadMBs));
+	mxSetField(out, 0, "pollCount", mxCreateDoubleScalar((double)pollCount));
+	mxSetField(out, 0, "pollsLastSequence", mxCreateDoubleScalar((double)pollsLastSequence));
+	mxSetField(out, 0, "lastSequenceDurationMs", mxCreateDoubleScalar(lastSequenceDuration * 1e3));
+	mxSetField(out, 0, "sequenceActive", mxCreateLogicalScalar(sequenceActive));
+
+	// last N events, oldest first
+	long long n = MIN(MIN((long long)maxEvents, numEvents), (long long)TELEMETRY_EVENTS);
+	const char *eventFields[] = { "time", "name", "durationUs", "result", "bytes", "sequence" };
+	mxArray *ev = mxCreateStructMatrix(1, (int)n, 6, eventFields);
+	for (long long j = 0; j < n; j++)
+	{
+		TelemetryEvent &evt = events[(numEvents - n + j) % TELEMETRY_EVENTS];
+		mxSetField(ev, (int)j, "time", mxCreateDoubleScalar(evt.time));
+		mxSetField(ev, (int)j, "name", mxCreateString(evt.name));
+		mxSetField(ev, (int)j, "durationUs", mxCreateDoubleScalar(evt.durationUs));
+		mxSetField(ev, (int)j, "result", mxCreateDoubleScalar(evt.result));
+		mxSetField(ev, (int)j, "bytes", mxCreateDoubleScalar(evt.bytes));
+		mxSetField(ev, (int)j, "sequence", mxCreateDoubleScalar(evt.sequence));
+	}
+	mxSetField(out, 0, "events", ev);
+	return out;
+}
+
+
+// Completion events. A watcher thread per device blocks in AlpProjWait while a
+// finite projection is running and time-stamps its end, so MATLAB can wait with a
+// timeout or ask "what finished since token X" without polling the device.
+const int COMPLETION_EVENTS = 64;
+
+struct CompletionEvent {
+	long long token;		// running number of completions on this device (1, 2, ...)
+	long sequence;			// last sequence started before the projection went idle
+	double startTime, endTime;	// sec, device event clock (ALPwrapper::eventTime)
+	bool halted;			// ended by StopSequence rather than running out
+};
+
+// Result of one upload + playback timing run (MeasureTiming)
+struct TimingMeasurement {
+	long numFrames, bitDepth;
+	long minPictureTimeUs;		// ALP_MIN_PICTURE_TIME of the test sequence
+	double maxRateHz;			// 1e6 / minPictureTimeUs
+	double requestedRateHz;
+	double uploadMs, uploadMBs;	// AlpSeqPut of all bit planes
+	double playMs, measuredRateHz;	// AlpProjStart to the watcher seeing the device idle
+	bool completed;
+};
+
+// How an index list is played from frames already in device memory
+enum IndexedPlaybackMode { INDEXED_NONE = 0, INDEXED_WINDOW, INDEXED_FLUT, INDEXED_QUEUE };
 
 class ALPwrapper {
 public:
@@ -30,25 +271,63 @@ public:
 
 		int uploadSequence(unsigned char *sequence, int numFrames);
 		bool runUploadedSequence(int sequence, double frameRate, bool continuous, long numRepeats);
+		bool runUploadedSequenceIndexed(int sequence, const std::vector<long> &frames, double frameRate, bool continuous, long numRepeats);
+		int planIndexedPlayback(int sequence, const std::vector<long> &frames, bool continuous, long numRepeats, std::vector<std::pair<long, long> > &runs);
 		bool releaseAllSequences();
 		bool releaseSequence(int sequence);
 		bool showPattern(unsigned char *pattern);
 		unsigned char* packInput(unsigned char *Input, int Input_width, int Input_height, int numFrames);
-		int allocateStandardSequence(int nFrames);
+		int allocateStandardSequence(int nFrames, int bitDepth = 1);
+		bool measureTiming(int numFrames, int bitDepth, double frameRate, TimingMeasurement &m);
 		long getSerial() { return nDmdSerial; }
 		long getType() { return nDmdType; }
 		int getWidth() { return width; }
 		int getHeight() { return height; }
+		bool waitForCompletion(double timeoutSec, long long sinceToken, long long &token);
+		long long getCompletionToken();
+		int completedSince(long long sinceToken, std::vector<CompletionEvent> &events);
+		double eventTime();
+		ALPtelemetry telemetry;
+		double lastMexExit;		// telemetry time the previous mex call on this device returned
 private:
+	void armCompletion(int sequence, double startTime);
+	void disarmCompletion();
+	void stopWatcher();
+	void watcherLoop();
 	void setResolutionFromType();
+	void queryCapabilities();
+	bool isAllocated(int sequence);
+	long getNumFrames(int sequence);
+	bool setSequenceControl(int sequence, long controlType, long value);
+	bool setSequenceTiming(int sequence, double frameRate);
+	bool setFrameWindow(int sequence, long first, long last);
+	bool startSequence(int sequence, bool continuous);
+	void restoreLinearPlayback(int sequence);
+	void restoreLegacyQueueMode();
 
 	void removeAllocatedSequenceFromList(int sequence);
 	bool playingCont;
 	std::list<int> allocatedSequences;
+	std::map<int, long> indexedSequences;	// sequences whose frame window / FLUT mode was changed by indexed playback
+	long flutMaxEntries9, queueMaxAvail;
+	bool queueModeActive;
 	bool initialized;
 	ALP_ID nAlpId;
 	long nDmdSerial, nDmdType;
 	int width, height;
+
+	// completion watcher state, guarded by eventLock
+	std::thread watcher;
+	std::mutex eventLock;
+	std::condition_variable eventCv;
+	bool watcherQuit, haltPending;
+	bool continuousActive;	// a continuous projection (never completes) was started last
+	long long startGeneration, doneGeneration;	// finite projections started / accounted for
+	long long completionCount;
+	long pendingSequence;
+	double pendingStartTime;
+	CompletionEvent completions[COMPLETION_EVENTS];
+	std::chrono::steady_clock::time_point eventClock0;
 };
 
 const int MAX_DEVICES = 5;
@@ -77,6 +356,7 @@ bool ALPwrapper::init()
 		return false;
 	} 
 
+	queryCapabilities();
 	initialized = true;
 	return true;
 }
@@ -111,7 +391,14 @@ ALPwrapper::ALPwrapper(ALP_ID id, long serial, long type) : nAlpId(id), nDmdSeri
 {
 	initialized = true;
 	playingCont = false;
+	lastMexExit = -1;
+	watcherQuit = haltPending = continuousActive = false;
+	startGeneration = doneGeneration = completionCount = 0;
+	pendingSequence = -1;
+	pendingStartTime = 0;
+	eventClock0 = std::chrono::steady_clock::now();
 	setResolutionFromType();
+	queryCapabilities();
 }
 
 ALPwrapper::~ALPwrapper()
@@ -210,7 +497,7 @@ bool ALPwrapper::prepareCalibrationSequence(int numModes)
 	
 
 	// Allocate memory for sequence on host computer
-	UCHAR *pImageData = new UCHAR[nFrames*width*height/8];
+	unsigned char *pImageData = new unsigned char[nFrames*width*height/8];
 	if (pImageData == nullptr) 
 	{
 		mexPrintf( "Error allocating memory for sequence on host computer\n" );
@@ -238,6 +525,7 @@ void ALPwrapper::release()
 		return;
 
 	AlpDevHalt( nAlpId );
+	stopWatcher();
 	releaseAllSequences();
 	AlpDevFree( nAlpId );
 
@@ -246,16 +534,38 @@ void ALPwrapper::release()
 
 bool ALPwrapper::stopSequence()
 {
+	{
+		std::lock_guard<std::mutex> guard(eventLock);
+		haltPending = startGeneration != doneGeneration;
+		continuousActive = false;
+	}
+	double t0 = telemetry.now();
 	int Ret1 = AlpProjHalt(nAlpId); // non-blocking. Request sequence halt
+	telemetry.record("AlpProjHalt", t0, Ret1);
+	t0 = telemetry.now();
 	int Ret2 = AlpProjWait(nAlpId); // wait for sequence to end, then return.
+	telemetry.record("AlpProjWait", t0, Ret2);
+	telemetry.sequenceEnded("SequenceHalted");
 	playingCont = false;
 	return Ret1 == ALP_OK && Ret2 == ALP_OK;
 }
 
 bool ALPwrapper::hasSequenceCompleted()
 {
+	{
+		// a finite projection the watcher has not seen finish yet; no need to ask the device
+		std::lock_guard<std::mutex> guard(eventLock);
+		if (startGeneration != doneGeneration)
+		{
+			telemetry.poll(false);
+			return false;
+		}
+	}
 	long Ret;
+	double t0 = telemetry.now();
 	int Ret2 = AlpProjInquire(nAlpId,ALP_PROJ_STATE,&Ret); // wait for sequence to end, then return.
+	telemetry.record("AlpProjInquire", t0, Ret2, 0, -1, false);	// polled in a loop, keep it out of the event log
+	telemetry.poll(Ret == ALP_PROJ_IDLE);
 	return Ret == ALP_PROJ_IDLE;
 
 }
@@ -263,34 +573,187 @@ bool ALPwrapper::hasSequenceCompleted()
 
 bool ALPwrapper::waitForSequenceCompletion()
 {
+	bool pending;
+	{
+		std::lock_guard<std::mutex> guard(eventLock);
+		pending = startGeneration != doneGeneration;
+	}
+	if (pending)
+	{
+		long long token;
+		bool done = waitForCompletion(-1, -1, token);
+		if (done)
+			telemetry.sequenceEnded("SequenceCompleted");
+		return done;
+	}
+	double t0 = telemetry.now();
 	int Ret2 = AlpProjWait(nAlpId); // wait for sequence to end, then return.
+	telemetry.record("AlpProjWait", t0, Ret2);
+	if (Ret2 == ALP_OK)
+		telemetry.sequenceEnded("SequenceCompleted");
 	return Ret2 == ALP_OK;
 }
-int ALPwrapper::allocateStandardSequence(int nFrames)
+double ALPwrapper::eventTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - eventClock0).count();
+}
+
+void ALPwrapper::armCompletion(int sequence, double startTime)
+{
+	std::lock_guard<std::mutex> guard(eventLock);
+	if (!watcher.joinable())
+	{
+		watcherQuit = false;
+		watcher = std::thread(&ALPwrapper::watcherLoop, this);
+	}
+	if (startGeneration == doneGeneration)
+		pendingStartTime = startTime;
+	pendingSequence = sequence;
+	startGeneration++;
+	continuousActive = false;
+	eventCv.notify_all();
+}
+
+void ALPwrapper::disarmCompletion()
+{
+	// continuous projections never complete; AlpProjWait refuses to wait for them
+	std::lock_guard<std::mutex> guard(eventLock);
+	doneGeneration = startGeneration;
+	continuousActive = true;
+	eventCv.notify_all();
+}
+
+void ALPwrapper::stopWatcher()
+{
+	{
+		std::lock_guard<std::mutex> guard(eventLock);
+		watcherQuit = true;
+		continuousActive = false;
+		doneGeneration = startGeneration;
+		eventCv.notify_all();
+	}
+	if (watcher.joinable())
+		watcher.join();
+}
+
+void ALPwrapper::watcherLoop()
+{
+	std::unique_lock<std::mutex> guard(eventLock);
+	while (!watcherQuit)
+	{
+		if (startGeneration == doneGeneration)
+		{
+			eventCv.wait(guard);
+			continue;
+		}
+		guard.unlock();
+		long waitRes = AlpProjWait(nAlpId);
+		guard.lock();
+		// Everything started up to this generation was issued before the state query,
+		// so an idle device means all of it has been projected.
+		long long generation = startGeneration;
+		guard.unlock();
+		long state = 0;
+		long inquireRes = AlpProjInquire(nAlpId, ALP_PROJ_STATE, &state);
+		double endTime = eventTime();
+		guard.lock();
+
+		if (inquireRes == ALP_OK && state == ALP_PROJ_IDLE)
+		{
+			if (doneGeneration < generation)
+			{
+				CompletionEvent &e = completions[completionCount % COMPLETION_EVENTS];
+				e.token = ++completionCount;
+				e.sequence = pendingSequence;
+				e.startTime = pendingStartTime;
+				e.endTime = endTime;
+				e.halted = haltPending;
+				haltPending = false;
+				doneGeneration = generation;
+				eventCv.notify_all();
+			}
+		}
+		else if (waitRes != ALP_OK)
+		{
+			// e.g. a continuous sequence was queued behind the finite one
+			eventCv.wait_for(guard, std::chrono::milliseconds(1));
+		}
+	}
+}
+
+bool ALPwrapper::waitForCompletion(double timeoutSec, long long sinceToken, long long &token)
+{
+	// sinceToken < 0: wait until no finite projection is pending.
+	// Otherwise wait for a completion newer than sinceToken. timeoutSec < 0 waits forever.
+	std::unique_lock<std::mutex> guard(eventLock);
+	if (sinceToken < 0 && continuousActive)
+	{
+		token = completionCount;
+		return false;
+	}
+	auto done = [this, sinceToken] { return sinceToken < 0 ? startGeneration == doneGeneration : completionCount > sinceToken; };
+	bool result;
+	if (timeoutSec < 0)
+	{
+		eventCv.wait(guard, done);
+		result = true;
+	}
+	else
+		result = eventCv.wait_for(guard, std::chrono::duration<double>(timeoutSec), done);
+	token = completionCount;
+	return result;
+}
+
+long long ALPwrapper::getCompletionToken()
+{
+	std::lock_guard<std::mutex> guard(eventLock);
+	return completionCount;
+}
+
+int ALPwrapper::completedSince(long long sinceToken, std::vector<CompletionEvent> &events)
+{
+	// only the last COMPLETION_EVENTS are kept; returns the total number missed + kept.
+	// Tokens count from 0, a negative one means "since the device was opened".
+	std::lock_guard<std::mutex> guard(eventLock);
+	events.clear();
+	sinceToken = MAX(sinceToken, 0LL);
+	long long first = MAX(sinceToken, completionCount - COMPLETION_EVENTS);
+	for (long long k = first; k < completionCount; k++)
+		events.push_back(completions[k % COMPLETION_EVENTS]);
+	return (int)(completionCount - MIN(sinceToken, completionCount));
+}
+
+int ALPwrapper::allocateStandardSequence(int nFrames, int bitDepth)
 {
 	ALP_ID nSeqId;
-	if (ALP_OK != AlpSeqAlloc(nAlpId, 1, nFrames, &nSeqId))
+	double t0 = telemetry.now();
+	long Result0 = AlpSeqAlloc(nAlpId, bitDepth, nFrames, &nSeqId);
+	telemetry.record("AlpSeqAlloc", t0, Result0, 0, nSeqId);
+	if (ALP_OK != Result0)
 	{
 		mexPrintf("Error allocating memory for sequence on device\n");
 		return -1;
 	}
+	t0 = telemetry.now();
 	// Set the data format as binary. This will save space and allow more sequences to be stored on the device.
 	long Result1 = AlpSeqControl(nAlpId, nSeqId, ALP_SEQ_REPEAT, 1); // only run the calibraiton sequence once
-	long Result2 = AlpSeqControl(nAlpId, nSeqId, ALP_BITNUM, 1); // binary patterns and not gray scale
+	long Result2 = AlpSeqControl(nAlpId, nSeqId, ALP_BITNUM, bitDepth); // binary patterns and not gray scale
 	long Result3 = AlpSeqControl(nAlpId, nSeqId, ALP_FIRSTFRAME, 0); // binary patterns and not gray scale
 	long Result4 = AlpSeqControl(nAlpId, nSeqId, ALP_LASTFRAME, nFrames - 1); // binary patterns and not gray scale
-	long Result5 = AlpSeqControl(nAlpId, nSeqId, ALP_DATA_FORMAT, ALP_DATA_BINARY_TOPDOWN);
+	long Result5 = AlpSeqControl(nAlpId, nSeqId, ALP_DATA_FORMAT, bitDepth == 1 ? ALP_DATA_BINARY_TOPDOWN : ALP_DATA_MSB_ALIGN);
 
 	// Imporant.  To achieve maximal frame rate we switch to a binary mode that is uninterrupted by "dark phase"
 	// "Dark phase" is usually used to initialize the next frame. However, in binary mode, no such preprocessing is needed!
-	long Result6 = AlpSeqControl(nAlpId, nSeqId, ALP_BIN_MODE, ALP_BIN_UNINTERRUPTED);
+	long Result6 = bitDepth == 1 ? AlpSeqControl(nAlpId, nSeqId, ALP_BIN_MODE, ALP_BIN_UNINTERRUPTED) : ALP_OK;
 
 	if (Result1 != ALP_OK || Result2 != ALP_OK || Result3 != ALP_OK || Result4 != ALP_OK || Result5 != ALP_OK || Result6 != ALP_OK)
 	{
+		telemetry.record("AlpSeqControl", t0, ALP_PARM_INVALID, 0, nSeqId);
 		AlpSeqFree(nAlpId, nSeqId);
 		mexPrintf("Error setting sequence control parameters\n");
 		return -1;
 	}
+	telemetry.record("AlpSeqControl", t0, ALP_OK, 0, nSeqId);
 
 
 	// Use SYNCH_OUT lines? Not very useful at the moment
@@ -319,8 +782,74 @@ int ALPwrapper::allocateStandardSequence(int nFrames)
 	return nSeqId;
 }
 
+bool ALPwrapper::measureTiming(int numFrames, int bitDepth, double frameRate, TimingMeasurement &m)
+{
+	// Upload a throw-away sequence, play it once and time both steps. frameRate <= 0 plays
+	// at the fastest rate the sequence allows (ALP_MIN_PICTURE_TIME).
+	memset(&m, 0, sizeof(m));
+	m.numFrames = numFrames;
+	m.bitDepth = bitDepth;
+	int nSeqId = allocateStandardSequence(numFrames, bitDepth);
+	if (nSeqId == -1)
+		return false;
+
+	double t0 = telemetry.now();
+	long Res = AlpSeqInquire(nAlpId, nSeqId, ALP_MIN_PICTURE_TIME, &m.minPictureTimeUs);
+	telemetry.record("AlpSeqInquire", t0, Res, 0, nSeqId);
+	if (Res != ALP_OK || m.minPictureTimeUs <= 0)
+	{
+		releaseSequence(nSeqId);
+		return false;
+	}
+	m.maxRateHz = 1e6 / m.minPictureTimeUs;
+
+	// checkerboard-ish content; the data itself does not change the timing
+	size_t bytesPerFrame = bitDepth == 1 ? (size_t)width / 8 * height : (size_t)width * height;
+	std::vector<unsigned char> data(bytesPerFrame * numFrames);
+	for (size_t k = 0; k < data.size(); k++)
+		data[k] = (k & 1) ? 0x55 : 0xAA;
+	double wireBytes = double(width / 8) * height * bitDepth * numFrames;
+	t0 = telemetry.now();
+	Res = AlpSeqPut(nAlpId, nSeqId, 0, numFrames, data.data());
+	telemetry.record("AlpSeqPut", t0, Res, wireBytes, nSeqId);
+	m.uploadMs = (telemetry.now() - t0) * 1e3;
+	m.uploadMBs = m.uploadMs > 0 ? wireBytes / (m.uploadMs * 1e3) : 0;
+	if (Res != ALP_OK)
+	{
+		releaseSequence(nSeqId);
+		return false;
+	}
+
+	restoreLegacyQueueMode();
+	m.requestedRateHz = frameRate > 0 ? frameRate : m.maxRateHz;
+	long pictureTime = MAX((long)(1e6 / m.requestedRateHz), m.minPictureTimeUs);
+	t0 = telemetry.now();
+	Res = AlpSeqTiming(nAlpId, nSeqId, 0, pictureTime, 0, pictureTime / 2, 0);
+	telemetry.record("AlpSeqTiming", t0, Res, 0, nSeqId);
+	long long since = getCompletionToken(), latest;
+	if (Res != ALP_OK || !startSequence(nSeqId, false))
+	{
+		releaseSequence(nSeqId);
+		return false;
+	}
+	double expectedSec = numFrames / m.requestedRateHz;
+	m.completed = waitForCompletion(2 * expectedSec + 1, since, latest);
+	std::vector<CompletionEvent> events;
+	if (m.completed && completedSince(since, events) > 0)
+	{
+		m.playMs = (events.back().endTime - events.back().startTime) * 1e3;
+		m.measuredRateHz = m.playMs > 0 ? numFrames / (m.playMs / 1e3) : 0;
+		telemetry.sequenceEnded("SequenceCompleted");
+	}
+	else
+		stopSequence();
+	releaseSequence(nSeqId);
+	return m.completed;
+}
+
 bool ALPwrapper::showPattern(unsigned char *pattern)
 {
+	restoreLegacyQueueMode();
 
 	int nSeqId = allocateStandardSequence(1);
 	if (nSeqId == -1)
@@ -329,7 +858,9 @@ bool ALPwrapper::showPattern(unsigned char *pattern)
 		return false;
 	}
 
+	double t0 = telemetry.now();
 	int nReturn = AlpSeqPut(nAlpId, nSeqId, 0, ALP_DEFAULT, pattern);
+	telemetry.record("AlpSeqPut", t0, nReturn, width*height / 8, nSeqId);
 	if (nReturn != ALP_OK)
 	{
 		releaseSequence(nSeqId);
@@ -337,7 +868,14 @@ bool ALPwrapper::showPattern(unsigned char *pattern)
 		return false;
 	}
 
+	t0 = telemetry.now();
 	int StartSuccessfuly = AlpProjStartCont(nAlpId, nSeqId);
+	telemetry.record("AlpProjStartCont", t0, StartSuccessfuly, 0, nSeqId);
+	if (StartSuccessfuly == ALP_OK)
+	{
+		disarmCompletion();
+		telemetry.sequenceStarted(nSeqId);
+	}
 
 	return StartSuccessfuly == ALP_OK ;
 }
@@ -347,6 +885,7 @@ bool ALPwrapper::showPattern(unsigned char *pattern)
 
 bool ALPwrapper::clear(bool white)
 {
+	restoreLegacyQueueMode();
 	int nSeqId = allocateStandardSequence(1);
 	if (nSeqId == -1)
 	{
@@ -354,13 +893,15 @@ bool ALPwrapper::clear(bool white)
 		return false;
 	}
 
-	UCHAR *pImageData = new UCHAR[width*height / 8];
+	unsigned char *pImageData = new unsigned char[width*height / 8];
 	if (white)
-		FillMemory(pImageData, width*height / 8, 255);		// black
+		memset(pImageData, 255, width*height / 8);		// black
 	else
-		FillMemory(pImageData, width*height / 8, 0x00);		// black
+		memset(pImageData, 0x00, width*height / 8);		// black
 
+	double t0 = telemetry.now();
 	int nReturn = AlpSeqPut(nAlpId, nSeqId, 0, 1, pImageData); // BLOCKING (!)
+	telemetry.record("AlpSeqPut", t0, nReturn, width*height / 8, nSeqId);
 
 	delete pImageData;
 
@@ -368,7 +909,14 @@ bool ALPwrapper::clear(bool white)
 	{
 		return false;
 	}
+	t0 = telemetry.now();
 	int StartSuccessfuly = AlpProjStartCont(nAlpId, nSeqId);
+	telemetry.record("AlpProjStartCont", t0, StartSuccessfuly, 0, nSeqId);
+	if (StartSuccessfuly == ALP_OK)
+	{
+		disarmCompletion();
+		telemetry.sequenceStarted(nSeqId);
+	}
 
 	return StartSuccessfuly == ALP_OK;
 
@@ -391,7 +939,9 @@ int ALPwrapper::uploadSequence(unsigned char *sequence, int numFrames)
 		return -1;
 	}
 
+	double t0 = telemetry.now();
 	int nReturn = AlpSeqPut(nAlpId, nSeqId, 0, ALP_DEFAULT, sequence);
+	telemetry.record("AlpSeqPut", t0, nReturn, double(width / 8) * height * numFrames, nSeqId);
 	if (nReturn != ALP_OK)
 	{
 		releaseSequence(nSeqId);		
@@ -401,58 +951,297 @@ int ALPwrapper::uploadSequence(unsigned char *sequence, int numFrames)
 	return nSeqId;
 }
 
-bool ALPwrapper::runUploadedSequence(int sequence, double frameRate, bool continuous, long numRepeats=1)
+bool ALPwrapper::isAllocated(int sequence)
 {
-	// Verify that the sequence was actually allocated...
 	for (std::list<int>::iterator it = allocatedSequences.begin(); it != allocatedSequences.end(); it++)
 	{
 		if (*it == sequence)
+			return true;
+	}
+	return false;
+}
+
+bool ALPwrapper::setSequenceTiming(int sequence, double frameRate)
+{
+	long IlluminateTime = 0; // Ignored, we are in uninterrupted binary mode
+	long PictureTime = 1.0 / double(frameRate) * 1000000; // in uSecs
+	long SynchDelay = 0;
+	long SynchPulseWidth = PictureTime / 2;
+	long TriggerInDelay = 0;
+
+/*	long minPictureTime, minIlluminationTime, SyncPulseWidth, SyncDelay, TriggerDelay;
+	long Result7 = AlpSeqInquire(nAlpId, nSeqId, ALP_MIN_PICTURE_TIME, &minPictureTime);
+	long Result8 = AlpSeqInquire(nAlpId, nSeqId, ALP_MIN_ILLUMINATE_TIME, &minIlluminationTime);
+	long Result9 = AlpSeqInquire(nAlpId, nSeqId, ALP_SYNCH_DELAY, &SyncDelay);
+	long Result10 = AlpSeqInquire(nAlpId, nSeqId, ALP_SYNCH_PULSEWIDTH, &SyncPulseWidth);
+	long Result11 = AlpSeqInquire(nAlpId, nSeqId, ALP_TRIGGER_IN_DELAY, &TriggerDelay);*/
+	double t0 = telemetry.now();
+	long Result9 = AlpSeqTiming(nAlpId, sequence, IlluminateTime, PictureTime, SynchDelay, SynchPulseWidth, TriggerInDelay);
+	telemetry.record("AlpSeqTiming", t0, Result9, 0, sequence);
+	return Result9 == ALP_OK;
+}
+
+bool ALPwrapper::setSequenceControl(int sequence, long controlType, long value)
+{
+	double t0 = telemetry.now();
+	long Res = AlpSeqControl(nAlpId, sequence, controlType, value);
+	telemetry.record("AlpSeqControl", t0, Res, 0, sequence);
+	return Res == ALP_OK;
+}
+
+bool ALPwrapper::startSequence(int sequence, bool continuous)
+{
+	int StartSuccessfuly;
+	double t0;
+	if (continuous) {
+		if (playingCont)
 		{
+			 // sequence is already playing. Stop it first.
+			stopSequence();
+		}
+		playingCont = true;
+		t0 = telemetry.now();
+		StartSuccessfuly  = AlpProjStartCont(nAlpId, sequence);
+		telemetry.record("AlpProjStartCont", t0, StartSuccessfuly, 0, sequence);
+		if (StartSuccessfuly == ALP_OK)
+			disarmCompletion();
+	}
+	else {
+		double startTime = eventTime();
+		t0 = telemetry.now();
+		StartSuccessfuly = AlpProjStart(nAlpId, sequence);
+		telemetry.record("AlpProjStart", t0, StartSuccessfuly, 0, sequence);
+		playingCont = false;
+		if (StartSuccessfuly == ALP_OK)
+			armCompletion(sequence, startTime);
+	}
+	if (StartSuccessfuly == ALP_OK)
+		telemetry.sequenceStarted(sequence);
+
+	return StartSuccessfuly == ALP_OK;
+}
 
+bool ALPwrapper::runUploadedSequence(int sequence, double frameRate, bool continuous, long numRepeats=1)
+{
+	// Verify that the sequence was actually allocated...
+	if (!isAllocated(sequence))
+		return false;
 
-			long IlluminateTime = 0; // Ignored, we are in uninterrupted binary mode
-			long PictureTime = 1.0 / double(frameRate) * 1000000; // in uSecs
-			long SynchDelay = 0;
-			long SynchPulseWidth = PictureTime / 2;
-			long TriggerInDelay = 0;
+	restoreLinearPlayback(sequence);
+	restoreLegacyQueueMode();
+	if (!continuous)
+	{
+		setSequenceControl(sequence, ALP_SEQ_REPEAT, numRepeats); // only run the calibraiton sequence once
+	}
+	if (!setSequenceTiming(sequence, frameRate))
+		return false;
+
+	return startSequence(sequence, continuous);
+}
+
+void ALPwrapper::queryCapabilities()
+{
+	// Frame look-up table and sequence queue are not available on older firmware/API versions
+	long value;
+	flutMaxEntries9 = 0;
+	if (AlpProjInquire(nAlpId, ALP_FLUT_MAX_ENTRIES9, &value) == ALP_OK)
+		flutMaxEntries9 = MIN(value, 4096);	// tFlutWrite holds up to 4096 entries
+
+	queueMaxAvail = 0;
+	queueModeActive = false;
+	if (AlpProjControl(nAlpId, ALP_PROJ_QUEUE_MODE, ALP_PROJ_SEQUENCE_QUEUE) == ALP_OK)
+	{
+		if (AlpProjInquire(nAlpId, ALP_PROJ_QUEUE_MAX_AVAIL, &value) == ALP_OK)
+			queueMaxAvail = value;
+		AlpProjControl(nAlpId, ALP_PROJ_QUEUE_MODE, ALP_PROJ_LEGACY);
+	}
+}
+
+void ALPwrapper::restoreLegacyQueueMode()
+{
+	// The rest of the wrapper relies on legacy semantics (a new start replaces a waiting sequence).
+	// The queue mode can only be changed when the projection is idle.
+	if (!queueModeActive)
+		return;
+	long state;
+	if (AlpProjInquire(nAlpId, ALP_PROJ_STATE, &state) == ALP_OK && state == ALP_PROJ_IDLE)
+	{
+		double t0 = telemetry.now();
+		long Res = AlpProjControl(nAlpId, ALP_PROJ_QUEUE_MODE, ALP_PROJ_LEGACY);
+		telemetry.record("AlpProjControl", t0, Res);
+		queueModeActive = Res != ALP_OK;
+	}
+}
+
+void ALPwrapper::restoreLinearPlayback(int sequence)
+{
+	std::map<int, long>::iterator it = indexedSequences.find(sequence);
+	if (it == indexedSequences.end())
+		return;
+	if (it->second == INDEXED_FLUT)
+		setSequenceControl(sequence, ALP_FLUT_MODE, ALP_FLUT_NONE);
+	setFrameWindow(sequence, 0, getNumFrames(sequence) - 1);
+	indexedSequences.erase(it);
+}
 
-/*			long minPictureTime, minIlluminationTime, SyncPulseWidth, SyncDelay, TriggerDelay;
-			long Result7 = AlpSeqInquire(nAlpId, nSeqId, ALP_MIN_PICTURE_TIME, &minPictureTime);
-			long Result8 = AlpSeqInquire(nAlpId, nSeqId, ALP_MIN_ILLUMINATE_TIME, &minIlluminationTime);
-			long Result9 = AlpSeqInquire(nAlpId, nSeqId, ALP_SYNCH_DELAY, &SyncDelay);
-			long Result10 = AlpSeqInquire(nAlpId, nSeqId, ALP_SYNCH_PULSEWIDTH, &SyncPulseWidth);
-			long Result11 = AlpSeqInquire(nAlpId, nSeqId, ALP_TRIGGER_IN_DELAY, &TriggerDelay);*/
-			if (!continuous)
+long ALPwrapper::getNumFrames(int sequence)
+{
+	long numFrames = 0;
+	if (AlpSeqInquire(nAlpId, sequence, ALP_PICNUM, &numFrames) != ALP_OK)
+		return 0;
+	return numFrames;
+}
+
+bool ALPwrapper::setFrameWindow(int sequence, long first, long last)
+{
+	// FIRSTFRAME <= LASTFRAME must hold after every call, so go through [0, last]
+	bool ok = setSequenceControl(sequence, ALP_FIRSTFRAME, 0);
+	ok = ok && setSequenceControl(sequence, ALP_LASTFRAME, last);
+	ok = ok && setSequenceControl(sequence, ALP_FIRSTFRAME, first);
+	return ok;
+}
+
+int ALPwrapper::planIndexedPlayback(int sequence, const std::vector<long> &frames, bool continuous, long numRepeats, std::vector<std::pair<long, long> > &runs)
+{
+	runs.clear();
+	long numFrames = getNumFrames(sequence);
+	if (frames.empty() || !isAllocated(sequence) || numFrames == 0)
+		return INDEXED_NONE;
+
+	long maxFrame = 0;
+	for (size_t k = 0; k < frames.size(); k++)
+	{
+		if (frames[k] < 0 || frames[k] >= numFrames)
+			return INDEXED_NONE;
+		maxFrame = MAX(maxFrame, frames[k]);
+		if (k > 0 && frames[k] == frames[k - 1] + 1)
+			runs.back().second = frames[k];
+		else
+			runs.push_back(std::make_pair(frames[k], frames[k]));
+	}
+
+	// 1. a single ascending block: only FIRSTFRAME/LASTFRAME change
+	if (runs.size() == 1)
+		return INDEXED_WINDOW;
+
+	// 2. frame look-up table: 9-bit entries address the first 512 pictures, 18-bit entries take two slots
+	if (maxFrame < 512 && (long)frames.size() <= flutMaxEntries9)
+		return INDEXED_FLUT;
+	if ((long)frames.size() <= flutMaxEntries9 / 2)
+		return INDEXED_FLUT;
+
+	// 3. one queue entry per block (the running one does not take a waiting position)
+	if (!continuous && queueMaxAvail > 0 && (long long)runs.size() * numRepeats <= queueMaxAvail + 1)
+		return INDEXED_QUEUE;
+
+	return INDEXED_NONE;
+}
+
+bool ALPwrapper::runUploadedSequenceIndexed(int sequence, const std::vector<long> &frames, double frameRate, bool continuous, long numRepeats)
+{
+	std::vector<std::pair<long, long> > runs;
+	int mode = planIndexedPlayback(sequence, frames, continuous, numRepeats, runs);
+	if (mode == INDEXED_NONE)
+	{
+		mexPrintf("Cannot play this frame list from device memory (%d frames, %d blocks). Upload the frames in order instead.\n",
+			(int)frames.size(), (int)runs.size());
+		return false;
+	}
+
+	long numFrames = getNumFrames(sequence);
+	if (mode == INDEXED_WINDOW)
+	{
+		restoreLegacyQueueMode();
+		if (indexedSequences.count(sequence) && indexedSequences[sequence] == INDEXED_FLUT)
+			setSequenceControl(sequence, ALP_FLUT_MODE, ALP_FLUT_NONE);
+		if (!setFrameWindow(sequence, runs[0].first, runs[0].second))
+			return false;
+		indexedSequences[sequence] = INDEXED_WINDOW;
+		if (!continuous && !setSequenceControl(sequence, ALP_SEQ_REPEAT, numRepeats))
+			return false;
+		if (!setSequenceTiming(sequence, frameRate))
+			return false;
+		return startSequence(sequence, continuous);
+	}
+
+	if (mode == INDEXED_FLUT)
+	{
+		// The table is shared by all sequences, so it must not change under a running one
+		if (!hasSequenceCompleted())
+		{
+			if (!playingCont)
 			{
-				long Res= AlpSeqControl(nAlpId, sequence, ALP_SEQ_REPEAT, numRepeats); // only run the calibraiton sequence once
+				mexPrintf("Indexed playback: a sequence is still running.\n");
+				return false;
 			}
-			long Result9 = AlpSeqTiming(nAlpId, sequence, IlluminateTime, PictureTime, SynchDelay, SynchPulseWidth, TriggerInDelay);
-			if (Result9 == ALP_OK)
-			{
-				int StartSuccessfuly;
-				if (continuous) {
-					if (playingCont)
-					{
-						 // sequence is already playing. Stop it first.
-						stopSequence();
-					}
-					playingCont = true;
-					StartSuccessfuly  = AlpProjStartCont(nAlpId, *it);
-				}
-				else {
-					StartSuccessfuly = AlpProjStart(nAlpId, *it);
-					playingCont = false;
-				}
+			stopSequence();
+		}
+		restoreLegacyQueueMode();
+
+		static tFlutWrite flut;
+		bool narrow = *std::max_element(frames.begin(), frames.end()) < 512 && (long)frames.size() <= flutMaxEntries9;
+		flut.nOffset = 0;
+		flut.nSize = (long)frames.size();
+		for (size_t k = 0; k < frames.size(); k++)
+			flut.FrameNumbers[k] = (unsigned long)frames[k];
+		double t0 = telemetry.now();
+		long Res = AlpProjControlEx(nAlpId, narrow ? ALP_FLUT_WRITE_9BIT : ALP_FLUT_WRITE_18BIT, &flut);
+		telemetry.record("AlpProjControlEx", t0, Res, (double)frames.size() * (narrow ? 2 : 4), sequence);
+		if (Res != ALP_OK)
+			return false;
+
+		indexedSequences[sequence] = INDEXED_FLUT;
+		bool ok = setFrameWindow(sequence, 0, numFrames - 1);
+		ok = ok && setSequenceControl(sequence, ALP_FLUT_MODE, narrow ? ALP_FLUT_9BIT : ALP_FLUT_18BIT);
+		ok = ok && setSequenceControl(sequence, ALP_FLUT_ENTRIES9, narrow ? (long)frames.size() : 2 * (long)frames.size());
+		ok = ok && setSequenceControl(sequence, ALP_FLUT_OFFSET9, 0);
+		ok = ok && (continuous || setSequenceControl(sequence, ALP_SEQ_REPEAT, numRepeats));
+		ok = ok && setSequenceTiming(sequence, frameRate);
+		return ok && startSequence(sequence, continuous);
+	}
 
-				return StartSuccessfuly == ALP_OK;
-			}
-			else
+	// INDEXED_QUEUE: AlpProjStart takes over the current sequence settings, so the same
+	// sequence can be enqueued once per block with a different frame window.
+	if (!queueModeActive)
+	{
+		if (!hasSequenceCompleted())
+		{
+			mexPrintf("Indexed playback: the projection must be idle to switch to queue mode.\n");
+			return false;
+		}
+		double t0 = telemetry.now();
+		long Res = AlpProjControl(nAlpId, ALP_PROJ_QUEUE_MODE, ALP_PROJ_SEQUENCE_QUEUE);
+		telemetry.record("AlpProjControl", t0, Res);
+		if (Res != ALP_OK)
+			return false;
+		queueModeActive = true;
+	}
+	if (indexedSequences.count(sequence) && indexedSequences[sequence] == INDEXED_FLUT)
+		setSequenceControl(sequence, ALP_FLUT_MODE, ALP_FLUT_NONE);
+	indexedSequences[sequence] = INDEXED_QUEUE;
+	if (!setSequenceControl(sequence, ALP_SEQ_REPEAT, 1) || !setSequenceTiming(sequence, frameRate))
+		return false;
+	double startTime = eventTime();
+	for (long r = 0; r < numRepeats; r++)
+	{
+		for (size_t k = 0; k < runs.size(); k++)
+		{
+			if (!setFrameWindow(sequence, runs[k].first, runs[k].second))
+				return false;
+			double t0 = telemetry.now();
+			long Res = AlpProjStart(nAlpId, sequence);
+			telemetry.record("AlpProjStart", t0, Res, 0, sequence);
+			if (Res != ALP_OK)
 			{
+				mexPrintf("Indexed playback: enqueueing block %d failed (%ld)\n", (int)k, Res);
 				return false;
 			}
+			armCompletion(sequence, startTime);
 		}
 	}
-	return false;
+	playingCont = false;
+	telemetry.sequenceStarted(sequence);
+	return true;
 }
 
 bool ALPwrapper::releaseAllSequences()
@@ -460,17 +1249,23 @@ bool ALPwrapper::releaseAllSequences()
 	bool allSuccessful = true;
 	for (std::list<int>::iterator it = allocatedSequences.begin(); it != allocatedSequences.end(); it++)
 	{
+		double t0 = telemetry.now();
 		int retValue = AlpSeqFree(nAlpId, *it);
+		telemetry.record("AlpSeqFree", t0, retValue, 0, *it);
 		allSuccessful = allSuccessful && retValue == ALP_OK;
 	}
 	allocatedSequences.clear();
+	indexedSequences.clear();
 	return allSuccessful;
 }
 
 bool ALPwrapper::releaseSequence(int sequence)
 {
+	double t0 = telemetry.now();
 	int retValue = AlpSeqFree(nAlpId, sequence);
+	telemetry.record("AlpSeqFree", t0, retValue, 0, sequence);
 	removeAllocatedSequenceFromList(sequence);
+	indexedSequences.erase(sequence);
 	return retValue == ALP_OK;
 }
 
@@ -641,6 +1436,144 @@ void PlaySequence(pALPwrapper alp, int nlhs, mxArray *plhs[], int nrhs, const mx
 
 
 
+bool getFrameIndices(const mxArray *arr, std::vector<long> &frames)
+{
+	// MATLAB (1-based) frame indices into the uploaded sequence
+	if (!mxIsDouble(arr))
+		return false;
+	size_t n = mxGetNumberOfElements(arr);
+	double *p = mxGetPr(arr);
+	frames.resize(n);
+	for (size_t k = 0; k < n; k++)
+		frames[k] = (long)p[k] - 1;
+	return true;
+}
+
+void PlaySequenceIndexed(pALPwrapper alp, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	std::vector<long> frames;
+	if (nrhs != 6 || !getFrameIndices(prhs[3], frames))
+	{
+		mexErrMsgTxt("Use: ALPwrapper('PlayUploadedSequenceIndexed',DevID, SequenceID, FrameIndices (1-based, double), FrameRate(Hz), NumRepeats (0=continuous)'\n");
+		return;
+	}
+
+	int seqID = (int)(*(double *)mxGetData(prhs[2]));
+	double frameRateHz = *(double *)mxGetData(prhs[4]);
+	long numRepeats = (long)(*(double *)mxGetData(prhs[5]));
+	bool retValue = alp->runUploadedSequenceIndexed(seqID, frames, frameRateHz, numRepeats == 0, MAX(numRepeats, 1));
+	plhs[0] = mxCreateDoubleScalar(retValue);
+}
+
+void CanPlayIndexed(pALPwrapper alp, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	std::vector<long> frames;
+	if (nrhs < 4 || !getFrameIndices(prhs[3], frames))
+	{
+		mexErrMsgTxt("Use: [ok, mode] = ALPwrapper('CanPlayIndexed',DevID, SequenceID, FrameIndices (1-based, double) [, NumRepeats (0=continuous)])'\n");
+		return;
+	}
+	int seqID = (int)(*(double *)mxGetData(prhs[2]));
+	long numRepeats = (nrhs >= 5) ? (long)(*(double *)mxGetData(prhs[4])) : 1;
+	std::vector<std::pair<long, long> > runs;
+	int mode = alp->planIndexedPlayback(seqID, frames, numRepeats == 0, MAX(numRepeats, 1), runs);
+	const char *modeNames[] = { "none", "window", "flut", "queue" };
+	plhs[0] = mxCreateLogicalScalar(mode != INDEXED_NONE);
+	if (nlhs > 1)
+		plhs[1] = mxCreateString(modeNames[mode]);
+}
+
+void WaitForCompletion(pALPwrapper alp, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// [done, token] = ALPwrapper('WaitForSequenceCompletion', DevID [, TimeoutSec [, SinceToken]])
+	if (nrhs < 3)
+	{
+		bool done = alp->waitForSequenceCompletion();
+		if (nlhs > 0)
+			plhs[0] = mxCreateLogicalScalar(done);
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar((double)alp->getCompletionToken());
+		return;
+	}
+	double timeoutSec = *(double *)mxGetData(prhs[2]);
+	long long sinceToken = (nrhs >= 4) ? (long long)(*(double *)mxGetData(prhs[3])) : -1;
+	long long token;
+	bool done = alp->waitForCompletion(mxIsInf(timeoutSec) ? -1 : MAX(timeoutSec, 0), sinceToken, token);
+	if (done && sinceToken < 0)
+		alp->telemetry.sequenceEnded("SequenceCompleted");
+	plhs[0] = mxCreateLogicalScalar(done);
+	if (nlhs > 1)
+		plhs[1] = mxCreateDoubleScalar((double)token);
+}
+
+void CompletedSince(pALPwrapper alp, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// [numCompleted, events, now] = ALPwrapper('CompletedSince', DevID, Token)
+	if (nrhs < 3)
+	{
+		mexErrMsgTxt("Use: [numCompleted, events, now] = ALPwrapper('CompletedSince',DevID, Token)'\n");
+		return;
+	}
+	long long sinceToken = (long long)(*(double *)mxGetData(prhs[2]));
+	if (sinceToken < 0)
+	{
+		mexErrMsgTxt("Token must be 0 or a value returned by GetCompletionToken / WaitForCompletion\n");
+		return;
+	}
+	std::vector<CompletionEvent> events;
+	int numCompleted = alp->completedSince(sinceToken, events);
+	plhs[0] = mxCreateDoubleScalar(numCompleted);
+	if (nlhs > 1)
+	{
+		const char *fields[] = { "token", "sequence", "startTime", "endTime", "halted" };
+		plhs[1] = mxCreateStructMatrix(1, (int)events.size(), 5, fields);
+		for (size_t k = 0; k < events.size(); k++)
+		{
+			mxSetField(plhs[1], (int)k, "token", mxCreateDoubleScalar((double)events[k].token));
+			mxSetField(plhs[1], (int)k, "sequence", mxCreateDoubleScalar(events[k].sequence));
+			mxSetField(plhs[1], (int)k, "startTime", mxCreateDoubleScalar(events[k].startTime));
+			mxSetField(plhs[1], (int)k, "endTime", mxCreateDoubleScalar(events[k].endTime));
+			mxSetField(plhs[1], (int)k, "halted", mxCreateLogicalScalar(events[k].halted));
+		}
+	}
+	if (nlhs > 2)
+		plhs[2] = mxCreateDoubleScalar(alp->eventTime());
+}
+
+void MeasureTiming(pALPwrapper alp, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (nrhs < 4)
+	{
+		mexErrMsgTxt("Use: timing = ALPwrapper('MeasureTiming',DevID, NumFrames, FrameRate(Hz, 0 = fastest) [, BitDepth (1..8)])'\n");
+		return;
+	}
+	int numFrames = (int)(*(double *)mxGetData(prhs[2]));
+	double frameRate = *(double *)mxGetData(prhs[3]);
+	int bitDepth = (nrhs >= 5) ? (int)(*(double *)mxGetData(prhs[4])) : 1;
+	if (numFrames < 1 || bitDepth < 1 || bitDepth > 8)
+	{
+		mexErrMsgTxt("MeasureTiming: need NumFrames >= 1 and BitDepth in 1..8\n");
+		return;
+	}
+	TimingMeasurement m;
+	alp->measureTiming(numFrames, bitDepth, frameRate, m);
+
+	const char *fields[] = { "serial", "numFrames", "bitDepth", "minPictureTimeUs", "maxRateHz", "requestedRateHz",
+		"uploadMs", "uploadMBs", "playMs", "measuredRateHz", "completed" };
+	plhs[0] = mxCreateStructMatrix(1, 1, 11, fields);
+	mxSetField(plhs[0], 0, "serial", mxCreateDoubleScalar(alp->getSerial()));
+	mxSetField(plhs[0], 0, "numFrames", mxCreateDoubleScalar(m.numFrames));
+	mxSetField(plhs[0], 0, "bitDepth", mxCreateDoubleScalar(m.bitDepth));
+	mxSetField(plhs[0], 0, "minPictureTimeUs", mxCreateDoubleScalar(m.minPictureTimeUs));
+	mxSetField(plhs[0], 0, "maxRateHz", mxCreateDoubleScalar(m.maxRateHz));
+	mxSetField(plhs[0], 0, "requestedRateHz", mxCreateDoubleScalar(m.requestedRateHz));
+	mxSetField(plhs[0], 0, "uploadMs", mxCreateDoubleScalar(m.uploadMs));
+	mxSetField(plhs[0], 0, "uploadMBs", mxCreateDoubleScalar(m.uploadMBs));
+	mxSetField(plhs[0], 0, "playMs", mxCreateDoubleScalar(m.playMs));
+	mxSetField(plhs[0], 0, "measuredRateHz", mxCreateDoubleScalar(m.measuredRateHz));
+	mxSetField(plhs[0], 0, "completed", mxCreateLogicalScalar(m.completed));
+}
+
 void exitFunction()
 {
 	for (int k = 0; k < NUM_DEVICS; k++)
@@ -756,6 +1689,10 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		int devID = (int)(*(double *)mxGetData(prhs[1]));
 		if (devID < 0 || devID > NUM_DEVICS) mexErrMsgTxt("Invalid device ID.\n");
 		pALPwrapper alp = alps[devID];
+		double mexEntry = alp->telemetry.now();
+		bool isPoll = strcmp(Command, "HasSequenceCompleted") == 0 || strcmp(Command, "CompletedSince") == 0;
+		if (alp->lastMexExit >= 0)
+			alp->telemetry.record("MatlabGap", alp->lastMexExit, ALP_OK, 0, -1, !isPoll);
 
 		if (strcmp(Command, "ClearWhite") == 0) {
 			alp->clear(true);
@@ -770,7 +1707,18 @@ void mexFunction(int nlhs, mxArray *plhs[],
 			alp->stopSequence();
 		}
 		else if (strcmp(Command, "WaitForSequenceCompletion") == 0) {
-			alp->waitForSequenceCompletion();
+			WaitForCompletion(alp, nlhs, plhs, nrhs, prhs);
+		}
+		else if (strcmp(Command, "MeasureTiming") == 0) {
+			MeasureTiming(alp, nlhs, plhs, nrhs, prhs);
+		}
+		else if (strcmp(Command, "GetCompletionToken") == 0) {
+			plhs[0] = mxCreateDoubleScalar((double)alp->getCompletionToken());
+			if (nlhs > 1)
+				plhs[1] = mxCreateDoubleScalar(alp->eventTime());
+		}
+		else if (strcmp(Command, "CompletedSince") == 0) {
+			CompletedSince(alp, nlhs, plhs, nrhs, prhs);
 		}
 		else if (strcmp(Command, "UploadPatternSequence") == 0) {
 			UploadPatternSequence(alp,nlhs, plhs, nrhs, prhs);
@@ -778,6 +1726,12 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		else if (strcmp(Command, "PlayUploadedSequence") == 0) {
 			PlaySequence(alp, nlhs, plhs, nrhs, prhs);
 		}
+		else if (strcmp(Command, "PlayUploadedSequenceIndexed") == 0) {
+			PlaySequenceIndexed(alp, nlhs, plhs, nrhs, prhs);
+		}
+		else if (strcmp(Command, "CanPlayIndexed") == 0) {
+			CanPlayIndexed(alp, nlhs, plhs, nrhs, prhs);
+		}
 		else if (strcmp(Command, "ReleaseSequence") == 0) {
 			ReleaseSequence(alp, nlhs, plhs, nrhs, prhs);
 		}
@@ -788,9 +1742,26 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		{
 			plhs[0] = mxCreateLogicalScalar(alp->hasSequenceCompleted());
 		}
+		else if (strcmp(Command, "GetStats") == 0) {
+			int numEvents = (nrhs >= 3) ? (int)mxGetScalar(prhs[2]) : 64;
+			if (numEvents < 0)
+			{
+				delete Command;
+				mexErrMsgTxt("Use: stats = ALPwrapper('GetStats',DevID [, NumEvents >= 0])'\n");
+			}
+			plhs[0] = alp->telemetry.toMatlab(numEvents);
+		}
+		else if (strcmp(Command, "ResetStats") == 0) {
+			alp->telemetry.reset();
+			alp->lastMexExit = -1;
+			delete Command;
+			return;
+		}
 		else {
 			mexPrintf("Error. Unknown command\n");
 		}
+		alp->telemetry.record((std::string("mex:") + Command).c_str(), mexEntry, ALP_OK, 0, -1, !isPoll);
+		alp->lastMexExit = alp->telemetry.now();
 	}
 	delete Command;
 
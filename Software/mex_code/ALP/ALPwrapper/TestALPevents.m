@@ -0,0 +1,52 @@
+% Exercises the ALPwrapper completion events (watcher thread) instead of
+% polling HasSequenceCompleted. Works with the real device or with ALPsim.
+devID = 0;
+if ~ALPwrapper('IsInitialized',devID)
+    ALPwrapper('Init',devID);
+end
+
+numFrames = 500;
+Seq = rand(768,1024,numFrames) > 0.5;
+seqID=ALPwrapper('UploadPatternSequence',devID,Seq);
+
+% wait with a timeout, keeping MATLAB responsive
+token = ALPwrapper('GetCompletionToken',devID);
+res=ALPwrapper('PlayUploadedSequence',devID,seqID,10000,1);
+numWaits = 0;
+while ~ALPwrapper('WaitForSequenceCompletion',devID,0.01,token)
+    numWaits = numWaits + 1;
+    drawnow;
+end
+[numCompleted, events, now] = ALPwrapper('CompletedSince',devID,token);
+fprintf('%d completion(s), sequence took %.2f ms (expected %.1f ms), noticed %.0f us after it ended, %d timeouts\n', ...
+    numCompleted, (events(end).endTime-events(end).startTime)*1e3, numFrames/10000*1e3, ...
+    (now-events(end).endTime)*1e6, numWaits);
+
+% halted sequences are reported as well
+token = ALPwrapper('GetCompletionToken',devID);
+res=ALPwrapper('PlayUploadedSequence',devID,seqID,1000,1);
+WaitSecs(0.05);
+ALPwrapper('StopSequence',devID);
+[numCompleted, events] = ALPwrapper('CompletedSince',devID,token);
+fprintf('After StopSequence: %d completion(s), halted = %d\n', numCompleted, events(end).halted);
+
+% tokens taken between completions count only what completed after them
+tokens = zeros(1,4);
+for k=1:4
+    tokens(k) = ALPwrapper('GetCompletionToken',devID);
+    res=ALPwrapper('PlayUploadedSequence',devID,seqID,10000,1);
+    ALPwrapper('WaitForSequenceCompletion',devID,1,tokens(k));
+end
+for k=1:4
+    [numCompleted, events] = ALPwrapper('CompletedSince',devID,tokens(k));
+    assert(numCompleted == 5-k && numel(events) == 5-k, 'CompletedSince(token %d): %d completions, expected %d', tokens(k), numCompleted, 5-k);
+end
+fprintf('CompletedSince is consistent for non-zero tokens\n');
+try
+    ALPwrapper('CompletedSince',devID,-1);
+    error('CompletedSince accepted a negative token');
+catch err
+    assert(isempty(strfind(err.message,'accepted a negative token')), err.message);
+end
+
+ALPwrapper('ReleaseSequence',devID,seqID);
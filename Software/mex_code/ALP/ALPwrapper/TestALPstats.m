@@ -0,0 +1,29 @@
+% Exercises the ALPwrapper telemetry. Works with the real device or with the
+% ALPsim drop-in alpV42.dll (MEX\ALPsim on the PATH ahead of the ViALUX folder).
+devID = 0;
+if ~ALPwrapper('IsInitialized',devID)
+    ALPwrapper('Init',devID);
+end
+ALPwrapper('ResetStats',devID);
+
+numFrames = 500;
+Seq = rand(768,1024,numFrames) > 0.5;
+seqID=ALPwrapper('UploadPatternSequence',devID,Seq);
+res=ALPwrapper('PlayUploadedSequence',devID,seqID,10000,1);
+while ~ALPwrapper('HasSequenceCompleted',devID)
+end
+ALPwrapper('ReleaseSequence',devID,seqID);
+
+stats = ALPwrapper('GetStats',devID,20);
+fprintf('Upload: %.1f MB/s, sequence took %.1f ms (expected %.1f ms), %d polls\n', ...
+    stats.uploadMBs, stats.lastSequenceDurationMs, numFrames/10000*1e3, stats.pollsLastSequence);
+for k=1:length(stats.commands)
+    fprintf('%-28s %7d calls, mean %9.1f us, max %9.1f us, %d errors\n', stats.commands(k).name, ...
+        stats.commands(k).count, stats.commands(k).meanUs, stats.commands(k).maxUs, stats.commands(k).errors);
+end
+H = cat(1,stats.commands.histogram);
+figure;
+bar(log2(stats.histogramEdgesUs(2:end-1)), H(:,2:end)', 'stacked');
+xlabel('log2(duration [us])');
+legend({stats.commands.name},'interpreter','none');
+struct2table(stats.events)
@@ -0,0 +1,3407 @@
+/*
+Camera Acquisition Core
+Programmed by Shay Ohayon
+DiCarlo Lab @ MIT
+
+Revision History
+Version 0.1 10/18/2026
+
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <limits>
+#include <new>
+#include <emmintrin.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "CameraCore.h"
+#ifdef ALP_SIMULATOR
+#include "alpsim.h"
+#endif
+
+
+#ifdef _WIN32
+static bool enableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool ok = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return ok;
+}
+#endif
+
+FramePool::FramePool() : slab(nullptr), slabBytes(0), slotBytes(0), capacity(0), localWritePos(0), localReadPos(0),
+	writePos(&localWritePos), readPos(&localReadPos), info(nullptr), largePages(false), sharedHeader(nullptr), sharedBytes(0)
+{
+#ifdef _WIN32
+	sharedFileHandle = INVALID_HANDLE_VALUE;
+	sharedMapping = NULL;
+#endif
+	resetStats();
+}
+
+// Creates (or truncates) the file and maps all of it shared, read / write.
+bool FramePool::mapSharedFile(const char *fileName, size_t totalBytes)
+{
+#ifdef _WIN32
+	// other processes may open, write (readPosition) and delete the file while it is mapped
+	sharedFileHandle = CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+	if (sharedFileHandle == INVALID_HANDLE_VALUE)
+	{
+		mexPrintf("Cannot create %s (error %d)\n", fileName, (int)GetLastError());
+		return false;
+	}
+	sharedMapping = CreateFileMappingA(sharedFileHandle, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)totalBytes >> 32), (DWORD)(totalBytes & 0xFFFFFFFF), NULL);
+	void *view = (sharedMapping != NULL) ? MapViewOfFile(sharedMapping, FILE_MAP_ALL_ACCESS, 0, 0, totalBytes) : nullptr;
+	if (view == nullptr)
+	{
+		mexPrintf("Cannot map %s (error %d)\n", fileName, (int)GetLastError());
+		return false;
+	}
+#else
+	int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		mexPrintf("Cannot create %s (%s)\n", fileName, strerror(errno));
+		return false;
+	}
+	void *view = nullptr;
+	if (ftruncate(fd, (off_t)totalBytes) == 0)
+	{
+		view = mmap(NULL, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+		if (view == MAP_FAILED)
+			view = nullptr;
+	}
+	if (view == nullptr)
+		mexPrintf("Cannot map %s (%s)\n", fileName, strerror(errno));
+	close(fd);	// the mapping keeps the file open
+	if (view == nullptr)
+	{
+		unlink(fileName);
+		return false;
+	}
+#endif
+	sharedHeader = (SharedPoolHeader*)view;
+	sharedBytes = totalBytes;
+	return true;
+}
+
+// allocate / release must not run concurrently with the frame callback or a reader
+bool FramePool::allocate(size_t frameBytes, size_t numSlots, const char *fileName)
+{
+	release();
+	slotBytes = (frameBytes + FRAME_SLOT_ALIGNMENT - 1) / FRAME_SLOT_ALIGNMENT * FRAME_SLOT_ALIGNMENT;
+	slabBytes = slotBytes * numSlots;
+
+	if (fileName != nullptr && fileName[0] != 0)
+	{
+		// header page, info table, slots. No large pages: those cannot back a file mapping.
+		size_t infoBytes = (numSlots * sizeof(FrameSlotInfo) + FRAME_SLOT_ALIGNMENT - 1) / FRAME_SLOT_ALIGNMENT * FRAME_SLOT_ALIGNMENT;
+		size_t infoOffset = FRAME_SLOT_ALIGNMENT;
+		size_t slotOffset = infoOffset + infoBytes;
+		sharedFile = fileName;
+		if (!mapSharedFile(fileName, slotOffset + slabBytes))
+		{
+			release();
+			return false;
+		}
+		unsigned char *base = (unsigned char*)sharedHeader;
+		memset(base, 0, slotOffset);
+		SharedPoolHeader *h = new (base) SharedPoolHeader();
+		h->version = 1;
+		h->headerBytes = (int)FRAME_SLOT_ALIGNMENT;
+		h->infoOffset = (long long)infoOffset;
+		h->slotOffset = (long long)slotOffset;
+		h->slotBytes = (long long)slotBytes;
+		h->capacity = (long long)numSlots;
+		writePos = new (&h->writePosition) std::atomic<unsigned long long>(0);
+		readPos = new (&h->readPosition) std::atomic<unsigned long long>(0);
+		info = (FrameSlotInfo*)(base + infoOffset);
+		slab = base + slotOffset;
+		// the magic goes in last, a reader polling the file sees a complete header
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(h->magic, "FSCAMSHM", 8);
+	}
+	else
+	{
+#ifdef _WIN32
+		size_t largePage = GetLargePageMinimum();
+		if (largePage > 0 && enableLockMemoryPrivilege())
+		{
+			size_t rounded = (slabBytes + largePage - 1) / largePage * largePage;
+			slab = (unsigned char*)VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			largePages = slab != nullptr;
+		}
+		if (slab == nullptr)
+			slab = (unsigned char*)VirtualAlloc(NULL, slabBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void *mapped = mmap(NULL, slabBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		slab = (mapped == MAP_FAILED) ? nullptr : (unsigned char*)mapped;
+#endif
+		if (slab == nullptr)
+			return false;
+		localInfo.assign(numSlots, FrameSlotInfo());
+		info = localInfo.data();
+	}
+
+	capacity = numSlots;
+	writePos->store(0);
+	readPos->store(0);
+	resetStats();
+	return true;
+}
+
+void FramePool::release()
+{
+	if (sharedHeader != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(sharedHeader);
+#else
+		munmap(sharedHeader, sharedBytes);
+#endif
+	}
+	else if (slab != nullptr)
+	{
+#ifdef _WIN32
+		VirtualFree(slab, 0, MEM_RELEASE);
+#else
+		munmap(slab, slabBytes);
+#endif
+	}
+#ifdef _WIN32
+	if (sharedMapping != NULL)
+		CloseHandle(sharedMapping);
+	if (sharedFileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(sharedFileHandle);
+	sharedMapping = NULL;
+	sharedFileHandle = INVALID_HANDLE_VALUE;
+#endif
+	if (!sharedFile.empty())
+	{
+		// readers that still have it open keep their view, the name goes away
+#ifdef _WIN32
+		DeleteFileA(sharedFile.c_str());
+#else
+		unlink(sharedFile.c_str());
+#endif
+	}
+	sharedFile.clear();
+	sharedHeader = nullptr;
+	sharedBytes = 0;
+	slab = nullptr;
+	capacity = 0;
+	largePages = false;
+	writePos = &localWritePos;
+	readPos = &localReadPos;
+	writePos->store(0);
+	readPos->store(0);
+	localInfo.clear();
+	info = nullptr;
+}
+
+unsigned char* FramePool::claim()
+{
+	unsigned long long w = writePos->load(std::memory_order_relaxed);
+	if (capacity == 0 || w - readPos->load(std::memory_order_acquire) >= capacity)
+	{
+		overflowDropped++;
+		return nullptr;
+	}
+	return atPosition(w);
+}
+
+void FramePool::commit(const FrameSlotInfo &slotInfo)
+{
+	unsigned long long w = writePos->load(std::memory_order_relaxed);
+	info[(size_t)(w % capacity)] = slotInfo;
+	// publishes the slot contents and its info to the reader
+	writePos->store(w + 1, std::memory_order_release);
+	framesStored++;
+	size_t n = (size_t)(w + 1 - readPos->load(std::memory_order_relaxed));
+	if (n > highWatermark.load(std::memory_order_relaxed))
+		highWatermark.store(n, std::memory_order_relaxed);
+}
+
+size_t FramePool::claimRead(size_t maxFrames)
+{
+	// frames [0, n) stay valid until releaseRead, the producer only writes past them
+	size_t available = size();
+	return MIN(available, maxFrames);
+}
+
+void FramePool::releaseRead(size_t n)
+{
+	if (n == 0)
+		return;
+	// the slots go back to the producer only after the reader is done with them
+	releaseTo(readPos->load(std::memory_order_relaxed) + n);
+}
+
+void FramePool::releaseTo(unsigned long long position)
+{
+	// A shared ring's read position is also written by the external consumer: it only
+	// ever moves forward, so a release that lost the race to a later one is dropped.
+	unsigned long long r = readPos->load(std::memory_order_relaxed);
+	while (r < position && !readPos->compare_exchange_weak(r, position, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+
+
+// Row-major 16 bit frame -> column-major (MATLAB) frame, every pixel shifted right
+// by 'shift'. 8x8 blocks are transposed in registers with the SSE2 unpack network.
+// The frame is walked in 8 pixel wide vertical strips, top to bottom: the 8 output
+// columns of a strip are written sequentially and the input lines a strip touches
+// are still in L2 for the next three strips.
+
+static inline void transposeBlock8x8(const unsigned short *in, int inStride, unsigned short *out, int outStride, __m128i shift)
+{
+	__m128i a0 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 0 * inStride)), shift);
+	__m128i a1 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 1 * inStride)), shift);
+	__m128i a2 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 2 * inStride)), shift);
+	__m128i a3 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 3 * inStride)), shift);
+	__m128i a4 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 4 * inStride)), shift);
+	__m128i a5 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 5 * inStride)), shift);
+	__m128i a6 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 6 * inStride)), shift);
+	__m128i a7 = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + 7 * inStride)), shift);
+
+	__m128i b0 = _mm_unpacklo_epi16(a0, a1), b1 = _mm_unpackhi_epi16(a0, a1);
+	__m128i b2 = _mm_unpacklo_epi16(a2, a3), b3 = _mm_unpackhi_epi16(a2, a3);
+	__m128i b4 = _mm_unpacklo_epi16(a4, a5), b5 = _mm_unpackhi_epi16(a4, a5);
+	__m128i b6 = _mm_unpacklo_epi16(a6, a7), b7 = _mm_unpackhi_epi16(a6, a7);
+
+	__m128i c0 = _mm_unpacklo_epi32(b0, b2), c1 = _mm_unpackhi_epi32(b0, b2);
+	__m128i c2 = _mm_unpacklo_epi32(b1, b3), c3 = _mm_unpackhi_epi32(b1, b3);
+	__m128i c4 = _mm_unpacklo_epi32(b4, b6), c5 = _mm_unpackhi_epi32(b4, b6);
+	__m128i c6 = _mm_unpacklo_epi32(b5, b7), c7 = _mm_unpackhi_epi32(b5, b7);
+
+	_mm_storeu_si128((__m128i*)(out + 0 * outStride), _mm_unpacklo_epi64(c0, c4));
+	_mm_storeu_si128((__m128i*)(out + 1 * outStride), _mm_unpackhi_epi64(c0, c4));
+	_mm_storeu_si128((__m128i*)(out + 2 * outStride), _mm_unpacklo_epi64(c1, c5));
+	_mm_storeu_si128((__m128i*)(out + 3 * outStride), _mm_unpackhi_epi64(c1, c5));
+	_mm_storeu_si128((__m128i*)(out + 4 * outStride), _mm_unpacklo_epi64(c2, c6));
+	_mm_storeu_si128((__m128i*)(out + 5 * outStride), _mm_unpackhi_epi64(c2, c6));
+	_mm_storeu_si128((__m128i*)(out + 6 * outStride), _mm_unpacklo_epi64(c3, c7));
+	_mm_storeu_si128((__m128i*)(out + 7 * outStride), _mm_unpackhi_epi64(c3, c7));
+}
+
+void transposeShift16(const unsigned short *in, unsigned short *out, int width, int height, int shift)
+{
+	__m128i shiftCount = _mm_cvtsi32_si128(shift);
+	int width8 = width & ~7, height8 = height & ~7;
+	for (int x = 0; x < width8; x += 8)
+		for (int y = 0; y < height8; y += 8)
+			transposeBlock8x8(in + (size_t)y * width + x, width, out + (size_t)x * height + y, height, shiftCount);
+	// ragged right columns and bottom rows
+	for (int y = 0; y < height; y++)
+		for (int x = (y < height8) ? width8 : 0; x < width; x++)
+			out[(size_t)x * height + y] = in[(size_t)y * width + x] >> shift;
+}
+
+void transpose8(const unsigned char *in, unsigned char *out, int width, int height)
+{
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			out[(size_t)x * height + y] = in[(size_t)y * width + x];
+}
+
+static void exportFrameRun(FramePool &pool, size_t first, size_t k0, size_t k1, unsigned short *out, int width, int height, int shift, int packedBits)
+{
+	size_t framePixels = (size_t)width * height;
+	std::vector<unsigned short> unpacked(packedBits > 0 ? framePixels : 0);
+	for (size_t k = k0; k < k1; k++)
+	{
+		if (packedBits > 0)
+		{
+			unpackSamples(pool.at(first + k), framePixels, packedBits, unpacked.data());
+			transposeShift16(unpacked.data(), out + k * framePixels, width, height, 0);
+		}
+		else
+			transposeShift16((const unsigned short*)pool.at(first + k), out + k * framePixels, width, height, shift);
+	}
+}
+
+// Frames are independent, so each core takes a contiguous run of them.
+void exportFrames16(FramePool &pool, size_t first, size_t numFrames, unsigned short *out, int width, int height, int shift, int packedBits)
+{
+	size_t numThreads = MIN((size_t)std::thread::hardware_concurrency(), numFrames);
+	if (numThreads <= 1)
+	{
+		exportFrameRun(pool, first, 0, numFrames, out, width, height, shift, packedBits);
+		return;
+	}
+	size_t framesPerThread = (numFrames + numThreads - 1) / numThreads;
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < numThreads; t++)
+	{
+		size_t k0 = t * framesPerThread;
+		size_t k1 = MIN(k0 + framesPerThread, numFrames);
+		workers.push_back(std::thread([=, &pool]()
+		{
+			exportFrameRun(pool, first, k0, k1, out, width, height, shift, packedBits);
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+// 12 and 10 bit have unrolled paths; any other depth, and the tail, go through the
+// generic bit stream. The groups end on byte boundaries, so both paths share one stream.
+// The 12 bit path moves 4 samples per 8 byte (little-endian) store; the 2 bytes past the
+// group are overwritten by the next one, and it stops while 4 more samples remain.
+void packSamples(const unsigned short *in, size_t numSamples, int shift, int bits, unsigned char *out)
+{
+	size_t k = 0;
+	if (bits == 12)
+	{
+		for (; k + 8 <= numSamples; k += 4, out += 6)
+		{
+			unsigned long long group = (unsigned long long)((in[k] >> shift) & 0xFFF) | (unsigned long long)((in[k + 1] >> shift) & 0xFFF) << 12 |
+				(unsigned long long)((in[k + 2] >> shift) & 0xFFF) << 24 | (unsigned long long)((in[k + 3] >> shift) & 0xFFF) << 36;
+			memcpy(out, &group, 8);
+		}
+		for (; k + 2 <= numSamples; k += 2, out += 3)
+		{
+			unsigned int a = (in[k] >> shift) & 0xFFF, b = (in[k + 1] >> shift) & 0xFFF;
+			out[0] = (unsigned char)a;
+			out[1] = (unsigned char)((a >> 8) | (b << 4));
+			out[2] = (unsigned char)(b >> 4);
+		}
+	}
+	else if (bits == 10)
+	{
+		for (; k + 4 <= numSamples; k += 4, out += 5)
+		{
+			unsigned long long group = 0;
+			for (int j = 0; j < 4; j++)
+				group |= (unsigned long long)((in[k + j] >> shift) & 0x3FF) << (10 * j);
+			for (int j = 0; j < 5; j++)
+				out[j] = (unsigned char)(group >> (8 * j));
+		}
+	}
+	unsigned int mask = (1u << bits) - 1;
+	unsigned long long stream = 0;
+	int numBits = 0;
+	for (; k < numSamples; k++)
+	{
+		stream |= (unsigned long long)((in[k] >> shift) & mask) << numBits;
+		for (numBits += bits; numBits >= 8; numBits -= 8, stream >>= 8)
+			*out++ = (unsigned char)stream;
+	}
+	if (numBits > 0)
+		*out = (unsigned char)stream;
+}
+
+void unpackSamples(const unsigned char *in, size_t numSamples, int bits, unsigned short *out)
+{
+	size_t k = 0;
+	if (bits == 12)
+	{
+		for (; k + 8 <= numSamples; k += 4, in += 6)
+		{
+			unsigned long long group;
+			memcpy(&group, in, 8);
+			out[k] = (unsigned short)(group & 0xFFF);
+			out[k + 1] = (unsigned short)((group >> 12) & 0xFFF);
+			out[k + 2] = (unsigned short)((group >> 24) & 0xFFF);
+			out[k + 3] = (unsigned short)((group >> 36) & 0xFFF);
+		}
+		for (; k + 2 <= numSamples; k += 2, in += 3)
+		{
+			out[k] = (unsigned short)(in[0] | ((in[1] & 0x0F) << 8));
+			out[k + 1] = (unsigned short)((in[1] >> 4) | (in[2] << 4));
+		}
+	}
+	else if (bits == 10)
+	{
+		for (; k + 4 <= numSamples; k += 4, in += 5)
+		{
+			unsigned long long group = 0;
+			for (int j = 0; j < 5; j++)
+				group |= (unsigned long long)in[j] << (8 * j);
+			for (int j = 0; j < 4; j++)
+				out[k + j] = (unsigned short)((group >> (10 * j)) & 0x3FF);
+		}
+	}
+	unsigned int mask = (1u << bits) - 1;
+	unsigned long long stream = 0;
+	int numBits = 0;
+	for (; k < numSamples; k++)
+	{
+		for (; numBits < bits; numBits += 8)
+			stream |= (unsigned long long)(*in++) << numBits;
+		out[k] = (unsigned short)(stream & mask);
+		stream >>= bits;
+		numBits -= bits;
+	}
+}
+
+// The residuals and the width of a block (the OR of its codes has the same top bit as
+// their max) are SSE2; a block is packed two codes at a time into 32 bit stores, the
+// same stream packSamples writes. Decoding unpacks with unpackSamples, then undoes the
+// zigzag and runs the prefix sum along a row 8 samples at a time, the carry being the
+// last sample decoded.
+static inline unsigned short zigzag16(unsigned short residual)
+{
+	return (unsigned short)((residual << 1) ^ (0 - (residual >> 15)));
+}
+
+static inline void packBlock(const unsigned short *codes, int bits, unsigned char *out)
+{
+	unsigned long long stream = 0;
+	int numBits = 0;
+	for (size_t k = 0; k < CODEC_BLOCK; k += 2)
+	{
+		stream |= ((unsigned long long)codes[k] | (unsigned long long)codes[k + 1] << bits) << numBits;
+		numBits += 2 * bits;
+		if (numBits >= 32)
+		{
+			unsigned int word = (unsigned int)stream;
+			memcpy(out, &word, 4);
+			out += 4;
+			stream >>= 32;
+			numBits -= 32;
+		}
+	}
+	for (; numBits > 0; numBits -= 8, stream >>= 8)
+		*out++ = (unsigned char)stream;
+}
+
+size_t compressFrame16(const unsigned short *in, int width, int height, int shift, unsigned char *out, std::vector<unsigned short> &scratch)
+{
+	size_t numSamples = (size_t)width * height;
+	size_t numBlocks = (numSamples + CODEC_BLOCK - 1) / CODEC_BLOCK;
+	scratch.resize(numBlocks * CODEC_BLOCK);
+	unsigned short *codes = scratch.data();
+	__m128i shiftCount = _mm_cvtsi32_si128(shift);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned short *row = in + (size_t)y * width;
+		unsigned short *code = codes + (size_t)y * width;
+		unsigned short above = (y > 0) ? (row[-width] >> shift) : 0;
+		code[0] = zigzag16((unsigned short)((row[0] >> shift) - above));
+		int x = 1;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i current = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(row + x)), shiftCount);
+			__m128i left = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(row + x - 1)), shiftCount);
+			__m128i residual = _mm_sub_epi16(current, left);
+			_mm_storeu_si128((__m128i*)(code + x), _mm_xor_si128(_mm_slli_epi16(residual, 1), _mm_srai_epi16(residual, 15)));
+		}
+		for (; x < width; x++)
+			code[x] = zigzag16((unsigned short)((row[x] >> shift) - (row[x - 1] >> shift)));
+	}
+	for (size_t k = numSamples; k < scratch.size(); k++)
+		codes[k] = 0;
+
+	unsigned char *block = out + numBlocks;
+	for (size_t b = 0; b < numBlocks; b++)
+	{
+		const unsigned short *blockCodes = codes + b * CODEC_BLOCK;
+		__m128i any = _mm_or_si128(_mm_loadu_si128((const __m128i*)blockCodes), _mm_loadu_si128((const __m128i*)(blockCodes + 8)));
+		any = _mm_or_si128(any, _mm_srli_si128(any, 8));
+		any = _mm_or_si128(any, _mm_srli_si128(any, 4));
+		any = _mm_or_si128(any, _mm_srli_si128(any, 2));
+		unsigned int topBits = (unsigned int)_mm_extract_epi16(any, 0);
+		int bits = 0;
+		while (topBits >> bits)
+			bits++;
+		out[b] = (unsigned char)bits;
+		packBlock(blockCodes, bits, block);
+		block += 2 * bits;
+	}
+	return block - out;
+}
+
+bool decompressFrame16(const unsigned char *in, size_t inBytes, int width, int height, unsigned short *out)
+{
+	size_t numSamples = (size_t)width * height;
+	size_t numBlocks = (numSamples + CODEC_BLOCK - 1) / CODEC_BLOCK;
+	if (inBytes < numBlocks)
+		return false;
+	const unsigned char *block = in + numBlocks, *end = in + inBytes;
+	unsigned short lastBlock[CODEC_BLOCK];
+	for (size_t b = 0; b < numBlocks; b++)
+	{
+		int bits = in[b];
+		if (bits > 16 || block + 2 * bits > end)
+			return false;
+		size_t first = b * CODEC_BLOCK;
+		bool whole = first + CODEC_BLOCK <= numSamples;
+		unpackSamples(block, CODEC_BLOCK, bits, whole ? out + first : lastBlock);
+		if (!whole)
+			memcpy(out + first, lastBlock, (numSamples - first) * sizeof(unsigned short));
+		block += 2 * bits;
+	}
+
+	const __m128i one = _mm_set1_epi16(1), zero = _mm_setzero_si128();
+	for (int y = 0; y < height; y++)
+	{
+		unsigned short *row = out + (size_t)y * width;
+		unsigned short carry = (y > 0) ? row[-width] : 0;
+		int x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i code = _mm_loadu_si128((const __m128i*)(row + x));
+			__m128i v = _mm_xor_si128(_mm_srli_epi16(code, 1), _mm_sub_epi16(zero, _mm_and_si128(code, one)));
+			v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+			v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+			v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+			v = _mm_add_epi16(v, _mm_set1_epi16((short)carry));
+			_mm_storeu_si128((__m128i*)(row + x), v);
+			carry = (unsigned short)_mm_extract_epi16(v, 7);
+		}
+		for (; x < width; x++)
+		{
+			carry = (unsigned short)(carry + ((row[x] >> 1) ^ (0 - (row[x] & 1))));
+			row[x] = carry;
+		}
+	}
+	return true;
+}
+
+
+
+// Max and number of samples >= satRaw along one row. SSE2 only has signed 16 bit
+// compares, so both run on values with the sign bit flipped.
+static inline void rowStats16(const unsigned short *row, int n, unsigned short satRaw, unsigned short &maxRaw, unsigned int &numSaturated)
+{
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	const __m128i threshold = _mm_set1_epi16((short)((satRaw - 1) ^ 0x8000));
+	__m128i vmax = bias;
+	__m128i count = _mm_setzero_si128();	// 16 bit lanes, one row never has 8 * 65535 pixels
+	int k = 0;
+	for (; k + 8 <= n; k += 8)
+	{
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row + k)), bias);
+		vmax = _mm_max_epi16(vmax, v);
+		count = _mm_sub_epi16(count, _mm_cmpgt_epi16(v, threshold));
+	}
+	unsigned short lanes[8], counts[8];
+	_mm_storeu_si128((__m128i*)lanes, _mm_xor_si128(vmax, bias));
+	_mm_storeu_si128((__m128i*)counts, count);
+	for (int j = 0; j < 8; j++)
+	{
+		maxRaw = MAX(maxRaw, lanes[j]);
+		numSaturated += counts[j];
+	}
+	for (; k < n; k++)
+	{
+		maxRaw = MAX(maxRaw, row[k]);
+		numSaturated += row[k] >= satRaw;
+	}
+}
+
+void regionStats16(const unsigned short *in, int stride, int width, int height, unsigned short satRaw, unsigned short &maxRaw, unsigned int &numSaturated)
+{
+	maxRaw = 0;
+	numSaturated = 0;
+	for (int y = 0; y < height; y++)
+		rowStats16(in + (size_t)y * stride, width, satRaw, maxRaw, numSaturated);
+}
+
+// One pass over the ROI rows: each row is measured and then cropped while it is in L1.
+void cropFrame16(const unsigned short *in, int inWidth, const CaptureROI &roi, unsigned short *out, std::vector<unsigned int> &binRow,
+	unsigned short satRaw, unsigned short &maxRaw, unsigned int &numSaturated)
+{
+	int step = roi.step, outWidth = roi.outWidth();
+	unsigned int binArea = step * step;
+	maxRaw = 0;
+	numSaturated = 0;
+	if (roi.binning)
+		binRow.assign(outWidth, 0);
+	for (int y = 0; y < roi.height; y++)
+	{
+		const unsigned short *row = in + (size_t)(roi.y0 + y) * inWidth + roi.x0;
+		rowStats16(row, roi.width, satRaw, maxRaw, numSaturated);
+		if (step == 1)
+			memcpy(out + (size_t)y * outWidth, row, outWidth * sizeof(unsigned short));
+		else if (!roi.binning)
+		{
+			if (y % step != 0)
+				continue;
+			unsigned short *outRow = out + (size_t)(y / step) * outWidth;
+			for (int x = 0; x < outWidth; x++)
+				outRow[x] = row[x * step];
+		}
+		else if (y / step < roi.outHeight())
+		{
+			for (int x = 0; x < outWidth; x++)
+			{
+				unsigned int sum = 0;
+				for (int j = 0; j < step; j++)
+					sum += row[x * step + j];
+				binRow[x] += sum;
+			}
+			if (y % step == step - 1)
+			{
+				unsigned short *outRow = out + (size_t)(y / step) * outWidth;
+				for (int x = 0; x < outWidth; x++)
+				{
+					outRow[x] = (unsigned short)((binRow[x] + binArea / 2) / binArea);
+					binRow[x] = 0;
+				}
+			}
+		}
+	}
+}
+
+
+
+bool FrameAccumulator::allocate(size_t _numPixels, size_t _numPlanes, bool _withSquares)
+{
+	numPixels = _numPixels;
+	numPlanes = _numPlanes;
+	withSquares = _withSquares;
+	try
+	{
+		sums.assign(numPixels * numPlanes, 0);
+		if (withSquares)
+			squares.assign(numPixels * numPlanes, 0);
+		else
+			std::vector<unsigned long long>().swap(squares);
+		counts.assign(numPlanes, 0);
+	}
+	catch (std::bad_alloc&)
+	{
+		std::vector<unsigned int>().swap(sums);
+		std::vector<unsigned long long>().swap(squares);
+		numPlanes = 0;
+		return false;
+	}
+	return true;
+}
+
+void FrameAccumulator::add(size_t plane, const unsigned short *frame)
+{
+	unsigned int *sum = &sums[plane * numPixels];
+	const __m128i zero = _mm_setzero_si128();
+	size_t k = 0;
+	if (withSquares)
+	{
+		unsigned long long *sq = &squares[plane * numPixels];
+		for (; k + 8 <= numPixels; k += 8)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(frame + k));
+			_mm_storeu_si128((__m128i*)(sum + k), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sum + k)), _mm_unpacklo_epi16(v, zero)));
+			_mm_storeu_si128((__m128i*)(sum + k + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sum + k + 4)), _mm_unpackhi_epi16(v, zero)));
+			// 16x16 -> 32 bit squares, widened to 64 bit
+			__m128i lo = _mm_mullo_epi16(v, v), hi = _mm_mulhi_epu16(v, v);
+			__m128i p0 = _mm_unpacklo_epi16(lo, hi), p1 = _mm_unpackhi_epi16(lo, hi);
+			_mm_storeu_si128((__m128i*)(sq + k), _mm_add_epi64(_mm_loadu_si128((const __m128i*)(sq + k)), _mm_unpacklo_epi32(p0, zero)));
+			_mm_storeu_si128((__m128i*)(sq + k + 2), _mm_add_epi64(_mm_loadu_si128((const __m128i*)(sq + k + 2)), _mm_unpackhi_epi32(p0, zero)));
+			_mm_storeu_si128((__m128i*)(sq + k + 4), _mm_add_epi64(_mm_loadu_si128((const __m128i*)(sq + k + 4)), _mm_unpacklo_epi32(p1, zero)));
+			_mm_storeu_si128((__m128i*)(sq + k + 6), _mm_add_epi64(_mm_loadu_si128((const __m128i*)(sq + k + 6)), _mm_unpackhi_epi32(p1, zero)));
+		}
+		for (; k < numPixels; k++)
+		{
+			sum[k] += frame[k];
+			sq[k] += (unsigned int)frame[k] * frame[k];
+		}
+	}
+	else
+	{
+		for (; k + 8 <= numPixels; k += 8)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(frame + k));
+			_mm_storeu_si128((__m128i*)(sum + k), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sum + k)), _mm_unpacklo_epi16(v, zero)));
+			_mm_storeu_si128((__m128i*)(sum + k + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sum + k + 4)), _mm_unpackhi_epi16(v, zero)));
+		}
+		for (; k < numPixels; k++)
+			sum[k] += frame[k];
+	}
+	counts[plane]++;
+}
+
+void FrameAccumulator::mean(size_t plane, unsigned short *out, int exportShift)
+{
+	// rounded at the precision the frame is exported with (out >> exportShift)
+	const unsigned int *sum = &sums[plane * numPixels];
+	unsigned long long n = MAX(counts[plane], 1u);
+	unsigned long long half = (n << exportShift) / 2;
+	for (size_t k = 0; k < numPixels; k++)
+		out[k] = (unsigned short)((sum[k] + half) / n);
+}
+
+void FrameAccumulator::variance(size_t plane, float *out, int width, int height, int exportShift)
+{
+	// unbiased per-pixel variance in exported gray levels, column-major for MATLAB
+	const unsigned int *sum = &sums[plane * numPixels];
+	const unsigned long long *sq = &squares[plane * numPixels];
+	unsigned long long n = counts[plane];
+	double scale = (n > 1) ? 1.0 / ((double)n * (n - 1) * (1 << (2 * exportShift))) : 0;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			size_t k = (size_t)y * width + x;
+			unsigned long long s = sum[k];
+			out[(size_t)x * height + y] = (float)((double)(n * sq[k] - s * s) * scale);
+		}
+	}
+}
+
+
+
+bool PhaseAccumulator::allocate(size_t _numPixels, size_t _numPlanes)
+{
+	numPixels = _numPixels;
+	numPlanes = _numPlanes;
+	try
+	{
+		re.assign(numPixels * numPlanes, 0);
+		im.assign(numPixels * numPlanes, 0);
+		counts.assign(numPlanes, 0);
+	}
+	catch (std::bad_alloc&)
+	{
+		release();
+		return false;
+	}
+	return true;
+}
+
+void PhaseAccumulator::release()
+{
+	std::vector<int>().swap(re);
+	std::vector<int>().swap(im);
+	std::vector<unsigned int>().swap(counts);
+	numPlanes = 0;
+}
+
+void PhaseAccumulator::add(size_t plane, const unsigned short *I0, const unsigned short *Ipi_2, const unsigned short *Ipi)
+{
+	// raw samples, the common scale does not change the phase. |difference| < 2^16, so
+	// the int32 sums hold 32768 repetitions.
+	int *pRe = &re[plane * numPixels];
+	int *pIm = &im[plane * numPixels];
+	const __m128i zero = _mm_setzero_si128();
+	size_t k = 0;
+	for (; k + 8 <= numPixels; k += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(I0 + k));
+		__m128i b = _mm_loadu_si128((const __m128i*)(Ipi_2 + k));
+		__m128i c = _mm_loadu_si128((const __m128i*)(Ipi + k));
+		__m128i aLo = _mm_unpacklo_epi16(a, zero), aHi = _mm_unpackhi_epi16(a, zero);
+		__m128i bLo = _mm_unpacklo_epi16(b, zero), bHi = _mm_unpackhi_epi16(b, zero);
+		__m128i cLo = _mm_unpacklo_epi16(c, zero), cHi = _mm_unpackhi_epi16(c, zero);
+		_mm_storeu_si128((__m128i*)(pRe + k), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pRe + k)), _mm_sub_epi32(aLo, bLo)));
+		_mm_storeu_si128((__m128i*)(pRe + k + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pRe + k + 4)), _mm_sub_epi32(aHi, bHi)));
+		_mm_storeu_si128((__m128i*)(pIm + k), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pIm + k)), _mm_sub_epi32(bLo, cLo)));
+		_mm_storeu_si128((__m128i*)(pIm + k + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pIm + k + 4)), _mm_sub_epi32(bHi, cHi)));
+	}
+	for (; k < numPixels; k++)
+	{
+		pRe[k] += (int)I0[k] - (int)Ipi_2[k];
+		pIm[k] += (int)Ipi_2[k] - (int)Ipi[k];
+	}
+	counts[plane]++;
+}
+
+void PhaseAccumulator::phase(size_t plane, float *out)
+{
+	const int *pRe = &re[plane * numPixels];
+	const int *pIm = &im[plane * numPixels];
+	for (size_t k = 0; k < numPixels; k++)
+		out[k] = atan2f((float)pIm[k], (float)pRe[k]);
+}
+
+
+bool HdrAccumulator::allocate(size_t _numPixels, size_t _numPlanes, const std::vector<float> &_dark, float _lowCut, float _highCut)
+{
+	numPixels = _numPixels;
+	numPlanes = _numPlanes;
+	scale = 1;
+	lowCut = _lowCut;
+	highCut = _highCut;
+	try
+	{
+		if (_dark.empty())
+			dark.assign(numPixels, 0);
+		else
+			dark = _dark;
+		sums.assign(numPixels * numPlanes, 0);
+		weights.assign(numPixels * numPlanes, 0);
+		counts.assign(numPlanes, 0);
+	}
+	catch (std::bad_alloc&)
+	{
+		release();
+		return false;
+	}
+	return true;
+}
+
+void HdrAccumulator::release()
+{
+	std::vector<float>().swap(dark);
+	std::vector<float>().swap(sums);
+	std::vector<float>().swap(weights);
+	std::vector<unsigned int>().swap(counts);
+	numPlanes = 0;
+}
+
+void HdrAccumulator::add(size_t plane, const unsigned short *frame)
+{
+	// sum += hat * signal, weight += hat / scale, so sum / weight is the radiance
+	float *sum = &sums[plane * numPixels];
+	float *weight = &weights[plane * numPixels];
+	const float *d = dark.data();
+	float invScale = 1.0f / scale;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 vZero = _mm_setzero_ps(), vLow = _mm_set1_ps(lowCut), vHigh = _mm_set1_ps(highCut), vInvScale = _mm_set1_ps(invScale);
+	size_t k = 0;
+	for (; k + 8 <= numPixels; k += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(frame + k));
+		__m128 samples[2] = { _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)) };
+		for (int half = 0; half < 2; half++)
+		{
+			size_t j = k + 4 * half;
+			__m128 signal = _mm_sub_ps(samples[half], _mm_loadu_ps(d + j));
+			__m128 hat = _mm_max_ps(vZero, _mm_min_ps(_mm_sub_ps(signal, vLow), _mm_sub_ps(vHigh, samples[half])));
+			_mm_storeu_ps(sum + j, _mm_add_ps(_mm_loadu_ps(sum + j), _mm_mul_ps(hat, signal)));
+			_mm_storeu_ps(weight + j, _mm_add_ps(_mm_loadu_ps(weight + j), _mm_mul_ps(hat, vInvScale)));
+		}
+	}
+	for (; k < numPixels; k++)
+	{
+		float signal = frame[k] - d[k];
+		float hat = MAX(0.0f, (MIN(signal - lowCut, highCut - frame[k])));
+		sum[k] += hat * signal;
+		weight[k] += hat * invScale;
+	}
+	counts[plane]++;
+}
+
+void HdrAccumulator::radiance(size_t plane, float *out, int width, int height, float unit)
+{
+	const float *sum = &sums[plane * numPixels];
+	const float *weight = &weights[plane * numPixels];
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			size_t k = (size_t)y * width + x;
+			out[(size_t)x * height + y] = (weight[k] > 0) ? sum[k] / weight[k] * unit : nan;
+		}
+	}
+}
+
+
+
+static double steadyClockSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const size_t RECORDING_HEADER_BYTES = 4096;
+const size_t RECORDING_MIN_WRITE = 8 << 20;		// bytes, unless the ring has been idle for a while
+const size_t RECORDING_MAX_WRITE = 64 << 20;
+const unsigned long long RECORDING_RESERVE_STEP = 1ULL << 30;
+
+FrameRecorder::FrameRecorder() : pool(nullptr), indexFile(nullptr), unbuffered(false), headerBlock(nullptr), maxFrames(0), reservedBytes(0),
+	sampleShift(0), samplePackedBits(0), compressed(false), staging(nullptr), stagingCapacity(0), stagedBytes(0), stagingOffset(0),
+	startHostTime(0), stopHostTime(0), previewValid(false), lastPreviewTime(0)
+{
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+#else
+	file = -1;
+#endif
+	running = false;
+	stopRequested = false;
+	failed = false;
+	stopPosition = 0;
+	framesWritten = 0;
+	bytesWritten = 0;
+	headerStorage.assign(2 * RECORDING_HEADER_BYTES, 0);
+	size_t misalignment = (size_t)headerStorage.data() % RECORDING_HEADER_BYTES;
+	headerBlock = headerStorage.data() + (misalignment ? RECORDING_HEADER_BYTES - misalignment : 0);
+}
+
+bool FrameRecorder::openFile(const char *name)
+{
+	// unbuffered first, the writes bypass the page cache and keep full disk bandwidth
+#ifdef _WIN32
+	file = CreateFileA(name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	unbuffered = file != INVALID_HANDLE_VALUE;
+	if (!unbuffered)
+		file = CreateFileA(name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	return file != INVALID_HANDLE_VALUE;
+#else
+	file = -1;
+#ifdef O_DIRECT
+	file = ::open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+	unbuffered = file >= 0;
+	if (!unbuffered)
+		file = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	return file >= 0;
+#endif
+}
+
+void FrameRecorder::closeFile(unsigned long long finalBytes)
+{
+	// space reserved ahead of the last frame is given back
+#ifdef _WIN32
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER size;
+		size.QuadPart = (LONGLONG)finalBytes;
+		if (SetFilePointerEx(file, size, NULL, FILE_BEGIN))
+			SetEndOfFile(file);
+		CloseHandle(file);
+	}
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (file >= 0)
+	{
+		if (ftruncate(file, (off_t)finalBytes) != 0)
+			mexPrintf("Warning: could not trim the recording file.\n");
+		::close(file);
+	}
+	file = -1;
+#endif
+}
+
+bool FrameRecorder::reserve(unsigned long long bytes)
+{
+	// allocate ahead so the file system does not extend the file on every write.
+	// A failure only costs speed.
+	if (bytes <= reservedBytes)
+		return true;
+	bool ok = false;
+#ifdef _WIN32
+	FILE_ALLOCATION_INFO allocation;
+	allocation.AllocationSize.QuadPart = (LONGLONG)bytes;
+	ok = SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation)) != 0;
+#elif defined(__linux__)
+	ok = fallocate(file, FALLOC_FL_KEEP_SIZE, 0, (off_t)bytes) == 0;
+#endif
+	reservedBytes = bytes;
+	return ok;
+}
+
+bool FrameRecorder::writeAt(const void *data, size_t bytes, unsigned long long offset)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	while (bytes > 0)
+	{
+#ifdef _WIN32
+		DWORD chunk = (DWORD)(MIN(bytes, (size_t)1 << 30)), written = 0;
+		OVERLAPPED position;
+		memset(&position, 0, sizeof(position));
+		position.Offset = (DWORD)offset;
+		position.OffsetHigh = (DWORD)(offset >> 32);
+		if (!WriteFile(file, p, chunk, &written, &position) || written == 0)
+			return false;
+#else
+		ssize_t written = pwrite(file, p, bytes, (off_t)offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+#endif
+		p += written;
+		bytes -= written;
+		offset += written;
+	}
+	return true;
+}
+
+bool FrameRecorder::open(const char *_fileName, int width, int height, int bytesPerPixel, int exportShift, int packedBits, size_t slotBytes, unsigned long long _maxFrames, bool _compressed)
+{
+	if (running)
+		return false;
+	pool = nullptr;
+	fileName = _fileName;
+	maxFrames = _maxFrames;
+	reservedBytes = 0;
+	framesWritten = 0;
+	bytesWritten = 0;
+	failed = false;
+	stopRequested = false;
+	stopPosition = 0;
+	setError("");
+	{
+		std::lock_guard<std::mutex> lock(previewMutex);
+		previewFrame.assign(packedBits > 0 ? packedFrameBytes((size_t)width * height, packedBits) : (size_t)width * height * bytesPerPixel, 0);
+		previewValid = false;
+		lastPreviewTime = 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "FSCAMREC", 8);
+	header.version = 2;
+	header.headerBytes = (int)RECORDING_HEADER_BYTES;
+	header.width = width;
+	header.height = height;
+	header.bytesPerPixel = bytesPerPixel;
+	// packed samples are exported gray levels already
+	sampleShift = (packedBits > 0) ? 0 : exportShift;
+	samplePackedBits = packedBits;
+	header.exportShift = sampleShift;
+	header.packedBits = packedBits;
+	header.slotBytes = (long long)slotBytes;
+	compressed = _compressed;
+	if (compressed)
+	{
+		// gray levels of any depth, the reader needs neither the shift nor the packing
+		header.version = 3;
+		header.codec = 1;
+		header.exportShift = 0;
+		header.packedBits = 0;
+		header.slotBytes = 0;
+		// room for the largest batch writeBatch takes, plus the partial 4K block left over
+		size_t maxBatch = MAX(RECORDING_MAX_WRITE / slotBytes, (size_t)1);
+		size_t capacity = RECORDING_HEADER_BYTES + maxBatch * compressedFrameBound((size_t)width * height);
+		capacity = (capacity + RECORDING_HEADER_BYTES - 1) / RECORDING_HEADER_BYTES * RECORDING_HEADER_BYTES;
+		if (stagingCapacity != capacity)
+		{
+			std::vector<unsigned char>().swap(stagingStorage);
+			try
+			{
+				stagingStorage.resize(capacity + RECORDING_HEADER_BYTES);
+			}
+			catch (std::bad_alloc&)
+			{
+				mexPrintf("Cannot allocate the compression buffer.\n");
+				stagingCapacity = 0;
+				return false;
+			}
+			size_t misalignment = (size_t)stagingStorage.data() % RECORDING_HEADER_BYTES;
+			staging = stagingStorage.data() + (misalignment ? RECORDING_HEADER_BYTES - misalignment : 0);
+			stagingCapacity = capacity;
+		}
+		stagedBytes = 0;
+		stagingOffset = RECORDING_HEADER_BYTES;
+	}
+
+	if (!openFile(_fileName))
+	{
+		mexPrintf("Cannot create %s\n", _fileName);
+		return false;
+	}
+	std::string indexName = fileName + ".idx";
+	indexFile = fopen(indexName.c_str(), "wb");
+	if (indexFile == nullptr)
+	{
+		mexPrintf("Cannot create %s\n", indexName.c_str());
+		closeFile(0);
+		return false;
+	}
+	// records are tiny, let the C runtime batch them
+	setvbuf(indexFile, nullptr, _IOFBF, 1 << 20);
+	const char indexMagic[8] = { 'F', 'S', 'C', 'A', 'M', 'I', 'D', 'X' };
+	int indexFormat[2] = { 2, 24 };		// version, bytes per record
+	if (compressed)
+	{
+		indexFormat[0] = 3;		// + file offset of the frame
+		indexFormat[1] = 32;
+	}
+	fwrite(indexMagic, 1, 8, indexFile);
+	fwrite(indexFormat, sizeof(int), 2, indexFile);
+
+	// a valid header from the start, numFrames = 0 means "take it from the file size"
+	memset(headerBlock, 0, RECORDING_HEADER_BYTES);
+	memcpy(headerBlock, &header, sizeof(header));
+	if (!writeAt(headerBlock, RECORDING_HEADER_BYTES, 0))
+	{
+		mexPrintf("Error writing to %s\n", _fileName);
+		fclose(indexFile);
+		indexFile = nullptr;
+		closeFile(0);
+		return false;
+	}
+	reserve((maxFrames > 0 && !compressed) ? RECORDING_HEADER_BYTES + maxFrames * header.slotBytes : RECORDING_RESERVE_STEP);
+
+	// from here on the core treats the ring as taken
+	running = true;
+	return true;
+}
+
+void FrameRecorder::begin(FramePool *_pool)
+{
+	pool = _pool;
+	startHostTime = steadyClockSeconds();
+	worker = std::thread(&FrameRecorder::run, this);
+	mexPrintf("Recording to %s (%s)\n", fileName.c_str(), unbuffered ? "unbuffered" : "buffered");
+}
+
+void FrameRecorder::setError(const char *message)
+{
+	std::lock_guard<std::mutex> lock(errorMutex);
+	lastError = message;
+}
+
+std::string FrameRecorder::getError()
+{
+	std::lock_guard<std::mutex> lock(errorMutex);
+	return lastError;
+}
+
+size_t FrameRecorder::writeBatch(size_t numFrames)
+{
+	// one write straight from the ring slots, up to the wrap of the slab
+	size_t slotBytes = pool->getSlotBytes();
+	size_t count = pool->contiguous(MIN(numFrames, MAX(RECORDING_MAX_WRITE / slotBytes, (size_t)1)));
+	if (maxFrames > 0)
+		count = (size_t)(MIN((unsigned long long)count, maxFrames - framesWritten));
+	size_t bytes = count * slotBytes;
+	if (compressed)
+	{
+		unsigned long long dataEnd = stagingOffset + stagedBytes;
+		if (!compressBatch(count))
+		{
+			setError("write failed (disk full?)");
+			return 0;
+		}
+		bytes = (size_t)(stagingOffset + stagedBytes - dataEnd);
+	}
+	else
+	{
+		unsigned long long offset = RECORDING_HEADER_BYTES + framesWritten * slotBytes;
+		if (maxFrames == 0 && offset + bytes > reservedBytes)
+			reserve(offset + (MAX((unsigned long long)bytes, RECORDING_RESERVE_STEP)));
+		if (!writeAt(pool->at(0), bytes, offset))
+		{
+			setError("write failed (disk full?)");
+			return 0;
+		}
+	}
+
+	for (size_t k = 0; k < count; k++)
+	{
+		const FrameSlotInfo &slotInfo = pool->infoAt(k);
+		if (framesWritten == 0 && k == 0)
+			header.startTime = slotInfo.hostTime;
+		int counters[2] = { slotInfo.frameCounter, slotInfo.driverFrame };
+		fwrite(counters, sizeof(int), 2, indexFile);
+		double times[2] = { slotInfo.hostTime, slotInfo.deviceTime };
+		fwrite(times, sizeof(double), 2, indexFile);
+		if (compressed)
+			fwrite(&frameOffsets[k], sizeof(unsigned long long), 1, indexFile);
+	}
+	// the index on disk never lags the frames by more than a batch
+	fflush(indexFile);
+
+	double now = steadyClockSeconds();
+	if (now - lastPreviewTime > 1.0 / 30)
+	{
+		std::lock_guard<std::mutex> lock(previewMutex);
+		memcpy(previewFrame.data(), pool->at(count - 1), previewFrame.size());
+		previewInfo = pool->infoAt(count - 1);
+		previewValid = true;
+		lastPreviewTime = now;
+	}
+
+	pool->releaseRead(count);
+	framesWritten += count;
+	bytesWritten += bytes;
+	return count;
+}
+
+// Frames are independent: each thread compresses a run of them to the worst case
+// spacing, then they are moved up against each other in order.
+bool FrameRecorder::compressBatch(size_t numFrames)
+{
+	int width = header.width, height = header.height, bytesPerPixel = header.bytesPerPixel, packedBits = samplePackedBits;
+	size_t numSamples = (size_t)width * height, bound = compressedFrameBound(numSamples);
+	frameOffsets.resize(numFrames);
+	std::vector<size_t> frameBytes(numFrames);
+	unsigned char *area = staging + stagedBytes;
+	// half the cores, the frame callback and MATLAB keep the rest
+	unsigned int halfCores = std::thread::hardware_concurrency() / 2;
+	size_t numThreads = MIN((size_t)(MAX(halfCores, 1u)), numFrames);
+	size_t framesPerThread = (numFrames + numThreads - 1) / numThreads;
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < numThreads; t++)
+	{
+		size_t k0 = t * framesPerThread;
+		size_t k1 = MIN(k0 + framesPerThread, numFrames);
+		workers.push_back(std::thread([=, &frameBytes]()
+		{
+			std::vector<unsigned short> levels, scratch;
+			for (size_t k = k0; k < k1; k++)
+			{
+				const unsigned char *slot = pool->at(k);
+				const unsigned short *frame = (const unsigned short*)slot;
+				if (packedBits > 0 || bytesPerPixel == 1)
+				{
+					levels.resize(numSamples);
+					if (packedBits > 0)
+						unpackSamples(slot, numSamples, packedBits, levels.data());
+					else
+						for (size_t j = 0; j < numSamples; j++)
+							levels[j] = slot[j];
+					frame = levels.data();
+				}
+				frameBytes[k] = compressFrame16(frame, width, height, sampleShift, area + k * bound, scratch);
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	for (size_t k = 0; k < numFrames; k++)
+	{
+		frameOffsets[k] = stagingOffset + stagedBytes;
+		memmove(staging + stagedBytes, area + k * bound, frameBytes[k]);
+		stagedBytes += frameBytes[k];
+	}
+	return flushStaging();
+}
+
+// Writes everything staged, the last partial 4K block zero padded (unbuffered files take
+// whole blocks only). That block stays staged and is written again with the next frames,
+// so the file always holds every frame in the index.
+bool FrameRecorder::flushStaging()
+{
+	size_t bytes = (stagedBytes + RECORDING_HEADER_BYTES - 1) / RECORDING_HEADER_BYTES * RECORDING_HEADER_BYTES;
+	if (bytes == 0)
+		return true;
+	memset(staging + stagedBytes, 0, bytes - stagedBytes);
+	if (stagingOffset + bytes > reservedBytes)
+		reserve(stagingOffset + (MAX((unsigned long long)bytes, RECORDING_RESERVE_STEP)));
+	if (!writeAt(staging, bytes, stagingOffset))
+		return false;
+	size_t partial = stagedBytes % RECORDING_HEADER_BYTES, whole = stagedBytes - partial;
+	memmove(staging, staging + whole, partial);
+	stagingOffset += whole;
+	stagedBytes = partial;
+	return true;
+}
+
+void FrameRecorder::run()
+{
+	double lastWrite = steadyClockSeconds();
+	size_t slotBytes = pool->getSlotBytes();
+	while (true)
+	{
+		// Frames published before the stop request are all written, later ones stay in
+		// the ring. A camera that keeps streaming never leaves the ring empty, so the
+		// drain is bounded by the write position taken at the request.
+		bool stopping = stopRequested;
+		if (maxFrames > 0 && framesWritten >= maxFrames)
+			break;
+		size_t numFrames = pool->claimRead(pool->getCapacity());
+		if (stopping)
+		{
+			unsigned long long readPos = pool->readPosition();
+			unsigned long long remaining = (stopPosition > readPos) ? stopPosition - readPos : 0;
+			numFrames = (size_t)(MIN((unsigned long long)numFrames, remaining));
+			if (numFrames == 0)
+				break;
+		}
+		double now = steadyClockSeconds();
+		if (numFrames == 0 || (!stopping && numFrames * slotBytes < RECORDING_MIN_WRITE && now - lastWrite < 0.05))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+		if (writeBatch(numFrames) == 0)
+		{
+			// stop taking frames, whatever arrives from now on stays in the ring
+			failed = true;
+			break;
+		}
+		lastWrite = now;
+	}
+}
+
+unsigned long long FrameRecorder::stop()
+{
+	if (!running)
+		return framesWritten;
+	stopPosition = (pool != nullptr) ? pool->writePosition() : 0;
+	stopRequested = true;
+	if (worker.joinable())
+		worker.join();
+	stopHostTime = steadyClockSeconds();
+
+	header.numFrames = (long long)framesWritten;
+	memset(headerBlock, 0, RECORDING_HEADER_BYTES);
+	memcpy(headerBlock, &header, sizeof(header));
+	if (!writeAt(headerBlock, RECORDING_HEADER_BYTES, 0))
+		mexPrintf("Error updating the recording header.\n");
+	fclose(indexFile);
+	indexFile = nullptr;
+	closeFile(compressed ? stagingOffset + stagedBytes : RECORDING_HEADER_BYTES + framesWritten * header.slotBytes);
+	running = false;
+	{
+		std::lock_guard<std::mutex> lock(previewMutex);
+		previewValid = false;
+	}
+	if (failed)
+		mexPrintf("Recording stopped early: %s\n", getError().c_str());
+	return framesWritten;
+}
+
+bool FrameRecorder::getPreview(std::vector<unsigned char> &frame, FrameSlotInfo &slotInfo)
+{
+	std::lock_guard<std::mutex> lock(previewMutex);
+	if (!previewValid)
+		return false;
+	frame = previewFrame;
+	slotInfo = previewInfo;
+	return true;
+}
+
+mxArray* FrameRecorder::getStatus()
+{
+	const char *fields[] = { "recording", "fileName", "unbuffered", "framesWritten", "bytesWritten", "MBps", "backlog", "failed", "error", "compressionRatio" };
+	mxArray *out = mxCreateStructMatrix(1, 1, 10, fields);
+	double elapsed = (running ? steadyClockSeconds() : stopHostTime) - startHostTime;
+	mxSetField(out, 0, "recording", mxCreateLogicalScalar(running && !failed));
+	mxSetField(out, 0, "fileName", mxCreateString(fileName.c_str()));
+	mxSetField(out, 0, "unbuffered", mxCreateLogicalScalar(unbuffered));
+	mxSetField(out, 0, "framesWritten", mxCreateDoubleScalar((double)framesWritten));
+	mxSetField(out, 0, "bytesWritten", mxCreateDoubleScalar((double)bytesWritten));
+	mxSetField(out, 0, "MBps", mxCreateDoubleScalar(elapsed > 0 ? (double)bytesWritten / elapsed / 1e6 : 0));
+	// frames waiting in the ring, the recorder keeps up while this stays small
+	mxSetField(out, 0, "backlog", mxCreateDoubleScalar((running && pool != nullptr) ? (double)pool->size() : 0));
+	mxSetField(out, 0, "failed", mxCreateLogicalScalar(failed));
+	mxSetField(out, 0, "error", mxCreateString(getError().c_str()));
+	// frame bytes as the camera delivers them over bytes in the file
+	double frameBytes = (double)header.width * header.height * header.bytesPerPixel;
+	mxSetField(out, 0, "compressionRatio", mxCreateDoubleScalar(bytesWritten > 0 ? frameBytes * (double)framesWritten / (double)bytesWritten : 0));
+	return out;
+}
+
+
+void AcquisitionHealth::reset()
+{
+	framesReceived = bufferFull = driverSkip = truncated = lateCallbacks = counterResets = 0;
+	lastDriverFrame = -1;
+	lastDeviceTime = lastHostTime = -1;
+	maxCallbackLag = maxCallbackDuration = 0;
+	gaps.clear();
+}
+
+void AcquisitionHealth::frameArrived(int frameCounter, int driverFrame, double deviceTime, double hostTime)
+{
+	framesReceived++;
+	bool counterReset = false;
+	if (driverFrame >= 0 && lastDriverFrame >= 0)
+	{
+		long long expected = (long long)lastDriverFrame + 1;
+		if (driverFrame > expected)
+		{
+			driverSkip += (unsigned long long)(driverFrame - expected);
+			if (gaps.size() < MAX_GAP_EVENTS)
+			{
+				FrameGap gap = { frameCounter, (int)expected, driverFrame, hostTime };
+				gaps.push_back(gap);
+			}
+		}
+		else if (driverFrame < expected)
+		{
+			// the camera restarted its counter (exposure change, capture restart), nothing lost
+			counterReset = true;
+			counterResets++;
+		}
+	}
+	// the device clock may wrap or restart, only forward steps are compared
+	if (!counterReset && deviceTime >= 0 && lastDeviceTime >= 0 && deviceTime >= lastDeviceTime)
+	{
+		double lag = (hostTime - lastHostTime) - (deviceTime - lastDeviceTime);
+		maxCallbackLag = MAX(maxCallbackLag, lag);
+		if (lag > LATE_CALLBACK_SEC)
+			lateCallbacks++;
+	}
+	lastDriverFrame = driverFrame;
+	lastDeviceTime = deviceTime;
+	lastHostTime = hostTime;
+}
+
+
+
+void LivePreview::configure(int _frameWidth, int _frameHeight, int _bitDepth)
+{
+	frameWidth = _frameWidth;
+	frameHeight = _frameHeight;
+	bitDepth = _bitDepth;
+	setStep(step);
+}
+
+bool LivePreview::setStep(int _step)
+{
+	if (_step != 1 && _step != 2 && _step != 4)
+	{
+		mexPrintf("Preview decimation must be 1, 2 or 4.\n");
+		return false;
+	}
+	step = _step;
+	work.assign((size_t)outWidth() * outHeight(), 0);
+	workHistogram.assign(PREVIEW_HISTOGRAM_BINS, 0);
+	lastUpdate = -1;
+	std::lock_guard<std::mutex> lock(previewMutex);
+	valid = false;
+	return true;
+}
+
+void LivePreview::update(const unsigned char *frame, int bytesPerPixel, int shift, const FrameSlotInfo &slotInfo, double now)
+{
+	lastUpdate = now;
+	int w = outWidth(), h = outHeight();
+	int binShift = MAX(bitDepth - 8, 0);
+	workHistogram.assign(PREVIEW_HISTOGRAM_BINS, 0);
+	unsigned short minGray = 65535;
+	unsigned long long sum = 0;
+	// written column-major, the MATLAB layout, so get() is a plain copy
+	for (int y = 0; y < h; y++)
+	{
+		size_t row = (size_t)y * step * frameWidth;
+		for (int x = 0; x < w; x++)
+		{
+			size_t k = row + (size_t)x * step;
+			unsigned short gray = (bytesPerPixel == 2) ? (unsigned short)(((const unsigned short*)frame)[k] >> shift) : frame[k];
+			work[(size_t)x * h + y] = gray;
+			workHistogram[MIN(gray >> binShift, PREVIEW_HISTOGRAM_BINS - 1)]++;
+			minGray = MIN(minGray, gray);
+			sum += gray;
+		}
+	}
+	std::lock_guard<std::mutex> lock(previewMutex);
+	image.swap(work);
+	histogram.swap(workHistogram);
+	work.resize(image.size());
+	workHistogram.resize(PREVIEW_HISTOGRAM_BINS);
+	info = slotInfo;
+	minValue = minGray;
+	meanValue = image.empty() ? 0 : (double)sum / image.size();
+	updates++;
+	valid = true;
+}
+
+mxArray* LivePreview::get()
+{
+	const char *fields[] = { "image", "step", "frameCounter", "hostTime", "min", "max", "mean", "numSaturated", "histogram", "binWidth", "updates" };
+	mxArray *out = mxCreateStructMatrix(1, 1, 11, fields);
+	std::lock_guard<std::mutex> lock(previewMutex);
+	int w = valid ? outWidth() : 0, h = valid ? outHeight() : 0;
+	mxArray *imageArray = mxCreateNumericMatrix(h, w, mxUINT16_CLASS, mxREAL);
+	mxArray *histogramArray = mxCreateDoubleMatrix(valid ? PREVIEW_HISTOGRAM_BINS : 0, valid ? 1 : 0, mxREAL);
+	if (valid)
+	{
+		memcpy(mxGetData(imageArray), image.data(), image.size() * sizeof(unsigned short));
+		double *bins = mxGetPr(histogramArray);
+		for (int k = 0; k < PREVIEW_HISTOGRAM_BINS; k++)
+			bins[k] = histogram[k];
+	}
+	mxSetField(out, 0, "image", imageArray);
+	mxSetField(out, 0, "step", mxCreateDoubleScalar(step));
+	mxSetField(out, 0, "frameCounter", mxCreateDoubleScalar(valid ? info.frameCounter : -1));
+	mxSetField(out, 0, "hostTime", mxCreateDoubleScalar(valid ? info.hostTime : -1));
+	mxSetField(out, 0, "min", mxCreateDoubleScalar(valid ? minValue : 0));
+	mxSetField(out, 0, "max", mxCreateDoubleScalar(valid ? info.maxValue : 0));
+	mxSetField(out, 0, "mean", mxCreateDoubleScalar(valid ? meanValue : 0));
+	mxSetField(out, 0, "numSaturated", mxCreateDoubleScalar(valid ? info.numSaturated : 0));
+	mxSetField(out, 0, "histogram", histogramArray);
+	mxSetField(out, 0, "binWidth", mxCreateDoubleScalar(1 << MAX(bitDepth - 8, 0)));
+	mxSetField(out, 0, "updates", mxCreateDoubleScalar((double)updates));
+	return out;
+}
+
+
+CameraCore::CameraCore(ICameraBackend *_backend) : backend(_backend), initialized(false), streaming(false), sensorWidth(0), sensorHeight(0), width(0), height(0), bytesPerPixel(2), exportShift(0), bitDepth(12), packedBits(0)
+{
+	saturationLevel = 4094;
+	triggerEnabled = true;
+	resyncHealth = false;
+	numTrig = 0;
+	requestedPoolFrames = 0;
+	averagingMode = false;
+	reconstructionMode = false;
+	reconstructionBlock = false;
+	averagingBlockSize = 1;
+	phaseWidth = phaseHeight = 0;
+	hdrMode = hdrBlock = false;
+	hdrWidth = hdrHeight = 0;
+}
+
+CameraCore::~CameraCore()
+{
+	release();
+	delete backend;
+}
+
+bool CameraCore::init(const CameraConfig &config)
+{
+	if (initialized)
+		return true;
+
+	if (!backend->open(config, this))
+	{
+		backend->close();
+		return false;
+	}
+	sensorWidth = width = backend->getWidth();
+	sensorHeight = height = backend->getHeight();
+	bytesPerPixel = backend->getBytesPerPixel();
+	exportShift = backend->getExportShift();
+	// the same margin below full scale the calibration used to test (4094 for 12 bit)
+	bitDepth = backend->getBitDepth();
+	saturationLevel = (1 << bitDepth) - 2;
+	captureROI = CaptureROI();
+	captureROI.width = sensorWidth;
+	captureROI.height = sensorHeight;
+
+	// before the backend starts delivering frames
+	health.reset();
+	if (!allocateFramePool())
+	{
+		backend->close();
+		return false;
+	}
+
+	if (!backend->start())
+	{
+		backend->stop();
+		backend->close();
+		framePool.release();
+		return false;
+	}
+	streaming = true;
+	initialized = true;
+	mexPrintf("Camera initialized and in capture mode\n");
+	return true;
+}
+
+void CameraCore::release()
+{
+	if (streaming)
+	{
+		triggerEnabled = false;
+		mexPrintf("Stopping capture...");
+		backend->stop();
+		streaming = false;
+		mexPrintf("OK!\n");
+	}
+	if (initialized)
+	{
+		// flushes whatever the camera delivered before it stopped
+		recorder.stop();
+		backend->close();
+		framePool.release();
+		initialized = false;
+	}
+}
+
+double CameraCore::hostTime()
+{
+	return steadyClockSeconds();
+}
+
+bool CameraCore::allocateFramePool()
+{
+	// At most 15GB, and no more than half of the physical memory that is free right now.
+	// The slab is committed here, once; the frame callback never allocates.
+	size_t frameBytes = storedFrameBytes();
+	size_t numFrames = requestedPoolFrames;
+	if (numFrames == 0)
+	{
+		double budget = 15e9;
+#ifdef _WIN32
+		MEMORYSTATUSEX memStatus;
+		memStatus.dwLength = sizeof(memStatus);
+		if (GlobalMemoryStatusEx(&memStatus))
+			budget = MIN(budget, 0.5 * (double)memStatus.ullAvailPhys);
+#else
+		long pages = sysconf(_SC_AVPHYS_PAGES), pageSize = sysconf(_SC_PAGESIZE);
+		if (pages > 0 && pageSize > 0)
+			budget = MIN(budget, 0.5 * (double)pages * pageSize);
+#endif
+		numFrames = (size_t)(budget / frameBytes);
+	}
+	numFrames = MAX(numFrames, (size_t)16);
+	// halve until the commit succeeds
+	const char *sharedFile = sharedExportFile.empty() ? nullptr : sharedExportFile.c_str();
+	while (!framePool.allocate(frameBytes, numFrames, sharedFile))
+	{
+		if (numFrames <= 16 || sharedFile != nullptr)
+		{
+			mexPrintf("Error allocating the frame buffer.\n");
+			return false;
+		}
+		numFrames /= 2;
+	}
+	SharedPoolHeader *header = framePool.getSharedHeader();
+	if (header != nullptr)
+	{
+		header->width = width;
+		header->height = height;
+		header->bytesPerPixel = bytesPerPixel;
+		header->exportShift = exportShift;
+		header->packedBits = packedBits;
+		mexPrintf("Frame buffer shared in %s\n", sharedExportFile.c_str());
+	}
+	cropScratch.resize((size_t)width * height);
+	preview.configure(width, height, bitDepth);
+	mexPrintf("Frame buffer: %d images of %dx%d (%.2f GB%s).\n", (int)framePool.getCapacity(), width, height,
+		(double)framePool.getCapacity() * framePool.getSlotBytes() / 1e9, framePool.usesLargePages() ? ", large pages" : "");
+	return true;
+}
+
+size_t CameraCore::storedFrameBytes()
+{
+	if (packedBits > 0)
+		return packedFrameBytes((size_t)width * height, packedBits);
+	return (size_t)width * height * bytesPerPixel;
+}
+
+bool CameraCore::setPackedStorage(bool enable)
+{
+	// Ring frames packed to the camera's bit depth (12 bit: 25% smaller, 10 bit: 37.5%),
+	// so the same memory holds more frames and the recorder writes fewer bytes. Clears
+	// the buffer.
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (averagingMode || recorder.isRecording())
+	{
+		mexPrintf("Please call StopAveraging / StopRecording before changing the storage format.\n");
+		return false;
+	}
+	if (enable && (bytesPerPixel != 2 || bitDepth >= 16))
+	{
+		mexPrintf("Packed storage needs a camera with less than 16 bit per pixel.\n");
+		return false;
+	}
+	packedBits = enable ? bitDepth : 0;
+	return initialized ? allocateFramePool() : true;
+}
+
+bool CameraCore::setCaptureROI(const CaptureROI &roi)
+{
+	// Stored frames change size, so the ring is reallocated for the new geometry and
+	// holds proportionally more frames. Clears the buffer.
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (averagingMode || recorder.isRecording())
+	{
+		mexPrintf("Please call StopAveraging / StopRecording before changing the capture ROI.\n");
+		return false;
+	}
+	CaptureROI newROI = roi;
+	if (newROI.width == 0)
+	{
+		newROI.x0 = newROI.y0 = 0;
+		newROI.width = sensorWidth;
+		newROI.height = sensorHeight;
+	}
+	if (bytesPerPixel != 2 || newROI.step < 1 || newROI.x0 < 0 || newROI.y0 < 0 || newROI.width < 1 || newROI.height < 1 ||
+		newROI.x0 + newROI.width > sensorWidth || newROI.y0 + newROI.height > sensorHeight || newROI.outWidth() < 1 || newROI.outHeight() < 1)
+	{
+		mexPrintf("Invalid capture ROI [%d %d %d %d] for a %dx%d sensor.\n", newROI.x0, newROI.y0, newROI.width, newROI.height, sensorWidth, sensorHeight);
+		return false;
+	}
+	captureROI = newROI;
+	width = captureROI.outWidth();
+	height = captureROI.outHeight();
+	return allocateFramePool();
+}
+
+bool CameraCore::setSharedExport(const std::string &fileName)
+{
+	// The ring moves into (or out of) a memory mapped file: frames are no longer copied
+	// into mxArrays, the consumer reads them in place and releases them with
+	// ReleaseSharedFrames or by raising readPosition in the file. That consumer is the
+	// ring's only reader: the commands that take frames out of the ring are refused until
+	// the export is turned off. Clears the buffer.
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (averagingMode || recorder.isRecording())
+	{
+		mexPrintf("Please call StopAveraging / StopRecording before changing the shared export.\n");
+		return false;
+	}
+	sharedExportFile = fileName;
+	if (!initialized)
+		return true;
+	if (allocateFramePool())
+		return true;
+	// keep the camera running on a private ring
+	sharedExportFile.clear();
+	allocateFramePool();
+	return false;
+}
+
+mxArray* CameraCore::getSharedRange()
+{
+	// Only the header is copied: frames [first, last) are valid, frame p is in slot
+	// mod(p, capacity) at slotOffset + slot * slotBytes of the file.
+	const char *fields[] = { "fileName", "first", "last", "capacity", "slotBytes", "slotOffset", "infoOffset", "width", "height", "bytesPerPixel", "exportShift", "packedBits" };
+	mxArray *out = mxCreateStructMatrix(1, 1, 12, fields);
+	SharedPoolHeader *header = framePool.getSharedHeader();
+	mxSetField(out, 0, "fileName", mxCreateString(framePool.getSharedFile().c_str()));
+	if (header == nullptr)
+		return out;
+	mxSetField(out, 0, "first", mxCreateDoubleScalar((double)header->readPosition.load(std::memory_order_acquire)));
+	mxSetField(out, 0, "last", mxCreateDoubleScalar((double)header->writePosition.load(std::memory_order_acquire)));
+	mxSetField(out, 0, "capacity", mxCreateDoubleScalar((double)header->capacity));
+	mxSetField(out, 0, "slotBytes", mxCreateDoubleScalar((double)header->slotBytes));
+	mxSetField(out, 0, "slotOffset", mxCreateDoubleScalar((double)header->slotOffset));
+	mxSetField(out, 0, "infoOffset", mxCreateDoubleScalar((double)header->infoOffset));
+	mxSetField(out, 0, "width", mxCreateDoubleScalar(header->width));
+	mxSetField(out, 0, "height", mxCreateDoubleScalar(header->height));
+	mxSetField(out, 0, "bytesPerPixel", mxCreateDoubleScalar(header->bytesPerPixel));
+	mxSetField(out, 0, "exportShift", mxCreateDoubleScalar(header->exportShift));
+	mxSetField(out, 0, "packedBits", mxCreateDoubleScalar(header->packedBits));
+	return out;
+}
+
+bool CameraCore::releaseSharedFrames(unsigned long long position)
+{
+	// frames before 'position' go back to the camera
+	if (framePool.getSharedHeader() == nullptr)
+	{
+		mexPrintf("The frame buffer is not shared, call SetSharedExport first.\n");
+		return false;
+	}
+	// absolute, so it cannot undo a release the external consumer made meanwhile
+	framePool.releaseTo(MIN(position, framePool.writePosition()));
+	return true;
+}
+
+bool CameraCore::startRecording(const char *fileName, unsigned long long maxFrames, bool compressed)
+{
+	// The recorder becomes the reader of the ring; it starts from an empty buffer.
+	// Creating and preallocating the file can take a while, so it happens outside the
+	// lock the frame callback takes; the ring cannot be reconfigured meanwhile because
+	// the recorder already counts as recording.
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		if (averagingMode || recorder.isRecording())
+		{
+			mexPrintf("Please call StopAveraging / StopRecording first.\n");
+			return false;
+		}
+		if (!sharedExportFile.empty())
+		{
+			mexPrintf("The frame buffer is shared, call SetSharedExport('') before recording.\n");
+			return false;
+		}
+	}
+	if (!recorder.open(fileName, width, height, bytesPerPixel, exportShift, packedBits, framePool.getSlotBytes(), maxFrames, compressed))
+		return false;
+	std::lock_guard<std::mutex> lock(configMutex);
+	clearBuffer();
+	framePool.resetStats();
+	recorder.begin(&framePool);
+	return true;
+}
+
+bool CameraCore::setBufferCapacity(size_t numFrames)
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (recorder.isRecording())
+	{
+		mexPrintf("Please call StopRecording before resizing the buffer.\n");
+		return false;
+	}
+	requestedPoolFrames = numFrames;
+	bool ok = true;
+	if (initialized)
+		ok = allocateFramePool();
+	return ok;
+}
+
+mxArray* CameraCore::getBufferStats()
+{
+	const char *fields[] = { "capacity", "numBuffered", "highWatermark", "framesStored", "overflowDropped", "numTrigs", "slotBytes", "largePages", "packedBits" };
+	mxArray *out = mxCreateStructMatrix(1, 1, 9, fields);
+	mxSetField(out, 0, "capacity", mxCreateDoubleScalar((double)framePool.getCapacity()));
+	mxSetField(out, 0, "numBuffered", mxCreateDoubleScalar((double)framePool.size()));
+	mxSetField(out, 0, "highWatermark", mxCreateDoubleScalar((double)framePool.highWatermark));
+	mxSetField(out, 0, "framesStored", mxCreateDoubleScalar((double)framePool.framesStored));
+	mxSetField(out, 0, "overflowDropped", mxCreateDoubleScalar((double)framePool.overflowDropped));
+	mxSetField(out, 0, "numTrigs", mxCreateDoubleScalar((double)numTrig));
+	mxSetField(out, 0, "slotBytes", mxCreateDoubleScalar((double)framePool.getSlotBytes()));
+	mxSetField(out, 0, "largePages", mxCreateLogicalScalar(framePool.usesLargePages()));
+	mxSetField(out, 0, "packedBits", mxCreateDoubleScalar(packedBits));
+	return out;
+}
+
+mxArray* CameraCore::getAcquisitionHealth()
+{
+	// losses per cause since the last ResetTriggerCounter / StartAveraging
+	AcquisitionHealth snapshot;
+	unsigned long numTrigs;
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		snapshot = health;
+		numTrigs = numTrig;
+	}
+	long long driverDropped = backend->getDriverDropped();
+	unsigned long long framesLost = snapshot.bufferFull + snapshot.driverSkip + snapshot.truncated;
+
+	const char *fields[] = { "ok", "numTrigs", "framesReceived", "framesLost", "bufferFull", "driverSkip", "truncated",
+		"lateCallbacks", "counterResets", "driverReported", "maxCallbackLag", "maxCallbackDuration", "lastDriverFrame", "gaps" };
+	mxArray *out = mxCreateStructMatrix(1, 1, 14, fields);
+	mxSetField(out, 0, "ok", mxCreateLogicalScalar(framesLost == 0));
+	mxSetField(out, 0, "numTrigs", mxCreateDoubleScalar((double)numTrigs));
+	mxSetField(out, 0, "framesReceived", mxCreateDoubleScalar((double)snapshot.framesReceived));
+	mxSetField(out, 0, "framesLost", mxCreateDoubleScalar((double)framesLost));
+	mxSetField(out, 0, "bufferFull", mxCreateDoubleScalar((double)snapshot.bufferFull));
+	mxSetField(out, 0, "driverSkip", mxCreateDoubleScalar((double)snapshot.driverSkip));
+	mxSetField(out, 0, "truncated", mxCreateDoubleScalar((double)snapshot.truncated));
+	mxSetField(out, 0, "lateCallbacks", mxCreateDoubleScalar((double)snapshot.lateCallbacks));
+	mxSetField(out, 0, "counterResets", mxCreateDoubleScalar((double)snapshot.counterResets));
+	// drops the camera / driver counts itself (since start, -1 = not available)
+	mxSetField(out, 0, "driverReported", mxCreateDoubleScalar((double)driverDropped));
+	mxSetField(out, 0, "maxCallbackLag", mxCreateDoubleScalar(snapshot.maxCallbackLag));
+	mxSetField(out, 0, "maxCallbackDuration", mxCreateDoubleScalar(snapshot.maxCallbackDuration));
+	mxSetField(out, 0, "lastDriverFrame", mxCreateDoubleScalar(snapshot.lastDriverFrame));
+	// one row per gap: [trigger number after the gap, expected driver frame, received driver frame, host time]
+	mxArray *gaps = mxCreateDoubleMatrix(snapshot.gaps.size(), 4, mxREAL);
+	double *gapData = mxGetPr(gaps);
+	size_t numGaps = snapshot.gaps.size();
+	for (size_t k = 0; k < numGaps; k++)
+	{
+		gapData[k] = snapshot.gaps[k].frameCounter;
+		gapData[k + numGaps] = snapshot.gaps[k].expectedFrame;
+		gapData[k + 2 * numGaps] = snapshot.gaps[k].driverFrame;
+		gapData[k + 3 * numGaps] = snapshot.gaps[k].hostTime;
+	}
+	mxSetField(out, 0, "gaps", gaps);
+	return out;
+}
+
+
+void CameraCore::quantizePhase(const float *phase, unsigned short *dataOut)
+{
+	// -pi..pi mapped to 0..4095 exported gray levels (phase = J/4095*2*pi - pi)
+	const float PI = 3.1415926536f;
+	for (size_t k = 0; k < (size_t)phaseWidth * phaseHeight; k++)
+	{
+		unsigned short quantizedValue = (unsigned short)((phase[k] + PI) / (2 * PI) * 4095 + 0.5f);
+		dataOut[k] = (unsigned short)((MIN(quantizedValue, 4095)) << exportShift);
+	}
+}
+
+void CameraCore::onFrame(const void *data, size_t bytes, int driverFrame, double deviceTime)
+{
+	if (!triggerEnabled)
+		return;
+
+	double arrival = hostTime();
+	std::lock_guard<std::mutex> lock(configMutex);
+	unsigned long trig = ++numTrig;
+	// frames skipped while triggers were disabled are not losses
+	if (resyncHealth.exchange(false))
+		health.resync();
+	health.frameArrived((int)trig, driverFrame, deviceTime, arrival);
+
+	FrameSlotInfo slotInfo;
+	slotInfo.frameCounter = (int)trig;
+	slotInfo.driverFrame = driverFrame;
+	slotInfo.hostTime = arrival;
+	slotInfo.deviceTime = deviceTime;
+
+	if (bytes < (size_t)sensorWidth * sensorHeight * bytesPerPixel)
+	{
+		// a short (truncated) frame is counted as a trigger but never stored
+		health.truncated++;
+	}
+	else if (hdrMode)
+	{
+		storeFrame((const unsigned char*)data, (unsigned char*)cropScratch.data(), slotInfo);
+		updatePreview((const unsigned char*)cropScratch.data(), slotInfo, arrival);
+		hdrAccumulator.add((trig - 1) % averagingBlockSize, cropScratch.data());
+	}
+	else if (reconstructionMode)
+	{
+		// This mode assumes that the DMD gets three consecutive phase shifted images (0, pi/2, pi).
+		// Triple k of every repetition goes to phase plane k; the raw frames are not kept.
+		int index3 = (trig - 1) % 3;
+		size_t plane = ((trig - 1) / 3) % averagingBlockSize;
+		unsigned short *out = (index3 < 2) ? phaseFrames[index3].data() : cropScratch.data();
+		storeFrame((const unsigned char*)data, (unsigned char*)out, slotInfo);
+		updatePreview((const unsigned char*)out, slotInfo, arrival);
+		phaseMax[plane] = MAX(phaseMax[plane], slotInfo.maxValue);
+		phaseSaturated[plane] = MAX(phaseSaturated[plane], slotInfo.numSaturated);
+
+		if (index3 == 2)
+			phaseAccumulator.add(plane, phaseFrames[0].data(), phaseFrames[1].data(), cropScratch.data());
+	}
+	else if (averagingMode)
+	{
+		// we are averaging images. Frame numTrig goes to sum plane (numTrig-1) % averagingBlockSize
+		storeFrame((const unsigned char*)data, (unsigned char*)cropScratch.data(), slotInfo);
+		updatePreview((const unsigned char*)cropScratch.data(), slotInfo, arrival);
+		accumulator.add((trig - 1) % averagingBlockSize, cropScratch.data());
+	}
+	else
+	{
+		unsigned char *slot = framePool.claim();
+		if (slot != nullptr && packedBits > 0)
+		{
+			// cropScratch is free outside the averaging modes
+			storeFrame((const unsigned char*)data, (unsigned char*)cropScratch.data(), slotInfo);
+			updatePreview((const unsigned char*)cropScratch.data(), slotInfo, arrival);
+			packSamples(cropScratch.data(), (size_t)width * height, exportShift, packedBits, slot);
+			framePool.commit(slotInfo);
+		}
+		else if (slot != nullptr)
+		{
+			storeFrame((const unsigned char*)data, slot, slotInfo);
+			updatePreview(slot, slotInfo, arrival);
+			framePool.commit(slotInfo);
+		}
+		else
+			health.bufferFull++;
+	}
+	health.maxCallbackDuration = MAX(health.maxCallbackDuration, hostTime() - arrival);
+}
+
+void CameraCore::updatePreview(const unsigned char *frame, const FrameSlotInfo &slotInfo, double now)
+{
+	// the slot is still ours until commit, so reading it here is safe
+	if (preview.due(now))
+		preview.update(frame, bytesPerPixel, exportShift, slotInfo, now);
+}
+
+bool CameraCore::setPreviewStep(int step)
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	return preview.setStep(step);
+}
+
+void CameraCore::resetTriggerCounter()
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	resetCounters();
+}
+
+void CameraCore::resetCounters()
+{
+	numTrig = 0;
+	health.reset();
+}
+
+bool CameraCore::setSaturationLevel(int level)
+{
+	if (level < 1 || level > (1 << bitDepth) - 1)
+	{
+		mexPrintf("Saturation level must be between 1 and %d.\n", (1 << bitDepth) - 1);
+		return false;
+	}
+	saturationLevel = level;
+	return true;
+}
+
+unsigned short CameraCore::rawSaturationLevel()
+{
+	// in the units of the stored (shifted) pixels, clamped before narrowing
+	long long level = (long long)saturationLevel.load() << exportShift;
+	return (unsigned short)(MIN(level, 65535LL));
+}
+
+void CameraCore::storeFrame(const unsigned char *data, unsigned char *out, FrameSlotInfo &slotInfo)
+{
+	// crop to the capture ROI, and measure the ROI on the way
+	if (bytesPerPixel != 2)
+	{
+		memcpy(out, data, (size_t)width * height * bytesPerPixel);
+		slotInfo.maxValue = 0;
+		slotInfo.numSaturated = 0;
+		return;
+	}
+	unsigned short maxRaw;
+	cropFrame16((const unsigned short*)data, sensorWidth, captureROI, (unsigned short*)out, binRow,
+		rawSaturationLevel(), maxRaw, slotInfo.numSaturated);
+	slotInfo.maxValue = maxRaw >> exportShift;
+}
+
+
+bool CameraCore::startAveraging(int numFrames, bool ReconstructionMode, bool withVariance)
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (recorder.isRecording())
+	{
+		mexPrintf("Please call StopRecording before averaging.\n");
+		return false;
+	}
+	if (!sharedExportFile.empty())
+	{
+		mexPrintf("The frame buffer is shared, call SetSharedExport('') before averaging.\n");
+		return false;
+	}
+	clearBuffer();
+	averagingMode = false;
+	reconstructionMode = false;
+	hdrMode = false;
+	// only the engine of the requested mode holds memory
+	size_t numPixels = (size_t)width * height;
+	bool ok = numFrames > 0 && bytesPerPixel == 2;
+	hdrAccumulator.release();
+	if (ok && ReconstructionMode && packedBits > 0 && packedBits < 12)
+	{
+		// the quantized phase frames span 12 bits
+		mexPrintf("Reconstruction needs 12 bit frames, please call SetPackedStorage(false) first.\n");
+		return false;
+	}
+	if (ok && ReconstructionMode)
+	{
+		accumulator.allocate(numPixels, 0, false);
+		ok = phaseAccumulator.allocate(numPixels, numFrames);
+		if (ok)
+		{
+			for (int k = 0; k < 2; k++)
+				phaseFrames[k].assign(numPixels, 0);
+			phaseMax.assign(numFrames, 0);
+			phaseSaturated.assign(numFrames, 0);
+			phaseWidth = width;
+			phaseHeight = height;
+		}
+	}
+	else if (ok)
+	{
+		phaseAccumulator.release();
+		ok = accumulator.allocate(numPixels, numFrames, withVariance);
+	}
+	if (ok)
+	{
+		averagingBlockSize = numFrames;
+		averagingMode = true;
+		reconstructionMode = ReconstructionMode;
+		reconstructionBlock = ReconstructionMode;
+		hdrBlock = false;
+		resetCounters();
+	}
+	else
+		mexPrintf("Error allocating averaging buffers for %d frames.\n", numFrames);
+	return ok;
+}
+
+bool CameraCore::startHdr(int numFrames, const std::vector<float> &darkFrame, double lowCut, double highCut)
+{
+	// Frame numTrig goes to radiance plane (numTrig-1) % numFrames, like averaging. The
+	// bracket level is set with setHdrScale before its frames arrive. Nothing is stored in
+	// the ring, the merged planes are read with getHdrBuffer.
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (recorder.isRecording())
+	{
+		mexPrintf("Please call StopRecording before averaging.\n");
+		return false;
+	}
+	if (!sharedExportFile.empty())
+	{
+		mexPrintf("The frame buffer is shared, call SetSharedExport('') before averaging.\n");
+		return false;
+	}
+	if (numFrames <= 0 || bytesPerPixel != 2 || (!darkFrame.empty() && darkFrame.size() != (size_t)width * height) || highCut <= lowCut)
+	{
+		mexPrintf("HDR needs a 16 bit camera, a dark frame of %dx%d (or none) and lowCut < highCut.\n", height, width);
+		return false;
+	}
+	clearBuffer();
+	averagingMode = false;
+	reconstructionMode = false;
+	hdrMode = false;
+	// the accumulator works on raw samples, row-major
+	float unit = (float)(1 << exportShift);
+	std::vector<float> dark(darkFrame.size());
+	for (int y = 0; y < height && !dark.empty(); y++)
+		for (int x = 0; x < width; x++)
+			dark[(size_t)y * width + x] = darkFrame[(size_t)x * height + y] * unit;
+	size_t numPixels = (size_t)width * height;
+	accumulator.allocate(numPixels, 0, false);
+	phaseAccumulator.release();
+	if (!hdrAccumulator.allocate(numPixels, numFrames, dark, (float)lowCut * unit, (float)highCut * unit))
+	{
+		mexPrintf("Error allocating HDR buffers for %d frames.\n", numFrames);
+		return false;
+	}
+	hdrWidth = width;
+	hdrHeight = height;
+	averagingBlockSize = numFrames;
+	averagingMode = true;
+	hdrMode = true;
+	hdrBlock = true;
+	reconstructionBlock = false;
+	resetCounters();
+	return true;
+}
+
+bool CameraCore::setHdrScale(double scale)
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (!hdrMode || !(scale > 0))
+	{
+		mexPrintf("Please call StartHDR first, the scale must be positive.\n");
+		return false;
+	}
+	hdrAccumulator.setScale((float)scale);
+	return true;
+}
+
+void CameraCore::stopAveraging()
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	if (averagingMode && !hdrMode)
+		storeAverages();
+	averagingMode = false;
+	reconstructionMode = false;
+	hdrMode = false;
+}
+
+void CameraCore::storeAverages()
+{
+	// Divide once and hand the averages to the reader as ordinary frames. The callback
+	// is locked out, so the mex thread acts as the ring producer here. Packed frames are
+	// computed in cropScratch and packed into the slot.
+	double now = hostTime();
+	size_t numPixels = (size_t)width * height;
+	if (reconstructionMode)
+	{
+		// quantized phase frames, tagged with the exposure stats of their raw frames
+		std::vector<float> phase((size_t)phaseWidth * phaseHeight);
+		for (size_t plane = 0; plane < phaseAccumulator.getNumPlanes() && phaseAccumulator.count(plane) > 0; plane++)
+		{
+			unsigned char *slot = framePool.claim();
+			if (slot == nullptr)
+				break;
+			unsigned short *frame = (packedBits > 0) ? cropScratch.data() : (unsigned short*)slot;
+			phaseAccumulator.phase(plane, phase.data());
+			quantizePhase(phase.data(), frame);
+			if (packedBits > 0)
+				packSamples(frame, numPixels, exportShift, packedBits, slot);
+			FrameSlotInfo slotInfo;
+			slotInfo.frameCounter = (int)plane + 1;
+			slotInfo.driverFrame = -1;
+			slotInfo.hostTime = now;
+			slotInfo.deviceTime = -1;
+			slotInfo.maxValue = phaseMax[plane];
+			slotInfo.numSaturated = phaseSaturated[plane];
+			framePool.commit(slotInfo);
+		}
+		return;
+	}
+	for (size_t plane = 0; plane < accumulator.getNumPlanes() && accumulator.count(plane) > 0; plane++)
+	{
+		unsigned char *slot = framePool.claim();
+		if (slot == nullptr)
+			break;
+		unsigned short *frame = (packedBits > 0) ? cropScratch.data() : (unsigned short*)slot;
+		accumulator.mean(plane, frame, exportShift);
+		FrameSlotInfo slotInfo;
+		slotInfo.frameCounter = (int)plane + 1;
+		slotInfo.driverFrame = -1;
+		slotInfo.hostTime = now;
+		slotInfo.deviceTime = -1;
+		unsigned short maxRaw;
+		regionStats16(frame, width, width, height, rawSaturationLevel(), maxRaw, slotInfo.numSaturated);
+		slotInfo.maxValue = maxRaw >> exportShift;
+		if (packedBits > 0)
+			packSamples(frame, numPixels, exportShift, packedBits, slot);
+		framePool.commit(slotInfo);
+	}
+}
+
+mxArray* CameraCore::getVarianceBuffer()
+{
+	// per-pixel variance of the last averaging block, and the number of frames behind each plane.
+	// The sums are copied under the lock, the camera callback is not held up by the division.
+	FrameAccumulator snapshot;
+	int frameWidth, frameHeight, shift;
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		if (accumulator.hasSquares())
+			snapshot = accumulator;
+		frameWidth = width;
+		frameHeight = height;
+		shift = exportShift;
+	}
+	int numPlanes = snapshot.hasSquares() ? (int)snapshot.getNumPlanes() : 0;
+	mwSize dim[3] = { (mwSize)frameHeight, (mwSize)frameWidth, (mwSize)numPlanes };
+	mxArray *variance = mxCreateNumericArray(3, dim, mxSINGLE_CLASS, mxREAL);
+	float *out = (float*)mxGetData(variance);
+	for (int plane = 0; plane < numPlanes; plane++)
+		snapshot.variance(plane, out + (size_t)plane * frameWidth * frameHeight, frameWidth, frameHeight, shift);
+	return variance;
+}
+
+mxArray* CameraCore::getAveragingCounts()
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	int numPlanes = (int)accumulator.getNumPlanes();
+	mxArray *counts = mxCreateDoubleMatrix(1, numPlanes, mxREAL);
+	double *out = mxGetPr(counts);
+	for (int plane = 0; plane < numPlanes; plane++)
+		out[plane] = accumulator.count(plane);
+	return counts;
+}
+
+mxArray* CameraCore::getPhaseBuffer()
+{
+	// phase of every plane of the last reconstruction block, in the layout of the
+	// calibration's Kinv_angle: numPlanes x numPixels, pixels column-major.
+	// Only the sum planes are copied under the lock; atan2 and the transpose run outside it.
+	PhaseAccumulator snapshot;
+	int frameWidth, frameHeight;
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		if (reconstructionBlock)
+			snapshot = phaseAccumulator;
+		frameWidth = phaseWidth;
+		frameHeight = phaseHeight;
+	}
+	size_t numPlanes = snapshot.getNumPlanes();
+	size_t numPixels = (size_t)frameWidth * frameHeight;
+	mxArray *Kinv_angle = mxCreateNumericMatrix(numPlanes, numPlanes > 0 ? numPixels : 0, mxSINGLE_CLASS, mxREAL);
+	float *out = (float*)mxGetData(Kinv_angle);
+	std::vector<float> phase(numPlanes > 0 ? numPixels : 0);
+	for (size_t plane = 0; plane < numPlanes; plane++)
+	{
+		snapshot.phase(plane, phase.data());
+		for (int y = 0; y < frameHeight; y++)
+			for (int x = 0; x < frameWidth; x++)
+				out[plane + numPlanes * ((size_t)x * frameHeight + y)] = phase[(size_t)y * frameWidth + x];
+	}
+	return Kinv_angle;
+}
+
+mxArray* CameraCore::getHdrBuffer()
+{
+	// radiance planes of the last HDR block, in exported gray levels at scale 1, NaN where
+	// no frame had a valid sample. The division runs outside the lock, like the phase.
+	HdrAccumulator snapshot;
+	int frameWidth, frameHeight, shift;
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		if (hdrBlock)
+			snapshot = hdrAccumulator;
+		frameWidth = hdrWidth;
+		frameHeight = hdrHeight;
+		shift = exportShift;
+	}
+	int numPlanes = (int)snapshot.getNumPlanes();
+	mwSize dim[3] = { (mwSize)frameHeight, (mwSize)frameWidth, (mwSize)numPlanes };
+	mxArray *radiance = mxCreateNumericArray(3, dim, mxSINGLE_CLASS, mxREAL);
+	float *out = (float*)mxGetData(radiance);
+	for (int plane = 0; plane < numPlanes; plane++)
+		snapshot.radiance(plane, out + (size_t)plane * frameWidth * frameHeight, frameWidth, frameHeight, 1.0f / (1 << shift));
+	return radiance;
+}
+
+mxArray* CameraCore::getHdrCounts()
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	int numPlanes = hdrBlock ? (int)hdrAccumulator.getNumPlanes() : 0;
+	mxArray *counts = mxCreateDoubleMatrix(1, numPlanes, mxREAL);
+	double *out = mxGetPr(counts);
+	for (int plane = 0; plane < numPlanes; plane++)
+		out[plane] = hdrAccumulator.count(plane);
+	return counts;
+}
+
+mxArray* CameraCore::getPhaseStats()
+{
+	std::vector<unsigned short> planeMax;
+	std::vector<unsigned int> planeSaturated, planeCounts;
+	int frameWidth, frameHeight;
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		size_t numPlanes = reconstructionBlock ? phaseAccumulator.getNumPlanes() : 0;
+		planeMax.assign(phaseMax.begin(), phaseMax.begin() + numPlanes);
+		planeSaturated.assign(phaseSaturated.begin(), phaseSaturated.begin() + numPlanes);
+		for (size_t plane = 0; plane < numPlanes; plane++)
+			planeCounts.push_back(phaseAccumulator.count(plane));
+		frameWidth = phaseWidth;
+		frameHeight = phaseHeight;
+	}
+	size_t numPlanes = planeCounts.size();
+	const char *fields[] = { "max", "numSaturated", "counts", "frameSize" };
+	mxArray *stats = mxCreateStructMatrix(1, 1, 4, fields);
+	mxArray *maxValue = mxCreateDoubleMatrix(1, numPlanes, mxREAL);
+	mxArray *numSaturated = mxCreateDoubleMatrix(1, numPlanes, mxREAL);
+	mxArray *counts = mxCreateDoubleMatrix(1, numPlanes, mxREAL);
+	for (size_t plane = 0; plane < numPlanes; plane++)
+	{
+		mxGetPr(maxValue)[plane] = planeMax[plane];
+		mxGetPr(numSaturated)[plane] = planeSaturated[plane];
+		mxGetPr(counts)[plane] = planeCounts[plane];
+	}
+	mxArray *frameSize = mxCreateDoubleMatrix(1, 2, mxREAL);
+	mxGetPr(frameSize)[0] = frameHeight;
+	mxGetPr(frameSize)[1] = frameWidth;
+	mxSetField(stats, 0, "max", maxValue);
+	mxSetField(stats, 0, "numSaturated", numSaturated);
+	mxSetField(stats, 0, "counts", counts);
+	mxSetField(stats, 0, "frameSize", frameSize);
+	return stats;
+}
+
+
+int CameraCore::copyAndClearBuffer8Bit(unsigned char *imageBufferPtr, int numToCopy)
+{
+	// the first numToCopy slots are already claimed by copyAndClearBuffer
+	for (int k = 0; k < numToCopy; k++)
+		transpose8(framePool.at(k), imageBufferPtr + (size_t)width * height * k, width, height);
+	return (numToCopy > 0) ? framePool.infoAt(0).frameCounter : -1;
+}
+
+int CameraCore::copyAndClearBuffer16Bit(unsigned char *imageBufferPtr, int numToCopy)
+{
+	// the first numToCopy slots are already claimed by copyAndClearBuffer
+	exportFrames16(framePool, 0, numToCopy, (unsigned short *)imageBufferPtr, width, height, exportShift, packedBits);
+	return (numToCopy > 0) ? framePool.infoAt(0).frameCounter : -1;
+}
+
+int CameraCore::pokeLastFrames(unsigned char *imageBufferPtr, int N)
+{
+	// copy the N-tuple images from the buffer, but keeps them there...
+	// if an incomplete tuple exist, use the one before that...
+	if (N <= 0)
+		return -1;
+
+	// the frames are not released, so a snapshot of the published span is all we need
+	int numBuffered = (int)framePool.claimRead(framePool.getCapacity());
+	int startImage = MAX(N * (numBuffered / N - 1), 0);
+	int numToCopy = MIN(numBuffered - startImage, N);
+	if (numToCopy <= 0)
+		return -1;
+
+	if (bytesPerPixel == 2)
+		exportFrames16(framePool, startImage, numToCopy, (unsigned short *)imageBufferPtr, width, height, exportShift, packedBits);
+	else
+		for (int k = 0; k < numToCopy; k++)
+			transpose8(framePool.at(startImage + k), imageBufferPtr + (size_t)width * height * k, width, height);
+	return startImage;
+}
+
+int CameraCore::copyAndClearBuffer(unsigned char *imageBufferPtr, int N, std::vector<FrameSlotInfo> *frameInfo)
+{
+	// no lock: the callback keeps publishing past the claimed span while we copy.
+	// The span is claimed once so the images and their infos always match.
+	int numToCopy = (int)framePool.claimRead(MAX(N, 0));
+	if (frameInfo != nullptr)
+	{
+		frameInfo->resize(numToCopy);
+		for (int k = 0; k < numToCopy; k++)
+			(*frameInfo)[k] = framePool.infoAt(k);
+	}
+	int FirstImageTrig = -1;
+	if (bytesPerPixel == 1)
+		FirstImageTrig = copyAndClearBuffer8Bit(imageBufferPtr, numToCopy);
+	else if (bytesPerPixel == 2)
+		FirstImageTrig = copyAndClearBuffer16Bit(imageBufferPtr, numToCopy);
+	framePool.releaseRead(numToCopy);
+	return FirstImageTrig;
+}
+
+// double, single or uint16 array -> float, in MATLAB element order
+static bool getFloatArray(const mxArray *array, std::vector<float> &out)
+{
+	out.resize(mxGetNumberOfElements(array));
+	for (size_t k = 0; k < out.size(); k++)
+	{
+		switch (mxGetClassID(array))
+		{
+		case mxDOUBLE_CLASS: out[k] = (float)mxGetPr(array)[k]; break;
+		case mxSINGLE_CLASS: out[k] = ((float*)mxGetData(array))[k]; break;
+		case mxUINT16_CLASS: out[k] = ((unsigned short*)mxGetData(array))[k]; break;
+		default:
+			mexPrintf("Expected a double, single or uint16 array.\n");
+			out.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+static mxArray* createImageArray(CameraCore *camera, int N)
+{
+	mwSize dim[3] = { (mwSize)camera->getHeight(), (mwSize)camera->getWidth(), (mwSize)(MAX(N, 0)) };
+	return mxCreateNumericArray(3, dim, camera->getBytesPerPixel() == 1 ? mxUINT8_CLASS : mxUINT16_CLASS, mxREAL);
+}
+
+bool CameraCore::handleCommand(const char *Command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (backend->handleCommand(Command, nlhs, plhs, nrhs, prhs))
+		return true;
+
+	// while recording the recorder is the only reader of the ring, while the ring is
+	// shared the external consumer is
+	bool takesFrames = strcmp(Command, "GetImageBuffer") == 0 || strcmp(Command, "PokeLastImageTuple") == 0 || strcmp(Command, "ClearBuffer") == 0;
+	if (takesFrames && (isRecording() || isSharedExport()))
+	{
+		if (isRecording())
+			mexPrintf("Recording in progress, only PeekLastImage is available. Call StopRecording first.\n");
+		else
+			mexPrintf("The frame buffer is shared, only PeekLastImage is available. Call SetSharedExport('') first.\n");
+		plhs[0] = createImageArray(this, 0);
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(-1);
+		return true;
+	}
+
+	if (strcmp(Command, "SetTriggerMode") == 0)
+	{
+		bool external = *(bool*)mxGetData(prhs[1]);
+		backend->setTriggerMode(external);
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "CameraStatus") == 0)
+	{
+		backend->printStats();
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "GetBufferStats") == 0)
+	{
+		plhs[0] = getBufferStats();
+	}
+	else if (strcmp(Command, "SetPackedStorage") == 0)
+	{
+		// SetPackedStorage(true) - keep ring frames packed to the camera's bit depth. Clears the buffer.
+		bool enable = (nrhs > 1) ? mxGetScalar(prhs[1]) != 0 : true;
+		plhs[0] = mxCreateDoubleScalar(setPackedStorage(enable));
+	}
+	else if (strcmp(Command, "GetPreview") == 0)
+	{
+		// newest frame subsampled by the preview step, with its min / max / mean, saturated
+		// count and histogram. Never touches the buffer, frameCounter is -1 until a frame arrived.
+		plhs[0] = getPreview();
+	}
+	else if (strcmp(Command, "SetPreviewDecimation") == 0)
+	{
+		// SetPreviewDecimation(step), step 1, 2 or 4
+		int step = (nrhs > 1) ? (int)mxGetScalar(prhs[1]) : 2;
+		plhs[0] = mxCreateDoubleScalar(setPreviewStep(step));
+	}
+	else if (strcmp(Command, "GetAcquisitionHealth") == 0)
+	{
+		plhs[0] = getAcquisitionHealth();
+	}
+	else if (strcmp(Command, "SetBufferCapacity") == 0)
+	{
+		// number of frames, 0 = size from available memory. Clears the buffer.
+		if (nrhs < 2) {
+			mexPrintf("Please specify the number of frames.\n");
+			return true;
+		}
+		size_t numFrames = (size_t)*(double*)mxGetPr(prhs[1]);
+		plhs[0] = mxCreateDoubleScalar(setBufferCapacity(numFrames));
+	}
+	else if (strcmp(Command, "SetSharedExport") == 0)
+	{
+		// SetSharedExport(fileName) - keep the ring in a memory mapped file that another process
+		// reads in place (see readCameraSharedBuffer.m in Software), SetSharedExport('') to stop.
+		// Clears the buffer; the file is deleted when the export stops or the camera is released.
+		char *fileName = (nrhs > 1 && mxIsChar(prhs[1])) ? mxArrayToString(prhs[1]) : nullptr;
+		plhs[0] = mxCreateDoubleScalar(setSharedExport(fileName != nullptr ? fileName : ""));
+		if (fileName != nullptr)
+			mxFree(fileName);
+	}
+	else if (strcmp(Command, "GetSharedRange") == 0)
+	{
+		// file layout and the valid frame positions [first, last)
+		plhs[0] = getSharedRange();
+	}
+	else if (strcmp(Command, "ReleaseSharedFrames") == 0)
+	{
+		// ReleaseSharedFrames(position) - the consumer is done with every frame before position
+		if (nrhs < 2) {
+			mexPrintf("Please specify the position.\n");
+			return true;
+		}
+		plhs[0] = mxCreateDoubleScalar(releaseSharedFrames((unsigned long long)mxGetScalar(prhs[1])));
+	}
+	else if (strcmp(Command, "GetImageBuffer") == 0)
+	{
+		if (inAveragingMode())
+		{
+			mwSize dim[3] = { (mwSize)height, (mwSize)width, 0 };
+			plhs[0] = mxCreateNumericArray(3, dim, mxUINT8_CLASS, mxREAL);
+			mexPrintf("Please call Stop Averaging before calling get image buffer\n");
+			return true;
+		}
+
+		int N = getNumImagesInBuffer();
+		if (nrhs > 1)
+		{
+			// grab a subset of images
+			int requestedNumberOfImages = (int)*(double*)mxGetPr(prhs[1]);
+			N = MIN(N, requestedNumberOfImages);
+		}
+
+		mxArray* imageBuffer = createImageArray(this, N);
+		if (imageBuffer == nullptr)
+		{
+			mexPrintf("Error allocating memory for buffer.\n");
+			return true;
+		}
+		std::vector<FrameSlotInfo> frameInfo;
+		int firstTrig = copyAndClearBuffer((unsigned char*)mxGetData(imageBuffer), N, (nlhs > 2) ? &frameInfo : nullptr);
+		plhs[0] = imageBuffer;
+		// trigger number of the first returned frame
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(firstTrig);
+		// per frame max and number of saturated pixels inside the capture ROI, trigger
+		// number, driver frame number (-1 = none), host arrival and camera time (sec, -1 = none)
+		if (nlhs > 2)
+		{
+			const char *fields[] = { "max", "numSaturated", "frameCounter", "driverFrame", "hostTime", "deviceTime" };
+			plhs[2] = mxCreateStructMatrix(1, 1, 6, fields);
+			mxArray *values[6];
+			for (int field = 0; field < 6; field++)
+				values[field] = mxCreateDoubleMatrix(1, frameInfo.size(), mxREAL);
+			for (size_t k = 0; k < frameInfo.size(); k++)
+			{
+				mxGetPr(values[0])[k] = frameInfo[k].maxValue;
+				mxGetPr(values[1])[k] = frameInfo[k].numSaturated;
+				mxGetPr(values[2])[k] = frameInfo[k].frameCounter;
+				mxGetPr(values[3])[k] = frameInfo[k].driverFrame;
+				mxGetPr(values[4])[k] = frameInfo[k].hostTime;
+				mxGetPr(values[5])[k] = frameInfo[k].deviceTime;
+			}
+			for (int field = 0; field < 6; field++)
+				mxSetField(plhs[2], 0, fields[field], values[field]);
+		}
+	}
+	else if (strcmp(Command, "SetCaptureROI") == 0)
+	{
+		// SetCaptureROI([x y width height] [, step [, binning]]), 1 based like a MATLAB
+		// box; [] = full frame. Clears the buffer.
+		CaptureROI roi;
+		if (nrhs > 1 && mxGetNumberOfElements(prhs[1]) >= 4)
+		{
+			double *box = mxGetPr(prhs[1]);
+			roi.x0 = (int)box[0] - 1;
+			roi.y0 = (int)box[1] - 1;
+			roi.width = (int)box[2];
+			roi.height = (int)box[3];
+		}
+		if (nrhs > 2)
+			roi.step = (int)mxGetScalar(prhs[2]);
+		if (nrhs > 3)
+			roi.binning = mxGetScalar(prhs[3]) != 0;
+		plhs[0] = mxCreateDoubleScalar(setCaptureROI(roi));
+	}
+	else if (strcmp(Command, "StartRecording") == 0)
+	{
+		// StartRecording(fileName [, maxFrames [, compressed]]) - stream every frame to disk, see
+		// readCameraRecording.m in Software. maxFrames 0 = until StopRecording; compressed
+		// frames are stored losslessly with compressFrame16 (about 1.3 - 2x smaller)
+		if (nrhs < 2 || !mxIsChar(prhs[1]))
+		{
+			mexPrintf("Please specify a file name.\n");
+			plhs[0] = mxCreateDoubleScalar(0);
+			return true;
+		}
+		char *fileName = mxArrayToString(prhs[1]);
+		unsigned long long maxFrames = (nrhs > 2) ? (unsigned long long)mxGetScalar(prhs[2]) : 0;
+		bool compressed = (nrhs > 3) && mxGetScalar(prhs[3]) != 0;
+		plhs[0] = mxCreateDoubleScalar(startRecording(fileName, maxFrames, compressed));
+		mxFree(fileName);
+	}
+	else if (strcmp(Command, "StopRecording") == 0)
+	{
+		// number of frames in the file
+		plhs[0] = mxCreateDoubleScalar((double)stopRecording());
+	}
+	else if (strcmp(Command, "GetRecordingStatus") == 0)
+	{
+		plhs[0] = recorder.getStatus();
+	}
+	else if (strcmp(Command, "SetSaturationLevel") == 0)
+	{
+		// exported gray level at which a pixel counts as saturated
+		if (nrhs < 2)
+		{
+			mexPrintf("Please specify the saturation level.\n");
+			plhs[0] = mxCreateDoubleScalar(0);
+			return true;
+		}
+		plhs[0] = mxCreateDoubleScalar(setSaturationLevel((int)mxGetScalar(prhs[1])));
+	}
+	else if (strcmp(Command, "PokeLastImageTuple") == 0)
+	{
+		if (nrhs < 2)
+		{
+			mexPrintf("Error - please specify tuple size.\n");
+			return true;
+		}
+		int requestedNumberOfImages = (int)*(double*)mxGetPr(prhs[1]);
+		mxArray* imageBuffer = createImageArray(this, requestedNumberOfImages);
+		int startFrame = pokeLastFrames((unsigned char*)mxGetData(imageBuffer), requestedNumberOfImages);
+		plhs[0] = imageBuffer;
+		plhs[1] = mxCreateDoubleScalar(startFrame);
+	}
+	else if (strcmp(Command, "PeekLastImage") == 0 && isRecording())
+	{
+		// the newest frame the recorder has written
+		std::vector<unsigned char> frame;
+		FrameSlotInfo slotInfo;
+		bool available = recorder.getPreview(frame, slotInfo);
+		mxArray* imageBuffer = createImageArray(this, available ? 1 : 0);
+		if (available && packedBits > 0)
+		{
+			std::vector<unsigned short> unpacked((size_t)width * height);
+			unpackSamples(frame.data(), unpacked.size(), packedBits, unpacked.data());
+			transposeShift16(unpacked.data(), (unsigned short*)mxGetData(imageBuffer), width, height, 0);
+		}
+		else if (available && bytesPerPixel == 2)
+			transposeShift16((const unsigned short*)frame.data(), (unsigned short*)mxGetData(imageBuffer), width, height, exportShift);
+		else if (available)
+			transpose8(frame.data(), (unsigned char*)mxGetData(imageBuffer), width, height);
+		plhs[0] = imageBuffer;
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(available ? slotInfo.frameCounter : -1);
+	}
+	else if (strcmp(Command, "PeekLastImage") == 0)
+	{
+		// the newest frame in the buffer, an empty array if there is none
+		bool available = getNumImagesInBuffer() > 0;
+		mxArray* imageBuffer = createImageArray(this, available ? 1 : 0);
+		int startFrame = available ? pokeLastFrames((unsigned char*)mxGetData(imageBuffer), 1) : -1;
+		plhs[0] = imageBuffer;
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(startFrame);
+	}
+	else if (strcmp(Command, "SetExposure") == 0)
+	{
+		// seconds
+		backend->setExposure(*(double*)mxGetPr(prhs[1]));
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "GetExposure") == 0)
+	{
+		plhs[0] = mxCreateDoubleScalar(backend->getExposure());
+	}
+	else if (strcmp(Command, "StartAveraging") == 0)
+	{
+		// StartAveraging(blockSize, reconstruction [, withVariance]). In reconstruction
+		// mode blockSize is the number of (0, pi/2, pi) triples.
+		int blockSize = (int)*(double*)mxGetPr(prhs[1]);
+		bool Reconstruction = (nrhs > 2) ? mxGetScalar(prhs[2]) != 0 : false;
+		bool withVariance = (nrhs > 3) ? mxGetScalar(prhs[3]) != 0 : false;
+		plhs[0] = mxCreateDoubleScalar(startAveraging(blockSize, Reconstruction, withVariance));
+	}
+	else if (strcmp(Command, "StartHDR") == 0)
+	{
+		// StartHDR(blockSize [, darkImage [, lowCut [, highCut]]]). Gray levels; darkImage
+		// is h x w (double, single or uint16, [] for none), lowCut is above the dark frame and
+		// highCut defaults to the saturation level. Set the bracket level with SetHDRScale.
+		int blockSize = (int)mxGetScalar(prhs[1]);
+		std::vector<float> dark;
+		if (nrhs > 2 && !mxIsEmpty(prhs[2]) && !getFloatArray(prhs[2], dark))
+		{
+			plhs[0] = mxCreateDoubleScalar(0);
+			return true;
+		}
+		double lowCut = (nrhs > 3) ? mxGetScalar(prhs[3]) : 0;
+		double highCut = (nrhs > 4) ? mxGetScalar(prhs[4]) : saturationLevel.load();
+		plhs[0] = mxCreateDoubleScalar(startHdr(blockSize, dark, lowCut, highCut));
+	}
+	else if (strcmp(Command, "SetHDRScale") == 0)
+	{
+		// radiance multiplier of the frames that follow: 10^ND, or reference exposure / exposure
+		plhs[0] = mxCreateDoubleScalar(setHdrScale(mxGetScalar(prhs[1])));
+	}
+	else if (strcmp(Command, "GetHDRBuffer") == 0)
+	{
+		// [radiance, counts] of the last HDR block
+		plhs[0] = getHdrBuffer();
+		if (nlhs > 1)
+			plhs[1] = getHdrCounts();
+	}
+	else if (strcmp(Command, "StopAveraging") == 0)
+	{
+		stopAveraging();
+		plhs[0] = mxCreateDoubleScalar(successfulAveraging());
+	}
+	else if (strcmp(Command, "GetVarianceBuffer") == 0)
+	{
+		// [variance, counts] of the last averaging block (empty unless started withVariance)
+		plhs[0] = getVarianceBuffer();
+		if (nlhs > 1)
+			plhs[1] = getAveragingCounts();
+	}
+	else if (strcmp(Command, "GetPhaseBuffer") == 0)
+	{
+		// [Kinv_angle, stats] of the last reconstruction block. Kinv_angle is single,
+		// numModes x numPixels; stats has the max / saturation of the raw frames of each
+		// mode, the number of repetitions and the frame size.
+		plhs[0] = getPhaseBuffer();
+		if (nlhs > 1)
+			plhs[1] = getPhaseStats();
+	}
+	else if (strcmp(Command, "SetGain") == 0)
+	{
+		backend->setGain(*(double*)mxGetPr(prhs[1]));
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "GetGain") == 0)
+	{
+		plhs[0] = mxCreateDoubleScalar(backend->getGain());
+	}
+	else if (strcmp(Command, "GetBufferSize") == 0)
+	{
+		plhs[0] = mxCreateDoubleScalar(getNumImagesInBuffer());
+	}
+	else if (strcmp(Command, "SoftwareTrigger") == 0)
+	{
+		backend->softwareTrigger();
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "ClearBuffer") == 0)
+	{
+		clearBuffer();
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "ResetTriggerCounter") == 0)
+	{
+		resetTriggerCounter();
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "TriggerOFF") == 0)
+	{
+		setTrigger(false);
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "TriggerON") == 0)
+	{
+		setTrigger(true);
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "getNumTrigs") == 0)
+	{
+		plhs[0] = mxCreateDoubleScalar(getNumTrigs());
+	}
+	else if (strcmp(Command, "getFrameRate") == 0)
+	{
+		plhs[0] = mxCreateDoubleScalar(backend->getFrameRate());
+	}
+	else if (strcmp(Command, "setFrameRate") == 0)
+	{
+		backend->setFrameRate(*(double*)mxGetPr(prhs[1]));
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else
+		return false;
+	return true;
+}
+
+
+void CameraCore::exportClaimedFrame(size_t k, unsigned char *out)
+{
+	if (bytesPerPixel == 1)
+		transpose8(framePool.at(k), out, width, height);
+	else
+		exportFrames16(framePool, k, 1, (unsigned short*)out, width, height, exportShift, packedBits);
+}
+
+
+
+CameraSession& CameraSession::shared()
+{
+	static CameraSession session;
+	return session;
+}
+
+bool CameraSession::addCamera(CameraCore *camera, const char *owner)
+{
+	if (camera == nullptr || !camera->isInitialized())
+	{
+		delete camera;
+		return false;
+	}
+	cameras.push_back(camera);
+	owners.push_back(owner);
+	clocks.push_back(SessionClock());
+	unmatched.push_back(0);
+	return true;
+}
+
+void CameraSession::release(size_t firstCamera)
+{
+	for (size_t c = firstCamera; c < cameras.size(); c++)
+		delete cameras[c];
+	firstCamera = MIN(firstCamera, cameras.size());
+	cameras.resize(firstCamera);
+	owners.resize(firstCamera);
+	clocks.resize(firstCamera);
+	unmatched.resize(firstCamera);
+	if (firstCamera == 0)
+		tuplesReturned = 0;
+}
+
+void CameraSession::releaseOwner(const char *owner)
+{
+	for (size_t c = cameras.size(); c-- > 0;)
+	{
+		if (owners[c] != owner)
+			continue;
+		delete cameras[c];
+		cameras.erase(cameras.begin() + c);
+		owners.erase(owners.begin() + c);
+		clocks.erase(clocks.begin() + c);
+		unmatched.erase(unmatched.begin() + c);
+	}
+}
+
+void CameraSession::start()
+{
+	for (size_t c = 0; c < cameras.size(); c++)
+	{
+		cameras[c]->resetTriggerCounter();
+		// a shared ring belongs to its external consumer
+		if (!cameras[c]->isSharedExport())
+			cameras[c]->clearBuffer();
+		clocks[c] = SessionClock();
+		unmatched[c] = 0;
+	}
+	tuplesReturned = 0;
+}
+
+void CameraSession::updateClock(size_t c, size_t numFrames)
+{
+	// Only frames not seen yet go into the estimate; the ones still buffered from the
+	// last call are skipped by their trigger number.
+	SessionClock &clock = clocks[c];
+	for (size_t k = 0; k < numFrames; k++)
+	{
+		const FrameSlotInfo &slotInfo = cameras[c]->claimedFrameInfo(k);
+		if (slotInfo.frameCounter <= clock.lastFrameCounter || slotInfo.deviceTime < 0)
+			continue;
+		double offset = slotInfo.hostTime - slotInfo.deviceTime;
+		if (!clock.valid || slotInfo.deviceTime < clock.lastDeviceTime)
+			clock.offset = offset;	// first frame, or the camera clock restarted
+		else
+			clock.offset = MIN(clock.offset + SESSION_CLOCK_DRIFT * (slotInfo.deviceTime - clock.lastDeviceTime), offset);
+		clock.valid = true;
+		clock.lastDeviceTime = slotInfo.deviceTime;
+		clock.lastFrameCounter = slotInfo.frameCounter;
+	}
+}
+
+double CameraSession::frameTime(size_t c, size_t k)
+{
+	const FrameSlotInfo &slotInfo = cameras[c]->claimedFrameInfo(k);
+	if (slotInfo.deviceTime < 0 || !clocks[c].valid)
+		return slotInfo.hostTime;
+	return slotInfo.deviceTime + clocks[c].offset;
+}
+
+mxArray* CameraSession::getAlignedFrames(int maxTuples, double tolerance, mxArray **info)
+{
+	// Walks the first camera's frames and advances every other camera to the frame that
+	// was taken closest after (time - tolerance). A tuple waits while some camera has no
+	// frame that recent yet; everything before the last complete tuple is released.
+	size_t numCameras = cameras.size();
+	std::vector<size_t> available(numCameras), next(numCameras, 0);
+	bool recording = false;
+	for (size_t c = 0; c < numCameras; c++)
+	{
+		recording |= cameras[c]->isRecording() || cameras[c]->isSharedExport();
+		available[c] = recording ? 0 : cameras[c]->claimFrames();
+		updateClock(c, available[c]);
+	}
+	if (recording)
+		mexPrintf("Recording or shared export in progress, please call StopRecording / SetSharedExport('') on every camera first.\n");
+	std::vector<std::vector<size_t> > tuples;	// frame index of every camera
+	while (numCameras > 0 && next[0] < available[0] && (int)tuples.size() < maxTuples)
+	{
+		double t = frameTime(0, next[0]);
+		bool waiting = false, matched = true;
+		for (size_t c = 1; c < numCameras && matched && !waiting; c++)
+		{
+			while (next[c] < available[c] && frameTime(c, next[c]) < t - tolerance)
+			{
+				next[c]++;
+				unmatched[c]++;
+			}
+			if (next[c] == available[c])
+				waiting = true;
+			else if (frameTime(c, next[c]) > t + tolerance)
+				matched = false;
+		}
+		if (waiting)
+			break;
+		if (!matched)
+		{
+			next[0]++;
+			unmatched[0]++;
+			continue;
+		}
+		tuples.push_back(next);
+		for (size_t c = 0; c < numCameras; c++)
+			next[c]++;
+	}
+
+	size_t numTuples = tuples.size();
+	mxArray *frames = mxCreateCellMatrix(1, numCameras);
+	mxArray *alignedTime = mxCreateDoubleMatrix(numCameras, numTuples, mxREAL);
+	mxArray *hostTime = mxCreateDoubleMatrix(numCameras, numTuples, mxREAL);
+	mxArray *deviceTime = mxCreateDoubleMatrix(numCameras, numTuples, mxREAL);
+	mxArray *frameCounter = mxCreateDoubleMatrix(numCameras, numTuples, mxREAL);
+	mxArray *driverFrame = mxCreateDoubleMatrix(numCameras, numTuples, mxREAL);
+	mxArray *sessionIndex = mxCreateDoubleMatrix(1, numTuples, mxREAL);
+	mxArray *unmatchedCounts = mxCreateDoubleMatrix(1, numCameras, mxREAL);
+	mxArray *ownerNames = mxCreateCellMatrix(1, numCameras);
+	for (size_t c = 0; c < numCameras; c++)
+	{
+		CameraCore *camera = cameras[c];
+		mwSize dim[3] = { (mwSize)camera->getHeight(), (mwSize)camera->getWidth(), (mwSize)numTuples };
+		mxArray *stack = mxCreateNumericArray(3, dim, camera->getBytesPerPixel() == 1 ? mxUINT8_CLASS : mxUINT16_CLASS, mxREAL);
+		size_t frameBytes = (size_t)camera->getWidth() * camera->getHeight() * camera->getBytesPerPixel();
+		for (size_t k = 0; k < numTuples; k++)
+		{
+			const FrameSlotInfo &slotInfo = camera->claimedFrameInfo(tuples[k][c]);
+			camera->exportClaimedFrame(tuples[k][c], (unsigned char*)mxGetData(stack) + k * frameBytes);
+			mxGetPr(alignedTime)[k * numCameras + c] = frameTime(c, tuples[k][c]);
+			mxGetPr(hostTime)[k * numCameras + c] = slotInfo.hostTime;
+			mxGetPr(deviceTime)[k * numCameras + c] = slotInfo.deviceTime;
+			mxGetPr(frameCounter)[k * numCameras + c] = slotInfo.frameCounter;
+			mxGetPr(driverFrame)[k * numCameras + c] = slotInfo.driverFrame;
+		}
+		mxSetCell(frames, c, stack);
+		mxGetPr(unmatchedCounts)[c] = (double)unmatched[c];
+		mxSetCell(ownerNames, c, mxCreateString(owners[c].c_str()));
+		camera->releaseFrames(next[c]);
+	}
+	for (size_t k = 0; k < numTuples; k++)
+		mxGetPr(sessionIndex)[k] = (double)(tuplesReturned + k + 1);
+	tuplesReturned += numTuples;
+
+	const char *fields[] = { "time", "hostTime", "deviceTime", "frameCounter", "driverFrame", "sessionIndex", "unmatched", "owner" };
+	*info = mxCreateStructMatrix(1, 1, 8, fields);
+	mxSetField(*info, 0, "time", alignedTime);
+	mxSetField(*info, 0, "hostTime", hostTime);
+	mxSetField(*info, 0, "deviceTime", deviceTime);
+	mxSetField(*info, 0, "frameCounter", frameCounter);
+	mxSetField(*info, 0, "driverFrame", driverFrame);
+	mxSetField(*info, 0, "sessionIndex", sessionIndex);
+	mxSetField(*info, 0, "unmatched", unmatchedCounts);
+	mxSetField(*info, 0, "owner", ownerNames);
+	return frames;
+}
+
+bool CameraSession::handleCommand(const char *Command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (strcmp(Command, "StartSession") == 0)
+	{
+		start();
+		plhs[0] = mxCreateDoubleScalar(1);
+	}
+	else if (strcmp(Command, "GetAlignedFrames") == 0)
+	{
+		// [frames, info] = GetAlignedFrames([tolerance [, maxTuples]]), tolerance in sec (default 2 ms)
+		double tolerance = (nrhs > 1) ? mxGetScalar(prhs[1]) : 0.002;
+		int maxTuples = (nrhs > 2) ? (int)mxGetScalar(prhs[2]) : 0x7fffffff;
+		mxArray *info;
+		plhs[0] = getAlignedFrames(maxTuples, tolerance, &info);
+		if (nlhs > 1)
+			plhs[1] = info;
+		else
+			mxDestroyArray(info);
+	}
+	else if (strcmp(Command, "SessionCommand") == 0)
+	{
+		// SessionCommand(k, command, ...) - any camera command for camera k (1 based)
+		int k = (nrhs > 2) ? (int)mxGetScalar(prhs[1]) - 1 : -1;
+		char command[64];
+		if (k < 0 || k >= (int)cameras.size() || mxGetString(prhs[2], command, sizeof(command)) != 0)
+		{
+			mexPrintf("SessionCommand needs a camera between 1 and %d and a command.\n", (int)cameras.size());
+			plhs[0] = mxCreateDoubleScalar(0);
+			return true;
+		}
+		if (!cameras[k]->handleCommand(command, nlhs, plhs, nrhs - 2, prhs + 2))
+			mexPrintf("Error. Unknown command\n");
+	}
+	else
+		return false;
+	return true;
+}
+
+
+bool SyntheticBackend::open(const CameraConfig &config, CameraCore *_core)
+{
+	core = _core;
+	width = (config.width > 0) ? config.width : 640;
+	height = (config.height > 0) ? config.height : 480;
+	if (config.frameRate > 0)
+		frameRate = config.frameRate;
+	// a diagonal 12 bit ramp, scrolled by one pixel per frame
+	pattern.resize((size_t)width * height + width + height);
+	for (size_t k = 0; k < pattern.size(); k++)
+		pattern[k] = (unsigned short)((k % 4096) << 4);
+	frame.resize((size_t)width * height);
+	mexPrintf("Synthetic camera [%d x %d] at %.1f Hz\n", width, height, (double)frameRate);
+	return true;
+}
+
+bool SyntheticBackend::setFrameRate(double rate)
+{
+	if (rate <= 0)
+		return false;
+	frameRate = rate;
+	return true;
+}
+
+void SyntheticBackend::renderFrame(int n)
+{
+	size_t offset = (size_t)n % (width + height);
+	memcpy(frame.data(), pattern.data() + offset, frame.size() * sizeof(unsigned short));
+	// frame number in the first pixel, so dropped or reordered frames show up in MATLAB
+	frame[0] = (unsigned short)((n & 4095) << 4);
+}
+
+void SyntheticBackend::renderSpeckle(const std::vector<float> &input)
+{
+	// DMD patterns are mostly on / off, the modes that are off cost nothing
+	activeModes.clear();
+	for (int m = 0; m < numModes; m++)
+		if (input[m] != 0)
+			activeModes.push_back(m);
+	std::normal_distribution<double> gaussian(0.0, 1.0);
+	size_t numPixels = (size_t)width * height;
+	for (size_t p = 0; p < numPixels; p++)
+	{
+		const float *tRe = &transmissionRe[p * numModes];
+		const float *tIm = &transmissionIm[p * numModes];
+		float re = 0, im = 0;
+		for (size_t k = 0; k < activeModes.size(); k++)
+		{
+			int m = activeModes[k];
+			re += tRe[m] * input[m];
+			im += tIm[m] * input[m];
+		}
+		double gray = (re * re + im * im) * intensityScale;
+		if (electronsPerGray > 0)
+		{
+			// Poisson, Gaussian once the mean is large enough for it not to matter
+			double electrons = gray * electronsPerGray;
+			if (electrons < 30)
+				electrons = std::poisson_distribution<int>(electrons)(rng);
+			else
+				electrons += sqrt(electrons) * gaussian(rng);
+			gray = electrons / electronsPerGray;
+		}
+		if (readNoise > 0)
+			gray += readNoise * gaussian(rng);
+		gray = (MIN((MAX(floor(gray + 0.5), 0.0)), 4095.0));
+		frame[p] = (unsigned short)((int)gray << 4);
+	}
+}
+
+void SyntheticBackend::decodePicture(const std::vector<unsigned char> &packedFrame, std::vector<float> &input)
+{
+	// Binary, top-down, leftmost mirror in the MSB. Mode maps are made of blocks, so
+	// most bytes fall in a single mode and only need their bits counted.
+	input.assign(numModes, 0);
+	for (size_t k = 0; k < packedFrame.size(); k++)
+	{
+		unsigned char bits = packedFrame[k];
+		if (bits == 0)
+			continue;
+		if (byteMode[k] >= 0)
+		{
+			int on = 0;
+			for (; bits != 0; bits &= bits - 1)
+				on++;
+			input[byteMode[k]] += on;
+		}
+		else if (byteMode[k] == -2)
+		{
+			for (int b = 0; b < 8; b++)
+			{
+				int m = mirrorMode[k * 8 + b];
+				if (m >= 0 && (bits & (0x80 >> b)))
+					input[m] += 1;
+			}
+		}
+	}
+	for (int m = 0; m < numModes; m++)
+		input[m] = mirrorsPerMode[m] > 0 ? input[m] / mirrorsPerMode[m] : 0;
+}
+
+#ifdef ALP_SIMULATOR
+static void dmdFrameTap(void *context, const tAlpSimSynchPulse *pulse, const unsigned char *packedFrame, long, long)
+{
+	((SyntheticBackend*)context)->onDmdPicture(pulse->PulseCounter, pulse->TimestampUs, packedFrame);
+}
+
+static void dmdSynch(void *context, const tAlpSimSynchPulse *pulse)
+{
+	((SyntheticBackend*)context)->onDmdPicture(pulse->PulseCounter, pulse->TimestampUs, nullptr);
+}
+#endif
+
+void SyntheticBackend::onDmdPicture(unsigned long long pulseCounter, double timestampUs, const unsigned char *packedFrame)
+{
+	// ALPsim's projection thread: copy and leave, the rendering happens on the worker
+	std::lock_guard<std::mutex> lock(dmdMutex);
+	if (dmdPictures.size() >= DMD_TAP_QUEUE)
+		return;	// missed, shows up as a gap in the pulse counter
+	dmdPictures.push_back(DmdPicture());
+	DmdPicture &picture = dmdPictures.back();
+	picture.pulseCounter = pulseCounter;
+	picture.timestampUs = timestampUs;
+	if (packedFrame != nullptr)
+		picture.packedFrame.assign(packedFrame, packedFrame + (size_t)dmdWidth * dmdHeight / 8);
+	dmdReady.notify_one();
+}
+
+bool SyntheticBackend::connectDMD(long serialNumber, const mxArray *modeMap)
+{
+#ifdef ALP_SIMULATOR
+	disconnectDMD();
+	ALP_ID id;
+	long columns, rows;
+	if (AlpSimGetDeviceId(serialNumber, &id) != ALP_OK || AlpDevInquire(id, ALP_DEV_DISPLAY_WIDTH, &columns) != ALP_OK ||
+		AlpDevInquire(id, ALP_DEV_DISPLAY_HEIGHT, &rows) != ALP_OK)
+	{
+		mexPrintf("No simulated DMD is allocated, call ALPwrapper('Init') first.\n");
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(modelMutex);
+	if (numModes > 0)
+	{
+		// mode map: dmdHeight x dmdWidth mode numbers (1-based, 0 = not coupled into the
+		// fiber); by default the mirrors are split in a sqrt(numModes) square grid
+		size_t numMirrors = (size_t)columns * rows;
+		std::vector<float> map;
+		int gridSize = (int)floor(sqrt((double)numModes) + 0.5);
+		if (modeMap != nullptr && !mxIsEmpty(modeMap))
+		{
+			if (mxGetM(modeMap) != (size_t)rows || mxGetN(modeMap) != (size_t)columns || !getFloatArray(modeMap, map))
+			{
+				mexPrintf("The mode map must be a %d x %d array of mode numbers.\n", (int)rows, (int)columns);
+				return false;
+			}
+		}
+		else if (gridSize * gridSize != numModes)
+		{
+			mexPrintf("%d modes do not make a square grid, please pass a mode map.\n", numModes);
+			return false;
+		}
+		mirrorMode.assign(numMirrors, -1);
+		mirrorsPerMode.assign(numModes, 0);
+		for (long y = 0; y < rows; y++)
+		{
+			for (long x = 0; x < columns; x++)
+			{
+				int m = map.empty() ? (int)(y * gridSize / rows) * gridSize + (int)(x * gridSize / columns) : (int)map[(size_t)x * rows + y] - 1;
+				if (m < 0 || m >= numModes)
+					continue;
+				mirrorMode[(size_t)y * columns + x] = m;
+				mirrorsPerMode[m]++;
+			}
+		}
+		// -1: no mirror of the byte is coupled, -2: the byte spans several modes
+		byteMode.assign(numMirrors / 8, -1);
+		for (size_t k = 0; k < byteMode.size(); k++)
+		{
+			int m = mirrorMode[k * 8];
+			for (int b = 1; b < 8 && m != -2; b++)
+				if (mirrorMode[k * 8 + b] != m)
+					m = -2;
+			byteMode[k] = m;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(dmdMutex);
+		dmdPictures.clear();
+		dmdWidth = columns;
+		dmdHeight = rows;
+		lastPulseCounter = 0;
+	}
+	// the picture itself is only needed to render through the fiber
+	long status = (numModes > 0) ? AlpSimSetFrameTap(id, dmdFrameTap, this) : AlpSimSubscribeSynch(id, dmdSynch, this, &dmdSubscription);
+	if (status != ALP_OK)
+	{
+		mexPrintf("Error connecting to the simulated DMD (%d).\n", (int)status);
+		return false;
+	}
+	if (numModes == 0)
+		mexPrintf("No fiber model, the simulated DMD only triggers the frames.\n");
+	dmdId = id;
+	dmdConnected = true;
+	return true;
+#else
+	mexPrintf("Built without ALP_SIMULATOR, there is no simulated DMD to connect to.\n");
+	return false;
+#endif
+}
+
+void SyntheticBackend::disconnectDMD()
+{
+	if (!dmdConnected)
+		return;
+#ifdef ALP_SIMULATOR
+	// no callback runs once these return; they fail harmlessly if the DMD was freed
+	if (dmdSubscription != 0)
+		AlpSimUnsubscribeSynch(dmdId, dmdSubscription);
+	else
+		AlpSimSetFrameTap(dmdId, nullptr, nullptr);
+#endif
+	dmdSubscription = 0;
+	dmdConnected = false;
+	std::lock_guard<std::mutex> lock(dmdMutex);
+	dmdPictures.clear();
+	dmdReady.notify_all();
+}
+
+bool SyntheticBackend::handleCommand(const char *command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (strcmp(command, "SetSimulatedFiber") == 0)
+	{
+		// SetSimulatedFiber(Treal, Timag) - numPixels x numModes, pixels in MATLAB (:) order of
+		// a height x width frame. Timag may be [] for a real matrix.
+		size_t numPixels = (size_t)width * height;
+		std::vector<float> re, im;
+		bool ok = !dmdConnected && nrhs > 1 && getFloatArray(prhs[1], re) && !re.empty() && re.size() % numPixels == 0;
+		if (ok && nrhs > 2 && !mxIsEmpty(prhs[2]))
+			ok = getFloatArray(prhs[2], im) && im.size() == re.size();
+		if (ok)
+		{
+			std::lock_guard<std::mutex> lock(modelMutex);
+			numModes = (int)(re.size() / numPixels);
+			transmissionRe.assign(re.size(), 0);
+			transmissionIm.assign(re.size(), 0);
+			for (int m = 0; m < numModes; m++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					for (int y = 0; y < height; y++)
+					{
+						size_t in = (size_t)m * numPixels + (size_t)x * height + y;
+						size_t out = ((size_t)y * width + x) * numModes + m;
+						transmissionRe[out] = re[in];
+						transmissionIm[out] = im.empty() ? 0 : im[in];
+					}
+				}
+			}
+		}
+		else if (dmdConnected)
+			mexPrintf("Please call DisconnectSimulatedDMD before changing the fiber.\n");
+		else
+			mexPrintf("The transmission matrix must have %d rows (height x width pixels).\n", (int)numPixels);
+		plhs[0] = mxCreateDoubleScalar(ok);
+		return true;
+	}
+	if (strcmp(command, "SetSimulatedNoise") == 0)
+	{
+		// SetSimulatedNoise(intensityScale [, electronsPerGray [, readNoise [, dropProbability]]])
+		std::lock_guard<std::mutex> lock(modelMutex);
+		intensityScale = (nrhs > 1) ? mxGetScalar(prhs[1]) : 1;
+		electronsPerGray = (nrhs > 2) ? mxGetScalar(prhs[2]) : 0;
+		readNoise = (nrhs > 3) ? mxGetScalar(prhs[3]) : 0;
+		dropProbability = (nrhs > 4) ? mxGetScalar(prhs[4]) : 0;
+		plhs[0] = mxCreateDoubleScalar(1);
+		return true;
+	}
+	if (strcmp(command, "ConnectSimulatedDMD") == 0)
+	{
+		// ConnectSimulatedDMD([serialNumber [, modeMap]]) - the ALPsim device ALPwrapper
+		// allocated (0 = the first one). Every picture it shows renders one frame.
+		long serialNumber = (nrhs > 1) ? (long)mxGetScalar(prhs[1]) : 0;
+		plhs[0] = mxCreateDoubleScalar(connectDMD(serialNumber, (nrhs > 2) ? prhs[2] : nullptr));
+		return true;
+	}
+	if (strcmp(command, "DisconnectSimulatedDMD") == 0)
+	{
+		disconnectDMD();
+		plhs[0] = mxCreateDoubleScalar(1);
+		return true;
+	}
+	return false;
+}
+
+void SyntheticBackend::run()
+{
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::vector<float> input;
+	while (running)
+	{
+		DmdPicture picture;
+		bool fromDmd = false;
+		if (dmdConnected)
+		{
+			// the simulated DMD triggers the frame
+			std::unique_lock<std::mutex> lock(dmdMutex);
+			if (dmdPictures.empty())
+				dmdReady.wait_for(lock, std::chrono::milliseconds(10));
+			if (dmdPictures.empty())
+				continue;
+			picture.packedFrame.swap(dmdPictures.front().packedFrame);
+			picture.pulseCounter = dmdPictures.front().pulseCounter;
+			picture.timestampUs = dmdPictures.front().timestampUs;
+			dmdPictures.pop_front();
+			// pictures the queue had no room for are frames the camera never saw
+			if (lastPulseCounter > 0 && picture.pulseCounter > lastPulseCounter + 1)
+				frameNumber += (int)(picture.pulseCounter - lastPulseCounter - 1);
+			lastPulseCounter = picture.pulseCounter;
+			fromDmd = true;
+		}
+		else if (externalTrigger)
+		{
+			if (pendingTriggers == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				continue;
+			}
+			pendingTriggers--;
+		}
+		else
+		{
+			next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+			std::this_thread::sleep_until(next);
+		}
+		// the DMD clock, or the scheduled exposure time, stands in for a camera timestamp
+		double deviceTime;
+		if (fromDmd)
+			deviceTime = picture.timestampUs * 1e-6;
+		else
+			deviceTime = std::chrono::duration<double>((externalTrigger ? std::chrono::steady_clock::now() : next).time_since_epoch()).count();
+		bool dropped;
+		{
+			std::lock_guard<std::mutex> lock(modelMutex);
+			if (fromDmd && !picture.packedFrame.empty() && numModes > 0)
+			{
+				decodePicture(picture.packedFrame, input);
+				renderSpeckle(input);
+			}
+			else
+				renderFrame(frameNumber);
+			dropped = dropProbability > 0 && uniform(rng) < dropProbability;
+		}
+		if (!dropped)
+			core->onFrame(frame.data(), frame.size() * sizeof(unsigned short), frameNumber, deviceTime);
+		frameNumber++;
+	}
+}
+
+bool SyntheticBackend::start()
+{
+	running = true;
+	worker = std::thread(&SyntheticBackend::run, this);
+	return true;
+}
+
+void SyntheticBackend::stop()
+{
+	running = false;
+	if (worker.joinable())
+		worker.join();
+}
@@ -0,0 +1,750 @@
+/*
+Camera Acquisition Core
+Programmed by Shay Ohayon
+DiCarlo Lab @ MIT
+
+Shared by PTwrapper, ISwrapper and XimeaWrapper. The core owns everything that is
+not vendor specific: the frame ring, the averaging engines, the export kernels,
+trigger counting, buffer statistics and the MATLAB command dispatch. Each wrapper is
+a thin ICameraBackend that opens the device, delivers frames with onFrame and maps
+exposure / gain / frame rate / trigger mode onto its SDK.
+
+Build options:
+  * As the shared MEX\CameraCore.dll (CameraCore.vcxproj; the x64 configurations of
+    PTwrapper and XimeaWrapper define CAMERACORE_SHARED and link CameraCore.lib). Keep
+    MEX on the PATH or copy the dll next to the mex files. Every camera mex then sees
+    the same CameraSession, so one session can hold cameras of several vendors. The
+    dll and the wrappers must share the dll CRT (/MD), since cameras cross the boundary.
+  * Compiled straight into a single mex, as before:
+    mex -I../CameraCore PTwrapper.cpp ../CameraCore/CameraCore.cpp ...
+    Each mex then has a session of its own.
+
+Revision History
+Version 0.1 10/18/2026
+
+*/
+#ifndef CAMERA_CORE_H
+#define CAMERA_CORE_H
+
+#include "mex.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <deque>
+#include <condition_variable>
+
+#if defined(_WIN32) && defined(CAMERACORE_SHARED)
+#ifdef CAMERACORE_EXPORTS
+#define CAMERACORE_API __declspec(dllexport)
+#else
+#define CAMERACORE_API __declspec(dllimport)
+#endif
+#else
+#define CAMERACORE_API
+#endif
+
+#ifndef MIN
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#endif
+#ifndef MAX
+#define MAX(a,b) ((a)>(b)?(a):(b))
+#endif
+
+
+// Frame pool. A fixed-capacity ring of frame slots carved out of one slab that is
+// allocated at init (large pages when the process may lock memory). The backend's
+// frame callback copies each frame into the next free slot; when the ring is full the
+// new frame is dropped and counted, buffered frames are never overwritten.
+//
+// The ring is a single-producer / single-consumer queue. writePos (frames published)
+// is only advanced by the frame callback and readPos (frames released) only by the mex
+// thread, both are monotonic frame counts. A reader claims the span of published
+// frames, copies it without any lock and releases it afterwards, so a long
+// GetImageBuffer never stalls the callback.
+//
+// Shared export (SetSharedExport) carves the same ring out of a memory mapped file instead,
+// so another process (Python, a second MATLAB with memmapfile) reads the frames where they
+// are. The file is a 4096 byte SharedPoolHeader, the FrameSlotInfo table (capacity x 32
+// bytes, padded to 4K), then the slots. The positions live in the header: frames
+// [readPosition, writePosition) are valid, frame p sits in slot p % capacity, and the one
+// consumer releases frames by raising readPosition.
+const size_t FRAME_SLOT_ALIGNMENT = 4096;
+
+struct FrameSlotInfo {	// 32 bytes, shared export table layout
+	int frameCounter;	// trigger number (numTrig) of the frame
+	int driverFrame;	// frame number reported by the camera driver, -1 if none
+	double hostTime;	// sec, steady clock when the frame reached the core
+	double deviceTime;	// sec, camera / driver timestamp of the frame, -1 if none
+	unsigned short maxValue;	// brightest pixel inside the capture ROI, exported gray levels
+	unsigned int numSaturated;	// pixels inside the capture ROI at or above the saturation level
+};
+
+// Field offsets are fixed for readers in other languages (bytes):
+//   magic 0, version 8, headerBytes 12, infoOffset 16, slotOffset 24, slotBytes 32,
+//   capacity 40, width 48, height 52, bytesPerPixel 56, exportShift 60, packedBits 64,
+//   writePosition 72, readPosition 80
+struct SharedPoolHeader {
+	char magic[8];			// "FSCAMSHM"
+	int version, headerBytes;
+	long long infoOffset, slotOffset;	// from the start of the file
+	long long slotBytes, capacity;
+	int width, height, bytesPerPixel, exportShift, packedBits, reserved;
+	std::atomic<unsigned long long> writePosition;	// frames published, raised by the camera
+	std::atomic<unsigned long long> readPosition;	// frames released, raised by the consumer
+};
+static_assert(sizeof(FrameSlotInfo) == 32 && sizeof(SharedPoolHeader) == 88, "shared export layout changed");
+
+class CAMERACORE_API FramePool {
+public:
+	FramePool();
+	~FramePool() { release(); }
+	// sharedFile: back the ring with this memory mapped file, nullptr / empty = private memory
+	bool allocate(size_t frameBytes, size_t numSlots, const char *sharedFile = nullptr);
+	void release();
+	// producer (frame callback)
+	unsigned char* claim();
+	void commit(const FrameSlotInfo &slotInfo);
+	unsigned long long writePosition() { return writePos->load(std::memory_order_relaxed); }
+	unsigned long long readPosition() { return readPos->load(std::memory_order_relaxed); }	// only exact on the reader thread
+	unsigned char* atPosition(unsigned long long pos) { return slab + (size_t)(pos % capacity) * slotBytes; }
+	// consumer (mex thread)
+	size_t claimRead(size_t maxFrames);
+	// how many of the n oldest frames sit back to back in the slab (before the wrap)
+	size_t contiguous(size_t n) { return MIN(n, capacity - (size_t)(readPos->load(std::memory_order_relaxed) % capacity)); }
+	unsigned char* at(size_t k) { return atPosition(readPos->load(std::memory_order_relaxed) + k); }	// k-th oldest frame
+	const FrameSlotInfo& infoAt(size_t k) { return info[(size_t)((readPos->load(std::memory_order_relaxed) + k) % capacity)]; }
+	void releaseRead(size_t n);
+	void releaseTo(unsigned long long position);	// forward only
+	void clear() { releaseTo(writePos->load(std::memory_order_acquire)); }
+	void resetStats() { framesStored = 0; overflowDropped = 0; highWatermark = 0; }
+	size_t size() { return (size_t)(writePos->load(std::memory_order_acquire) - readPos->load(std::memory_order_acquire)); }
+	size_t getCapacity() { return capacity; }
+	size_t getSlotBytes() { return slotBytes; }
+	bool usesLargePages() { return largePages; }
+	SharedPoolHeader* getSharedHeader() { return sharedHeader; }	// nullptr unless shared
+	const std::string& getSharedFile() { return sharedFile; }
+
+	std::atomic<unsigned long long> framesStored, overflowDropped;
+	std::atomic<size_t> highWatermark;
+private:
+	bool mapSharedFile(const char *fileName, size_t totalBytes);
+
+	unsigned char *slab;
+	size_t slabBytes, slotBytes, capacity;
+	// in this object, or in the shared header
+	std::atomic<unsigned long long> localWritePos, localReadPos;
+	std::atomic<unsigned long long> *writePos, *readPos;
+	std::vector<FrameSlotInfo> localInfo;
+	FrameSlotInfo *info;
+	bool largePages;
+
+	std::string sharedFile;
+	SharedPoolHeader *sharedHeader;		// start of the mapped file
+	size_t sharedBytes;
+#ifdef _WIN32
+	void *sharedFileHandle, *sharedMapping;
+#endif
+};
+
+
+// Row-major 16 bit frame -> column-major (MATLAB) frame, every pixel shifted right by 'shift'
+CAMERACORE_API void transposeShift16(const unsigned short *in, unsigned short *out, int width, int height, int shift);
+// Row-major 8 bit frame -> column-major (MATLAB) frame
+CAMERACORE_API void transpose8(const unsigned char *in, unsigned char *out, int width, int height);
+// Exports frames [first, first + numFrames) of the ring to a column-major uint16 array.
+// Packed frames (packedBits > 0) already hold exported gray levels, 'shift' is ignored.
+CAMERACORE_API void exportFrames16(FramePool &pool, size_t first, size_t numFrames, unsigned short *out, int width, int height, int shift, int packedBits = 0);
+
+// Optional packed storage. Exported gray levels (raw >> shift) are packed into a
+// little-endian bit stream of 'bits' bits per sample: 12 bit = 2 samples in 3 bytes,
+// 10 bit = 4 samples in 5 bytes. Lossless for data within the camera's bit depth.
+inline size_t packedFrameBytes(size_t numSamples, int bits) { return (numSamples * bits + 7) / 8; }
+CAMERACORE_API void packSamples(const unsigned short *in, size_t numSamples, int shift, int bits, unsigned char *out);
+CAMERACORE_API void unpackSamples(const unsigned char *in, size_t numSamples, int bits, unsigned short *out);
+
+// Lossless codec of the compressed recorder. Every sample is predicted from its left
+// neighbour (the first of a row from the one above it), the residual is zigzag mapped
+// (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...) and each block of 16 codes is stored with the
+// bit width of its largest one, in the packSamples bit stream:
+//   [one width byte (0..16) per block][block 0, 2 * width bytes][block 1]...
+// Noise limited frames lose the bits the noise does not use, dark and saturated regions
+// shrink to almost nothing. 'shift' as in transposeShift16; the decoder returns the
+// exported gray levels. scratch is resized as needed.
+const size_t CODEC_BLOCK = 16;
+inline size_t compressedFrameBound(size_t numSamples) { return (numSamples + CODEC_BLOCK - 1) / CODEC_BLOCK * (1 + 2 * CODEC_BLOCK); }
+CAMERACORE_API size_t compressFrame16(const unsigned short *in, int width, int height, int shift, unsigned char *out, std::vector<unsigned short> &scratch);
+// false if the data is cut short or corrupt
+CAMERACORE_API bool decompressFrame16(const unsigned char *in, size_t inBytes, int width, int height, unsigned short *out);
+
+
+// Software region of interest applied in the capture path, before a frame is stored or
+// averaged. Every step-th pixel of the region is kept (decimation), or step x step
+// blocks are averaged (binning).
+struct CaptureROI {
+	CaptureROI() : x0(0), y0(0), width(0), height(0), step(1), binning(false) {}
+	int x0, y0, width, height;	// sensor pixels, 0 based
+	int step;
+	bool binning;
+	int outWidth() const { return binning ? width / step : (width + step - 1) / step; }
+	int outHeight() const { return binning ? height / step : (height + step - 1) / step; }
+};
+
+// Crops a row-major 16 bit sensor frame to the ROI, and measures the max and the number of
+// samples >= satRaw over the whole ROI on the way
+CAMERACORE_API void cropFrame16(const unsigned short *in, int inWidth, const CaptureROI &roi, unsigned short *out, std::vector<unsigned int> &binRow,
+	unsigned short satRaw, unsigned short &maxRaw, unsigned int &numSaturated);
+CAMERACORE_API void regionStats16(const unsigned short *in, int stride, int width, int height, unsigned short satRaw, unsigned short &maxRaw, unsigned int &numSaturated);
+
+
+// Averaging mode accumulator. Every frame is added into a uint32 sum plane (and
+// optionally a uint64 sum-of-squares plane) and the division happens once, at
+// readout, so the mean is exact instead of being re-quantized on every frame.
+// The sums are exact integers, so the variance can be taken straight from them
+// without losing precision.
+class CAMERACORE_API FrameAccumulator {
+public:
+	FrameAccumulator() : numPixels(0), numPlanes(0), withSquares(false) {}
+	bool allocate(size_t _numPixels, size_t _numPlanes, bool _withSquares);
+	void add(size_t plane, const unsigned short *frame);
+	void mean(size_t plane, unsigned short *out, int exportShift);
+	void variance(size_t plane, float *out, int width, int height, int exportShift);
+	unsigned int count(size_t plane) { return counts[plane]; }
+	size_t getNumPlanes() { return numPlanes; }
+	bool hasSquares() { return withSquares; }
+private:
+	size_t numPixels, numPlanes;
+	bool withSquares;
+	std::vector<unsigned int> sums;
+	std::vector<unsigned long long> squares;
+	std::vector<unsigned int> counts;
+};
+
+
+// Reconstruction mode accumulator. Every (0, pi/2, pi) triple adds its complex field
+// (I0 - Ipi_2) + i*(Ipi_2 - Ipi) into int32 real / imaginary sum planes, so repetitions
+// are averaged in cos/sin space and the atan2 runs once per pixel, at readout. The sums
+// are linear in the frames, so the result is exactly the phase of the averaged frames
+// that the calibration computes offline.
+class CAMERACORE_API PhaseAccumulator {
+public:
+	PhaseAccumulator() : numPixels(0), numPlanes(0) {}
+	bool allocate(size_t _numPixels, size_t _numPlanes);
+	void release();
+	void add(size_t plane, const unsigned short *I0, const unsigned short *Ipi_2, const unsigned short *Ipi);
+	void phase(size_t plane, float *out);	// -pi..pi, row-major
+	unsigned int count(size_t plane) { return counts[plane]; }
+	size_t getNumPlanes() { return numPlanes; }
+	size_t getNumPixels() { return numPixels; }
+private:
+	size_t numPixels, numPlanes;
+	std::vector<int> re, im;
+	std::vector<unsigned int> counts;
+};
+
+
+// HDR mode accumulator. The frames of an exposure / ND bracket are merged into a
+// radiance map as they arrive. Every sample adds w * (sample - dark) * scale to a float
+// sum plane and w to a weight plane, where scale is the radiance multiplier of the
+// current bracket level (10^ND, or a reference exposure over this one) and w is a hat
+// that falls to zero at lowCut above the dark frame and at highCut (saturation):
+//   w = max(0, min(sample - dark - lowCut, highCut - sample)) / scale
+// Dividing by the scale lets the longer exposure of two valid samples count more. The
+// division runs once, at readout; pixels that never had a valid sample read as NaN.
+class CAMERACORE_API HdrAccumulator {
+public:
+	HdrAccumulator() : numPixels(0), numPlanes(0), scale(1), lowCut(0), highCut(0) {}
+	// dark is row-major in raw units (empty = no dark frame), cuts in raw units
+	bool allocate(size_t _numPixels, size_t _numPlanes, const std::vector<float> &_dark, float _lowCut, float _highCut);
+	void release();
+	void setScale(float _scale) { scale = _scale; }
+	void add(size_t plane, const unsigned short *frame);
+	void radiance(size_t plane, float *out, int width, int height, float unit);	// column-major, out = sum / weight * unit
+	unsigned int count(size_t plane) { return counts[plane]; }
+	size_t getNumPlanes() { return numPlanes; }
+private:
+	size_t numPixels, numPlanes;
+	float scale, lowCut, highCut;
+	std::vector<float> dark, sums, weights;
+	std::vector<unsigned int> counts;
+};
+
+// Direct-to-disk recorder. A writer thread takes the place of the MATLAB reader: it
+// drains the frame ring straight into a file with large writes issued from the ring
+// slots themselves (no copy; slots are 4K aligned and a multiple of 4K long, so the file
+// can be opened unbuffered / O_DIRECT). Frames are stored as they sit in the ring (raw
+// 16 bit words, or packed after SetPackedStorage), one slot per frame:
+//   [4096 byte header][frame 0, slotBytes][frame 1, slotBytes]...
+// and a sidecar <file>.idx holds one record per frame (trigger count, driver frame
+// number, host time, camera time). MATLAB keeps previewing through a copy of the newest frame the
+// writer made, at most ~30 times a second. See Software/readCameraRecording.m.
+// Compressed recordings (header version 3, codec 1) store every frame with
+// compressFrame16 instead, back to back after the header; the frames of a batch are
+// compressed in parallel into an aligned staging buffer, and the index records gain the
+// file offset of the frame.
+struct RecordingHeader {
+	char magic[8];			// "FSCAMREC"
+	int version, headerBytes;
+	int width, height, bytesPerPixel, exportShift;
+	long long slotBytes;	// file stride of a frame
+	long long numFrames;	// written at StopRecording
+	double startTime;		// host time of the first frame (sec, steady clock)
+	int packedBits;			// version 2: 0 = 16 bit words, else samples packed to this many bits
+	int codec;				// version 3: 1 = compressFrame16, slotBytes 0
+};
+
+class CAMERACORE_API FrameRecorder {
+public:
+	FrameRecorder();
+	~FrameRecorder() { stop(); }
+	// Creates the file; maxFrames > 0 preallocates it and stops writing after that many
+	// frames. From open on the recorder counts as recording, begin starts the writer.
+	bool open(const char *fileName, int width, int height, int bytesPerPixel, int exportShift, int packedBits, size_t slotBytes, unsigned long long maxFrames, bool compressed = false);
+	void begin(FramePool *_pool);
+	// writes the frames published up to now, returns the number of frames in the file
+	unsigned long long stop();
+	bool isRecording() { return running; }
+	bool getPreview(std::vector<unsigned char> &frame, FrameSlotInfo &slotInfo);
+	mxArray* getStatus();
+private:
+	void run();
+	size_t writeBatch(size_t numFrames);
+	bool compressBatch(size_t numFrames);
+	bool flushStaging();
+	bool writeAt(const void *data, size_t bytes, unsigned long long offset);
+	bool reserve(unsigned long long bytes);
+	bool openFile(const char *fileName);
+	void closeFile(unsigned long long finalBytes);
+	void setError(const char *message);
+	std::string getError();
+
+	FramePool *pool;
+	std::string fileName;
+#ifdef _WIN32
+	void *file;
+#else
+	int file;
+#endif
+	FILE *indexFile;
+	bool unbuffered;
+	RecordingHeader header;
+	std::vector<unsigned char> headerStorage;
+	unsigned char *headerBlock;		// one aligned 4K block inside headerStorage
+	unsigned long long maxFrames, reservedBytes;
+	int sampleShift, samplePackedBits;	// how the ring holds the samples, compressed files hold gray levels
+	bool compressed;
+	std::vector<unsigned char> stagingStorage;
+	unsigned char *staging;			// aligned, compressed frames not yet on disk for good
+	size_t stagingCapacity, stagedBytes;
+	unsigned long long stagingOffset;	// file offset of staging[0], a multiple of 4K
+	std::vector<unsigned long long> frameOffsets;	// of the batch being written
+	std::atomic<bool> running, stopRequested, failed;
+	std::atomic<unsigned long long> stopPosition;	// ring write position at the stop request
+	std::atomic<unsigned long long> framesWritten, bytesWritten;
+	double startHostTime, stopHostTime;
+	std::mutex errorMutex;
+	std::string lastError;	// set by the writer thread
+	std::thread worker;
+
+	std::mutex previewMutex;
+	std::vector<unsigned char> previewFrame;
+	FrameSlotInfo previewInfo;
+	bool previewValid;
+	double lastPreviewTime;
+};
+
+
+// Init parameters. Zero / empty fields leave the choice to the backend.
+struct CameraConfig {
+	CameraConfig() : x0(0), y0(0), width(0), height(0), mode(-1), deviceIndex(0), frameRate(0) {}
+	int x0, y0, width, height;
+	int mode;				// vendor imaging mode (Point Grey format 7 mode)
+	int deviceIndex;		// which of the connected cameras (bus order), 0 = first
+	double frameRate;		// Hz, free running rate of the synthetic backend
+	std::string deviceName, videoFormat;
+};
+
+// Acquisition health. The frame callback checks every frame against the previous one
+// as it arrives, so a lost frame is known at once instead of from a trigger count that
+// does not add up at the end of a calibration. Losses are counted per cause:
+//   bufferFull  the ring was full (the reader fell behind)
+//   driverSkip  numbers missing from the driver's frame counter (lost before the core)
+//   truncated   incomplete frames, counted as a trigger but not stored
+// A callback is late when it reached the core more than LATE_CALLBACK_SEC after the
+// camera clock says it should have, measured against the previous frame (so the drift
+// between the two clocks does not add up).
+const double LATE_CALLBACK_SEC = 0.005;
+const size_t MAX_GAP_EVENTS = 256;
+
+struct FrameGap {
+	int frameCounter;		// trigger number of the first frame after the gap
+	int expectedFrame, driverFrame;
+	double hostTime;
+};
+
+struct CAMERACORE_API AcquisitionHealth {
+	AcquisitionHealth() { reset(); }
+	void reset();
+	void resync() { lastDriverFrame = -1; lastDeviceTime = -1; }	// the next frame starts a new sequence
+	// called for every frame by the callback, before the frame is stored
+	void frameArrived(int frameCounter, int driverFrame, double deviceTime, double hostTime);
+
+	unsigned long long framesReceived, bufferFull, driverSkip, truncated, lateCallbacks, counterResets;
+	int lastDriverFrame;
+	double lastDeviceTime, lastHostTime;
+	double maxCallbackLag;		// sec, worst lateness relative to the camera clock
+	double maxCallbackDuration;	// sec, worst time spent in onFrame
+	std::vector<FrameGap> gaps;	// the first MAX_GAP_EVENTS gaps
+};
+
+// Live preview. The frame callback keeps every step-th pixel (step 1, 2 or 4) of the
+// newest frame it stored or averaged, together with the frame's statistics, refreshed
+// at most PREVIEW_RATE_HZ times a second. A GUI timer polls it for the cost of the
+// preview alone, without touching the ring. Histogram (PREVIEW_HISTOGRAM_BINS bins over
+// the camera's gray levels), min and mean are taken over the preview pixels; max and the
+// saturated count over the whole frame, as the callback measured them.
+const double PREVIEW_RATE_HZ = 30;
+const int PREVIEW_HISTOGRAM_BINS = 256;
+
+class CAMERACORE_API LivePreview {
+public:
+	LivePreview() : step(2), frameWidth(0), frameHeight(0), bitDepth(12), lastUpdate(-1), updates(0), valid(false) {}
+	void configure(int _frameWidth, int _frameHeight, int _bitDepth);	// frame geometry changed, drops the preview
+	bool setStep(int _step);
+	int getStep() { return step; }
+	bool due(double now) { return now - lastUpdate >= 1.0 / PREVIEW_RATE_HZ; }
+	// row-major frame of 1 or 2 bytes per pixel, gray level = sample >> shift
+	void update(const unsigned char *frame, int bytesPerPixel, int shift, const FrameSlotInfo &slotInfo, double now);
+	mxArray* get();
+private:
+	int outWidth() { return (frameWidth + step - 1) / step; }
+	int outHeight() { return (frameHeight + step - 1) / step; }
+
+	// written by the callback (configMutex held), then swapped into the published copy
+	int step, frameWidth, frameHeight, bitDepth;
+	double lastUpdate;
+	std::vector<unsigned short> work;
+	std::vector<unsigned int> workHistogram;
+
+	std::mutex previewMutex;
+	std::vector<unsigned short> image;	// column-major, outHeight x outWidth
+	std::vector<unsigned int> histogram;
+	FrameSlotInfo info;
+	unsigned short minValue;
+	double meanValue;
+	unsigned long long updates;
+	bool valid;
+};
+
+class CameraCore;
+
+// Vendor adapter. open() configures the device and fixes the frame geometry, the core
+// then allocates its buffers and calls start(), after which the backend delivers every
+// frame with core->onFrame from its callback or acquisition thread. stop() must not
+// return while a frame is still being delivered.
+class ICameraBackend {
+public:
+	virtual ~ICameraBackend() {}
+	virtual bool open(const CameraConfig &config, CameraCore *core) = 0;
+	virtual bool start() = 0;
+	virtual void stop() = 0;
+	virtual void close() = 0;
+
+	virtual int getWidth() = 0;
+	virtual int getHeight() = 0;
+	virtual int getBytesPerPixel() = 0;
+	// right shift that brings a raw 16 bit sample to the exported gray levels
+	// (4 for 12 bit data in the upper bits, 0 for data that sits in the low bits)
+	virtual int getExportShift() = 0;
+	virtual int getBitDepth() = 0;		// of the exported gray levels
+
+	virtual bool softwareTrigger() = 0;
+	virtual bool setTriggerMode(bool external) = 0;
+	virtual bool setExposure(double seconds) = 0;
+	virtual double getExposure() = 0;			// sec
+	virtual bool setGain(double value) = 0;
+	virtual double getGain() = 0;
+	virtual bool setFrameRate(double rate) { return false; }
+	virtual double getFrameRate() { return -1; }
+	virtual void printStats() {}
+	// frames the driver / camera itself reports as dropped since start, -1 if it cannot tell
+	virtual long long getDriverDropped() { return -1; }
+	// vendor specific mex commands, tried before the common ones
+	virtual bool handleCommand(const char *command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) { return false; }
+};
+
+
+class CAMERACORE_API CameraCore {
+public:
+	CameraCore(ICameraBackend *_backend);	// takes ownership of the backend
+	~CameraCore();
+	bool init(const CameraConfig &config);
+	void release();
+	bool isInitialized() { return initialized; }
+	ICameraBackend* getBackend() { return backend; }
+
+	// producer side, called by the backend for every frame it receives. 'data' only has
+	// to stay valid for the duration of the call. driverFrame is the camera's own frame
+	// counter and deviceTime its timestamp (sec), -1 for either when the camera has none.
+	void onFrame(const void *data, size_t bytes, int driverFrame, double deviceTime = -1);
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+	int getBytesPerPixel() { return bytesPerPixel; }
+	int getNumImagesInBuffer() { return (int)framePool.size(); }
+	void clearBuffer() { framePool.clear(); }
+	int getNumTrigs() { return (int)numTrig; }
+	void resetTriggerCounter();	// and the acquisition health
+	void setTrigger(bool state) { triggerEnabled = state; resyncHealth = true; }
+	int copyAndClearBuffer(unsigned char *imageBufferPtr, int N, std::vector<FrameSlotInfo> *frameInfo = nullptr);
+	int pokeLastFrames(unsigned char *imageBufferPtr, int N);
+	bool startAveraging(int numFrames, bool ReconstructionMode, bool withVariance);
+	// dark: column-major exported gray levels, empty for none; cuts in exported gray levels
+	bool startHdr(int numFrames, const std::vector<float> &darkFrame, double lowCut, double highCut);
+	bool setHdrScale(double scale);
+	void stopAveraging();
+	bool inAveragingMode() { return averagingMode; }
+	bool successfulAveraging() { return numTrig % (reconstructionBlock ? 3 * averagingBlockSize : averagingBlockSize) == 0; }
+	mxArray* getVarianceBuffer();
+	mxArray* getAveragingCounts();
+	mxArray* getPhaseBuffer();
+	mxArray* getPhaseStats();
+	mxArray* getHdrBuffer();
+	mxArray* getHdrCounts();
+	mxArray* getBufferStats();
+	mxArray* getAcquisitionHealth();
+	bool setBufferCapacity(size_t numFrames);
+	bool setCaptureROI(const CaptureROI &roi);	// width 0 = full frame
+	bool setPackedStorage(bool enable);
+	bool startRecording(const char *fileName, unsigned long long maxFrames, bool compressed = false);
+	unsigned long long stopRecording() { return recorder.stop(); }
+	bool isRecording() { return recorder.isRecording(); }
+	bool isSharedExport() { return !sharedExportFile.empty(); }
+	bool setSaturationLevel(int level);
+	bool setPreviewStep(int step);
+	// ring in a memory mapped file another process reads directly, empty name = private memory
+	bool setSharedExport(const std::string &fileName);
+	mxArray* getSharedRange();
+	bool releaseSharedFrames(unsigned long long position);
+
+	// reader access for CameraSession (mex thread). Frames [0, n) of claimFrames stay put
+	// until releaseFrames; the recorder must not be running.
+	size_t claimFrames() { return framePool.claimRead(framePool.getCapacity()); }
+	const FrameSlotInfo& claimedFrameInfo(size_t k) { return framePool.infoAt(k); }
+	void exportClaimedFrame(size_t k, unsigned char *out);	// column-major, like GetImageBuffer
+	void releaseFrames(size_t n) { framePool.releaseRead(n); }
+	mxArray* getPreview() { return preview.get(); }
+
+	// the commands every camera mex understands (GetImageBuffer, StartAveraging, ...)
+	bool handleCommand(const char *Command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+
+private:
+	bool allocateFramePool();
+	void storeAverages();
+	void quantizePhase(const float *phase, unsigned short *dataOut);
+	int copyAndClearBuffer8Bit(unsigned char *imageBufferPtr, int numToCopy);
+	int copyAndClearBuffer16Bit(unsigned char *imageBufferPtr, int numToCopy);
+	void storeFrame(const unsigned char *data, unsigned char *out, FrameSlotInfo &slotInfo);
+	void updatePreview(const unsigned char *frame, const FrameSlotInfo &slotInfo, double now);
+	unsigned short rawSaturationLevel();
+	size_t storedFrameBytes();
+	void resetCounters();	// configMutex held
+	double hostTime();
+
+	ICameraBackend *backend;
+	bool initialized, streaming;
+	int sensorWidth, sensorHeight;
+	int width, height, bytesPerPixel, exportShift;	// of the stored (cropped) frames
+	int bitDepth;
+	int packedBits;		// ring frames packed to this many bits per pixel, 0 = 16 bit words
+	CaptureROI captureROI;
+	std::vector<unsigned short> cropScratch;
+	std::vector<unsigned int> binRow;
+	std::atomic<int> saturationLevel;	// exported gray level, set from mex while frames arrive
+
+	// only guards against reconfiguration (averaging mode, buffer reallocation) while a
+	// frame is delivered; buffer reads never take it
+	std::mutex configMutex;
+	std::atomic<bool> triggerEnabled, resyncHealth;
+	std::atomic<unsigned long> numTrig;
+
+	FramePool framePool;
+	AcquisitionHealth health;	// guarded by configMutex
+	FrameRecorder recorder;		// the ring's reader while recording
+	LivePreview preview;
+	size_t requestedPoolFrames;	// 0 = size from available physical memory
+	std::string sharedExportFile;	// empty = the ring is private memory
+	FrameAccumulator accumulator;
+	bool averagingMode, reconstructionMode;
+	bool reconstructionBlock;	// the last averaging block was a reconstruction
+	int averagingBlockSize;
+	PhaseAccumulator phaseAccumulator;
+	std::vector<unsigned short> phaseFrames[2];	// I0, Ipi_2 of the current triple
+	std::vector<unsigned short> phaseMax;		// per plane, brightest raw frame of its triples
+	std::vector<unsigned int> phaseSaturated;
+	int phaseWidth, phaseHeight;
+	HdrAccumulator hdrAccumulator;
+	bool hdrMode, hdrBlock;		// hdrBlock: the last averaging block was an HDR merge
+	int hdrWidth, hdrHeight;
+};
+
+
+// Multi-camera session. Owns a set of cameras (Point Grey, Ximea, synthetic ones) and
+// hands their frames out as aligned tuples instead of one polled buffer per camera.
+// Built as the shared CameraCore library there is one session per process: the
+// wrappers add their cameras to it (InitSession / AddToSession) and any of them reads
+// the tuples, so a Point Grey behavior camera and a Ximea fluorescence camera can be
+// captured together. Each camera remembers the mex that added it, which removes its
+// cameras before it unloads (the backend code lives there).
+//
+// Frames are aligned on the camera timestamps. Every camera clock is mapped onto the
+// host steady clock with the smallest (hostTime - deviceTime) seen so far, the
+// transfer latency without the callback jitter, allowed to drift by
+// SESSION_CLOCK_DRIFT; cameras without timestamps fall back to hostTime. A tuple is the
+// first camera's frame plus the frame of every other camera within 'tolerance' of it;
+// frames that find no partner are dropped and counted. StartSession clears all buffers,
+// trigger counters and clock estimates, and the session index counts tuples from there.
+const double SESSION_CLOCK_DRIFT = 1e-4;	// sec per sec, 100 ppm
+
+struct SessionClock {
+	SessionClock() : valid(false), offset(0), lastDeviceTime(0), lastFrameCounter(-1) {}
+	bool valid;
+	double offset;				// host = device + offset
+	double lastDeviceTime;
+	int lastFrameCounter;		// frames up to this one are in the estimate
+};
+
+class CAMERACORE_API CameraSession {
+public:
+	CameraSession() : tuplesReturned(0) {}
+	~CameraSession() { release(); }
+	static CameraSession& shared();		// the process-wide session of the shared library
+	// takes ownership, the camera is initialized; owner is the adding mex ("PTwrapper")
+	bool addCamera(CameraCore *camera, const char *owner);
+	void release(size_t firstCamera = 0);	// cameras [firstCamera, end)
+	void releaseOwner(const char *owner);	// the cameras one mex added, before it unloads
+	size_t getNumCameras() { return cameras.size(); }
+	void start();
+	// cell array of h x w x numTuples stacks, one per camera; info has per-tuple time
+	// (aligned, host clock), hostTime, deviceTime, frameCounter, driverFrame (numCameras x
+	// numTuples), sessionIndex, the unmatched counts and each camera's owner
+	mxArray* getAlignedFrames(int maxTuples, double tolerance, mxArray **info);
+	// StartSession, GetAlignedFrames, SessionCommand(k, command, ...) -> camera k
+	bool handleCommand(const char *Command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+private:
+	void updateClock(size_t c, size_t numFrames);
+	double frameTime(size_t c, size_t k);
+
+	std::vector<CameraCore*> cameras;
+	std::vector<std::string> owners;
+	std::vector<SessionClock> clocks;
+	std::vector<unsigned long long> unmatched;
+	unsigned long long tuplesReturned;
+};
+
+
+// Frame generator for benchmarks and for running the MATLAB side without a camera.
+// Free runs at config.frameRate (100 Hz by default), or produces one frame per
+// SoftwareTrigger once the trigger mode is set to external. Frames are 12 bit data in
+// the upper bits of a 16 bit word, like the Point Grey and Imaging Source cameras.
+//
+// With a fiber model it stands in for the fiber and the camera behind the simulated DMD,
+// so the calibration scripts run unchanged through ALPwrapper without hardware.
+// SetSimulatedFiber gives the complex transmission matrix T (numPixels x numModes,
+// pixels in MATLAB order), ConnectSimulatedDMD attaches the camera to an ALPsim device
+// that ALPwrapper has allocated. Every picture the DMD shows triggers one frame, like
+// the DMD synch output triggering the camera, rendered from that picture:
+//   input(m) = fraction of the mirrors of mode m that are on (the mode map)
+//   gray = |T * input|^2 * intensityScale, with shot noise (electronsPerGray > 0) and
+//   Gaussian read noise (gray levels), rounded and clipped to 12 bit.
+// Without a fiber model the synch pulses only trigger the ramp frames. The DMD clock
+// is the camera timestamp. dropProbability drops rendered frames before they reach
+// the core; the driver frame counter still advances, so the acquisition health sees
+// them as driver skips, like pictures the camera missed while DMD_TAP_QUEUE was full.
+//
+// The DMD is only there when the mex is built with -DALP_SIMULATOR and linked against
+// the shared ALPsim library (MEX\ALPsim\alpV42.lib, libalpsim.so on Linux), the same
+// library ALPwrapper loads, so both mex files see the same devices:
+//   mex -DALP_SIMULATOR -I../ALP/ALPsim -I../ALP/ALP-4.2 ... -L../MEX/ALPsim -lalpV42
+const size_t DMD_TAP_QUEUE = 64;	// pictures waiting to be rendered
+
+class CAMERACORE_API SyntheticBackend : public ICameraBackend {
+public:
+	SyntheticBackend() : core(nullptr), width(0), height(0), frameRate(100), exposure(0.01), gain(0), externalTrigger(false), running(false), pendingTriggers(0), frameNumber(0),
+		numModes(0), intensityScale(1), electronsPerGray(0), readNoise(0), dropProbability(0),
+		dmdConnected(false), dmdId(0), dmdSubscription(0), dmdWidth(0), dmdHeight(0), lastPulseCounter(0) {}
+	~SyntheticBackend() { close(); stop(); }
+	bool open(const CameraConfig &config, CameraCore *_core);
+	bool start();
+	void stop();
+	void close() { disconnectDMD(); }
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+	int getBytesPerPixel() { return 2; }
+	int getExportShift() { return 4; }
+	int getBitDepth() { return 12; }
+
+	bool softwareTrigger() { pendingTriggers++; return true; }
+	bool setTriggerMode(bool external) { externalTrigger = external; return true; }
+	bool setExposure(double seconds) { exposure = seconds; return true; }
+	double getExposure() { return exposure; }
+	bool setGain(double value) { gain = value; return true; }
+	double getGain() { return gain; }
+	bool setFrameRate(double rate);
+	double getFrameRate() { return frameRate; }
+	// SetSimulatedFiber, SetSimulatedNoise, ConnectSimulatedDMD, DisconnectSimulatedDMD
+	bool handleCommand(const char *command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+
+	// called by ALPsim on its projection thread for every picture shown
+	void onDmdPicture(unsigned long long pulseCounter, double timestampUs, const unsigned char *packedFrame);
+
+private:
+	struct DmdPicture {
+		unsigned long long pulseCounter;
+		double timestampUs;
+		std::vector<unsigned char> packedFrame;	// empty without a fiber model
+	};
+
+	void run();
+	void renderFrame(int n);
+	void renderSpeckle(const std::vector<float> &input);	// modelMutex held
+	bool connectDMD(long serialNumber, const mxArray *modeMap);
+	void disconnectDMD();
+	void decodePicture(const std::vector<unsigned char> &packedFrame, std::vector<float> &input);
+
+	CameraCore *core;
+	int width, height;
+	std::atomic<double> frameRate;
+	double exposure, gain;
+	std::atomic<bool> externalTrigger, running;
+	std::atomic<int> pendingTriggers;
+	int frameNumber;
+	std::vector<unsigned short> pattern, frame;
+	std::thread worker;
+
+	// fiber model, set from the mex thread while frames are rendered
+	std::mutex modelMutex;
+	int numModes;
+	std::vector<float> transmissionRe, transmissionIm;	// row-major pixels x modes
+	std::vector<int> activeModes;	// modes of the current picture that are not off
+	double intensityScale, electronsPerGray, readNoise, dropProbability;
+	std::mt19937 rng;
+
+	// simulated DMD (ALPsim); the mode map is fixed while connected
+	std::atomic<bool> dmdConnected;
+	unsigned long dmdId;
+	long dmdSubscription;		// synch subscription without a fiber model, 0 with the frame tap
+	int dmdWidth, dmdHeight;
+	std::vector<int> byteMode;		// mode of the 8 mirrors of a packed byte, -1 if they differ
+	std::vector<int> mirrorMode;	// row-major dmdHeight x dmdWidth, -1 = not coupled
+	std::vector<float> mirrorsPerMode;
+	std::mutex dmdMutex;
+	std::condition_variable dmdReady;
+	std::deque<DmdPicture> dmdPictures;
+	unsigned long long lastPulseCounter;
+};
+
+#endif
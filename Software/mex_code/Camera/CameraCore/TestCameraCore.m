@@ -0,0 +1,128 @@
+% Test the shared camera core with the synthetic backend (no camera needed).
+% Any of PTwrapper / ISwrapper / XimeaWrapper can be used, they share the core.
+addpath('C:\Users\shayo\Dropbox (MIT)\Code\Github\FiberImaging\Code\mex');
+addpath(fullfile(fileparts(mfilename('fullpath')),'..','..','..'));	% readCameraSharedBuffer
+
+cam = @PTwrapper;
+w = 1920; h = 1200; rate = 400;
+cam('InitSynthetic', w, h, rate);
+cam('SetBufferCapacity', 2000);
+
+% Readout throughput
+pause(2);
+tic; [X, firstTrig] = cam('GetImageBuffer'); t = toc;
+fprintf('%d frames (first trigger %d) in %.1f ms, %.2f ms/frame\n', size(X,3), firstTrig, 1e3*t, 1e3*t/size(X,3));
+% frame number is stamped in the first pixel, consecutive frames must differ by one
+d = mod(diff(double(squeeze(X(1,1,:)))), 4096);
+fprintf('Non consecutive frames: %d\n', sum(d ~= 1));
+
+% Averaging with variance. The synthetic frames scroll, so the variance is not zero.
+cam('StartAveraging', 4, false, true);
+pause(1);
+ok = cam('StopAveraging')
+A = cam('GetImageBuffer');
+[V, counts] = cam('GetVarianceBuffer');
+size(A), size(V), counts
+
+% Software triggered
+cam('SetTriggerMode', true);
+cam('ClearBuffer');
+for k=1:10
+    cam('SoftwareTrigger');
+end
+pause(0.1);
+assert(cam('GetBufferSize') == 10);
+
+stats = cam('GetBufferStats')
+
+% Acquisition health: the synthetic camera numbers its frames, nothing may be lost
+cam('SetTriggerMode', false);
+cam('ResetTriggerCounter');
+cam('ClearBuffer');
+pause(0.5);
+health = cam('GetAcquisitionHealth')
+[~, ~, frameStats] = cam('GetImageBuffer');
+assert(health.ok && health.driverSkip == 0);
+assert(all(diff(frameStats.driverFrame) == 1) && all(diff(frameStats.deviceTime) > 0));
+
+% Capture ROI: only a decimated box is stored, max / saturation cover the whole box
+cam('SetTriggerMode', false);
+cam('SetCaptureROI', [101 51 200 100], 4);
+cam('ClearBuffer');
+pause(0.2);
+[C, ~, frameStats] = cam('GetImageBuffer');
+assert(size(C,1) == 25 && size(C,2) == 50);
+fprintf('ROI frames: %d, max of first frame %d, saturated pixels %d\n', size(C,3), frameStats.max(1), frameStats.numSaturated(1));
+cam('SetCaptureROI', []);
+
+% Reconstruction: 4 modes x 2 repetitions of (0, pi/2, pi) triples, software triggered
+cam('SetTriggerMode', true);
+cam('StartAveraging', 4, true);
+for k=1:24
+    cam('SoftwareTrigger');
+    pause(0.005);
+end
+pause(0.1);
+assert(cam('StopAveraging') == 1);
+[Kinv_angle, phaseStats] = cam('GetPhaseBuffer');
+assert(all(size(Kinv_angle) == [4, prod(phaseStats.frameSize)]) && all(phaseStats.counts == 2));
+% the buffer holds the same phases quantized to 0..4095
+Q = cam('GetImageBuffer');
+Q = reshape(double(Q)/4095*2*pi-pi, [], 4)';
+fprintf('Max quantization error: %.5f rad\n', max(abs(angle(exp(1i*(Q-double(Kinv_angle))))), [], 'all'));
+cam('SetTriggerMode', false);
+
+% Packed storage: 12 bit frames take 3/4 of the memory and read back unchanged
+cam('SetBufferCapacity', 0);
+statsUnpacked = cam('GetBufferStats');
+assert(cam('SetPackedStorage', true) == 1);
+statsPacked = cam('GetBufferStats');
+fprintf('Buffer capacity %d -> %d frames\n', statsUnpacked.capacity, statsPacked.capacity);
+pause(0.5);
+P = cam('GetImageBuffer');
+d = mod(diff(double(squeeze(P(1,1,:)))), 4096);
+assert(all(d == 1) && max(P(:)) < 4096);
+cam('SetPackedStorage', false);
+
+% Live preview: a subsampled newest frame and its statistics, without reading the buffer
+assert(cam('SetPreviewDecimation', 4) == 1);
+cam('ClearBuffer');
+pause(0.2);
+numBuffered = cam('GetBufferSize');
+preview = cam('GetPreview');
+assert(cam('GetBufferSize') >= numBuffered);
+assert(all(size(preview.image) == ceil([size(P,1) size(P,2)]/4)));
+assert(sum(preview.histogram) == numel(preview.image) && preview.max >= max(preview.image(:)));
+fprintf('Preview of frame %d: min %d, max %d, mean %.1f, %d updates\n', preview.frameCounter, preview.min, preview.max, preview.mean, preview.updates);
+cam('SetPreviewDecimation', 2);
+
+% HDR: two planes merged over two bracket levels, nothing reaches the buffer
+cam('SetTriggerMode', true);
+assert(cam('StartHDR', 2, [], 20) == 1);
+for scale = [1 10]
+    cam('SetHDRScale', scale);
+    for k=1:8
+        cam('SoftwareTrigger');
+        pause(0.005);
+    end
+end
+pause(0.1);
+assert(cam('StopAveraging') == 1 && cam('GetBufferSize') == 0);
+[radiance, hdrCounts] = cam('GetHDRBuffer');
+assert(size(radiance,3) == 2 && all(hdrCounts == 8));
+fprintf('HDR radiance range [%.1f %.1f], %d pixels without a valid sample\n', min(radiance(:)), max(radiance(:)), sum(isnan(radiance(:))));
+cam('SetTriggerMode', false);
+
+% Shared export: frames read in place from the mapped file, released by the reader
+sharedFile = fullfile(tempdir, 'camera_shared.bin');
+assert(cam('SetSharedExport', sharedFile) == 1);
+pause(0.2);
+[S, index, range] = readCameraSharedBuffer(sharedFile);
+assert(size(S,3) == range.last - range.first && all(diff(index.frameCounter) == 1));
+shared = cam('GetSharedRange');
+assert(shared.first == range.last);
+fprintf('Read %d frames in place from %s\n', size(S,3), sharedFile);
+% the external reader owns the ring, the mex readers are refused
+assert(isempty(cam('GetImageBuffer')));
+assert(cam('SetSharedExport', '') == 1 && ~exist(sharedFile, 'file'));
+cam('Release');
@@ -0,0 +1,51 @@
+% Test the direct-to-disk recorder with the synthetic backend (no camera needed).
+% StopRecording must return while the camera keeps streaming, and the file, its
+% index and the returned frame count must agree.
+addpath('C:\Users\shayo\Dropbox (MIT)\Code\Github\FiberImaging\Code\mex');
+addpath(fullfile(fileparts(mfilename('fullpath')),'..','..','..'));	% readCameraRecording
+
+cam = @PTwrapper;
+w = 1024; h = 1024; rate = 1000;
+fileName = fullfile(tempdir,'TestCameraRecording.raw');
+cam('InitSynthetic', w, h, rate);
+
+assert(cam('StartRecording', fileName) == 1);
+for k=1:10
+    pause(0.2);
+    P = cam('PeekLastImage');	% preview keeps working while recording
+end
+status = cam('GetRecordingStatus')
+tic; numFrames = cam('StopRecording'); t = toc;
+fprintf('StopRecording returned after %.2f sec with %d frames\n', t, numFrames);
+assert(t < 5);
+stats = cam('GetBufferStats');
+
+[~, index, header] = readCameraRecording(fileName, []);
+assert(header.numFrames == numFrames && numel(index.frameCounter) == numFrames);
+% trigger counts are consecutive unless frames were dropped on a full ring
+fprintf('Index gaps: %d, dropped on full ring: %d\n', sum(diff(index.frameCounter) ~= 1), stats.overflowDropped);
+% frame number is stamped in the first pixel
+X = readCameraRecording(fileName, [1 min(numFrames,100)]);
+d = mod(diff(double(squeeze(X(1,1,:)))), 4096);
+fprintf('Non consecutive frames in the first 100: %d\n', sum(d ~= 1));
+
+delete(fileName);
+delete([fileName '.idx']);
+
+% Compressed: the frame previewed during the recording must come back bit exact
+assert(cam('StartRecording', fileName, 0, true) == 1);
+pause(1);
+[P, previewTrigger] = cam('PeekLastImage');
+pause(0.5);
+status = cam('GetRecordingStatus');
+numFrames = cam('StopRecording');
+[~, index, header] = readCameraRecording(fileName, []);
+assert(header.codec == 1 && header.numFrames == numFrames);
+f = find(index.frameCounter == previewTrigger);
+X = readCameraRecording(fileName, [f f]);
+assert(isequal(X, P));
+fprintf('Compressed %d frames, %.2fx smaller than 16 bit, %.0f MB/s to disk\n', numFrames, status.compressionRatio, status.MBps);
+
+cam('Release');
+delete(fileName);
+delete([fileName '.idx']);
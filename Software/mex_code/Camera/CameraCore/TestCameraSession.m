@@ -0,0 +1,49 @@
+% Test a two camera session with synthetic cameras (no camera needed). Both cameras are
+% triggered together, camera 2 misses one trigger; the tuples must pair frames of the
+% same trigger and report the unpaired frame.
+addpath('C:\Users\shayo\Dropbox (MIT)\Code\Github\FiberImaging\Code\mex');
+
+cam = @PTwrapper;
+assert(cam('InitSession', [-1 -1], 320, 240) == 1);
+for k=1:2
+    cam('SessionCommand', k, 'SetTriggerMode', true);
+end
+cam('StartSession');
+for k=1:20
+    cam('SessionCommand', 1, 'SoftwareTrigger');
+    if k ~= 10
+        cam('SessionCommand', 2, 'SoftwareTrigger');
+    end
+    pause(0.01);
+end
+pause(0.1);
+[frames, info] = cam('GetAlignedFrames', 0.002);
+fprintf('%d tuples, worst skew %.2f ms, unmatched frames [%d %d]\n', size(info.hostTime,2), ...
+    1e3*max(abs(diff(info.hostTime,1,1))), info.unmatched(1), info.unmatched(2));
+assert(numel(frames) == 2 && size(frames{1},3) == 19 && all(info.unmatched == [1 0]));
+assert(all(info.sessionIndex == 1:19));
+cam('ReleaseSession');
+
+% Cameras of two wrappers in one session (needs both mex built against the shared
+% CameraCore.dll). Tuples are matched on the camera timestamps mapped to the host
+% clock (info.time); info.owner tells which mex opened each camera.
+assert(PTwrapper('InitSession', -1, 320, 240) == 1);
+assert(XimeaWrapper('AddToSession', -1, 160, 120) == 1);
+PTwrapper('SessionCommand', 1, 'SetTriggerMode', true);
+XimeaWrapper('SessionCommand', 2, 'SetTriggerMode', true);
+XimeaWrapper('StartSession');
+for k=1:10
+    PTwrapper('SessionCommand', 1, 'SoftwareTrigger');
+    PTwrapper('SessionCommand', 2, 'SoftwareTrigger');
+    pause(0.01);
+end
+pause(0.1);
+[frames, info] = XimeaWrapper('GetAlignedFrames', 0.002);
+fprintf('%d tuples, worst skew %.2f ms (host arrival %.2f ms)\n', size(info.time,2), ...
+    1e3*max(abs(diff(info.time,1,1))), 1e3*max(abs(diff(info.hostTime,1,1))));
+assert(isequal(info.owner, {'PTwrapper', 'XimeaWrapper'}));
+assert(size(frames{1},1) == 240 && size(frames{2},1) == 120 && size(frames{1},3) == 10);
+clear XimeaWrapper	% releases only the camera XimeaWrapper opened
+[frames, info] = PTwrapper('GetAlignedFrames', 0.002);
+assert(numel(frames) == 1 && isequal(info.owner, {'PTwrapper'}));
+PTwrapper('ReleaseSession');
@@ -0,0 +1,55 @@
+% Test the simulated fiber camera (no camera or DMD needed). ALPwrapper drives the
+% ALPsim DMD as it would the real one, a random transmission matrix stands in for
+% the fiber, and the averaged frames must match |T * pattern|^2.
+% Needs ALPwrapper and the camera mex built with -DALP_SIMULATOR against the shared
+% ALPsim library (MEX\ALPsim ahead of the ViALUX folder on the PATH).
+addpath('C:\Users\shayo\Dropbox (MIT)\Code\Github\FiberImaging\Code\mex');
+
+cam = @PTwrapper;
+w = 64; h = 48; numModes = 64; numPatterns = 16; numRepetitions = 4; rate = 2000;
+devID = 0;
+if ~ALPwrapper('IsInitialized',devID)
+    ALPwrapper('Init',devID);
+end
+cam('InitSynthetic', w, h);
+cam('SetTriggerMode', true);	% frames come from the DMD only
+
+T = (randn(w*h, numModes) + 1i*randn(w*h, numModes)) / sqrt(2*numModes);
+patterns = double(rand(numModes, numPatterns) > 0.5);
+intensityScale = 2000;
+assert(cam('SetSimulatedFiber', real(T), imag(T)) == 1);
+cam('SetSimulatedNoise', intensityScale);	% noise free
+% default mode map: the mirrors split in a sqrt(numModes) square grid, numbered
+% row by row ((m-1) = gridRow * gridSize + gridColumn)
+assert(cam('ConnectSimulatedDMD') == 1);
+
+gridSize = sqrt(numModes);
+Seq = false(768, 1024, numPatterns);
+for k=1:numPatterns
+    grid = reshape(patterns(:,k), gridSize, gridSize)';
+    Seq(:,:,k) = kron(grid, ones(768/gridSize, 1024/gridSize)) > 0;
+end
+seqID = ALPwrapper('UploadPatternSequence',devID,Seq);
+
+assert(cam('StartAveraging', numPatterns, false) == 1);
+ALPwrapper('PlayUploadedSequence',devID,seqID,rate,numRepetitions);
+ALPwrapper('WaitForSequenceCompletion',devID);
+pause(0.1);
+assert(cam('StopAveraging') == 1);
+A = double(cam('GetImageBuffer'));
+expected = min(round(abs(T * patterns).^2 * intensityScale), 4095);
+fprintf('Max deviation from the model: %.2f gray levels\n', max(abs(A(:) - expected(:))));
+
+% shot / read noise and 10% injected drops, which the health check must see
+cam('SetSimulatedNoise', intensityScale, 4, 2, 0.1);
+cam('ResetTriggerCounter');
+cam('ClearBuffer');
+ALPwrapper('PlayUploadedSequence',devID,seqID,rate,50);
+ALPwrapper('WaitForSequenceCompletion',devID);
+pause(0.1);
+health = cam('GetAcquisitionHealth');
+fprintf('Played %d frames: %d received, %d dropped by the driver\n', numPatterns*50, health.framesReceived, health.driverSkip);
+assert(~health.ok && health.driverSkip > 0);
+cam('DisconnectSimulatedDMD');
+cam('Release');
+ALPwrapper('ReleaseSequence',devID,seqID);
@@ -5,230 +5,97 @@ DiCarlo Lab @ MIT
 
 Revision History
 Version 0.1 03/25/2015
+Version 0.2 10/18/2026	Buffering, averaging and export moved to the shared CameraCore
+Version 0.3 10/18/2026	Multi-camera sessions
 
 */
 #include <stdio.h>
 #include "mex.h"
 #include "FlyCapture2.h"
 #include <Windows.h>
-#include <queue>
-#include <deque>
-
-#define MIN(a,b) (a)<(b)?(a):(b)
-#define MAX(a,b) (a)>(b)?(a):(b)
-bool calledOnce = false;
+#include "../CameraCore/CameraCore.h"
 
 
 using namespace FlyCapture2;
 using namespace std;
 
 
-class myImage : public Image
-{
-public:
-	int frameCounter;
-};
-
-
-template<typename T, typename Container = std::deque<T> >
-class iterable_queue : public std::queue<T, Container>
-{
+// FlyCapture2 adapter. The grab callback hands every frame to the core; exposure is
+// kept in seconds on the core side and converted to the milliseconds of the SHUTTER
+// property here.
+class PTBackend : public ICameraBackend {
 public:
-	typedef typename Container::iterator iterator;
-	typedef typename Container::const_iterator const_iterator;
+	PTBackend() : core(nullptr), deviceOpened(false), embeddedFrameCounter(false), embeddedTimestamp(false), width(0), height(0) {}
+	bool open(const CameraConfig &config, CameraCore *_core);
+	bool start();
+	void stop();
+	void close();
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+	int getBytesPerPixel() { return 2; }	// 12 bit ADC
+	int getExportShift() { return 4; }		// move the upper 12 bit to the right, so we have 0..4095 gray scales.
+	int getBitDepth() { return 12; }
 
-	iterator begin() { return this->c.begin(); }
-	iterator end() { return this->c.end(); }
-	const_iterator begin() const { return this->c.begin(); }
-	const_iterator end() const { return this->c.end(); }
-};
-
-
-
-class PTwrapper {
-public:
-	PTwrapper();
-	~PTwrapper();
-	bool isInitialized();
-	bool init(int x0, int y0, int _width, int _height, int _mode);
-	int getWidth();
-	int getHeight();
 	bool softwareTrigger();
-	void frameCallback(myImage* pImage);
-	bool setGain(float value);
-	float getGain();
-	void setAutoExposure(bool value);
-	bool getAutoExposure();
-	int getNumImagesInBuffer();
-	void setExposure(float value);
-	float getExposure();
-	int copyAndClearBuffer(unsigned char *imageBufferPtr, int N);
-	int getBytesPerPixel();
-	void clearBuffer();
-	int getNumTrigs();
-	void resetTriggerCounter();
-	float getFrameRate();
-	void setFrameRate(float Rate);
-	void setTrigger(bool state);
-	int pokeLastFrames(unsigned char *imageBufferPtr, int N);
-	int copyBuffer16Bit(unsigned char *imageBufferPtr, int N);
+	bool setTriggerMode(bool external);
+	bool setExposure(double seconds);
+	double getExposure();
+	bool setGain(double value);
+	double getGain();
+	double getFrameRate();
 	void printStats();
-	unsigned long numTrig;
-	bool triggerEnabled;
-	void startAveraging(int numFrames, bool ReconstructionMode);
-	void stopAveraging();
-	bool inAveragingMode();
-	bool successfulAveraging();
-	void printError(Error error);
-	void setTriggerMode(bool external);
-	void lockMutex();
-	void unlockMutex();
-	myImage*  computePhase();
+	long long getDriverDropped();
 
+	void frameCallback(Image* pImage);
 private:
-	void averageImages(myImage *A, myImage *B, int iter);
-	int copyAndClearBuffer8Bit(unsigned char *imageBufferPtr, int N);
-	int copyAndClearBuffer16Bit(unsigned char *imageBufferPtr, int N);
-
-	int bytesPerPixel;
-	void release();
-
-	myImage TempImages[3];
-	iterable_queue<myImage*>::iterator averagingIterator;
-	bool averagingMode;
-	int averagingBlockSize;
-	bool initialized;
+	void printError(Error error);
+
+	CameraCore *core;
 	bool deviceOpened;
-	bool streaming;
-	int lastResult;
-	bool triggered;
-	HANDLE ghMutex;
+	bool embeddedFrameCounter, embeddedTimestamp;
 	int width, height;
-	unsigned long maxImagesInBuffer;
-	int mutexCount;
-	unsigned long trigsSinceBufferRead;
-	iterable_queue<myImage*> imageQueue;
-	int imageFrameCounter;
 	Camera cam;
 	Error error;
 	BusManager busMgr;
-	bool reconstructionMode;
-
 };
 
 
-bool PTwrapper::inAveragingMode()
-{
-	return averagingMode;
-}
-
-bool PTwrapper::successfulAveraging()
-{
-	return numTrig % averagingBlockSize == 0;
-}
-
-void PTwrapper::startAveraging(int numFrames, bool ReconstructionMode)
-{
-	lockMutex();
-	clearBuffer();
-	averagingBlockSize = numFrames;
-	averagingMode = true;
-	reconstructionMode = ReconstructionMode;
-	resetTriggerCounter();
-	unlockMutex();
-}
-
-void PTwrapper::stopAveraging()
-{
-	averagingMode = false;
-	reconstructionMode = false;
-}
-
-void PTwrapper::printError(Error error)
+void PTBackend::printError(Error error)
 {
 	mexPrintf("%s\n", error.GetDescription());
 }
 
-bool PTwrapper::isInitialized()
-{
-	return initialized;
-}
-
-void PTwrapper::setTrigger(bool state)
-{
-	triggerEnabled = state;
-}
-
-void PTwrapper::setFrameRate(float Rate)
-{
-}
-
-
-void PTwrapper::setExposure(float value)
+bool PTBackend::setExposure(double seconds)
 {
 	Property shutterProp(SHUTTER);
 	error = cam.GetProperty(&shutterProp);
 	shutterProp.absControl = true;
-	shutterProp.absValue = value;
+	shutterProp.absValue = (float)(seconds * 1000.0);
 	shutterProp.autoManualMode = false;
 	shutterProp.onOff = true;
 	error = cam.SetProperty(&shutterProp);
 	if (error != PGRERROR_OK)
 	{
 		printError(error);
-		return;
+		return false;
 	}
+	return true;
 }
 
-void PTwrapper::resetTriggerCounter()
-{
-	numTrig = 0;
-
-}
-int PTwrapper::getNumTrigs()
-{
-	return numTrig;
-}
-int PTwrapper::getBytesPerPixel()
-{
-	return bytesPerPixel;
-}
-
-int PTwrapper::getNumImagesInBuffer()
-{
-	int n;
-	lockMutex();
-	n = (int)imageQueue.size();
-	unlockMutex();
-	return n;
-}
-
-
-
-float PTwrapper::getExposure()
+double PTBackend::getExposure()
 {
 	Property shutterProp(SHUTTER);
 	error = cam.GetProperty(&shutterProp);
 	if (error != PGRERROR_OK)
 	{
 		printError(error);
-		return false;
+		return 0;
 	}
-	return shutterProp.absValue;
-}
-
-void PTwrapper::setAutoExposure(bool value)
-{
-}
-
-
-bool PTwrapper::getAutoExposure()
-{
-	return false;
+	return shutterProp.absValue / 1000.0;
 }
 
-
-bool PTwrapper::setGain(float value)
+bool PTBackend::setGain(double value)
 {
 	Property Prop(GAIN);
 	error = cam.GetProperty(&Prop);
@@ -239,7 +106,7 @@ bool PTwrapper::setGain(float value)
 	}
 
 	Prop.absControl = true;
-	Prop.absValue = value;
+	Prop.absValue = (float)value;
 	Prop.autoManualMode = false;
 	Prop.onOff = true; // On ?
 
@@ -252,9 +119,7 @@ bool PTwrapper::setGain(float value)
 	return true;
 }
 
-
-
-float PTwrapper::getGain()
+double PTBackend::getGain()
 {
 	Property Prop(GAIN);
 	error = cam.GetProperty(&Prop);
@@ -266,409 +131,110 @@ float PTwrapper::getGain()
 	return Prop.absValue;
 }
 
-
-
-void PTwrapper::lockMutex()
+double PTBackend::getFrameRate()
 {
-	mutexCount++;
-	int dwWaitResult = WaitForSingleObject(
-		ghMutex,    // handle to mutex
-		INFINITE);  // no time-out interval
-}
-
-void PTwrapper::unlockMutex()
-{
-	ReleaseMutex(ghMutex);
-	mutexCount--;
+	Property framerateProp(FRAME_RATE);
+	error = cam.GetProperty(&framerateProp);
+	if (error != PGRERROR_OK)
+	{
+		printError(error);
+		return -1;
+	}
+	return framerateProp.absValue;
 }
 
-bool PTwrapper::softwareTrigger()
+bool PTBackend::softwareTrigger()
 {
 	error = cam.FireSoftwareTrigger();
-
 	if (error != PGRERROR_OK)
 	{
 		printError(error);
 		return false;
 	}
-
 	return true;
 }
 
-void PTwrapper::averageImages(myImage *A, myImage *B, int iter)
+void PTBackend::frameCallback(Image *pImage)
 {
-	// running average. Keep result in A.
-	unsigned short *dataA = (unsigned short*)A->GetData();
-	unsigned short *dataB = (unsigned short*)B->GetData();
-
-
-	for (long counter = 0; counter<height*width; counter++)
+	// pImage belongs to the driver and is only valid during the callback
+	int driverFrame = -1;
+	double deviceTime = -1;
+	if (embeddedFrameCounter)
+		driverFrame = (int)(pImage->GetMetadata().embeddedFrameCounter & 0x7FFFFFFF);
+	if (embeddedTimestamp)
 	{
-		unsigned short pA = dataA[counter] >> 4; // move the upper 12 bit to the right, so we have 0..4095 gray scales.
-		unsigned short pB = dataB[counter] >> 4; // move the upper 12 bit to the right, so we have 0..4095 gray scales.
-
-		unsigned short avgValue = float((iter)* pA + pB) / (float)(iter + 1);
-		dataA[counter] = avgValue << 4;
+		// bus cycle time: 0..127 sec, 8000 cycles per sec, 3072 ticks per cycle
+		TimeStamp timeStamp = pImage->GetTimeStamp();
+		deviceTime = timeStamp.cycleSeconds + (timeStamp.cycleCount + timeStamp.cycleOffset / 3072.0) / 8000.0;
 	}
+	core->onFrame(pImage->GetData(), pImage->GetDataSize(), driverFrame, deviceTime);
 }
 
-
-myImage* PTwrapper::computePhase()
-{
-	const float PI = 3.1415926536;
-	// running average. Keep result in A.
-	unsigned short *dataA = (unsigned short*)TempImages[0].GetData();
-	unsigned short *dataB = (unsigned short*)TempImages[1].GetData();
-	unsigned short *dataC = (unsigned short*)TempImages[2].GetData();
-	myImage* phaseImage = new myImage;
-	phaseImage->DeepCopy(&TempImages[0]);
-
-	unsigned short *dataOut = (unsigned short*)phaseImage->GetData();
-	for (long counter = 0; counter<height*width; counter++)
-	{
-		unsigned short pA = dataA[counter] >> 4; // move the upper 12 bit to the right, so we have 0..4095 gray scales.
-		unsigned short pB = dataB[counter] >> 4; // move the upper 12 bit to the right, so we have 0..4095 gray scales.
-		unsigned short pC = dataB[counter] >> 4; // move the upper 12 bit to the right, so we have 0..4095 gray scales.
-
-		float result = atan2(pB - pC, pA - pB);
-		// result is between -pi and pi.
-		// map it to be between 0 and 4095
-		unsigned short quantizedValue = (result + PI) / (2 * PI) * 4095;
-		dataOut[counter] = quantizedValue << 4;
-	}
-	return phaseImage;
-}
-
-void PTwrapper::frameCallback(myImage *pImage)
-{
-	triggered = true;
-	numTrig++;
-	trigsSinceBufferRead++;
-
-	pImage->frameCounter = numTrig;
-	int averagingIteration = (numTrig - 1) / averagingBlockSize;
-
-	if (reconstructionMode)
-	{
-		// This mode assumes that the DMD gets three consequeitive phase shifted imageas (0,pi/2, 3*pi/2). 
-		// the output will be the phase of the complex field. Values will be between 0..4095, but actually represent
-		// the range of -PI..PI
-		int averagingIteration3 = (numTrig - 1) / (averagingBlockSize * 3);
-
-		int index3 = (numTrig - 1) % 3;
-		TempImages[index3].DeepCopy(pImage);
-
-		if (index3 == 2)
-		{
-			myImage *phaseImage = computePhase();
-			// phase is now in phaseImage
-
-			if (averagingIteration3 == 0)
-			{
-				imageQueue.push(phaseImage);
-				averagingIterator = imageQueue.begin();
-			}
-			else
-			{
-				averageImages(*averagingIterator, phaseImage, averagingIteration3);
-				delete phaseImage;
-
-				averagingIterator++;
-				if (averagingIterator == imageQueue.end())
-					averagingIterator = imageQueue.begin();
-
-			}
-
-
-		}
-		delete pImage;
-
-
-	}
-	else
-	{
-		if (!averagingMode || averagingIteration == 0)
-		{
-			imageQueue.push(pImage);
-			averagingIterator = imageQueue.begin();
-		}
-		else
-		{
-
-			// we are averaging images. Buffer size never exceeds averagingBlockSize
-			// the image we need to manipulate is actually  (numTrig-1) % averagingBlockSize
-			// first, operate on the image pointed by averagingIterator
-			// then increase iterator.
-			averageImages(*averagingIterator, pImage, averagingIteration);
-			delete pImage;
-
-			averagingIterator++;
-			if (averagingIterator == imageQueue.end())
-				averagingIterator = imageQueue.begin();
-
-		}
-	}
-
-	if (imageQueue.size() > maxImagesInBuffer)
-	{
-		myImage *p = imageQueue.front();
-		delete p;
-		imageQueue.pop();
-	}
-
-}
-
-
-int PTwrapper::copyAndClearBuffer8Bit(unsigned char *imageBufferPtr, int N)
-{
-	lockMutex();
-	int numToCopy = MIN(imageQueue.size(), N);
-	int FirstImageTrig = (numToCopy > 0) ? (imageQueue.front())->frameCounter : -1;
-
-	for (int k = 0; k<numToCopy; k++)
-	{
-		Image *I = imageQueue.front();
-		unsigned char Pixel;
-		unsigned char *data8bits = (unsigned char*)I->GetData();
-		long long offset = ((long long)width*(long long)height*k);
-
-		int counter = 0;
-		for (long y = 0; y<height; y++)
-		{
-			for (long x = 0; x<width; x++)
-			{
-
-				Pixel = data8bits[counter];
-				imageBufferPtr[offset + (long long)((y)+x*(long)height)] = Pixel;
-				counter++;
-			}
-		}
-
-		imageQueue.pop();
-		delete I;
-	}
-	unlockMutex();
-	return FirstImageTrig;
-}
-
-void PTwrapper::clearBuffer()
-{
-	lockMutex();
-	int N = imageQueue.size();
-	for (int k = 0; k < N; k++)
-	{
-		Image *p = imageQueue.front();
-		delete p;
-		imageQueue.pop();
-	}
-	unlockMutex();
-}
-
-int PTwrapper::copyBuffer16Bit(unsigned char *imageBufferPtr, int N)
-{
-	//        std::cout << *it << "\n";
-
-	// copy the N-tuple images from the buffer, but keeps them there...
-	// if an incomplete tuple exist, use the one before that...
-
-	int startImage = N*(floor(imageQueue.size() / N) - 1);
-
-	int numToCopy = MIN(imageQueue.size(), N);
-
-	unsigned short *imageBufferIntPtr = (unsigned short *)imageBufferPtr;
-	int tmp = sizeof(unsigned short);
-	tmp = tmp;
-	lockMutex();
-
-	int cnt_in = 0;
-	int cnt_out = 0;
-	for (auto it = imageQueue.begin(); it != imageQueue.end(); it++)
-	{
-		if (cnt_in++ >= startImage)
-		{
-			if (cnt_out < numToCopy)
-			{
-				// copy image. store it in cnt_out
-				Image *I = *it;
-				unsigned short *data16bits = (unsigned short*)I->GetData();
-				long long offset = ((long long)width*(long long)height*cnt_out);
-				int counter = 0;
-				for (long y = 0; y<height; y++)
-				{
-					for (long x = 0; x<width; x++)
-					{
-
-						unsigned short Pixel = data16bits[counter] >> 4; // move the upper 12 bit to the right, so we have 0..4095 gray scales.
-						imageBufferIntPtr[offset + (long long)((y)+x*(long)height)] = Pixel;
-						counter++;
-					}
-				}
-
-				cnt_out++;
-			}
-		}
-
-	}
-	unlockMutex();
-	return startImage;
-}
-
-int PTwrapper::copyAndClearBuffer16Bit(unsigned char *imageBufferPtr, int N)
+void OnImageGrabbed(Image* pImage, const void* pCallbackData)
 {
-	unsigned short *imageBufferIntPtr = (unsigned short *)imageBufferPtr;
-	int tmp = sizeof(unsigned short);
-	tmp = tmp;
-	lockMutex();
-	int numCopied = 0;
-
-	int numToCopy = MIN(imageQueue.size(), N);
-	int FirstImageTrig = (numToCopy > 0) ? (imageQueue.front())->frameCounter : -1;
-	unsigned short Pixel = 0;
-	for (long k = 0; k<numToCopy; k++)
-	{
-		Image *I = imageQueue.front();
-
-		unsigned short *data16bits = (unsigned short*)I->GetData();
-		long long offset = ((long long)width*(long long)height*k);
-
-		int counter = 0;
-		for (long y = 0; y<height; y++)
-		{
-			for (long x = 0; x<width; x++)
-			{
-
-				Pixel = data16bits[counter];
-				Pixel = Pixel >> 4;	// move the upper 12 bit to the right, so we have 0..4095 gray scales.
-				imageBufferIntPtr[offset + (long long)((y)+x*(long)height)] = Pixel;
-				counter++;
-			}
-		}
-
-
-		imageQueue.pop();
-		delete I;
-	}
-	unlockMutex();
-
-	return FirstImageTrig;
+	((PTBackend*)pCallbackData)->frameCallback(pImage);
 }
 
-
-
-
-int PTwrapper::pokeLastFrames(unsigned char *imageBufferPtr, int N)
+void PTBackend::printStats()
 {
-	if (bytesPerPixel == 1)
-		return -1; // TODO
-	else if (bytesPerPixel == 2)
-		return copyBuffer16Bit(imageBufferPtr, N);
-	else
-		return -1;
-
+	CameraStats stat;
+	cam.GetStats(&stat);
+	mexPrintf("Timestamp %d\n", stat.timeStamp);
+	mexPrintf("Power is %d\n", stat.cameraPowerUp);
+	mexPrintf("Num Corrupted %d\n", stat.imageCorrupt);
+	mexPrintf("Driver Dropped %d\n", stat.imageDriverDropped);
+	mexPrintf("Images Dropped %d\n", stat.imageDropped);
+	mexPrintf("Temperature %d\n", stat.temperature);
+	mexPrintf("Port Errors %d\n", stat.portErrors);
 }
 
-int PTwrapper::copyAndClearBuffer(unsigned char *imageBufferPtr, int N)
+long long PTBackend::getDriverDropped()
 {
-	trigsSinceBufferRead = 0;
-	if (bytesPerPixel == 1)
-		return copyAndClearBuffer8Bit(imageBufferPtr, N);
-	else if (bytesPerPixel == 2)
-		return copyAndClearBuffer16Bit(imageBufferPtr, N);
-	else
+	CameraStats stat;
+	if (cam.GetStats(&stat) != PGRERROR_OK)
 		return -1;
+	return (long long)stat.imageDriverDropped + stat.imageDropped;
 }
 
-
-int PTwrapper::getWidth()
+bool PTBackend::setTriggerMode(bool external)
 {
-	return width;
-}
-
-int PTwrapper::getHeight()
-{
-	return height;
-}
-
+	mexPrintf("Stopping capture...");
+	cam.StopCapture();
 
+	// Set trigger
+	if (external)
+		mexPrintf("Setting external triggering mode...");
+	else
+		mexPrintf("Setting internal triggering mode...");
 
-float PTwrapper::getFrameRate()
-{
-	// Set Frame Rate
-	Property framerateProp(FRAME_RATE);
-	error = cam.GetProperty(&framerateProp);
+	TriggerMode triggerMode;     // Get current trigger settings
+	error = cam.GetTriggerMode(&triggerMode);
 	if (error != PGRERROR_OK)
 	{
 		printError(error);
-		return -1;
-	}
-	return framerateProp.absValue;
-}
-
-
-void PTwrapper::release()
-{
-	if (streaming)
-	{
-		// stop streaming...
-		triggerEnabled = false;
-		unlockMutex();
-		Sleep(300); // wait for all threads to finish reading... (?)
-
-		mexPrintf("Stopping capture...");
-		error = cam.StopCapture();
-		if (error != PGRERROR_OK)
-		{
-			printError(error);
-		}
-		streaming = false;
-		mexPrintf("OK!\n");
+		return false;
 	}
-	Sleep(1000); // wait for all threads to finish writing... (?)
-
 
-	if (initialized)
+	// Set camera to trigger mode 0 (why not 14?)
+	triggerMode.onOff = external;
+	triggerMode.mode = 14;
+	triggerMode.polarity = 1; // when line goes HIGH
+	triggerMode.parameter = 0;
+	triggerMode.source = 0;  // use GPIO 0
+	error = cam.SetTriggerMode(&triggerMode);
+	if (error != PGRERROR_OK)
 	{
-		if (deviceOpened)
-		{
-			mexPrintf("Disconnecting camera...");
-			error = cam.Disconnect();
-			if (error != PGRERROR_OK)
-			{
-				printError(error);
-			}
-			mexPrintf("OK!\n");
-		}
-
-		mexPrintf("Closing mutex...");
-		CloseHandle(ghMutex);
-		mexPrintf("OK!\n");
-		ghMutex = NULL;
-		initialized = false;
+		printError(error);
+		return false;
 	}
-	mexPrintf("Release sequence finished!\n");
-}
-
 
-void OnImageGrabbed(Image* pImage, const void* pCallbackData)
-{
-	PTwrapper *cls = (PTwrapper*)pCallbackData;
-	if (cls->triggerEnabled)
-	{
-		cls->lockMutex();
-		myImage *deepcopy = new myImage;
-		deepcopy->DeepCopy(pImage);
-		cls->frameCallback(deepcopy);
-		cls->unlockMutex();
-	}
+	return start();
 }
 
 
-
-
-bool PTwrapper::init(int x0 = 0, int y0 = 0, int _width = 640, int _height = 480, int _mode = MODE_7)
+bool PTBackend::open(const CameraConfig &config, CameraCore *_core)
 {
-	if (initialized)
-		return true;
+	core = _core;
 
 	FC2Version fc2Version;
 	Utilities::GetLibraryVersion(&fc2Version);
@@ -688,10 +254,14 @@ bool PTwrapper::init(int x0 = 0, int y0 = 0, int _width = 640, int _height = 480
 		return false;
 	}
 	mexPrintf("%d cameras found.\n", numCameras);
-	// Assume only one camera is connected....
+	if (config.deviceIndex < 0 || config.deviceIndex >= (int)numCameras)
+	{
+		mexPrintf("No camera %d on the bus\n", config.deviceIndex);
+		return false;
+	}
 
 	PGRGuid guid;
-	error = busMgr.GetCameraFromIndex(0, &guid);
+	error = busMgr.GetCameraFromIndex(config.deviceIndex, &guid);
 	if (error != PGRERROR_OK)
 	{
 		printError(error);
@@ -707,6 +277,7 @@ bool PTwrapper::init(int x0 = 0, int y0 = 0, int _width = 640, int _height = 480
 		printError(error);
 		return false;
 	}
+	deviceOpened = true;
 	mexPrintf("OK\n");
 
 	Sleep(500);
@@ -787,28 +358,39 @@ bool PTwrapper::init(int x0 = 0, int y0 = 0, int _width = 640, int _height = 480
 	}
 	mexPrintf("OK\n");
 
+	// The camera's frame counter and timestamp ride in the first pixels of every frame
+	// (4 pixels of row 0, far from the fiber image). Without them the core cannot tell
+	// a lost frame from a missed trigger.
+	mexPrintf("Enabling embedded frame counter and timestamp...");
+	EmbeddedImageInfo embeddedInfo;
+	error = cam.GetEmbeddedImageInfo(&embeddedInfo);
+	embeddedFrameCounter = error == PGRERROR_OK && embeddedInfo.frameCounter.available;
+	embeddedTimestamp = error == PGRERROR_OK && embeddedInfo.timestamp.available;
+	embeddedInfo.frameCounter.onOff = embeddedFrameCounter;
+	embeddedInfo.timestamp.onOff = embeddedTimestamp;
+	if (error != PGRERROR_OK || cam.SetEmbeddedImageInfo(&embeddedInfo) != PGRERROR_OK)
+	{
+		embeddedFrameCounter = embeddedTimestamp = false;
+		mexPrintf("not available\n");
+	}
+	else
+		mexPrintf("OK\n");
 
-	bytesPerPixel = 2; // 12 bit ADC
-
-	width = _width;
-	height = _height;
-
-	maxImagesInBuffer = (long)15 * 1e9 / (width*height*bytesPerPixel); // 15GB (!)
-	mexPrintf("Allowing maximum 15GB of memory, or %d 16 bit images.\n", maxImagesInBuffer);
-
+	width = (config.width > 0) ? config.width : 640;
+	height = (config.height > 0) ? config.height : 480;
 
 	// Set frame rate to maximum (?)
 	// Set Imaging mode to high sensitivity, low read noise (mode 7)
 	Format7ImageSettings fmt7ImageSettings;
 	// MODE_0
-	fmt7ImageSettings.mode = (Mode)_mode; // Low read noise mode (?)
+	fmt7ImageSettings.mode = (config.mode >= 0) ? (Mode)config.mode : MODE_7; // Low read noise mode (?)
 	fmt7ImageSettings.height = height; //1200;
 	fmt7ImageSettings.width = width; //1920;
-	fmt7ImageSettings.offsetX = x0;
-	fmt7ImageSettings.offsetY = y0;
+	fmt7ImageSettings.offsetX = config.x0;
+	fmt7ImageSettings.offsetY = config.y0;
 	fmt7ImageSettings.pixelFormat = PIXEL_FORMAT_RAW16; // Packet size = 49680
 
-	mexPrintf("Requesting resolution [%d x %d] with offset [%d x %d].\n", width, height, x0, y0);
+	mexPrintf("Requesting resolution [%d x %d] with offset [%d x %d].\n", width, height, config.x0, config.y0);
 
 	bool isValid;
 	Format7PacketInfo fmt7PacketInfo;
@@ -834,10 +416,11 @@ bool PTwrapper::init(int x0 = 0, int y0 = 0, int _width = 640, int _height = 480
 	mexPrintf("OK\n");
 
 	//error = cam.SetVideoModeAndFrameRate(VIDEOMODE_FORMAT7, FRAMERATE_FORMAT7); (?)
+	return true;
+}
 
-
-	deviceOpened = true;
-
+bool PTBackend::start()
+{
 	// Start capturing images
 	mexPrintf("Starting capture...");
 	error = cam.StartCapture(OnImageGrabbed, this);
@@ -847,106 +430,48 @@ bool PTwrapper::init(int x0 = 0, int y0 = 0, int _width = 640, int _height = 480
 		return false;
 	}
 	mexPrintf("OK\n");
-
-
-	bool use12Bits = true;
-
-	streaming = true;
-	initialized = true;
-	mexPrintf("Camera initialized and in capture mode\n");
 	return true;
 }
 
-PTwrapper::PTwrapper() : initialized(false), deviceOpened(false), streaming(false), triggered(false), numTrig(0), width(0), height(0), bytesPerPixel(2)
-{
-
-	ghMutex = CreateMutex(
-		NULL,              // default security attributes
-		FALSE,             // initially not owned
-		NULL);             // unnamed mutex
-	maxImagesInBuffer = 25000; // 15GB (!)
-	triggerEnabled = true;
-	trigsSinceBufferRead = 0;
-	averagingBlockSize = 1;
-	mutexCount = 0;
-	reconstructionMode = false;
-	averagingMode = false;
-}
-
-void PTwrapper::printStats()
-{
-	CameraStats stat;
-	cam.GetStats(&stat);
-	mexPrintf("Timestamp %d\n", stat.timeStamp);
-	mexPrintf("Power is %d\n", stat.cameraPowerUp);
-	mexPrintf("Num Corrupted %d\n", stat.imageCorrupt);
-	mexPrintf("Driver Dropped %d\n", stat.imageDriverDropped);
-	mexPrintf("Images Dropped %d\n", stat.imageDropped);
-	mexPrintf("Temperature %d\n", stat.temperature);
-	mexPrintf("Port Errors %d\n", stat.portErrors);
-
-}
-
-
-
-void PTwrapper::setTriggerMode(bool external)
+void PTBackend::stop()
 {
-	// Start capturing images
-	mexPrintf("Stopping capture...");
-	cam.StopCapture();
-
-	// Set trigger
-	if (external)
-		mexPrintf("Setting external triggering mode...");
-	else
-		mexPrintf("Setting internal triggering mode...");
-
-	TriggerMode triggerMode;     // Get current trigger settings
-	error = cam.GetTriggerMode(&triggerMode);
+	// returns once the grab callback is done with the last frame
+	error = cam.StopCapture();
 	if (error != PGRERROR_OK)
 	{
 		printError(error);
-		return;
 	}
-
-	// Set camera to trigger mode 0 (why not 14?)
-	triggerMode.onOff = external;
-	triggerMode.mode = 14;
-	triggerMode.polarity = 1; // when line goes HIGH
-	triggerMode.parameter = 0;
-	triggerMode.source = 0;  // use GPIO 0
-	error = cam.SetTriggerMode(&triggerMode);
-	if (error != PGRERROR_OK)
-	{
-		printError(error);
-		return;
-	}
-
-
-	error = cam.StartCapture(OnImageGrabbed, this);
-	if (error != PGRERROR_OK)
-	{
-		printError(error);
-		return;
-	}
-	mexPrintf("OK\n");
-
 }
 
-PTwrapper::~PTwrapper()
+void PTBackend::close()
 {
-	release();
+	if (deviceOpened)
+	{
+		mexPrintf("Disconnecting camera...");
+		error = cam.Disconnect();
+		if (error != PGRERROR_OK)
+		{
+			printError(error);
+		}
+		deviceOpened = false;
+		mexPrintf("OK!\n");
+	}
 }
 
 
 
-PTwrapper *camera = nullptr;
+CameraCore *camera = nullptr;
+// the process-wide session when CameraCore is the shared library; the cameras this mex
+// added run its backend code, so they go before it unloads
+CameraSession &session = CameraSession::shared();
 
 
 void exitFunction()
 {
 	if (camera != nullptr)
 		delete camera;
+	camera = nullptr;
+	session.releaseOwner("PTwrapper");
 }
 
 void mexFunction(int nlhs, mxArray *plhs[],
@@ -966,8 +491,8 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		if (camera != nullptr)
 			delete camera;
 
-		camera = new PTwrapper();
-		bool Success = camera->init();
+		camera = new CameraCore(new PTBackend());
+		bool Success = camera->init(CameraConfig());
 		plhs[0] = mxCreateDoubleScalar(Success);
 		delete Command;
 
@@ -977,28 +502,82 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		mexAtExit(exitFunction);
 		if (camera != nullptr)
 			delete camera;
-		if (nrhs < 4) {
+		camera = nullptr;
+		if (nrhs < 5) {
 			mexPrintf("Not enough parameters (x0,y0,width,height)\n");
 			return;
 		}
-		camera = new PTwrapper();
-
-		int x0 = (int)*(double*)mxGetPr(prhs[1]);
-		int y0 = (int)*(double*)mxGetPr(prhs[2]);
-
-		int w = (int)*(double*)mxGetPr(prhs[3]);
-		int h = (int)*(double*)mxGetPr(prhs[4]);
-		int mode = MODE_7;
-		if (nrhs > 4) {
-			mode = (int)*(double*)mxGetPr(prhs[5]);
-			mexPrintf("Using mode %d\n", mode);
+		CameraConfig config;
+		config.x0 = (int)*(double*)mxGetPr(prhs[1]);
+		config.y0 = (int)*(double*)mxGetPr(prhs[2]);
+		config.width = (int)*(double*)mxGetPr(prhs[3]);
+		config.height = (int)*(double*)mxGetPr(prhs[4]);
+		if (nrhs > 5) {
+			config.mode = (int)*(double*)mxGetPr(prhs[5]);
+			mexPrintf("Using mode %d\n", config.mode);
 		}
-		bool Success = camera->init(x0, y0, w, h, mode);
+		camera = new CameraCore(new PTBackend());
+		bool Success = camera->init(config);
 		plhs[0] = mxCreateDoubleScalar(Success);
 		delete Command;
 
 		return;
 	}
+	else if (strcmp(Command, "InitSynthetic") == 0) {
+		// InitSynthetic([width, height [, frameRate]]) - frame generator, no camera needed
+		mexAtExit(exitFunction);
+		if (camera != nullptr)
+			delete camera;
+		CameraConfig config;
+		if (nrhs > 2) {
+			config.width = (int)mxGetScalar(prhs[1]);
+			config.height = (int)mxGetScalar(prhs[2]);
+		}
+		if (nrhs > 3)
+			config.frameRate = mxGetScalar(prhs[3]);
+		camera = new CameraCore(new SyntheticBackend());
+		plhs[0] = mxCreateDoubleScalar(camera->init(config));
+		delete Command;
+		return;
+	}
+	else if (strcmp(Command, "InitSession") == 0 || strcmp(Command, "AddToSession") == 0) {
+		// InitSession(deviceIndices [, width, height]) - one camera per entry, bus order (0 based),
+		// -1 = synthetic camera of width x height. Frames are read with GetAlignedFrames,
+		// camera k is configured with SessionCommand(k, command, ...).
+		// AddToSession(...) appends to the session instead of replacing it, so the cameras of
+		// another wrapper (PTwrapper, XimeaWrapper) join the same tuples.
+		mexAtExit(exitFunction);
+		if (strcmp(Command, "InitSession") == 0)
+			session.release();
+		size_t firstCamera = session.getNumCameras();
+		bool Success = nrhs > 1 && mxGetNumberOfElements(prhs[1]) > 0;
+		for (size_t k = 0; Success && k < mxGetNumberOfElements(prhs[1]); k++) {
+			CameraConfig config;
+			config.deviceIndex = (int)mxGetPr(prhs[1])[k];
+			if (config.deviceIndex < 0 && nrhs > 3) {
+				config.width = (int)mxGetScalar(prhs[2]);
+				config.height = (int)mxGetScalar(prhs[3]);
+			}
+			CameraCore *core = new CameraCore(config.deviceIndex < 0 ? (ICameraBackend*)new SyntheticBackend() : new PTBackend());
+			core->init(config);
+			Success = session.addCamera(core, "PTwrapper");
+		}
+		if (!Success)
+			session.release(firstCamera);	// only the cameras of this call
+		plhs[0] = mxCreateDoubleScalar(Success);
+		delete Command;
+		return;
+	}
+	else if (strcmp(Command, "ReleaseSession") == 0) {
+		session.release();
+		plhs[0] = mxCreateDoubleScalar(1);
+		delete Command;
+		return;
+	}
+	else if (session.getNumCameras() > 0 && session.handleCommand(Command, nlhs, plhs, nrhs, prhs)) {
+		delete Command;
+		return;
+	}
 
 	if (strcmp(Command, "IsInitialized") == 0) {
 		if (camera == nullptr)
@@ -1025,188 +604,7 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		}
 		plhs[0] = mxCreateDoubleScalar(1);
 	}
-	else if (strcmp(Command, "SetTriggerMode") == 0)
-	{
-		bool external = *(bool*)mxGetData(prhs[1]);
-		camera->setTriggerMode(external);
-		plhs[0] = mxCreateDoubleScalar(1);
-		return;
-	}
-	else if (strcmp(Command, "CameraStatus") == 0)
-	{
-		camera->printStats();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "GetImageBuffer") == 0) {
-		if (camera->inAveragingMode())
-		{
-			int w = camera->getWidth();
-			int h = camera->getHeight();
-			mwSize dim[3] = { h, w, 0 };
-			plhs[0] = mxCreateNumericArray(3, dim, mxUINT8_CLASS, mxREAL);
-			mexPrintf("Please call Stop Averaging before calling get image buffer\n");
-			return;
-		}
-
-
-		int N = camera->getNumImagesInBuffer();
-
-		if (nrhs > 1)
-		{
-			// grab a subset of images
-			int requestedNumberOfImages = (int)*(double*)mxGetPr(prhs[1]);
-			N = MIN(N, requestedNumberOfImages);
-		}
-
-		int w = camera->getWidth();
-		int h = camera->getHeight();
-		mwSize dim[3] = { h, w, N };
-		mxArray* imageBuffer;
-
-		if (camera->getBytesPerPixel() == 1)
-			imageBuffer = mxCreateNumericArray(3, dim, mxUINT8_CLASS, mxREAL);
-		else if (camera->getBytesPerPixel() == 2)
-			imageBuffer = mxCreateNumericArray(3, dim, mxUINT16_CLASS, mxREAL);
-
-		if (imageBuffer == nullptr)
-		{
-			mexPrintf("Error allocating memory for buffer.\n");
-		}
-
-		unsigned char*imageBufferPtr = (unsigned char*)mxGetData(imageBuffer);
-
-		plhs[0] = imageBuffer;
-		plhs[1] = mxCreateDoubleScalar(camera->copyAndClearBuffer(imageBufferPtr, N));
-	}
-	else if (strcmp(Command, "PokeLastImageTuple") == 0) {
-		if (nrhs < 1)
-		{
-			mexPrintf("Error - please specify tuple size.\n");
-			return;
-		}
-
-		int w = camera->getWidth();
-		int h = camera->getHeight();
-		int requestedNumberOfImages = (int)*(double*)mxGetPr(prhs[1]);
-
-		mwSize dim[3] = { h, w, requestedNumberOfImages };
-		mxArray* imageBuffer;
-
-		if (camera->getBytesPerPixel() == 1)
-			imageBuffer = mxCreateNumericArray(3, dim, mxUINT8_CLASS, mxREAL);
-		else if (camera->getBytesPerPixel() == 2)
-			imageBuffer = mxCreateNumericArray(3, dim, mxUINT16_CLASS, mxREAL);
-
-		unsigned char*imageBufferPtr = (unsigned char*)mxGetData(imageBuffer);
-
-		int startFrame = camera->pokeLastFrames(imageBufferPtr, requestedNumberOfImages);
-		plhs[0] = imageBuffer;
-		plhs[1] = mxCreateDoubleScalar(startFrame);
-	}
-	else if (strcmp(Command, "PeekLastImage") == 0) {
-		int w = camera->getWidth();
-		int h = camera->getHeight();
-		int N = camera->getNumImagesInBuffer();
-		mwSize dim[3] = { h, w, N };
-		mxArray* imageBuffer;
-
-		if (camera->getBytesPerPixel() == 1)
-			imageBuffer = mxCreateNumericArray(3, dim, mxUINT8_CLASS, mxREAL);
-		else if (camera->getBytesPerPixel() == 2)
-			imageBuffer = mxCreateNumericArray(3, dim, mxUINT16_CLASS, mxREAL);
-
-		if (N > 0) {
-			unsigned char*imageBufferPtr = (unsigned char*)mxGetData(imageBuffer);
-			int startFrame = camera->pokeLastFrames(imageBufferPtr, 1);
-			plhs[0] = imageBuffer;
-			plhs[1] = mxCreateDoubleScalar(startFrame);
-		}
-
-	}
-
-
-	else if (strcmp(Command, "SetExposure") == 0)
-	{
-
-		float exposureSec = (float)*(double*)mxGetPr(prhs[1]);
-		float exposureMS = (float)exposureSec*1000.0;
-		camera->setExposure(exposureMS);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "StartAveraging") == 0)
-	{
-		int blockSize = (int)*(double*)mxGetPr(prhs[1]);
-		bool Reconstruction = (bool)*(unsigned char*)mxGetPr(prhs[2]);
-		camera->startAveraging(blockSize, Reconstruction);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "StopAveraging") == 0)
-	{
-		camera->stopAveraging();
-		plhs[0] = mxCreateDoubleScalar(camera->successfulAveraging());
-	}
-	else if (strcmp(Command, "GetExposure") == 0)
-	{
-
-		float exposureMS = (float)camera->getExposure();
-		float exposureSec = (float)exposureMS / 1000.0;
-		plhs[0] = mxCreateDoubleScalar(exposureSec);
-	}
-	else if (strcmp(Command, "SetGain") == 0)
-	{
-		float gain = *(double*)mxGetPr(prhs[1]);
-		camera->setGain(gain);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "GetGain") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getGain());
-	}
-	else if (strcmp(Command, "GetBufferSize") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getNumImagesInBuffer());
-	}
-	else if (strcmp(Command, "SoftwareTrigger") == 0)
-	{
-		camera->softwareTrigger();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "ClearBuffer") == 0)
-	{
-		camera->clearBuffer();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "ResetTriggerCounter") == 0)
-	{
-		camera->resetTriggerCounter();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "TriggerOFF") == 0)
-	{
-		camera->setTrigger(false);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "TriggerON") == 0)
-	{
-		camera->setTrigger(true);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "getNumTrigs") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getNumTrigs());
-	}
-	else  if (strcmp(Command, "getFrameRate") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getFrameRate());
-	}
-	else  if (strcmp(Command, "setFrameRate") == 0)
-	{
-		float rate = *(double*)mxGetPr(prhs[1]);
-		camera->setFrameRate(rate);
-		plhs[0] = mxCreateDoubleScalar(1);
-
-	}
-	else {
+	else if (!camera->handleCommand(Command, nlhs, plhs, nrhs, prhs)) {
 		mexPrintf("Error. Unknown command\n");
 	}
 
@@ -1215,4 +613,3 @@ void mexFunction(int nlhs, mxArray *plhs[],
 
 
 }
-
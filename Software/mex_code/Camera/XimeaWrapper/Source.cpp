@@ -5,6 +5,9 @@ DiCarlo Lab @ MIT
 
 Revision History
 Version 0.1 02/23/2017
+Version 0.2 10/18/2026	Buffering, averaging and export moved to the shared CameraCore
+Version 0.3 10/18/2026	Frames read from the driver queue, payload size from the image format
+Version 0.4 10/18/2026	Multi-camera sessions
 
 #define WIN32 1
 */
@@ -12,233 +15,106 @@ Version 0.1 02/23/2017
 #include "../Ximea/API/xiapi.h"
 #include "mex.h"
 #include <Windows.h>
-#include <queue>
-#include <deque>
+#include "../CameraCore/CameraCore.h"
 
-#define MIN(a,b) (a)<(b)?(a):(b)
-#define MAX(a,b) (a)>(b)?(a):(b)
 bool calledOnce = false;
 
 
 using namespace std;
 
 
-template<typename T, typename Container = std::deque<T> >
-class iterable_queue : public std::queue<T, Container>
-{
+// xiAPI adapter. xiAPI has no frame callback, so a polling thread waits in xiGetImage
+// and hands every frame to the core. 10 bit data sits in the low bits (no packing), so
+// frames are exported without a shift.
+// The driver owns the frame buffers (XI_BP_UNSAFE): xiGetImage returns a pointer into its
+// queue and the core's copy into the ring is the only one. Lines may be padded, in which
+// case they are compacted into rowScratch first.
+class XimeaBackend : public ICameraBackend {
 public:
-	typedef typename Container::iterator iterator;
-	typedef typename Container::const_iterator const_iterator;
-
-	iterator begin() { return this->c.begin(); }
-	iterator end() { return this->c.end(); }
-	const_iterator begin() const { return this->c.begin(); }
-	const_iterator end() const { return this->c.end(); }
-};
-
-
+	XimeaBackend() : core(nullptr), xiH(NULL), deviceOpened(false), stopThread(false), width(0), height(0), bytesPerPixel(2) {}
+	bool open(const CameraConfig &config, CameraCore *_core);
+	bool start();
+	void stop();
+	void close();
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+	int getBytesPerPixel() { return bytesPerPixel; }
+	int getExportShift() { return 0; }
+	int getBitDepth() { return 10; }
 
-class XimeaWrapper {
-public:
-	XimeaWrapper();
-	~XimeaWrapper();
-	bool isInitialized();
-	bool init(int x0, int y0, int _width, int _height);
-	int getWidth();
-	int getHeight();
 	bool softwareTrigger();
-	void frameCallback(XI_IMG* pImage);
-	bool setGain(float value);
-	float getGain();
-	void setAutoExposure(bool value);
-	bool getAutoExposure();
-	int getNumImagesInBuffer();
-	void setExposure(float value);
-	float getExposure();
-	int copyAndClearBuffer(unsigned char *imageBufferPtr, int N);
-	int getBytesPerPixel();
-	void clearBuffer();
-	int getNumTrigs();
-	void resetTriggerCounter();
-	//float getFrameRate();
-	void setFrameRate(float Rate);
-	void setTrigger(bool state);
-	//int pokeLastFrames(unsigned char *imageBufferPtr, int N);
-	//int copyBuffer16Bit(unsigned char *imageBufferPtr, int N);
-	void printStats();
-	unsigned long numTrig;
-	bool triggerEnabled;
-	void startAveraging(int numFrames, bool ReconstructionMode);
-	void stopAveraging();
-	bool inAveragingMode();
-	bool successfulAveraging();
-	//void printError(Error error);
-	void setTriggerMode(bool external);
-	void lockMutex();
-	void unlockMutex();
-	XI_IMG*  computePhase();
-	bool stopThread;
-	HANDLE xiH;
-	int width, height;
-private:
-	void averageImages(XI_IMG *A, XI_IMG *B, int iter);
-	int copyAndClearBuffer16Bit(unsigned char *imageBufferPtr, int N);
-
-	int bytesPerPixel;
-	void release();
-
-	XI_IMG TempImages[3];
-	iterable_queue<XI_IMG*>::iterator averagingIterator;
-	bool averagingMode;
-	int averagingBlockSize;
-	bool initialized;
-	bool deviceOpened;
-	bool streaming;
-	int lastResult;
-	bool triggered;
-	HANDLE ghMutex;
-	
-	unsigned long maxImagesInBuffer;
-	int mutexCount;
-	unsigned long trigsSinceBufferRead;
-	iterable_queue<XI_IMG*> imageQueue;
-	int imageFrameCounter;
+	bool setTriggerMode(bool external);
+	bool setExposure(double seconds);
+	double getExposure();
+	bool setGain(double value);
+	double getGain();
+	long long getDriverDropped();
 
+private:
+	void acquisitionThread();
 	bool printError(XI_RETURN res, char *error);
-	void startPoolingThread();
-	bool reconstructionMode;
-
-	DWORD   dwThreadId;
-	HANDLE  hThread;
-
 
+	CameraCore *core;
+	HANDLE xiH;
+	bool deviceOpened;
+	std::atomic<bool> stopThread;
+	std::thread worker;
+	int width, height;
+	int bytesPerPixel;	// from the data format actually set, 2 for RAW16
+	std::vector<unsigned char> rowScratch;
 };
 
-typedef struct
-{
-	XimeaWrapper* cam;
-} ThreadParams, *pThreadParams;
-
-
 
-DWORD WINAPI MyThreadFunction(LPVOID lpParam)
+void XimeaBackend::acquisitionThread()
 {
-	pThreadParams pData = (pThreadParams)lpParam;
 	XI_IMG image;
 	memset(&image, 0, sizeof(image));
 	image.size = sizeof(XI_IMG);
+	// frames are returned as soon as they arrive, the timeout only bounds how long stop() waits
 	int TIMOUT_MS = 500;
-	while (true)
+	while (!stopThread)
 	{
-		if (pData->cam->stopThread)
-			break;
-
-		XI_RETURN stat = XI_OK;
-		stat = xiGetImage(pData->cam->xiH, TIMOUT_MS, &image);
-		if (stat == XI_OK)
+		XI_RETURN stat = xiGetImage(xiH, TIMOUT_MS, &image);
+		if (stat != XI_OK)
+			continue;
+		// image.bp belongs to the driver and is only valid until the next xiGetImage
+		// acq_nframe counts from acquisition start (nframe restarts on exposure / gain changes),
+		// the timestamp is the camera's, taken at the start of read-out
+		int pixelBytes = (image.frm == XI_MONO8 || image.frm == XI_RAW8) ? 1 : 2;
+		size_t lineBytes = (size_t)image.width * pixelBytes;
+		size_t bytes = lineBytes * image.height;
+		const void *data = image.bp;
+		if (image.width != (DWORD)width || image.height != (DWORD)height || pixelBytes != bytesPerPixel)
+			bytes = 0;	// counted as truncated by the core
+		else if (image.padding_x > 0)
 		{
-			pData->cam->lockMutex();
-			XI_IMG *deepCopy = new XI_IMG;
-			*deepCopy = image;
-
-			long imgSize = deepCopy->height*deepCopy->width * 2; // assume 10 bit
-			deepCopy->bp = new unsigned char[imgSize];
-			memcpy(deepCopy->bp, image.bp, imgSize);
-
-			pData->cam->frameCallback(deepCopy);
-			pData->cam->unlockMutex();
-
+			rowScratch.resize(bytes);
+			const unsigned char *src = (const unsigned char*)image.bp;
+			for (int y = 0; y < height; y++)
+				memcpy(&rowScratch[y * lineBytes], src + y * (lineBytes + image.padding_x), lineBytes);
+			data = rowScratch.data();
 		}
+		core->onFrame(data, bytes, (int)image.acq_nframe, image.tsSec + image.tsUSec * 1e-6);
 	}
-	return 0;
 }
 
-
-
-void XimeaWrapper::frameCallback(XI_IMG *pImage)
+long long XimeaBackend::getDriverDropped()
 {
-	triggered = true;
-	numTrig++;
-	trigsSinceBufferRead++;
-
-	int averagingIteration = (numTrig - 1) / averagingBlockSize;
-	if (!averagingMode || averagingIteration == 0)
-	{
-		imageQueue.push(pImage);
-		averagingIterator = imageQueue.begin();
-	}
-	else
-	{
-
-		// we are averaging images. Buffer size never exceeds averagingBlockSize
-		// the image we need to manipulate is actually  (numTrig-1) % averagingBlockSize
-		// first, operate on the image pointed by averagingIterator
-		// then increase iterator.
-		averageImages(*averagingIterator, pImage, averagingIteration);
-		delete pImage;
-
-		averagingIterator++;
-		if (averagingIterator == imageQueue.end())
-			averagingIterator = imageQueue.begin();
-
-	}
-
-
-	if (imageQueue.size() > maxImagesInBuffer)
+	// frames lost on the transport and frames the API skipped because we fell behind
+	long long dropped = 0;
+	int selectors[2] = { XI_CNT_SEL_TRANSPORT_SKIPPED_FRAMES, XI_CNT_SEL_API_SKIPPED_FRAMES };
+	for (int k = 0; k < 2; k++)
 	{
-		XI_IMG *p = imageQueue.front();
-		delete p;
-		imageQueue.pop();
+		int value = 0;
+		if (xiSetParamInt(xiH, XI_PRM_COUNTER_SELECTOR, selectors[k]) != XI_OK || xiGetParamInt(xiH, XI_PRM_COUNTER_VALUE, &value) != XI_OK)
+			return -1;
+		dropped += value;
 	}
-
-}
-
-
-
-void XimeaWrapper::startPoolingThread()
-{
-	pThreadParams pThreadInput = (pThreadParams)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(ThreadParams));
-	pThreadInput->cam = this;
-	this->stopThread = false;
-	this->hThread = CreateThread(
-		NULL,                   // default security attributes
-		0,                      // use default stack size  
-		MyThreadFunction,       // thread function name
-		pThreadInput,          // argument to thread function 
-		0,                      // use default creation flags 
-		&this->dwThreadId);   // returns the thread identifier 
-
+	return dropped;
 }
 
-
-bool XimeaWrapper::inAveragingMode()
-{
-	return averagingMode;
-}
-
-bool XimeaWrapper::successfulAveraging()
-{
-	return numTrig % averagingBlockSize == 0;
-}
-
-void XimeaWrapper::startAveraging(int numFrames, bool ReconstructionMode)
-{
-	lockMutex();
-	clearBuffer();
-	averagingBlockSize = numFrames;
-	averagingMode = true;
-	reconstructionMode = ReconstructionMode;
-	resetTriggerCounter();
-	unlockMutex();
-}
-
-void XimeaWrapper::stopAveraging()
-{
-	averagingMode = false;
-	reconstructionMode = false;
-}
-
-bool XimeaWrapper::printError(XI_RETURN res, char *error)
+bool XimeaBackend::printError(XI_RETURN res, char *error)
 {
 	if (res != XI_OK) {
 		mexPrintf("Error encountered: %s\n", error);
@@ -247,262 +123,52 @@ bool XimeaWrapper::printError(XI_RETURN res, char *error)
 	return false;
 }
 
-bool XimeaWrapper::isInitialized()
+bool XimeaBackend::setExposure(double seconds)
 {
-	return initialized;
+	long ExposureMicroseconds = seconds * 1000000.0;
+	XI_RETURN stat = xiSetParamInt(xiH, XI_PRM_EXPOSURE, ExposureMicroseconds);
+	return !printError(stat, "xiSetParam (exposure set)");
 }
 
-void XimeaWrapper::setTrigger(bool state)
-{
-	triggerEnabled = state;
-}
-
-void XimeaWrapper::setFrameRate(float Rate)
-{
-}
-
-
-void XimeaWrapper::setExposure(float value)
-{
-	XI_RETURN stat = XI_OK;
-	long ExposureMicroseconds = value * 1000000.0;
-	stat = xiSetParamInt(xiH, XI_PRM_EXPOSURE, ExposureMicroseconds);
-	printError(stat, "xiSetParam (exposure set)");
-}
-
-void XimeaWrapper::resetTriggerCounter()
-{
-	numTrig = 0;
-
-}
-int XimeaWrapper::getNumTrigs()
+double XimeaBackend::getExposure()
 {
-	return numTrig;
-}
-
-int XimeaWrapper::getBytesPerPixel()
-{
-	return bytesPerPixel;
-}
-
-int XimeaWrapper::getNumImagesInBuffer()
-{
-	int n;
-	lockMutex();
-	n = (int)imageQueue.size();
-	unlockMutex();
-	return n;
-}
-
-
-
-float XimeaWrapper::getExposure()
-{
-	int explo;
-	XI_RETURN stat = XI_OK;
-	stat = xiGetParamInt(xiH, XI_PRM_EXPOSURE, &explo);
+	int explo = 0;
+	XI_RETURN stat = xiGetParamInt(xiH, XI_PRM_EXPOSURE, &explo);
 	printError(stat, "xiGetParam (exposure get)");
 
-	float exposureSec = (float)explo / 1000000.0;
-	return exposureSec;
+	return (double)explo / 1000000.0;
 }
 
-void XimeaWrapper::setAutoExposure(bool value)
+bool XimeaBackend::setGain(double value)
 {
+	XI_RETURN stat = xiSetParamFloat(xiH, XI_PRM_GAIN, (float)value);
+	return !printError(stat, "xiSetParam (gain set)");
 }
 
-
-bool XimeaWrapper::getAutoExposure()
+double XimeaBackend::getGain()
 {
-	return false;
-}
-
-
-bool XimeaWrapper::setGain(float value)
-{
-	XI_RETURN stat = XI_OK;
-	stat = xiSetParamFloat(xiH, XI_PRM_GAIN, value);
-	printError(stat, "xiSetParam (gain set)");
-	return stat == XI_OK;
-}
-
-
-
-float XimeaWrapper::getGain()
-{
-	XI_RETURN stat = XI_OK;
-	float value;
-	stat = xiGetParamFloat(xiH, XI_PRM_GAIN, &value);
+	float value = 0;
+	XI_RETURN stat = xiGetParamFloat(xiH, XI_PRM_GAIN, &value);
 	printError(stat, "xiGetParam (gain get)");
 	return value;
 }
 
-
-
-void XimeaWrapper::lockMutex()
-{
-	mutexCount++;
-	int dwWaitResult = WaitForSingleObject(
-		ghMutex,    // handle to mutex
-		INFINITE);  // no time-out interval
-}
-
-void XimeaWrapper::unlockMutex()
-{
-	ReleaseMutex(ghMutex);
-	mutexCount--;
-}
-
-bool XimeaWrapper::softwareTrigger()
+bool XimeaBackend::softwareTrigger()
 {
 	xiSetParamInt(xiH, XI_PRM_TRG_SOFTWARE, 0);
 	return true;
 }
 
-void XimeaWrapper::averageImages(XI_IMG *A, XI_IMG *B, int iter)
+bool XimeaBackend::setTriggerMode(bool external)
 {
-	// running average. Keep result in A.
-	unsigned short *dataA = (unsigned short*)A->bp;
-	unsigned short *dataB = (unsigned short*)B->bp;
-
-	long numPixels = A->width * A->height;
-	for (long counter = 0; counter<numPixels; counter++)
-	{
-		unsigned short pA = dataA[counter];
-		unsigned short pB = dataB[counter];
-
-		unsigned short avgValue = float((iter)* pA + pB) / (float)(iter + 1);
-		dataA[counter] = avgValue;
-	}
-}
-
-void XimeaWrapper::clearBuffer()
-{
-	lockMutex();
-	int N = imageQueue.size();
-	for (int k = 0; k < N; k++)
-	{
-		XI_IMG *p = imageQueue.front();
-		delete p;
-		imageQueue.pop();
-	}
-	unlockMutex();
-}
-
-int XimeaWrapper::copyAndClearBuffer16Bit(unsigned char *imageBufferPtr, int N)
-{
-	unsigned short *imageBufferIntPtr = (unsigned short *)imageBufferPtr;
-	int tmp = sizeof(unsigned short);
-	tmp = tmp;
-	lockMutex();
-	int numCopied = 0;
-
-	int numToCopy = MIN(imageQueue.size(), N);
-	int FirstImageTrig = (numToCopy > 0) ? (imageQueue.front())->nframe : -1;
-	unsigned short Pixel = 0;
-	for (long k = 0; k<numToCopy; k++)
-	{
-		XI_IMG *I = imageQueue.front();
-
-		unsigned short *data16bits = (unsigned short*)I->bp;
-		long long offset = ((long long)width*(long long)height*k);
-
-		long numBytesToCopy = I->height * I->width * 2;
-		// Assume no data packing....
-		memcpy(imageBufferIntPtr + offset, data16bits, numBytesToCopy);
-		
-		int counter = 0;
-		for (long y = 0; y<height; y++)
-		{
-		for (long x = 0; x<width; x++)
-		{
-
-		Pixel = data16bits[counter];
-		//Pixel = Pixel >> 4;	// move the upper 12 bit to the right, so we have 0..4095 gray scales.
-		imageBufferIntPtr[offset + (long long)((y)+x*(long)height)] = Pixel;
-		counter++;
-		}
-		}
-		
-
-		imageQueue.pop();
-		delete I;
-	}
-	unlockMutex();
-
-	return FirstImageTrig;
-}
-
-
-
-/*
-int XimeaWrapper::pokeLastFrames(unsigned char *imageBufferPtr, int N)
-{
-return copyBuffer16Bit(imageBufferPtr, N);
-}
-*/
-
-int XimeaWrapper::copyAndClearBuffer(unsigned char *imageBufferPtr, int N)
-{
-	trigsSinceBufferRead = 0;
-	return copyAndClearBuffer16Bit(imageBufferPtr, N);
-}
-
-
-int XimeaWrapper::getWidth()
-{
-	return width;
-}
-
-int XimeaWrapper::getHeight()
-{
-	return height;
+	// the trigger source is fixed to the rising edge at open
+	return false;
 }
 
 
-
-
-void XimeaWrapper::release()
+bool XimeaBackend::open(const CameraConfig &config, CameraCore *_core)
 {
-	if (streaming)
-	{
-		// stop streaming...
-		triggerEnabled = false;
-		stopThread = true;
-		unlockMutex();
-		Sleep(600); // wait for all threads to finish reading... (?)
-
-		mexPrintf("Stopping capture...");
-		xiStopAcquisition(this->xiH);
-
-		streaming = false;
-		mexPrintf("OK!\n");
-	}
-	Sleep(100); // wait for all threads to finish writing... (?)
-
-	if (initialized)
-	{
-		if (deviceOpened)
-		{
-			xiCloseDevice(this->xiH);
-		}
-
-		mexPrintf("Closing mutex...");
-		CloseHandle(ghMutex);
-		mexPrintf("OK!\n");
-		ghMutex = NULL;
-		initialized = false;
-	}
-	mexPrintf("Release sequence finished!\n");
-}
-
-
-
-
-bool XimeaWrapper::init(int x0 = 0, int y0 = 0, int _width = 1280, int _height = 1024)
-{
-	if (initialized)
-		return true;
+	core = _core;
 
 	DWORD NumberDevices;
 	XI_RETURN stat = xiGetNumberDevices(&NumberDevices);
@@ -511,134 +177,115 @@ bool XimeaWrapper::init(int x0 = 0, int y0 = 0, int _width = 1280, int _height =
 		return false;
 	}
 
-	// pick first device.
-	DWORD DevId = 0;
+	if (config.deviceIndex < 0 || config.deviceIndex >= (int)NumberDevices) {
+		mexPrintf("No XiMEA camera %d. Aborting\r\n", config.deviceIndex);
+		return false;
+	}
+	DWORD DevId = config.deviceIndex;
 
-	stat = xiOpenDevice(DevId, &this->xiH);
+	stat = xiOpenDevice(DevId, &xiH);
 	if (stat != XI_OK)
 	{
 		mexPrintf("Cannot open device %d\r\n", DevId);
 		return false;
 	}
+	deviceOpened = true;
 
-	xiSetParamInt(this->xiH, XI_PRM_SHUTTER_TYPE, XI_SHUTTER_GLOBAL);
-	xiSetParamInt(this->xiH, XI_PRM_IMAGE_DATA_FORMAT, XI_RAW16);
-	xiSetParamInt(this->xiH, XI_PRM_OUTPUT_DATA_BIT_DEPTH, 10);
-	xiSetParamInt(this->xiH, XI_PRM_TRG_SOURCE, XI_TRG_EDGE_RISING);
+	xiSetParamInt(xiH, XI_PRM_SHUTTER_TYPE, XI_SHUTTER_GLOBAL);
+	xiSetParamInt(xiH, XI_PRM_IMAGE_DATA_FORMAT, XI_RAW16);
+	xiSetParamInt(xiH, XI_PRM_OUTPUT_DATA_BIT_DEPTH, 10);
+	int format = XI_RAW16;
+	xiGetParamInt(xiH, XI_PRM_IMAGE_DATA_FORMAT, &format);
+	bytesPerPixel = (format == XI_MONO8 || format == XI_RAW8) ? 1 : 2;
+	// frames are read straight out of the driver's queue; a deeper queue absorbs callback jitter
+	// before the API starts skipping frames
+	xiSetParamInt(xiH, XI_PRM_BUFFER_POLICY, XI_BP_UNSAFE);
+	int maxQueue = 0;
+	if (xiGetParamInt(xiH, XI_PRM_BUFFERS_QUEUE_SIZE XI_PRM_INFO_MAX, &maxQueue) == XI_OK && maxQueue > 0)
+		printError(xiSetParamInt(xiH, XI_PRM_BUFFERS_QUEUE_SIZE, maxQueue), "Setting buffer queue size");
+	xiSetParamInt(xiH, XI_PRM_TRG_SOURCE, XI_TRG_EDGE_RISING);
 	// no auto white balance
-	printError(xiSetParamInt(this->xiH, XI_PRM_AUTO_WB, 0), "Setting White Balance");
+	printError(xiSetParamInt(xiH, XI_PRM_AUTO_WB, 0), "Setting White Balance");
 	// no auto exposure
-	printError(xiSetParamInt(this->xiH, XI_PRM_AEAG, 0), "Setting Auto Exposure");
-
+	printError(xiSetParamInt(xiH, XI_PRM_AEAG, 0), "Setting Auto Exposure");
 
+	int _width = (config.width > 0) ? config.width : 1280;
+	int _height = (config.height > 0) ? config.height : 1024;
 
 	int width_inc;
 	int height_inc;
-	xiGetParamInt(this->xiH, XI_PRM_HEIGHT XI_PRM_INFO_INCREMENT, &height_inc);
+	xiGetParamInt(xiH, XI_PRM_HEIGHT XI_PRM_INFO_INCREMENT, &height_inc);
 	width_inc = 16;
 
-	mexPrintf("Requesting ROI [%d,%d,%d,%d]\r\n", x0, y0, _width, _height);
-	int offset_x = (x0 / width_inc) * width_inc;
-	int offset_y = (y0 / height_inc) * height_inc;
+	mexPrintf("Requesting ROI [%d,%d,%d,%d]\r\n", config.x0, config.y0, _width, _height);
+	int offset_x = (config.x0 / width_inc) * width_inc;
+	int offset_y = (config.y0 / height_inc) * height_inc;
 	int image_width = (_width / height_inc) * height_inc;
 	int image_height = (_height / height_inc) * height_inc;
 	mexPrintf("Attempting to set ROI: [%d,%d,%d,%d]\r\n", offset_x, offset_y, image_width, image_height);
 	bool bError = false;
-	bError |= printError(xiSetParamInt(this->xiH, XI_PRM_WIDTH, image_width), "Set Image Width");
-	bError |= printError(xiSetParamInt(this->xiH, XI_PRM_HEIGHT, image_height), "Set Image Height");
+	bError |= printError(xiSetParamInt(xiH, XI_PRM_WIDTH, image_width), "Set Image Width");
+	bError |= printError(xiSetParamInt(xiH, XI_PRM_HEIGHT, image_height), "Set Image Height");
 
-	bError |=printError(xiSetParamInt(this->xiH, XI_PRM_OFFSET_X, offset_x), "Set Offset X");
-	bError |= printError(xiSetParamInt(this->xiH, XI_PRM_OFFSET_Y, offset_y), "Set Offset Y");
+	bError |=printError(xiSetParamInt(xiH, XI_PRM_OFFSET_X, offset_x), "Set Offset X");
+	bError |= printError(xiSetParamInt(xiH, XI_PRM_OFFSET_Y, offset_y), "Set Offset Y");
 	if (bError)
 	{
 		mexPrintf("Aborting and closing camera.\r\n");
-		stat = xiCloseDevice(this->xiH);
 		return false;
 	}
 
 	width = image_width;
 	height = image_height;
+	int payload = 0;
+	if (xiGetParamInt(xiH, XI_PRM_IMAGE_PAYLOAD_SIZE, &payload) == XI_OK)
+		mexPrintf("Frame payload %d bytes (%d bytes per pixel)\r\n", payload, bytesPerPixel);
+	return true;
+}
 
-	bytesPerPixel = 2; // 10 bit ADC
-
-
-
-	maxImagesInBuffer = (long)15 * 1e9 / (width*height*bytesPerPixel); // 15GB (!)
-	mexPrintf("Allowing maximum 15GB of memory, or %d 16 bit images.\n", maxImagesInBuffer);
-
-
-	deviceOpened = true;
-
-
-	stat = xiStartAcquisition(this->xiH);
+bool XimeaBackend::start()
+{
+	XI_RETURN stat = xiStartAcquisition(xiH);
 	if (stat != XI_OK)
-	{
-		xiCloseDevice(this->xiH);
 		return false;
-	}
 
 	xiSetParamInt(0, XI_PRM_DEBUG_LEVEL, XI_DL_FATAL);
-	streaming = true;
-	initialized = true;
-	mexPrintf("Camera initialized and in capture mode\n");
-	startPoolingThread();
+	stopThread = false;
+	worker = std::thread(&XimeaBackend::acquisitionThread, this);
 	return true;
 }
 
-XimeaWrapper::XimeaWrapper() : initialized(false), deviceOpened(false), streaming(false), triggered(false), numTrig(0), width(0), height(0), bytesPerPixel(2)
+void XimeaBackend::stop()
 {
-
-	ghMutex = CreateMutex(
-		NULL,              // default security attributes
-		FALSE,             // initially not owned
-		NULL);             // unnamed mutex
-	maxImagesInBuffer = 25000; // 15GB (!)
-	triggerEnabled = true;
-	trigsSinceBufferRead = 0;
-	averagingBlockSize = 1;
-	mutexCount = 0;
-	reconstructionMode = false;
-	averagingMode = false;
+	// the thread leaves xiGetImage within one timeout
+	stopThread = true;
+	if (worker.joinable())
+		worker.join();
+	if (deviceOpened)
+		xiStopAcquisition(xiH);
 }
 
-void XimeaWrapper::printStats()
+void XimeaBackend::close()
 {
-	/*CameraStats stat;
-	cam.GetStats(&stat);
-	mexPrintf("Timestamp %d\n", stat.timeStamp);
-	mexPrintf("Power is %d\n", stat.cameraPowerUp);
-	mexPrintf("Num Corrupted %d\n", stat.imageCorrupt);
-	mexPrintf("Driver Dropped %d\n", stat.imageDriverDropped);
-	mexPrintf("Images Dropped %d\n", stat.imageDropped);
-	mexPrintf("Temperature %d\n", stat.temperature);
-	mexPrintf("Port Errors %d\n", stat.portErrors);
-	*/
+	if (deviceOpened)
+		xiCloseDevice(xiH);
+	deviceOpened = false;
 }
 
 
 
-void XimeaWrapper::setTriggerMode(bool external)
-{
-	// Start capturing images
-	mexPrintf("Stopping capture...");
-
-
-}
-
-XimeaWrapper::~XimeaWrapper()
-{
-	release();
-}
-
-
-
-XimeaWrapper *camera = nullptr;
+CameraCore *camera = nullptr;
+// the process-wide session when CameraCore is the shared library; the cameras this mex
+// added run its backend code, so they go before it unloads
+CameraSession &session = CameraSession::shared();
 
 
 void exitFunction()
 {
 	if (camera != nullptr)
 		delete camera;
+	camera = nullptr;
+	session.releaseOwner("XimeaWrapper");
 }
 
 void mexFunction(int nlhs, mxArray *plhs[],
@@ -658,8 +305,8 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		if (camera != nullptr)
 			delete camera;
 
-		camera = new XimeaWrapper();
-		bool Success = camera->init();
+		camera = new CameraCore(new XimeaBackend());
+		bool Success = camera->init(CameraConfig());
 		plhs[0] = mxCreateDoubleScalar(Success);
 		delete Command;
 
@@ -669,24 +316,79 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		mexAtExit(exitFunction);
 		if (camera != nullptr)
 			delete camera;
-		if (nrhs < 4) {
+		camera = nullptr;
+		if (nrhs < 5) {
 			mexPrintf("Not enough parameters (x0,y0,width,height)\n");
 			return;
 		}
-		camera = new XimeaWrapper();
-
-		int x0 = (int)*(double*)mxGetPr(prhs[1]);
-		int y0 = (int)*(double*)mxGetPr(prhs[2]);
-
-		int w = (int)*(double*)mxGetPr(prhs[3]);
-		int h = (int)*(double*)mxGetPr(prhs[4]);
-
-		bool Success = camera->init(x0, y0, w, h);
+		CameraConfig config;
+		config.x0 = (int)*(double*)mxGetPr(prhs[1]);
+		config.y0 = (int)*(double*)mxGetPr(prhs[2]);
+		config.width = (int)*(double*)mxGetPr(prhs[3]);
+		config.height = (int)*(double*)mxGetPr(prhs[4]);
+
+		camera = new CameraCore(new XimeaBackend());
+		bool Success = camera->init(config);
 		plhs[0] = mxCreateDoubleScalar(Success);
 		delete Command;
 
 		return;
 	}
+	else if (strcmp(Command, "InitSynthetic") == 0) {
+		// InitSynthetic([width, height [, frameRate]]) - frame generator, no camera needed
+		mexAtExit(exitFunction);
+		if (camera != nullptr)
+			delete camera;
+		CameraConfig config;
+		if (nrhs > 2) {
+			config.width = (int)mxGetScalar(prhs[1]);
+			config.height = (int)mxGetScalar(prhs[2]);
+		}
+		if (nrhs > 3)
+			config.frameRate = mxGetScalar(prhs[3]);
+		camera = new CameraCore(new SyntheticBackend());
+		plhs[0] = mxCreateDoubleScalar(camera->init(config));
+		delete Command;
+		return;
+	}
+	else if (strcmp(Command, "InitSession") == 0 || strcmp(Command, "AddToSession") == 0) {
+		// InitSession(deviceIndices [, width, height]) - one camera per entry, xiAPI device order (0 based),
+		// -1 = synthetic camera of width x height. Frames are read with GetAlignedFrames,
+		// camera k is configured with SessionCommand(k, command, ...).
+		// AddToSession(...) appends to the session instead of replacing it, so the cameras of
+		// another wrapper (PTwrapper, XimeaWrapper) join the same tuples.
+		mexAtExit(exitFunction);
+		if (strcmp(Command, "InitSession") == 0)
+			session.release();
+		size_t firstCamera = session.getNumCameras();
+		bool Success = nrhs > 1 && mxGetNumberOfElements(prhs[1]) > 0;
+		for (size_t k = 0; Success && k < mxGetNumberOfElements(prhs[1]); k++) {
+			CameraConfig config;
+			config.deviceIndex = (int)mxGetPr(prhs[1])[k];
+			if (config.deviceIndex < 0 && nrhs > 3) {
+				config.width = (int)mxGetScalar(prhs[2]);
+				config.height = (int)mxGetScalar(prhs[3]);
+			}
+			CameraCore *core = new CameraCore(config.deviceIndex < 0 ? (ICameraBackend*)new SyntheticBackend() : new XimeaBackend());
+			core->init(config);
+			Success = session.addCamera(core, "XimeaWrapper");
+		}
+		if (!Success)
+			session.release(firstCamera);	// only the cameras of this call
+		plhs[0] = mxCreateDoubleScalar(Success);
+		delete Command;
+		return;
+	}
+	else if (strcmp(Command, "ReleaseSession") == 0) {
+		session.release();
+		plhs[0] = mxCreateDoubleScalar(1);
+		delete Command;
+		return;
+	}
+	else if (session.getNumCameras() > 0 && session.handleCommand(Command, nlhs, plhs, nrhs, prhs)) {
+		delete Command;
+		return;
+	}
 
 	if (strcmp(Command, "IsInitialized") == 0) {
 		if (camera == nullptr)
@@ -713,137 +415,10 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		}
 		plhs[0] = mxCreateDoubleScalar(1);
 	}
-	else if (strcmp(Command, "SetTriggerMode") == 0)
-	{
-		bool external = *(bool*)mxGetData(prhs[1]);
-		camera->setTriggerMode(external);
-		plhs[0] = mxCreateDoubleScalar(1);
-		return;
-	}
-	else if (strcmp(Command, "CameraStatus") == 0)
-	{
-		camera->printStats();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "GetImageBuffer") == 0) {
-		if (camera->inAveragingMode())
-		{
-			int w = camera->getWidth();
-			int h = camera->getHeight();
-			mwSize dim[3] = { h, w, 0 };
-			plhs[0] = mxCreateNumericArray(3, dim, mxUINT8_CLASS, mxREAL);
-			mexPrintf("Please call Stop Averaging before calling get image buffer\n");
-			return;
-		}
-
-
-		int N = camera->getNumImagesInBuffer();
-
-		if (nrhs > 1)
-		{
-			// grab a subset of images
-			int requestedNumberOfImages = (int)*(double*)mxGetPr(prhs[1]);
-			N = MIN(N, requestedNumberOfImages);
-		}
-
-		int w = camera->getWidth();
-		int h = camera->getHeight();
-		mwSize dim[3] = { h, w, N };
-		mxArray* imageBuffer;
-
-		imageBuffer = mxCreateNumericArray(3, dim, mxUINT16_CLASS, mxREAL);
-
-		if (imageBuffer == nullptr)
-		{
-			mexPrintf("Error allocating memory for buffer.\n");
-		}
-
-		unsigned char*imageBufferPtr = (unsigned char*)mxGetData(imageBuffer);
-
-		plhs[0] = imageBuffer;
-		plhs[1] = mxCreateDoubleScalar(camera->copyAndClearBuffer(imageBufferPtr, N));
-	}
-
-	else if (strcmp(Command, "SetExposure") == 0)
-	{
-
-		float exposureSec = (float)*(double*)mxGetPr(prhs[1]);
-		camera->setExposure(exposureSec);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "StartAveraging") == 0)
-	{
-		int blockSize = (int)*(double*)mxGetPr(prhs[1]);
-		bool Reconstruction = (bool)*(unsigned char*)mxGetPr(prhs[2]);
-		camera->startAveraging(blockSize, Reconstruction);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "StopAveraging") == 0)
-	{
-		camera->stopAveraging();
-		plhs[0] = mxCreateDoubleScalar(camera->successfulAveraging());
-	}
-	else if (strcmp(Command, "GetExposure") == 0)
-	{
-
-		float exposureSec = (float)camera->getExposure();
-		plhs[0] = mxCreateDoubleScalar(exposureSec);
-	}
-	else if (strcmp(Command, "SetGain") == 0)
-	{
-		float gain = *(double*)mxGetPr(prhs[1]);
-		camera->setGain(gain);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else if (strcmp(Command, "GetGain") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getGain());
-	}
-	else if (strcmp(Command, "GetBufferSize") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getNumImagesInBuffer());
-	}
-	else if (strcmp(Command, "SoftwareTrigger") == 0)
-	{
-		camera->softwareTrigger();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "ClearBuffer") == 0)
-	{
-		camera->clearBuffer();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "ResetTriggerCounter") == 0)
-	{
-		camera->resetTriggerCounter();
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "TriggerOFF") == 0)
-	{
-		camera->setTrigger(false);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "TriggerON") == 0)
-	{
-		camera->setTrigger(true);
-		plhs[0] = mxCreateDoubleScalar(1);
-	}
-	else  if (strcmp(Command, "getNumTrigs") == 0)
-	{
-		plhs[0] = mxCreateDoubleScalar(camera->getNumTrigs());
-	}
-
-	else  if (strcmp(Command, "setFrameRate") == 0)
-	{
-		float rate = *(double*)mxGetPr(prhs[1]);
-		camera->setFrameRate(rate);
-		plhs[0] = mxCreateDoubleScalar(1);
-
-	} 
-	else {
+	else if (!camera->handleCommand(Command, nlhs, plhs, nrhs, prhs)) {
 		mexPrintf("Error. Unknown command\n");
 	}
-	
+
 
 
 	delete Command;
@@ -851,4 +426,3 @@ void mexFunction(int nlhs, mxArray *plhs[],
 
 
 }
-
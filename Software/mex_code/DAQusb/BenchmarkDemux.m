@@ -0,0 +1,16 @@
+% Benchmark of the GetFrames demultiplexer at the scan geometries we use, no board needed.
+% A frame has to be demultiplexed faster than the DMD scans it (spotRate spots per second
+% over all planes) for the live view to keep up.
+addpath('C:\Users\shayo\Dropbox (MIT)\Code\Waveform Reshaping code\MEX\x64');
+
+spotRate = 22000;
+% numChannels, numPlanes, numSpotsPerPlane, overSampling
+geometries = [2 1 1000 20; 2 4 1000 20; 2 8 500 20; 1 8 500 10; 2 1 100 200; 2 4 2000 4];
+numFrames = 200;
+for k=1:size(geometries,1)
+    g = geometries(k,:);
+    msPerFrame = fnDAQusb('BenchmarkDemux', g(1), g(2), g(3), g(4), numFrames);
+    scanMs = 1e3 * g(2) * g(3) / spotRate;
+    fprintf('%d ch, %d planes x %d spots, oversampling %d: %.3f / %.3f / %.3f ms per frame (double / single / uint16), scan takes %.1f ms\n', ...
+        g(1), g(2), g(3), g(4), msPerFrame(1), msPerFrame(2), msPerFrame(3), scanMs);
+end
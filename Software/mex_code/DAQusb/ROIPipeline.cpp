@@ -0,0 +1,542 @@
+/*
+Real-time ROI imaging pipeline
+Programmed by Shay Ohayon
+DiCarlo Lab @ MIT
+
+Revision History
+Version 0.1 10/18/2026
+
+*/
+#include <math.h>
+#include <string.h>
+#include <limits>
+#include <emmintrin.h>
+#include "ROIPipeline.h"
+
+
+void SpotStatistics::reset(size_t _numValues, int _windowFrames)
+{
+	numValues = _numValues;
+	windowFrames = (_windowFrames > 0) ? _windowFrames : 0;
+	count = 0;
+	last.assign(numValues, 0);
+	mean.assign(numValues, 0);
+	m2.assign(numValues, 0);
+	window.assign((size_t)windowFrames * numValues, 0);
+	// like SmartAveraging('Init'), a reset drops the saved background
+	savedMean.clear();
+	hasSavedMean = false;
+}
+
+void SpotStatistics::add(const double *values)
+{
+	count++;
+	if (windowFrames == 0 || count <= windowFrames)
+	{
+		// Welford, growing
+		double n = (double)count;
+		for (size_t k = 0; k < numValues; k++)
+		{
+			double delta = values[k] - mean[k];
+			mean[k] += delta / n;
+			m2[k] += delta * (values[k] - mean[k]);
+		}
+	}
+	else
+	{
+		// the frame that leaves the window is replaced by the new one
+		const double *oldest = &window[(size_t)((count - 1) % windowFrames) * numValues];
+		double n = (double)windowFrames;
+		for (size_t k = 0; k < numValues; k++)
+		{
+			double oldMean = mean[k];
+			double change = values[k] - oldest[k];
+			mean[k] = oldMean + change / n;
+			m2[k] += change * (values[k] - mean[k] + oldest[k] - oldMean);
+		}
+	}
+	if (windowFrames > 0)
+		memcpy(&window[(size_t)((count - 1) % windowFrames) * numValues], values, numValues * sizeof(double));
+	memcpy(last.data(), values, numValues * sizeof(double));
+}
+
+double SpotStatistics::getStd(size_t k)
+{
+	long long n = (windowFrames > 0 && count > windowFrames) ? windowFrames : count;
+	if (n < 2)
+		return 0;
+	// the sliding update can leave tiny negative sums behind
+	return sqrt((m2[k] > 0 ? m2[k] : 0) / (double)(n - 1));
+}
+
+
+bool ROIPipeline::init(int _maskRows, int _maskCols, const std::vector<int> &_selectedSpots, int _numPlanes, int _numChannels,
+	int _offsetX, int _offsetY, int _subsampling, double _voltageRange, int windowFrames)
+{
+	if (_maskRows <= 0 || _maskCols <= 0 || _numPlanes <= 0 || _numChannels <= 0 || _subsampling <= 0 || _offsetX < 0 || _offsetY < 0)
+	{
+		mexPrintf("Invalid pipeline geometry.\n");
+		return false;
+	}
+	for (size_t k = 0; k < _selectedSpots.size(); k++)
+	{
+		if (_selectedSpots[k] < 0 || _selectedSpots[k] >= _maskRows * _maskCols)
+		{
+			mexPrintf("Selected spot %d is outside the %dx%d mask.\n", _selectedSpots[k] + 1, _maskRows, _maskCols);
+			return false;
+		}
+	}
+	maskRows = _maskRows;
+	maskCols = _maskCols;
+	selectedSpots = _selectedSpots;
+	numPlanes = _numPlanes;
+	numChannels = _numChannels;
+	offsetX = _offsetX;
+	offsetY = _offsetY;
+	subsampling = _subsampling;
+	voltageRange = _voltageRange;
+
+	size_t numValues = selectedSpots.size() * numPlanes;
+	statistics.assign(numChannels, SpotStatistics());
+	for (int ch = 0; ch < numChannels; ch++)
+		statistics[ch].reset(numValues, windowFrames);
+	newMin.assign(numChannels, std::numeric_limits<double>::infinity());
+	newMax.assign(numChannels, -std::numeric_limits<double>::infinity());
+	frameScratch.resize(numValues);
+	grid.resize((size_t)maskRows * maskCols);
+	smoothScratch.resize((size_t)maskRows * maskCols);
+	columnScratch.resize((size_t)maskRows + 16);
+
+	// fspecial('gaussian', [10 1], 1); with convn(..., 'same') output i sees inputs i-4 .. i+5
+	double sum = 0, taps[10];
+	for (int m = 0; m < 10; m++)
+	{
+		double x = m - 4.5;
+		taps[m] = exp(-x * x / 2);
+		sum += taps[m];
+	}
+	for (int m = 0; m < 10; m++)
+		kernel[m] = (float)(taps[m] / sum);
+	return true;
+}
+
+void ROIPipeline::setWindow(int channel, int windowFrames)
+{
+	statistics[channel].reset(selectedSpots.size() * numPlanes, windowFrames);
+}
+
+template <typename T>
+static void convertFrames(const T *frames, size_t frameSize, int numChannels, int channel, size_t frame, double scale, double *out)
+{
+	// ADC counts -> mV, the PMT output is inverted around mid range
+	const T *in = frames + frame * frameSize + channel;
+	size_t numValues = frameSize / numChannels;
+	for (size_t k = 0; k < numValues; k++)
+		out[k] = (2048.0 - (double)in[k * numChannels]) * scale;
+}
+
+void ROIPipeline::addFrames(const mxArray *frames, size_t skipFrames)
+{
+	size_t frameSize = selectedSpots.size() * numPlanes * numChannels;
+	if (frameSize == 0 || mxGetNumberOfElements(frames) % frameSize != 0)
+		return;
+	size_t numFrames = mxGetNumberOfElements(frames) / frameSize;
+	double scale = voltageRange * 1000.0 / 2048.0;
+	for (size_t f = skipFrames; f < numFrames; f++)
+	{
+		for (int ch = 0; ch < numChannels; ch++)
+		{
+			if (mxIsSingle(frames))
+				convertFrames((const float*)mxGetData(frames), frameSize, numChannels, ch, f, scale, frameScratch.data());
+			else if (mxIsUint16(frames))
+				convertFrames((const unsigned short*)mxGetData(frames), frameSize, numChannels, ch, f, scale, frameScratch.data());
+			else
+				convertFrames((const double*)mxGetData(frames), frameSize, numChannels, ch, f, scale, frameScratch.data());
+			for (size_t k = 0; k < frameScratch.size(); k++)
+			{
+				newMin[ch] = (frameScratch[k] < newMin[ch]) ? frameScratch[k] : newMin[ch];
+				newMax[ch] = (frameScratch[k] > newMax[ch]) ? frameScratch[k] : newMax[ch];
+			}
+			statistics[ch].add(frameScratch.data());
+		}
+	}
+}
+
+// Same result as FastUpSampling(Z, offsetX, offsetY, subsampling, subsampling): bilinear
+// between the grid samples at offset + k * subsampling, zero outside, samples past the
+// end of the image read as zero. Done separably: the grid columns are interpolated along
+// y first, then every output column is a blend of its two grid columns, 4 rows at a time.
+void ROIPipeline::upsample(const float *in, float *out)
+{
+	int rows = maskRows, cols = maskCols, step = subsampling;
+	size_t numPixels = (size_t)rows * cols;
+	memset(out, 0, numPixels * sizeof(float));
+	if (offsetX >= cols || offsetY >= rows)
+		return;
+
+	// interpolated grid columns, one past the last one inside the image
+	int numGridCols = (cols - 1 - offsetX) / step + 2;
+	gridColumns.assign((size_t)numGridCols * rows, 0.0f);
+	float *gridCols = gridColumns.data();
+	for (int k = 0; k < numGridCols; k++)
+	{
+		size_t column = (size_t)(offsetX + k * step) * rows;
+		float *dst = &gridCols[(size_t)k * rows];
+		for (int y = offsetY; y < rows; y++)
+		{
+			int p0 = offsetY + (y - offsetY) / step * step;
+			float sy = ((y - offsetY) % step) / (float)step;
+			size_t i0 = column + p0, i1 = column + p0 + step;
+			float v0 = (i0 < numPixels) ? in[i0] : 0.0f;
+			float v1 = (i1 < numPixels) ? in[i1] : 0.0f;
+			dst[y] = (sy == 0) ? v0 : v0 * (1 - sy) + v1 * sy;
+		}
+	}
+
+	for (int x = offsetX; x < cols; x++)
+	{
+		int k = (x - offsetX) / step;
+		float sx = ((x - offsetX) % step) / (float)step;
+		const float *left = &gridCols[(size_t)k * rows], *right = &gridCols[(size_t)(k + 1) * rows];
+		float *dst = out + (size_t)x * rows;
+		if (sx == 0)
+		{
+			memcpy(dst + offsetY, left + offsetY, (rows - offsetY) * sizeof(float));
+			continue;
+		}
+		__m128 wl = _mm_set1_ps(1 - sx), wr = _mm_set1_ps(sx);
+		int y = offsetY;
+		for (; y + 4 <= rows; y += 4)
+			_mm_storeu_ps(dst + y, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(left + y), wl), _mm_mul_ps(_mm_loadu_ps(right + y), wr)));
+		for (; y < rows; y++)
+			dst[y] = left[y] * (1 - sx) + right[y] * sx;
+	}
+}
+
+// convn(convn(I, kernel1D, 'same'), kernel1D', 'same') with the 10 tap gaussian, zero padded.
+// Both passes run down the columns 4 rows at a time.
+void ROIPipeline::smooth(float *image)
+{
+	int rows = maskRows, cols = maskCols;
+	float *tmp = smoothScratch.data();
+	float *pad = columnScratch.data();
+	__m128 w[10];
+	for (int m = 0; m < 10; m++)
+		w[m] = _mm_set1_ps(kernel[m]);
+
+	// along y: output y sees pad[y .. y + 9] = rows y - 4 .. y + 5
+	memset(pad, 0, columnScratch.size() * sizeof(float));
+	for (int x = 0; x < cols; x++)
+	{
+		memcpy(pad + 4, image + (size_t)x * rows, rows * sizeof(float));
+		float *dst = tmp + (size_t)x * rows;
+		int y = 0;
+		for (; y + 4 <= rows; y += 4)
+		{
+			__m128 acc = _mm_mul_ps(_mm_loadu_ps(pad + y), w[0]);
+			for (int m = 1; m < 10; m++)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(pad + y + m), w[m]));
+			_mm_storeu_ps(dst + y, acc);
+		}
+		for (; y < rows; y++)
+		{
+			float acc = 0;
+			for (int m = 0; m < 10; m++)
+				acc += pad[y + m] * kernel[m];
+			dst[y] = acc;
+		}
+	}
+
+	// along x: columns x - 4 .. x + 5 inside the image
+	for (int x = 0; x < cols; x++)
+	{
+		int m0 = (x >= 4) ? 0 : 4 - x;
+		int m1 = (x + 5 < cols) ? 10 : cols - x + 4;
+		float *dst = image + (size_t)x * rows;
+		int y = 0;
+		for (; y + 4 <= rows; y += 4)
+		{
+			__m128 acc = _mm_setzero_ps();
+			for (int m = m0; m < m1; m++)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(tmp + (size_t)(x + m - 4) * rows + y), w[m]));
+			_mm_storeu_ps(dst + y, acc);
+		}
+		for (; y < rows; y++)
+		{
+			float acc = 0;
+			for (int m = m0; m < m1; m++)
+				acc += tmp[(size_t)(x + m - 4) * rows + y] * kernel[m];
+			dst[y] = acc;
+		}
+	}
+}
+
+mxArray* ROIPipeline::render(int channel, PipelineSignal signal, bool subtractMean, bool smoothing, mxArray **outputSignal, mxArray **stats)
+{
+	SpotStatistics &s = statistics[channel];
+	int numSpotsPerPlane = (int)selectedSpots.size();
+	*outputSignal = mxCreateDoubleMatrix(numSpotsPerPlane, numPlanes, mxREAL);
+	double *values = mxGetPr(*outputSignal);
+	for (size_t k = 0; k < (size_t)numSpotsPerPlane * numPlanes; k++)
+	{
+		values[k] = (signal == PIPELINE_LAST) ? s.last[k] : (signal == PIPELINE_MEAN) ? s.mean[k] : s.getStd(k);
+		if (subtractMean && s.hasSavedMean)
+			values[k] -= s.savedMean[k];
+	}
+
+	const int dim[3] = { maskRows, maskCols, numPlanes };
+	mxArray *images = mxCreateNumericArray(3, dim, mxSINGLE_CLASS, mxREAL);
+	float *out = (float*)mxGetData(images);
+	for (int plane = 0; plane < numPlanes; plane++)
+	{
+		// Z = ones(size(roi.Mask)); Z(roi.selectedSpots) = outputSignal(:, plane)
+		for (size_t k = 0; k < grid.size(); k++)
+			grid[k] = 1.0f;
+		for (int spot = 0; spot < numSpotsPerPlane; spot++)
+			grid[selectedSpots[spot]] = (float)values[(size_t)plane * numSpotsPerPlane + spot];
+		float *image = out + (size_t)plane * maskRows * maskCols;
+		upsample(grid.data(), image);
+		if (smoothing)
+			smooth(image);
+	}
+
+	const char *fields[] = { "numFrames", "min", "max" };
+	*stats = mxCreateStructMatrix(1, 1, 3, fields);
+	bool any = newMin[channel] <= newMax[channel];
+	mxSetField(*stats, 0, "numFrames", mxCreateDoubleScalar((double)s.getCount()));
+	mxSetField(*stats, 0, "min", mxCreateDoubleScalar(any ? newMin[channel] : mxGetNaN()));
+	mxSetField(*stats, 0, "max", mxCreateDoubleScalar(any ? newMax[channel] : mxGetNaN()));
+	newMin[channel] = std::numeric_limits<double>::infinity();
+	newMax[channel] = -std::numeric_limits<double>::infinity();
+	return images;
+}
+
+
+// nobody reads the traces (no ROI plot): keep the newest frames only
+#define MAX_PENDING_TRACE_FRAMES 65536
+
+bool ROITraces::init(int _numChannels, int _numSpotsPerPlane, int _numPlanes, int _channel, int _plane,
+	const std::vector<int> &_roiOffsets, const std::vector<int> &_roiSpots,
+	const std::vector<double> &_b, const std::vector<double> &_a, int _baselineFrames)
+{
+	if (_channel < 0 || _channel >= _numChannels || _plane < 0 || _plane >= _numPlanes || _roiOffsets.empty() ||
+		_b.empty() || _a.empty() || _a[0] == 0)
+	{
+		mexPrintf("Invalid trace parameters.\n");
+		return false;
+	}
+	for (size_t k = 0; k < _roiSpots.size(); k++)
+	{
+		if (_roiSpots[k] < 0 || _roiSpots[k] >= _numSpotsPerPlane)
+		{
+			mexPrintf("ROI spot %d is outside the %d spots of a plane.\n", _roiSpots[k] + 1, _numSpotsPerPlane);
+			return false;
+		}
+	}
+	numChannels = _numChannels;
+	numSpotsPerPlane = _numSpotsPerPlane;
+	numPlanes = _numPlanes;
+	channel = _channel;
+	plane = _plane;
+	roiOffsets = _roiOffsets;
+	roiSpots = _roiSpots;
+	numROIs = (int)roiOffsets.size() - 1;
+	baselineFrames = (_baselineFrames > 0) ? _baselineFrames : 0;
+
+	// normalized so that a[0] = 1, both of length order + 1
+	order = (int)((_b.size() > _a.size()) ? _b.size() : _a.size()) - 1;
+	b.assign(order + 1, 0);
+	a.assign(order + 1, 0);
+	for (size_t k = 0; k < _b.size(); k++)
+		b[k] = _b[k] / _a[0];
+	for (size_t k = 0; k < _a.size(); k++)
+		a[k] = _a[k] / _a[0];
+
+	pendingRaw.clear();
+	pendingFiltered.clear();
+	pendingDff.clear();
+	pendingFirstFrame = -1;
+	framesDropped = 0;
+	reset();
+	return true;
+}
+
+void ROITraces::reset()
+{
+	filterState.assign((size_t)numROIs * order, 0);
+	baseline.assign((size_t)numROIs * baselineFrames, 0);
+	baselineSum.assign(numROIs, 0);
+	rawMean.assign(numROIs, 0);
+	rawM2.assign(numROIs, 0);
+	filteredMean.assign(numROIs, 0);
+	filteredM2.assign(numROIs, 0);
+	count = 0;
+}
+
+template <typename T>
+void ROITraces::addFrame(const T *frame)
+{
+	const T *values = frame + (size_t)plane * numSpotsPerPlane * numChannels + channel;
+	double n = (double)(count + 1);
+	long long baselineCount = (baselineFrames > 0 && count + 1 > baselineFrames) ? baselineFrames : count + 1;
+	for (int r = 0; r < numROIs; r++)
+	{
+		double raw = std::numeric_limits<double>::quiet_NaN(), filtered = raw, dff = raw;
+		int first = roiOffsets[r], last = roiOffsets[r + 1];
+		if (last > first)
+		{
+			// nanmean(signal(ROIs.ind{k})), the DAQ has no NaNs
+			double sum = 0;
+			for (int k = first; k < last; k++)
+				sum += (double)values[(size_t)roiSpots[k] * numChannels];
+			raw = sum / (last - first);
+
+			double *z = &filterState[(size_t)r * order];
+			if (count == 0)
+			{
+				// start in the steady state of a constant input (as filtfilt does), the
+				// slow high pass would otherwise ring for tens of seconds
+				double sumB = 0, sumA = 0;
+				for (int k = 0; k <= order; k++)
+				{
+					sumB += b[k];
+					sumA += a[k];
+				}
+				double steady = (sumA != 0) ? raw * sumB / sumA : 0;
+				double acc = 0;
+				for (int k = order; k >= 1; k--)
+				{
+					acc += b[k] * raw - a[k] * steady;
+					z[k - 1] = acc;
+				}
+			}
+			filtered = b[0] * raw + ((order > 0) ? z[0] : 0);
+			for (int k = 0; k < order - 1; k++)
+				z[k] = z[k + 1] + b[k + 1] * raw - a[k + 1] * filtered;
+			if (order > 0)
+				z[order - 1] = b[order] * raw - a[order] * filtered;
+
+			// dF/F of the PMT signal, which is inverted around mid range of the 12 bit ADC
+			double F = 2048.0 - raw;
+			if (baselineFrames > 0)
+			{
+				double *slot = &baseline[(size_t)r * baselineFrames + (size_t)(count % baselineFrames)];
+				baselineSum[r] += F - ((count >= baselineFrames) ? *slot : 0);
+				*slot = F;
+			}
+			else
+				baselineSum[r] += F;
+			double F0 = baselineSum[r] / (double)baselineCount;
+			dff = (F0 != 0) ? (F - F0) / F0 : 0;
+
+			double delta = raw - rawMean[r];
+			rawMean[r] += delta / n;
+			rawM2[r] += delta * (raw - rawMean[r]);
+			delta = filtered - filteredMean[r];
+			filteredMean[r] += delta / n;
+			filteredM2[r] += delta * (filtered - filteredMean[r]);
+		}
+		pendingRaw.push_back(raw);
+		pendingFiltered.push_back(filtered);
+		pendingDff.push_back(dff);
+	}
+	count++;
+}
+
+void ROITraces::addFrames(const mxArray *frames, long long firstFrame, size_t numInvalid)
+{
+	size_t frameSize = (size_t)numChannels * numSpotsPerPlane * numPlanes;
+	if (frameSize == 0 || mxGetNumberOfElements(frames) % frameSize != 0)
+		return;
+	size_t numFrames = mxGetNumberOfElements(frames) / frameSize;
+	long long expectedFrame = pendingFirstFrame + (long long)((numROIs > 0) ? pendingRaw.size() / numROIs : 0);
+	if (pendingFirstFrame >= 0 && firstFrame != expectedFrame)
+	{
+		// the column of a pending frame is its frame number, frames the ring lost read as NaN
+		if (firstFrame > expectedFrame && firstFrame - expectedFrame <= MAX_PENDING_TRACE_FRAMES)
+		{
+			size_t gap = (size_t)(firstFrame - expectedFrame) * numROIs;
+			pendingRaw.insert(pendingRaw.end(), gap, std::numeric_limits<double>::quiet_NaN());
+			pendingFiltered.insert(pendingFiltered.end(), gap, std::numeric_limits<double>::quiet_NaN());
+			pendingDff.insert(pendingDff.end(), gap, std::numeric_limits<double>::quiet_NaN());
+		}
+		else
+		{
+			framesDropped += expectedFrame - pendingFirstFrame;
+			pendingRaw.clear();
+			pendingFiltered.clear();
+			pendingDff.clear();
+			pendingFirstFrame = -1;
+		}
+	}
+	if (pendingFirstFrame < 0)
+		pendingFirstFrame = firstFrame;
+	for (size_t f = 0; f < numFrames; f++)
+	{
+		if (f < numInvalid)
+		{
+			pendingRaw.insert(pendingRaw.end(), numROIs, std::numeric_limits<double>::quiet_NaN());
+			pendingFiltered.insert(pendingFiltered.end(), numROIs, std::numeric_limits<double>::quiet_NaN());
+			pendingDff.insert(pendingDff.end(), numROIs, std::numeric_limits<double>::quiet_NaN());
+		}
+		else if (mxIsSingle(frames))
+			addFrame((const float*)mxGetData(frames) + f * frameSize);
+		else if (mxIsUint16(frames))
+			addFrame((const unsigned short*)mxGetData(frames) + f * frameSize);
+		else
+			addFrame((const double*)mxGetData(frames) + f * frameSize);
+	}
+
+	size_t pendingFrames = (numROIs > 0) ? pendingRaw.size() / numROIs : 0;
+	if (pendingFrames > MAX_PENDING_TRACE_FRAMES)
+	{
+		size_t drop = pendingFrames - MAX_PENDING_TRACE_FRAMES / 2;
+		pendingRaw.erase(pendingRaw.begin(), pendingRaw.begin() + drop * numROIs);
+		pendingFiltered.erase(pendingFiltered.begin(), pendingFiltered.begin() + drop * numROIs);
+		pendingDff.erase(pendingDff.begin(), pendingDff.begin() + drop * numROIs);
+		pendingFirstFrame += drop;
+		framesDropped += drop;
+	}
+}
+
+static mxArray* createTraceMatrix(const std::vector<double> &values, int numROIs)
+{
+	size_t numFrames = (numROIs > 0) ? values.size() / numROIs : 0;
+	mxArray *out = mxCreateDoubleMatrix(numROIs, numFrames, mxREAL);
+	if (!values.empty())
+		memcpy(mxGetPr(out), values.data(), values.size() * sizeof(double));
+	return out;
+}
+
+void ROITraces::read(mxArray **raw, mxArray **filtered, mxArray **dff, mxArray **stats)
+{
+	*raw = createTraceMatrix(pendingRaw, numROIs);
+	*filtered = createTraceMatrix(pendingFiltered, numROIs);
+	*dff = createTraceMatrix(pendingDff, numROIs);
+
+	const char *fields[] = { "firstFrame", "numFrames", "framesDropped", "meanRaw", "stdRaw", "meanFiltered", "stdFiltered" };
+	*stats = mxCreateStructMatrix(1, 1, 7, fields);
+	mxSetField(*stats, 0, "firstFrame", mxCreateDoubleScalar((double)pendingFirstFrame));
+	mxSetField(*stats, 0, "numFrames", mxCreateDoubleScalar((double)count));
+	mxSetField(*stats, 0, "framesDropped", mxCreateDoubleScalar((double)framesDropped));
+	mxArray *meanRaw = mxCreateDoubleMatrix(numROIs, 1, mxREAL), *stdRaw = mxCreateDoubleMatrix(numROIs, 1, mxREAL);
+	mxArray *meanFiltered = mxCreateDoubleMatrix(numROIs, 1, mxREAL), *stdFiltered = mxCreateDoubleMatrix(numROIs, 1, mxREAL);
+	for (int r = 0; r < numROIs; r++)
+	{
+		bool empty = roiOffsets[r + 1] == roiOffsets[r] || count == 0;
+		mxGetPr(meanRaw)[r] = empty ? mxGetNaN() : rawMean[r];
+		mxGetPr(meanFiltered)[r] = empty ? mxGetNaN() : filteredMean[r];
+		mxGetPr(stdRaw)[r] = empty ? mxGetNaN() : (count > 1) ? sqrt(rawM2[r] / (count - 1)) : 0;
+		mxGetPr(stdFiltered)[r] = empty ? mxGetNaN() : (count > 1) ? sqrt(filteredM2[r] / (count - 1)) : 0;
+	}
+	mxSetField(*stats, 0, "meanRaw", meanRaw);
+	mxSetField(*stats, 0, "stdRaw", stdRaw);
+	mxSetField(*stats, 0, "meanFiltered", meanFiltered);
+	mxSetField(*stats, 0, "stdFiltered", stdFiltered);
+
+	pendingRaw.clear();
+	pendingFiltered.clear();
+	pendingDff.clear();
+	pendingFirstFrame = -1;
+	framesDropped = 0;
+}
@@ -0,0 +1,118 @@
+/*
+Real-time ROI imaging pipeline
+Programmed by Shay Ohayon
+DiCarlo Lab @ MIT
+
+Native replacement of the live view path of ROIModule (SmartAveraging,
+RealTimeSignalProcessingPipeline, FastUpSampling and the two convn passes).
+The pipeline is attached to a fast DAQ board and GetFrames feeds it every
+frame it demultiplexes, so the per spot statistics are always up to date;
+the image of a channel is only rendered when the display asks for it.
+
+Revision History
+Version 0.1 10/18/2026
+
+*/
+#ifndef ROI_PIPELINE_H
+#define ROI_PIPELINE_H
+
+#include "mex.h"
+#include <vector>
+
+// Running mean / std of every spot (numSpotsPerPlane x numPlanes, MATLAB order) of one
+// channel, as SmartAveraging computes them. windowFrames 0: since the last reset
+// (Welford). windowFrames N: over the last N frames, the oldest frame leaves the
+// Welford sums as the new one enters, so a frame costs the same for any N.
+class SpotStatistics {
+public:
+	SpotStatistics() : hasSavedMean(false), numValues(0), windowFrames(0), count(0) {}
+	void reset(size_t numValues, int windowFrames);
+	void add(const double *values);		// one frame, mV
+	void saveMean() { savedMean = mean; hasSavedMean = true; }
+	int getWindowFrames() { return windowFrames; }
+	long long getCount() { return count; }
+	double getStd(size_t k);
+
+	std::vector<double> last, mean, savedMean;
+	bool hasSavedMean;
+private:
+	size_t numValues;
+	int windowFrames;
+	long long count;
+	std::vector<double> m2;			// sum of squared deviations
+	std::vector<double> window;		// windowFrames x numValues, frame count % windowFrames
+};
+
+enum PipelineSignal { PIPELINE_LAST, PIPELINE_MEAN, PIPELINE_STD };
+
+class ROIPipeline {
+public:
+	// selectedSpots: 0 based linear (column-major) indices of the spots in the
+	// maskRows x maskCols grid, one per spot of a plane. offsetX / offsetY / subsampling
+	// as passed to FastUpSampling.
+	bool init(int maskRows, int maskCols, const std::vector<int> &selectedSpots, int numPlanes, int numChannels,
+		int offsetX, int offsetY, int subsampling, double voltageRange, int windowFrames);
+	// channels x spots x planes x frames of ADC counts (GetFrames output, any class),
+	// the first skipFrames are not used (overwritten during the copy)
+	void addFrames(const mxArray *frames, size_t skipFrames = 0);
+	void setWindow(int channel, int windowFrames);	// and resets the channel
+	void reset(int channel) { setWindow(channel, statistics[channel].getWindowFrames()); }
+	void saveMean(int channel) { statistics[channel].saveMean(); }
+	int getNumChannels() { return numChannels; }
+	int getNumSpotsPerPlane() { return (int)selectedSpots.size(); }
+	int getNumPlanes() { return numPlanes; }
+	// maskRows x maskCols x numPlanes single; outputSignal: spots x planes (mV) before
+	// upsampling; stats: frames so far, min / max mV of the frames since the last render
+	mxArray* render(int channel, PipelineSignal signal, bool subtractMean, bool smoothing, mxArray **outputSignal, mxArray **stats);
+
+private:
+	void upsample(const float *grid, float *out);
+	void smooth(float *image);
+
+	int maskRows, maskCols, numPlanes, numChannels;
+	int offsetX, offsetY, subsampling;
+	double voltageRange;
+	std::vector<int> selectedSpots;
+	std::vector<SpotStatistics> statistics;
+	std::vector<double> newMin, newMax;		// per channel, since the last render
+	std::vector<double> frameScratch;		// one channel of a frame, mV
+	std::vector<float> grid, gridColumns, columnScratch, smoothScratch;
+	float kernel[10];
+};
+
+// Per ROI traces of one channel / plane, for the real time plot of ROIModule. The ROIs
+// are a CSR index into the spots of the plane (roiOffsets has numROIs + 1 entries), so
+// a frame is one pass over the ROI spots. Each ROI keeps its own IIR state (b / a as
+// butter returns them, run causally), a sliding baseline for dF/F and running mean / std,
+// so a frame costs the same at any point of a session. Traces are kept until read.
+class ROITraces {
+public:
+	bool init(int numChannels, int numSpotsPerPlane, int numPlanes, int channel, int plane,
+		const std::vector<int> &roiOffsets, const std::vector<int> &roiSpots,
+		const std::vector<double> &b, const std::vector<double> &a, int baselineFrames);
+	// channels x spots x planes x frames (GetFrames output, any class), firstFrame as GetFrames
+	// returns it. The first numInvalid frames read as NaN and leave the state alone.
+	void addFrames(const mxArray *frames, long long firstFrame, size_t numInvalid = 0);
+	void reset();	// filter state, baseline and statistics
+	// raw (ADC counts), filtered and dF/F: numROIs x frames since the last read
+	void read(mxArray **raw, mxArray **filtered, mxArray **dff, mxArray **stats);
+	int getNumChannels() { return numChannels; }
+	int getNumSpotsPerPlane() { return numSpotsPerPlane; }
+	int getNumPlanes() { return numPlanes; }
+
+private:
+	template <typename T> void addFrame(const T *frame);
+
+	int numChannels, numSpotsPerPlane, numPlanes, channel, plane, numROIs, order, baselineFrames;
+	std::vector<int> roiOffsets, roiSpots;
+	std::vector<double> b, a;
+	std::vector<double> filterState;		// numROIs x order, direct form II transposed
+	std::vector<double> baseline;			// numROIs x baselineFrames
+	std::vector<double> baselineSum;
+	std::vector<double> rawMean, rawM2, filteredMean, filteredM2;
+	long long count;						// frames since the reset
+	std::vector<double> pendingRaw, pendingFiltered, pendingDff;	// frames x numROIs
+	long long pendingFirstFrame, framesDropped;
+};
+
+#endif
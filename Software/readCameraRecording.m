@@ -0,0 +1,169 @@
+function [frames, index, header] = readCameraRecording(fileName, frameRange)
+% Reads a recording made with PTwrapper('StartRecording', fileName) (or the
+% ISwrapper / XimeaWrapper equivalent).
+% frames     height x width x N, same values as GetImageBuffer would return
+% index      struct with one entry per frame: trigger count, driver frame
+%            number (-1 if the camera has none), host time and camera
+%            timestamp (sec, -1 if the camera has none)
+% header     width, height, bytesPerPixel, exportShift, slotBytes, numFrames,
+%            startTime, packedBits (0 = 16 bit words), codec (1 = compressed)
+% frameRange optional [first last] (1 based). Omit it to read everything,
+%            use [] to read only the index and header.
+%
+% File layout: a 4096 byte header, then one frame every slotBytes bytes,
+% row-major. Frames recorded with SetPackedStorage hold packedBits bits per
+% pixel in a little-endian bit stream (12 bit: 2 pixels in 3 bytes, 10 bit:
+% 4 pixels in 5 bytes). <fileName>.idx holds a 16 byte header and one record per frame
+% (16 bytes in version 1 files, 24 bytes from version 2 on).
+% Compressed recordings (StartRecording(fileName, maxFrames, true), header version 3)
+% hold the frames back to back, each at the file offset its index record ends with
+% (32 byte records), see compressFrame16 in CameraCore.cpp.
+fid = fopen(fileName,'r','ieee-le');
+if fid < 0
+    error('Cannot open %s',fileName);
+end
+magic = fread(fid,8,'*char')';
+if ~strcmp(magic,'FSCAMREC')
+    fclose(fid);
+    error('%s is not a camera recording',fileName);
+end
+header.version = fread(fid,1,'int32');
+header.headerBytes = fread(fid,1,'int32');
+header.width = fread(fid,1,'int32');
+header.height = fread(fid,1,'int32');
+header.bytesPerPixel = fread(fid,1,'int32');
+header.exportShift = fread(fid,1,'int32');
+header.slotBytes = fread(fid,1,'int64');
+header.numFrames = fread(fid,1,'int64');
+header.startTime = fread(fid,1,'double');
+header.packedBits = 0;
+if header.version >= 2
+    header.packedBits = fread(fid,1,'int32');
+end
+header.codec = 0;
+if header.version >= 3
+    header.codec = fread(fid,1,'int32');
+end
+if header.numFrames == 0 && header.codec == 0
+    % recording was not stopped cleanly, take whatever made it to disk
+    fseek(fid,0,'eof');
+    header.numFrames = floor((ftell(fid)-header.headerBytes)/header.slotBytes);
+end
+
+index = struct('frameCounter',[],'driverFrame',[],'hostTime',[],'deviceTime',[]);
+fidIndex = fopen([fileName '.idx'],'r','ieee-le');
+if fidIndex >= 0
+    fread(fidIndex,8,'*char');
+    indexFormat = fread(fidIndex,2,'int32');
+    records = fread(fidIndex,[indexFormat(2)/4, Inf],'*uint32');
+    fclose(fidIndex);
+    if header.numFrames == 0
+        % compressed and not stopped cleanly, every indexed frame made it to disk
+        header.numFrames = size(records,2);
+    end
+    records = records(:,1:min(size(records,2),header.numFrames));
+    index.frameCounter = double(typecast(reshape(records(1,:),1,[]),'int32'));
+    index.driverFrame = double(typecast(reshape(records(2,:),1,[]),'int32'));
+    index.hostTime = typecast(reshape(records(3:4,:),1,[]),'double');
+    if indexFormat(2) >= 24
+        index.deviceTime = typecast(reshape(records(5:6,:),1,[]),'double');
+    else
+        index.deviceTime = -ones(size(index.hostTime));
+    end
+    if indexFormat(2) >= 32
+        frameOffsets = double(typecast(reshape(records(7:8,:),1,[]),'int64'));
+    end
+elseif header.codec > 0
+    fclose(fid);
+    error('%s.idx is needed to read a compressed recording',fileName);
+end
+
+if ~exist('frameRange','var')
+    frameRange = [1 header.numFrames];
+end
+if isempty(frameRange)
+    frames = [];
+    fclose(fid);
+    return;
+end
+frameRange = [max(1,frameRange(1)), min(header.numFrames,frameRange(end))];
+numToRead = max(0,frameRange(2)-frameRange(1)+1);
+if header.bytesPerPixel == 1
+    precision = '*uint8';
+else
+    precision = '*uint16';
+end
+frames = zeros(header.height,header.width,numToRead,precision(2:end));
+numPixels = header.width*header.height;
+if header.codec > 0
+    fseek(fid,0,'eof');
+    frameOffsets(end+1) = ftell(fid);
+end
+for k=1:numToRead
+    f = frameRange(1)+k-1;
+    if header.codec > 0
+        fseek(fid,frameOffsets(f),'bof');
+        compressed = fread(fid,frameOffsets(f+1)-frameOffsets(f),'*uint8');
+        frame = decompressFrame(compressed,header.width,header.height);
+    elseif header.packedBits > 0
+        fseek(fid,header.headerBytes+(f-1)*header.slotBytes,'bof');
+        packed = fread(fid,ceil(numPixels*header.packedBits/8),'*uint8');
+        frame = reshape(unpackSamples(packed,numPixels,header.packedBits),header.width,header.height);
+    else
+        fseek(fid,header.headerBytes+(f-1)*header.slotBytes,'bof');
+        frame = fread(fid,[header.width,header.height],precision);
+    end
+    frames(:,:,k) = bitshift(frame',-header.exportShift);
+end
+fclose(fid);
+
+
+function samples = unpackSamples(packed, numSamples, bits)
+% little-endian bit stream, see packSamples in CameraCore.cpp
+b = double(packed(:)');
+switch bits
+    case 12
+        b(end+1:3*ceil(numSamples/2)) = 0;
+        b = reshape(b,3,[]);
+        samples = [b(1,:) + mod(b(2,:),16)*256; floor(b(2,:)/16) + b(3,:)*16];
+    case 10
+        b(end+1:5*ceil(numSamples/4)) = 0;
+        b = reshape(b,5,[]);
+        samples = [b(1,:) + mod(b(2,:),4)*256; floor(b(2,:)/4) + mod(b(3,:),16)*64; ...
+            floor(b(3,:)/16) + mod(b(4,:),64)*16; floor(b(4,:)/64) + b(5,:)*4];
+    otherwise
+        bitStream = reshape(dec2bin(b,8)',8,[]);
+        bitStream = reshape(flipud(bitStream),1,[]);
+        bitStream = reshape(bitStream(1:bits*numSamples),bits,[]);
+        samples = (2.^(0:bits-1)) * (bitStream == '1');
+end
+samples = uint16(samples(1:numSamples));
+
+
+function frame = decompressFrame(data, width, height)
+% see compressFrame16 in CameraCore.cpp: a width byte per block of 16 codes, then the
+% blocks in the packSamples bit stream. Codes are zigzag mapped residuals of the left
+% neighbour (first column: of the pixel above). Returns width x height.
+numSamples = width*height;
+numBlocks = ceil(numSamples/16);
+bits = double(data(1:numBlocks));
+blockStart = numBlocks + cumsum([0; 2*bits(1:end-1)]);
+codes = zeros(16,numBlocks);
+for w = unique(bits(bits > 0))'
+    blocks = find(bits == w);
+    bytes = data(1 + bsxfun(@plus, blockStart(blocks)', (0:2*w-1)'));
+    bitStream = false(8,numel(bytes));
+    for b=1:8
+        bitStream(b,:) = bitget(bytes(:)',b) > 0;
+    end
+    bitStream = reshape(bitStream,w,[]);	% one code per column, LSB first
+    values = zeros(1,size(bitStream,2));
+    for b=1:w
+        values = values + bitStream(b,:) * 2^(b-1);
+    end
+    codes(:,blocks) = reshape(values,16,[]);
+end
+codes = codes(1:numSamples);
+residuals = reshape((1 - 2*mod(codes,2)) .* ceil(codes/2),width,height);
+residuals(1,:) = cumsum(residuals(1,:));
+frame = mod(cumsum(residuals,1),65536);
@@ -0,0 +1,80 @@
+function [frames, index, range] = readCameraSharedBuffer(fileName, maxFrames, releaseFrames)
+% Reads the frames a camera keeps in its shared buffer after
+% PTwrapper('SetSharedExport', fileName) (or the ISwrapper / XimeaWrapper
+% equivalent). Works from any MATLAB, the camera does not have to live in
+% this process. Only one reader may consume the buffer at a time.
+% frames        height x width x N, same values as GetImageBuffer would return
+% index         struct with one entry per frame: trigger count, driver frame
+%               number (-1 if the camera has none), host time, camera
+%               timestamp (sec, -1 if the camera has none), brightest pixel
+%               and number of saturated pixels
+% range         header of the file, first / last are the positions of the
+%               frames that were valid when the buffer was read
+% maxFrames     optional, read at most this many (oldest first). Default all.
+% releaseFrames optional, default true: hand the frames back to the camera.
+%               With false the next call returns them again.
+%
+% File layout: a 4096 byte header, the index table (32 bytes per slot,
+% padded to 4096), then capacity slots of slotBytes bytes, frames row-major.
+% Frame p (0 based position) is in slot mod(p, capacity); positions
+% [readPosition, writePosition) are valid. The camera only raises
+% writePosition, the reader only raises readPosition.
+if ~exist('maxFrames','var') || isempty(maxFrames)
+    maxFrames = Inf;
+end
+if ~exist('releaseFrames','var')
+    releaseFrames = true;
+end
+header = memmapfile(fileName,'Repeat',1,'Writable',true,'Format',{ ...
+    'uint8',[1 8],'magic'; 'int32',[1 1],'version'; 'int32',[1 1],'headerBytes'; ...
+    'int64',[1 1],'infoOffset'; 'int64',[1 1],'slotOffset'; 'int64',[1 1],'slotBytes'; ...
+    'int64',[1 1],'capacity'; 'int32',[1 1],'width'; 'int32',[1 1],'height'; ...
+    'int32',[1 1],'bytesPerPixel'; 'int32',[1 1],'exportShift'; 'int32',[1 1],'packedBits'; ...
+    'int32',[1 1],'reserved'; 'uint64',[1 1],'writePosition'; 'uint64',[1 1],'readPosition'});
+h = header.Data;
+if ~strcmp(char(h.magic),'FSCAMSHM')
+    error('%s is not a shared camera buffer',fileName);
+end
+if h.packedBits > 0
+    error('Packed frames cannot be read in place, call SetPackedStorage(false)');
+end
+range = struct('first',double(h.readPosition),'last',double(h.writePosition), ...
+    'capacity',double(h.capacity),'slotBytes',double(h.slotBytes),'width',double(h.width), ...
+    'height',double(h.height),'bytesPerPixel',double(h.bytesPerPixel),'exportShift',double(h.exportShift));
+numFrames = min(maxFrames, range.last-range.first);
+range.last = range.first + numFrames;
+
+% the slot positions of the frames, oldest first
+slots = mod(range.first + (0:numFrames-1), range.capacity) + 1;
+
+table = memmapfile(fileName,'Offset',double(h.infoOffset),'Repeat',range.capacity,'Format',{ ...
+    'int32',[1 1],'frameCounter'; 'int32',[1 1],'driverFrame'; 'double',[1 1],'hostTime'; ...
+    'double',[1 1],'deviceTime'; 'uint16',[1 1],'maxValue'; 'uint16',[1 1],'padding'; ...
+    'uint32',[1 1],'numSaturated'});
+records = table.Data(slots);
+index.frameCounter = double([records.frameCounter]);
+index.driverFrame = double([records.driverFrame]);
+index.hostTime = [records.hostTime];
+index.deviceTime = [records.deviceTime];
+index.maxValue = double([records.maxValue]);
+index.numSaturated = double([records.numSaturated]);
+
+if range.bytesPerPixel == 1
+    precision = 'uint8';
+else
+    precision = 'uint16';
+end
+frameFormat = {precision,[range.width range.height],'frame'};
+padding = range.slotBytes - range.width*range.height*range.bytesPerPixel;
+if padding > 0
+    frameFormat(2,:) = {'uint8',[1 padding],'padding'};
+end
+slotMap = memmapfile(fileName,'Offset',double(h.slotOffset),'Repeat',range.capacity,'Format',frameFormat);
+frames = zeros(range.height,range.width,numFrames,precision);
+for k=1:numFrames
+    frames(:,:,k) = bitshift(slotMap.Data(slots(k)).frame',-range.exportShift);
+end
+
+if releaseFrames && numFrames > 0
+    header.Data.readPosition = uint64(range.last);
+end